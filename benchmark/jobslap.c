@@ -0,0 +1,321 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Job slap server core utility
+ */
+
+#include "benchmark.h"
+
+#define JOBSLAP_DEFAULT_MIN_JOBS 1000
+#define JOBSLAP_DEFAULT_MAX_JOBS 10000000
+#define JOBSLAP_DEFAULT_LOOKUPS 1000000
+
+static uint64_t _usec(struct timeval *begin, struct timeval *end);
+static uint32_t _random(uint32_t max);
+static uint64_t _rss(void);
+
+static void _usage(char *name);
+
+int main(int argc, char *argv[])
+{
+  int c;
+  uint32_t min_jobs= JOBSLAP_DEFAULT_MIN_JOBS;
+  uint32_t max_jobs= JOBSLAP_DEFAULT_MAX_JOBS;
+  uint32_t lookups= JOBSLAP_DEFAULT_LOOKUPS;
+  const char *function= GEARMAN_BENCHMARK_DEFAULT_FUNCTION;
+  size_t function_size;
+  gearman_server_st server;
+  gearman_server_job_st **jobs;
+  gearman_server_job_st *job;
+  gearman_return_t ret;
+  char job_handle[GEARMAN_JOB_HANDLE_SIZE];
+  size_t job_handle_size;
+  char unique[GEARMAN_UNIQUE_SIZE];
+  size_t unique_size;
+  uint32_t unique_pad= 0;
+  struct timeval begin;
+  struct timeval end;
+  uint64_t add_usec;
+  uint64_t touch_usec;
+  uint64_t handle_usec;
+  uint64_t unique_usec;
+  uint64_t walk_usec;
+  uint64_t walk_jobs;
+  uint64_t probes;
+  gearman_server_hash_node_st *node;
+  volatile size_t touched= 0;
+  uint64_t rss_begin;
+  uint64_t job_bytes;
+  uint32_t count= 0;
+  uint32_t target;
+  uint32_t added;
+  uint32_t x;
+
+  while ((c= getopt(argc, argv, "f:l:m:M:s:u:")) != -1)
+  {
+    switch(c)
+    {
+    case 'f':
+      function= optarg;
+      break;
+
+    case 'l':
+      lookups= (uint32_t)atoi(optarg);
+      break;
+
+    case 'm':
+      min_jobs= (uint32_t)atoi(optarg);
+      break;
+
+    case 'M':
+      max_jobs= (uint32_t)atoi(optarg);
+      break;
+
+    case 's':
+      srand((unsigned int)atoi(optarg));
+      break;
+
+    case 'u':
+      unique_pad= (uint32_t)atoi(optarg);
+      break;
+
+    default:
+      _usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (min_jobs == 0 || min_jobs > max_jobs)
+  {
+    fprintf(stderr, "Min jobs must be non-zero and smaller than max jobs\n");
+    exit(1);
+  }
+
+  if (unique_pad >= GEARMAN_UNIQUE_SIZE)
+  {
+    fprintf(stderr, "Unique size must be smaller than %d\n",
+            GEARMAN_UNIQUE_SIZE);
+    exit(1);
+  }
+
+  function_size= strlen(function);
+
+  jobs= malloc(max_jobs * sizeof(gearman_server_job_st *));
+  if (jobs == NULL)
+  {
+    fprintf(stderr, "Memory allocation failure on malloc\n");
+    exit(1);
+  }
+
+  if (gearman_server_create(&server) == NULL)
+  {
+    fprintf(stderr, "Memory allocation failure on server creation\n");
+    exit(1);
+  }
+
+  rss_begin= _rss();
+
+  printf("job structure %zu bytes\n\n", sizeof(gearman_server_job_st));
+  printf("add and walk are ns per job, touch, handle and unique ns per get.\n"
+         "touch reads a random job without looking it up, the cache and TLB\n"
+         "misses every lookup pays. probes is the unique hash chain length\n"
+         "walked per get, which stays flat when the hash spreads keys. bytes\n"
+         "is the resident memory each queued job added, tables included.\n\n");
+  printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "jobs", "add", "touch",
+         "handle", "unique", "probes", "walk", "bytes");
+
+  for (target= min_jobs; ; )
+  {
+    /* Grow the job tables up to the next size. */
+    added= target - count;
+    gettimeofday(&begin, NULL);
+
+    for (; count < target; count++)
+    {
+      unique_size= (size_t)snprintf(unique, GEARMAN_UNIQUE_SIZE, "%0*u",
+                                    (int)unique_pad, count);
+      jobs[count]= gearman_server_job_add(server.shard, function, function_size,
+                                          unique, unique_size, NULL, 0,
+                                          GEARMAN_JOB_PRIORITY_NORMAL, NULL,
+                                          &ret);
+      if (jobs[count] == NULL)
+      {
+        fprintf(stderr, "Job add failed: %d\n", ret);
+        exit(1);
+      }
+    }
+
+    gettimeofday(&end, NULL);
+    add_usec= _usec(&begin, &end);
+
+    /* Leave out the pointer this program keeps for each job. Small queues
+       fit in memory the process already had and show no growth. */
+    job_bytes= (_rss() - rss_begin) / count;
+    if (job_bytes > sizeof(gearman_server_job_st *))
+      job_bytes-= sizeof(gearman_server_job_st *);
+    else
+      job_bytes= 0;
+
+    /* Read random jobs without a lookup, to separate memory latency from
+       the cost of the tables. */
+    gettimeofday(&begin, NULL);
+
+    for (x= 0; x < lookups; x++)
+    {
+      job= jobs[_random(count)];
+      touched+= job->unique_size +
+                (size_t)GEARMAN_SERVER_JOB_UNIQUE(job)[0];
+    }
+
+    gettimeofday(&end, NULL);
+    touch_usec= _usec(&begin, &end);
+
+    /* Look up random jobs by job handle, as WORK_* and GET_STATUS do. */
+    gettimeofday(&begin, NULL);
+
+    for (x= 0; x < lookups; x++)
+    {
+      job= jobs[_random(count)];
+      job_handle_size= gearman_server_job_handle(job, job_handle);
+      if (gearman_server_job_get(server.shard, job_handle,
+                                 job_handle_size) != job)
+      {
+        fprintf(stderr, "Job handle lookup failed: %s\n", job_handle);
+        exit(1);
+      }
+    }
+
+    gettimeofday(&end, NULL);
+    handle_usec= _usec(&begin, &end);
+
+    /* Look up random jobs by unique ID, as duplicate SUBMIT_JOB* does. */
+    gettimeofday(&begin, NULL);
+
+    for (x= 0; x < lookups; x++)
+    {
+      job= jobs[_random(count)];
+      if (gearman_server_job_add(server.shard, function, function_size,
+                                 GEARMAN_SERVER_JOB_UNIQUE(job),
+                                 job->unique_size, NULL, 0,
+                                 GEARMAN_JOB_PRIORITY_NORMAL, NULL,
+                                 &ret) != job || ret != GEARMAN_JOB_EXISTS)
+      {
+        fprintf(stderr, "Unique lookup failed: %s\n",
+                GEARMAN_SERVER_JOB_UNIQUE(job));
+        exit(1);
+      }
+    }
+
+    gettimeofday(&end, NULL);
+    unique_usec= _usec(&begin, &end);
+
+    /* Count the chain nodes the unique lookups above walk. */
+    probes= 0;
+    for (x= 0; x < lookups; x++)
+    {
+      job= jobs[_random(count)];
+      for (node= gearman_server_hash_get(&(server.shard->unique_hash),
+                                         job->unique_node.key);
+           node != NULL; node= node->next)
+      {
+        probes++;
+        if (node == &(job->unique_node))
+          break;
+      }
+    }
+
+    /* Walk the queue in order, as workers grabbing jobs do. */
+    walk_jobs= 0;
+    gettimeofday(&begin, NULL);
+
+    for (job= jobs[0]->function->job_list[GEARMAN_JOB_PRIORITY_NORMAL];
+         job != NULL; job= job->function_next)
+    {
+      if (job->worker == NULL && job->priority == GEARMAN_JOB_PRIORITY_NORMAL)
+        walk_jobs++;
+    }
+
+    gettimeofday(&end, NULL);
+    walk_usec= _usec(&begin, &end);
+
+    if (walk_jobs != count)
+    {
+      fprintf(stderr, "Queue walk failed: %" PRIu64 "\n", walk_jobs);
+      exit(1);
+    }
+
+    printf("%10u %10.1f %10.1f %10.1f %10.1f %10.2f %10.1f %10" PRIu64 "\n",
+           count,
+           added == 0 ? 0.0 : (double)add_usec * 1000.0 / (double)added,
+           lookups == 0 ? 0.0 : (double)touch_usec * 1000.0 / (double)lookups,
+           lookups == 0 ? 0.0 : (double)handle_usec * 1000.0 / (double)lookups,
+           lookups == 0 ? 0.0 : (double)unique_usec * 1000.0 / (double)lookups,
+           lookups == 0 ? 0.0 : (double)probes / (double)lookups,
+           (double)walk_usec * 1000.0 / (double)count, job_bytes);
+
+    if (target == max_jobs)
+      break;
+
+    /* Grow by ten, checking against max jobs first so it can't wrap. */
+    if (target > max_jobs / 10)
+      target= max_jobs;
+    else
+      target*= 10;
+  }
+
+  gearman_server_free(&server);
+  free(jobs);
+
+  return 0;
+}
+
+static uint64_t _usec(struct timeval *begin, struct timeval *end)
+{
+  return (((uint64_t)(end->tv_sec) * 1000000) + (uint64_t)(end->tv_usec)) -
+         (((uint64_t)(begin->tv_sec) * 1000000) + (uint64_t)(begin->tv_usec));
+}
+
+static uint32_t _random(uint32_t max)
+{
+  uint64_t value;
+
+  value= ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+
+  return (uint32_t)(value % max);
+}
+
+static uint64_t _rss(void)
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  /* Linux reports the peak resident size in kilobytes. Jobs are only ever
+     added here, so the peak is the current size. */
+  return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+static void _usage(char *name)
+{
+  printf("\nusage: %s\n"
+         "\t[-f <function>] [-l <lookups>] [-m <min_jobs>] [-M <max_jobs>]\n"
+         "\t[-s <seed>] [-u <unique_size>]\n\n", name);
+  printf("\t-f <function> - function name for jobs (default %s)\n",
+         GEARMAN_BENCHMARK_DEFAULT_FUNCTION);
+  printf("\t-l <lookups>  - lookups to time at each size (default %d)\n",
+         JOBSLAP_DEFAULT_LOOKUPS);
+  printf("\t-m <min_jobs> - number of jobs to start with (default %d)\n",
+         JOBSLAP_DEFAULT_MIN_JOBS);
+  printf("\t-M <max_jobs> - number of jobs to grow to, by factors of ten\n"
+         "\t                (default %d)\n", JOBSLAP_DEFAULT_MAX_JOBS);
+  printf("\t-s <seed>     - seed random number for lookups with <seed>\n");
+  printf("\t-u <unique_size> - zero pad unique IDs to <unique_size>\n");
+}
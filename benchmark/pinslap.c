@@ -0,0 +1,453 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief CPU pinning benchmark utility
+ */
+
+#include "benchmark.h"
+
+#include <sys/wait.h>
+
+#define PINSLAP_DEFAULT_PORT 32124
+#define PINSLAP_DEFAULT_THREADS 4
+#define PINSLAP_DEFAULT_SHARDS 1
+#define PINSLAP_DEFAULT_CLIENTS 8
+#define PINSLAP_DEFAULT_WORKERS 8
+#define PINSLAP_DEFAULT_SECONDS 10
+#define PINSLAP_DEFAULT_ROUNDS 3
+#define PINSLAP_DEFAULT_SIZE 1024
+#define PINSLAP_CPU_MAX 1024
+
+typedef struct
+{
+  in_port_t port;
+  uint32_t threads;
+  uint32_t shards;
+  uint32_t clients;
+  uint32_t workers;
+  uint32_t seconds;
+  size_t size;
+  uint32_t thread_cpu_count;
+  uint32_t proc_cpu_count;
+  uint32_t thread_cpus[PINSLAP_CPU_MAX];
+  uint32_t proc_cpus[PINSLAP_CPU_MAX];
+} pinslap_st;
+
+static uint64_t _run(pinslap_st *pinslap, bool pinned);
+static pid_t _server(pinslap_st *pinslap, bool pinned);
+static pid_t _worker(pinslap_st *pinslap);
+static pid_t _client(pinslap_st *pinslap, int fd);
+static void _stop(pid_t pid);
+static void *_worker_fn(gearman_job_st *job, void *cb_arg, size_t *result_size,
+                        gearman_return_t *ret_ptr);
+static bool _parse_cpus(const char *list, uint32_t *cpus,
+                        uint32_t *cpu_count);
+
+static void _usage(char *name);
+
+int main(int argc, char *argv[])
+{
+  static pinslap_st pinslap;
+  int c;
+  uint32_t rounds= PINSLAP_DEFAULT_ROUNDS;
+  uint32_t x;
+
+  pinslap.port= PINSLAP_DEFAULT_PORT;
+  pinslap.threads= PINSLAP_DEFAULT_THREADS;
+  pinslap.shards= PINSLAP_DEFAULT_SHARDS;
+  pinslap.clients= PINSLAP_DEFAULT_CLIENTS;
+  pinslap.workers= PINSLAP_DEFAULT_WORKERS;
+  pinslap.seconds= PINSLAP_DEFAULT_SECONDS;
+  pinslap.size= PINSLAP_DEFAULT_SIZE;
+
+  while ((c= getopt(argc, argv, "c:C:d:m:n:p:r:s:t:w:")) != -1)
+  {
+    switch(c)
+    {
+    case 'c':
+      if (_parse_cpus(optarg, pinslap.thread_cpus,
+                      &(pinslap.thread_cpu_count)))
+      {
+        exit(1);
+      }
+      break;
+
+    case 'C':
+      if (_parse_cpus(optarg, pinslap.proc_cpus, &(pinslap.proc_cpu_count)))
+        exit(1);
+      break;
+
+    case 'd':
+      pinslap.seconds= (uint32_t)atoi(optarg);
+      break;
+
+    case 'm':
+      pinslap.size= (size_t)atoi(optarg);
+      break;
+
+    case 'n':
+      pinslap.clients= (uint32_t)atoi(optarg);
+      break;
+
+    case 'p':
+      pinslap.port= (in_port_t)atoi(optarg);
+      break;
+
+    case 'r':
+      rounds= (uint32_t)atoi(optarg);
+      break;
+
+    case 's':
+      pinslap.shards= (uint32_t)atoi(optarg);
+      break;
+
+    case 't':
+      pinslap.threads= (uint32_t)atoi(optarg);
+      break;
+
+    case 'w':
+      pinslap.workers= (uint32_t)atoi(optarg);
+      break;
+
+    default:
+      _usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (pinslap.thread_cpu_count == 0 && pinslap.proc_cpu_count == 0)
+  {
+    fprintf(stderr, "At least one of -c and -C must be given\n");
+    exit(1);
+  }
+
+  if (pinslap.threads == 0 || pinslap.clients == 0 || pinslap.workers == 0 ||
+      pinslap.seconds == 0)
+  {
+    fprintf(stderr, "Threads, clients, workers and seconds must be larger "
+            "than zero\n");
+    exit(1);
+  }
+
+  if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+  {
+    fprintf(stderr, "signal:%d\n", errno);
+    exit(1);
+  }
+
+  /* Alternate the two setups so drift on the host hits both alike. */
+  printf("%10s %10s %10s\n", "round", "setup", "jobs/s");
+  fflush(stdout);
+
+  for (x= 1; x <= rounds; x++)
+  {
+    printf("%10u %10s %10" PRIu64 "\n", x, "default",
+           _run(&pinslap, false) / pinslap.seconds);
+    fflush(stdout);
+    printf("%10u %10s %10" PRIu64 "\n", x, "pinned",
+           _run(&pinslap, true) / pinslap.seconds);
+    fflush(stdout);
+  }
+
+  return 0;
+}
+
+static uint64_t _run(pinslap_st *pinslap, bool pinned)
+{
+  pid_t server_pid;
+  pid_t *worker_pid;
+  pid_t *client_pid;
+  int fd[2];
+  uint64_t jobs;
+  uint64_t total= 0;
+  uint32_t x;
+
+  worker_pid= malloc(sizeof(pid_t) * pinslap->workers);
+  client_pid= malloc(sizeof(pid_t) * pinslap->clients);
+  if (worker_pid == NULL || client_pid == NULL)
+  {
+    fprintf(stderr, "Memory allocation failure on malloc\n");
+    exit(1);
+  }
+
+  server_pid= _server(pinslap, pinned);
+
+  for (x= 0; x < pinslap->workers; x++)
+    worker_pid[x]= _worker(pinslap);
+
+  /* Wait for the workers to connect and register. */
+  sleep(1);
+
+  /* Only the clients may hold the write end, or the reads never end. */
+  if (pipe(fd) == -1)
+  {
+    fprintf(stderr, "pipe:%d\n", errno);
+    exit(1);
+  }
+
+  for (x= 0; x < pinslap->clients; x++)
+    client_pid[x]= _client(pinslap, fd[1]);
+
+  close(fd[1]);
+
+  while (read(fd[0], &jobs, sizeof(uint64_t)) == sizeof(uint64_t))
+    total+= jobs;
+
+  close(fd[0]);
+
+  for (x= 0; x < pinslap->clients; x++)
+    (void)waitpid(client_pid[x], NULL, 0);
+
+  for (x= 0; x < pinslap->workers; x++)
+    _stop(worker_pid[x]);
+
+  _stop(server_pid);
+
+  free(client_pid);
+  free(worker_pid);
+
+  return total;
+}
+
+static pid_t _server(pinslap_st *pinslap, bool pinned)
+{
+  pid_t pid;
+  gearmand_st *gearmand;
+
+  pid= fork();
+  if (pid == -1)
+  {
+    fprintf(stderr, "fork:%d\n", errno);
+    exit(1);
+  }
+
+  if (pid != 0)
+  {
+    /* Wait for the server to start and bind the port. */
+    sleep(1);
+    return pid;
+  }
+
+  gearmand= gearmand_create(NULL, pinslap->port);
+  if (gearmand == NULL)
+  {
+    fprintf(stderr, "Memory allocation failure on gearmand creation\n");
+    exit(1);
+  }
+
+  gearmand_set_threads(gearmand, pinslap->threads);
+
+  if (gearmand_set_shards(gearmand, pinslap->shards) != GEARMAN_SUCCESS ||
+      (pinned &&
+       (gearmand_set_thread_cpus(gearmand, pinslap->thread_cpus,
+                                 pinslap->thread_cpu_count) !=
+        GEARMAN_SUCCESS ||
+        gearmand_set_proc_cpus(gearmand, pinslap->proc_cpus,
+                               pinslap->proc_cpu_count) != GEARMAN_SUCCESS)))
+  {
+    fprintf(stderr, "Invalid number of shards or CPUs\n");
+    exit(1);
+  }
+
+  (void)gearmand_run(gearmand);
+  gearmand_free(gearmand);
+  exit(0);
+}
+
+static pid_t _worker(pinslap_st *pinslap)
+{
+  pid_t pid;
+  gearman_worker_st worker;
+
+  pid= fork();
+  if (pid == -1)
+  {
+    fprintf(stderr, "fork:%d\n", errno);
+    exit(1);
+  }
+
+  if (pid != 0)
+    return pid;
+
+  if (gearman_worker_create(&worker) == NULL ||
+      gearman_worker_add_server(&worker, NULL, pinslap->port) !=
+      GEARMAN_SUCCESS ||
+      gearman_worker_add_function(&worker, GEARMAN_BENCHMARK_DEFAULT_FUNCTION,
+                                  0, _worker_fn, NULL) != GEARMAN_SUCCESS)
+  {
+    fprintf(stderr, "Could not create worker\n");
+    exit(1);
+  }
+
+  while (gearman_worker_work(&worker) == GEARMAN_SUCCESS);
+
+  fprintf(stderr, "%s\n", gearman_worker_error(&worker));
+  exit(1);
+}
+
+static pid_t _client(pinslap_st *pinslap, int fd)
+{
+  pid_t pid;
+  gearman_client_st client;
+  gearman_return_t ret;
+  struct timeval now;
+  time_t end;
+  char *blob;
+  void *result;
+  size_t result_size;
+  uint64_t jobs= 0;
+
+  pid= fork();
+  if (pid == -1)
+  {
+    fprintf(stderr, "fork:%d\n", errno);
+    exit(1);
+  }
+
+  if (pid != 0)
+    return pid;
+
+  blob= malloc(pinslap->size + 1);
+  if (blob == NULL)
+  {
+    fprintf(stderr, "Memory allocation failure on malloc\n");
+    exit(1);
+  }
+
+  memset(blob, 'x', pinslap->size);
+
+  if (gearman_client_create(&client) == NULL ||
+      gearman_client_add_server(&client, NULL, pinslap->port) !=
+      GEARMAN_SUCCESS)
+  {
+    fprintf(stderr, "Could not create client\n");
+    exit(1);
+  }
+
+  gettimeofday(&now, NULL);
+  end= now.tv_sec + (time_t)(pinslap->seconds);
+
+  while (now.tv_sec < end)
+  {
+    result= gearman_client_do(&client, GEARMAN_BENCHMARK_DEFAULT_FUNCTION,
+                              NULL, blob, pinslap->size, &result_size, &ret);
+    if (ret != GEARMAN_SUCCESS)
+    {
+      fprintf(stderr, "%s\n", gearman_client_error(&client));
+      exit(1);
+    }
+
+    if (result != NULL)
+      free(result);
+
+    jobs++;
+    gettimeofday(&now, NULL);
+  }
+
+  if (write(fd, &jobs, sizeof(uint64_t)) != sizeof(uint64_t))
+    exit(1);
+
+  gearman_client_free(&client);
+  free(blob);
+  exit(0);
+}
+
+static void _stop(pid_t pid)
+{
+  (void)kill(pid, SIGKILL);
+  (void)waitpid(pid, NULL, 0);
+}
+
+static void *_worker_fn(gearman_job_st *job, void *cb_arg, size_t *result_size,
+                        gearman_return_t *ret_ptr)
+{
+  (void)job;
+  (void)cb_arg;
+
+  *result_size= 0;
+  *ret_ptr= GEARMAN_SUCCESS;
+  return NULL;
+}
+
+static bool _parse_cpus(const char *list, uint32_t *cpus,
+                        uint32_t *cpu_count)
+{
+  char *end;
+  unsigned long first;
+  unsigned long last;
+
+  *cpu_count= 0;
+
+  while (*list != 0)
+  {
+    first= strtoul(list, &end, 10);
+    if (end == list)
+      break;
+
+    last= first;
+    if (*end == '-')
+    {
+      list= end + 1;
+      last= strtoul(list, &end, 10);
+      if (end == list || last < first)
+        break;
+    }
+
+    for (; first <= last; first++)
+    {
+      if (*cpu_count == PINSLAP_CPU_MAX)
+      {
+        fprintf(stderr, "Too many CPUs given:%s\n", list);
+        return true;
+      }
+
+      cpus[(*cpu_count)++]= (uint32_t)first;
+    }
+
+    if (*end == 0)
+      return false;
+    else if (*end != ',')
+      break;
+
+    list= end + 1;
+  }
+
+  fprintf(stderr, "Invalid CPU list:%s\n", list);
+  return true;
+}
+
+static void _usage(char *name)
+{
+  printf("\nusage: %s\n"
+         "\t[-c <cpus>] [-C <cpus>] [-d <seconds>] [-m <size>] [-n <clients>]\n"
+         "\t[-p <port>] [-r <rounds>] [-s <shards>] [-t <threads>]\n"
+         "\t[-w <workers>]\n\n", name);
+  printf("Runs an in-process gearmand with and without CPU pinning, and\n"
+         "reports the job rate of each setup.\n\n");
+  printf("\t-c <cpus>    - CPUs to pin I/O threads to, like gearmand --cpus\n");
+  printf("\t-C <cpus>    - CPUs to pin processing threads to, like gearmand\n"
+         "\t               --proc-cpus\n");
+  printf("\t-d <seconds> - seconds to run each setup (default %u)\n",
+         PINSLAP_DEFAULT_SECONDS);
+  printf("\t-m <size>    - workload size of each job (default %u)\n",
+         PINSLAP_DEFAULT_SIZE);
+  printf("\t-n <clients> - client processes (default %u)\n",
+         PINSLAP_DEFAULT_CLIENTS);
+  printf("\t-p <port>    - port for the server (default %u)\n",
+         PINSLAP_DEFAULT_PORT);
+  printf("\t-r <rounds>  - times to run both setups (default %u)\n",
+         PINSLAP_DEFAULT_ROUNDS);
+  printf("\t-s <shards>  - server shards (default %u)\n",
+         PINSLAP_DEFAULT_SHARDS);
+  printf("\t-t <threads> - server I/O threads (default %u)\n",
+         PINSLAP_DEFAULT_THREADS);
+  printf("\t-w <workers> - worker processes (default %u)\n",
+         PINSLAP_DEFAULT_WORKERS);
+}
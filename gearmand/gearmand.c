@@ -75,6 +75,7 @@
 
 #define GEARMAND_LOG_REOPEN_TIME 60
 #define GEARMAND_LISTEN_BACKLOG 32
+#define GEARMAND_CPU_MAX 1024
 
 typedef struct
 {
@@ -85,6 +86,8 @@ typedef struct
 
 static gearmand_st *_gearmand;
 
+static bool _parse_cpus(const char *list, uint32_t *cpus,
+                        uint32_t *cpu_count);
 static bool _set_fdlimit(rlim_t fds);
 static bool _pid_write(const char *pid_file);
 static void _pid_delete(const char *pid_file);
@@ -107,6 +110,18 @@ int main(int argc, char *argv[])
   const char *pid_file= NULL;
   const char *queue_type= NULL;
   uint32_t threads= 0;
+  uint32_t shards= 1;
+  bool reuseport= false;
+  bool io_uring= false;
+  bool epoll= false;
+  bool rebalance= false;
+  bool log_sync= false;
+  static uint32_t thread_cpus[GEARMAND_CPU_MAX];
+  static uint32_t proc_cpus[GEARMAND_CPU_MAX];
+  uint32_t thread_cpu_count= 0;
+  uint32_t proc_cpu_count= 0;
+  uint32_t proc_packets= 0;
+  uint32_t proc_bytes= 0;
   const char *user= NULL;
   uint8_t verbose= 0;
   gearman_return_t ret;
@@ -133,20 +148,48 @@ int main(int argc, char *argv[])
   gearman_conf_module_add_option(&module, __name, __short, __value, __help);
 
   MCO("backlog", 'b', "BACKLOG", "Number of backlog connections for listen.")
+  MCO("cpus", 'c', "CPUS",
+      "CPUs to pin I/O threads to, as a list like 0-3,8. Threads take the "
+      "CPUs in turn.")
   MCO("daemon", 'd', NULL, "Daemon, detach and run in the background.")
+  MCO("epoll", 'E', NULL,
+      "Run the I/O threads directly on edge triggered epoll instead of "
+      "libevent.")
   MCO("file-descriptors", 'f', "FDS",
       "Number of file descriptors to allow for the process (total connections "
       "will be slightly less). Default is max allowed for user.")
   MCO("help", 'h', NULL, "Print this help menu.");
+  MCO("io-uring", 'I', NULL,
+      "Run the I/O threads on io_uring instead of libevent when the kernel "
+      "supports it.")
   MCO("log-file", 'l', "FILE",
       "Log file to write errors and information to. Turning this option on "
       "also forces the first verbose level to be enabled.")
+  MCO("log-sync", 'S', NULL,
+      "Write log lines from the thread that logs them, instead of handing "
+      "them to a writer thread. Slower, but nothing is dropped.")
   MCO("listen", 'L', "ADDRESS",
       "Address the server should listen on. Default is INADDR_ANY.")
   MCO("port", 'p', "PORT", "Port the server should listen on.")
   MCO("pid-file", 'P', "FILE", "File to write process ID out to.")
+  MCO("proc-cpus", 'C', "CPUS",
+      "CPUs to pin shard processing threads to, in the same form as --cpus.")
+  MCO("proc-bytes", 'N', "BYTES",
+      "Bytes of packets each connection may have run per turn in a shard "
+      "processing thread. Default=65536.")
+  MCO("proc-packets", 'n', "PACKETS",
+      "Packets each connection may have run per turn in a shard processing "
+      "thread. Default=64.")
   MCO("protocol", 'r', "PROTOCOL", "Load protocol module.")
   MCO("queue-type", 'q', "QUEUE", "Persistent queue type to use.")
+  MCO("rebalance", 'B', NULL,
+      "Move idle connections from busy I/O threads to idle ones.")
+  MCO("reuseport", 'R', NULL,
+      "Give each I/O thread its own listening socket with SO_REUSEPORT, "
+      "instead of accepting all connections in the main thread.")
+  MCO("shards", 's', "SHARDS",
+      "Number of processing shards to partition functions and jobs across. "
+      "Default=1.")
   MCO("threads", 't', "THREADS", "Number of I/O threads to use. Default=0.")
   MCO("user", 'u', "USER", "Switch to given user after startup.")
   MCO("verbose", 'v', NULL, "Increase verbosity level by one.")
@@ -220,6 +263,11 @@ int main(int argc, char *argv[])
   {
     if (!strcmp(name, "backlog"))
       backlog= atoi(value);
+    else if (!strcmp(name, "cpus"))
+    {
+      if (_parse_cpus(value, thread_cpus, &thread_cpu_count))
+        return 1;
+    }
     else if (!strcmp(name, "daemon"))
     {
       switch (fork())
@@ -241,6 +289,8 @@ int main(int argc, char *argv[])
         return 1;
       }
     }
+    else if (!strcmp(name, "epoll"))
+      epoll= true;
     else if (!strcmp(name, "file-descriptors"))
       fds= (rlim_t)atoi(value);
     else if (!strcmp(name, "help"))
@@ -250,18 +300,37 @@ int main(int argc, char *argv[])
       gearman_conf_usage(&conf);
       return 1;
     }
+    else if (!strcmp(name, "io-uring"))
+      io_uring= true;
     else if (!strcmp(name, "log-file"))
       log_info.file= value;
+    else if (!strcmp(name, "log-sync"))
+      log_sync= true;
     else if (!strcmp(name, "listen"))
       host= value;
     else if (!strcmp(name, "port"))
       port= (in_port_t)atoi(value);
     else if (!strcmp(name, "pid-file"))
       pid_file= value;
+    else if (!strcmp(name, "proc-cpus"))
+    {
+      if (_parse_cpus(value, proc_cpus, &proc_cpu_count))
+        return 1;
+    }
+    else if (!strcmp(name, "proc-bytes"))
+      proc_bytes= (uint32_t)atoi(value);
+    else if (!strcmp(name, "proc-packets"))
+      proc_packets= (uint32_t)atoi(value);
     else if (!strcmp(name, "protocol"))
       continue;
     else if (!strcmp(name, "queue-type"))
       queue_type= value;
+    else if (!strcmp(name, "rebalance"))
+      rebalance= true;
+    else if (!strcmp(name, "reuseport"))
+      reuseport= true;
+    else if (!strcmp(name, "shards"))
+      shards= (uint32_t)atoi(value);
     else if (!strcmp(name, "threads"))
       threads= (uint32_t)atoi(value);
     else if (!strcmp(name, "user"))
@@ -295,7 +364,27 @@ int main(int argc, char *argv[])
 
   gearmand_set_backlog(_gearmand, backlog);
   gearmand_set_threads(_gearmand, threads);
+  gearmand_set_reuseport(_gearmand, reuseport);
+  gearmand_set_io_uring(_gearmand, io_uring);
+  gearmand_set_epoll(_gearmand, epoll);
+  gearmand_set_rebalance(_gearmand, rebalance);
+  gearmand_set_proc_budget(_gearmand, proc_packets, proc_bytes);
+  if (gearmand_set_shards(_gearmand, shards) != GEARMAN_SUCCESS)
+  {
+    fprintf(stderr, "gearmand: Could not set number of shards\n");
+    return 1;
+  }
   gearmand_set_log(_gearmand, _log, &log_info, verbose);
+  gearmand_set_log_ring(_gearmand, !log_sync);
+
+  if (gearmand_set_thread_cpus(_gearmand, thread_cpus, thread_cpu_count) !=
+      GEARMAN_SUCCESS ||
+      gearmand_set_proc_cpus(_gearmand, proc_cpus, proc_cpu_count) !=
+      GEARMAN_SUCCESS)
+  {
+    fprintf(stderr, "gearmand: Could not pin threads to the given CPUs\n");
+    return 1;
+  }
 
   if (queue_type != NULL)
   {
@@ -403,6 +492,53 @@ int main(int argc, char *argv[])
   return (ret == GEARMAN_SUCCESS || ret == GEARMAN_SHUTDOWN) ? 0 : 1;
 }
 
+static bool _parse_cpus(const char *list, uint32_t *cpus,
+                        uint32_t *cpu_count)
+{
+  char *end;
+  unsigned long first;
+  unsigned long last;
+
+  *cpu_count= 0;
+
+  while (*list != 0)
+  {
+    first= strtoul(list, &end, 10);
+    if (end == list)
+      break;
+
+    last= first;
+    if (*end == '-')
+    {
+      list= end + 1;
+      last= strtoul(list, &end, 10);
+      if (end == list || last < first)
+        break;
+    }
+
+    for (; first <= last; first++)
+    {
+      if (*cpu_count == GEARMAND_CPU_MAX)
+      {
+        fprintf(stderr, "gearmand: Too many CPUs given:%s\n", list);
+        return true;
+      }
+
+      cpus[(*cpu_count)++]= (uint32_t)first;
+    }
+
+    if (*end == 0)
+      return false;
+    else if (*end != ',')
+      break;
+
+    list= end + 1;
+  }
+
+  fprintf(stderr, "gearmand: Invalid CPU list:%s\n", list);
+  return true;
+}
+
 static bool _set_fdlimit(rlim_t fds)
 {
   struct rlimit rl;
@@ -165,6 +165,13 @@ void gearman_client_set_options(gearman_client_st *client,
     client->options |= options;
   else
     client->options &= ~options;
+
+  if (options & (GEARMAN_CLIENT_COMPRESS | GEARMAN_CLIENT_UNBUFFERED_RESULT))
+  {
+    gearman_set_options(client->gearman, GEARMAN_COMPRESS,
+                        (client->options & GEARMAN_CLIENT_COMPRESS) &&
+                        !(client->options & GEARMAN_CLIENT_UNBUFFERED_RESULT));
+  }
 }
 
 void *gearman_client_data(gearman_client_st *client)
@@ -75,7 +75,11 @@ GEARMAN_API
 int gearman_client_errno(gearman_client_st *client);
 
 /**
- * Set options for a client structure.
+ * Set options for a client structure. With GEARMAN_CLIENT_COMPRESS, new
+ * connections ask job servers for compressed payloads, see
+ * gearman_set_options(). This is left off with
+ * GEARMAN_CLIENT_UNBUFFERED_RESULT, as compressed results can't be read in
+ * pieces.
  * @param client Client structure previously initialized with
  *        gearman_client_create or gearman_client_clone.
  * @param options Available options for gearman_client structs.
@@ -51,6 +51,17 @@
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 #ifdef HAVE_SYS_UTSNAME_H
 #include <sys/utsname.h>
 #endif
@@ -63,6 +74,10 @@
 #ifdef HAVE_UUID_UUID_H
 #include <uuid/uuid.h>
 #endif
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#define GEARMAN_ZLIB_SUPPORTED 1
+#endif
 
 #ifdef TIME_WITH_SYS_TIME
 # include <sys/time.h>
@@ -186,6 +201,31 @@ extern "C" {
     (void) pthread_mutex_unlock(&((__thread)->lock)); \
 }
 
+/**
+ * Get the part of a connection owned by a shard.
+ * @ingroup gearman_server_shard
+ */
+#define GEARMAN_SERVER_CON_SHARD(__con, __shard) \
+  (&((__con)->shard[(__shard)->index]))
+
+/**
+ * Lock the persistent queue only if there are multiple shards calling it.
+ * @ingroup gearman_server_shard
+ */
+#define GEARMAN_SERVER_QUEUE_LOCK(__server) { \
+  if ((__server)->shard_count > 1) \
+    (void) pthread_mutex_lock(&((__server)->queue_lock)); \
+}
+
+/**
+ * Unlock the persistent queue only if there are multiple shards.
+ * @ingroup gearman_server_shard
+ */
+#define GEARMAN_SERVER_QUEUE_UNLOCK(__server) { \
+  if ((__server)->shard_count > 1) \
+    (void) pthread_mutex_unlock(&((__server)->queue_lock)); \
+}
+
 /**
  * Add an object to a list.
  * @ingroup gearman_constants
@@ -238,31 +278,11 @@ extern "C" {
 }
 
 /**
- * Add an object to a hash.
+ * Get the object a hash node is embedded in.
  * @ingroup gearman_constants
  */
-#define GEARMAN_HASH_ADD(__hash, __key, __obj, __prefix) { \
-  if (__hash ## _hash[__key] != NULL) \
-    __hash ## _hash[__key]->__prefix ## prev= __obj; \
-  __obj->__prefix ## next= __hash ## _hash[__key]; \
-  __obj->__prefix ## prev= NULL; \
-  __hash ## _hash[__key]= __obj; \
-  __hash ## _count++; \
-}
-
-/**
- * Delete an object from a hash.
- * @ingroup gearman_constants
- */
-#define GEARMAN_HASH_DEL(__hash, __key, __obj, __prefix) { \
-  if (__hash ## _hash[__key] == __obj) \
-    __hash ## _hash[__key]= __obj->__prefix ## next; \
-  if (__obj->__prefix ## prev != NULL) \
-    __obj->__prefix ## prev->__prefix ## next= __obj->__prefix ## next; \
-  if (__obj->__prefix ## next != NULL) \
-    __obj->__prefix ## next->__prefix ## prev= __obj->__prefix ## prev; \
-  __hash ## _count--; \
-}
+#define GEARMAN_HASH_ENTRY(__node, __type, __member) \
+  ((__type *)((char *)(__node) - offsetof(__type, __member)))
 
 /* All thread-safe libevent functions are not in libevent 1.3x, and this is the
    common package version. Make this work for these earlier versions. */
@@ -28,6 +28,83 @@
  */
 static gearman_return_t _con_setsockopt(gearman_con_st *con);
 
+/**
+ * Borrow a GEARMAN_CON_BUFFER_SIZE buffer from the pool kept in the gearman
+ * structure, allocating one if the pool is empty.
+ */
+static uint8_t *_con_buffer_get(gearman_con_st *con);
+
+/**
+ * Give a buffer back to the pool, or free it if it was grown past
+ * GEARMAN_CON_BUFFER_SIZE or the pool is full.
+ */
+static void _con_buffer_put(gearman_con_st *con, uint8_t *buffer,
+                            size_t size);
+
+/**
+ * Give the send buffer back once nothing is left in it. Connections only
+ * hold buffers while they have data in flight, so idle ones stay small.
+ */
+static void _con_send_release(gearman_con_st *con);
+
+/**
+ * Give the receive buffer back once nothing is left in it.
+ */
+static void _con_recv_release(gearman_con_st *con);
+
+/**
+ * Make room at the end of the receive buffer for the next read, borrowing
+ * one first if needed. Leftover bytes are only moved to the front once less
+ * than half the buffer is free after them, and the buffer doubles up to
+ * GEARMAN_RECV_BUFFER_MAX when the last read filled it, so a stream of small
+ * packets needs fewer reads and moves.
+ */
+static gearman_return_t _con_recv_space(gearman_con_st *con, bool full);
+
+/**
+ * Read into a list of buffers, see gearman_con_read.
+ */
+static size_t _con_readv(gearman_con_st *con, struct iovec *iov, int iov_count,
+                         gearman_return_t *ret_ptr);
+
+/**
+ * Copy from the input given with gearman_con_set_recv_input into a list of
+ * buffers, the way _con_readv reads from the socket.
+ */
+static size_t _con_readv_input(gearman_con_st *con, struct iovec *iov,
+                               int iov_count, gearman_return_t *ret_ptr);
+
+/**
+ * Ask for compression with the "compress" option before the first packet on
+ * a new connection, and wait for the answer. The answer is waited for even
+ * in non-blocking mode, since callers only look for reads once they are done
+ * sending. If the server turns it down, packets go out as they are.
+ */
+static gearman_return_t _con_send_option(gearman_con_st *con);
+
+/**
+ * Frame the data of a packet on a connection with GEARMAN_CON_COMPRESS set.
+ * Data of GEARMAN_FRAME_ZLIB_MIN bytes or more is compressed into
+ * zlib_buffer if that makes it smaller, the rest only gets a raw frame byte.
+ */
+static void _con_send_frame(gearman_con_st *con, gearman_packet_st *packet);
+
+/**
+ * Replace framed data received on a connection with GEARMAN_CON_COMPRESS set
+ * with the data it holds.
+ */
+static gearman_return_t _con_recv_unframe(gearman_con_st *con,
+                                          gearman_packet_st *packet);
+
+/**
+ * OPTION_REQ packet asking for compression.
+ */
+static const uint8_t _con_compress_option[]=
+{
+  0, 'R', 'E', 'Q', 0, 0, 0, GEARMAN_COMMAND_OPTION_REQ, 0, 0, 0, 8,
+  'c', 'o', 'm', 'p', 'r', 'e', 's', 's'
+};
+
 /** @} */
 
 /*
@@ -41,7 +118,12 @@ gearman_con_st *gearman_con_add(gearman_st *gearman, gearman_con_st *con,
   if (con == NULL)
     return NULL;
 
-  gearman_con_set_host(con, host);
+  if (gearman_con_set_host(con, host) != GEARMAN_SUCCESS)
+  {
+    gearman_con_free(con);
+    return NULL;
+  }
+
   gearman_con_set_port(con, port);
 
   return con;
@@ -76,16 +158,25 @@ gearman_con_st *gearman_con_create(gearman_st *gearman, gearman_con_st *con)
   con->send_data_size= 0;
   con->send_data_offset= 0;
   con->recv_buffer_size= 0;
+  con->recv_buffer_total= 0;
   con->recv_data_size= 0;
   con->recv_data_offset= 0;
+  con->recv_input_size= 0;
+  con->send_frame_size= 0;
+  con->send_zlib_size= 0;
+  con->zlib_buffer_size= 0;
   con->gearman= gearman;
   GEARMAN_LIST_ADD(gearman->con, con,)
   con->data= NULL;
   con->addrinfo= NULL;
   con->addrinfo_next= NULL;
-  con->send_buffer_ptr= con->send_buffer;
+  con->host= NULL;
+  con->send_buffer= NULL;
+  con->send_buffer_ptr= NULL;
   con->recv_packet= NULL;
-  con->recv_buffer_ptr= con->recv_buffer;
+  con->recv_buffer_ptr= NULL;
+  con->recv_buffer_start= NULL;
+  con->recv_input= NULL;
   con->protocol_data= NULL;
   con->protocol_data_free_fn= NULL;
   con->recv_fn= NULL;
@@ -94,7 +185,8 @@ gearman_con_st *gearman_con_create(gearman_st *gearman, gearman_con_st *con)
   con->send_data_fn= NULL;
   con->packet_pack_fn= gearman_packet_pack;
   con->packet_unpack_fn= gearman_packet_unpack;
-  con->host[0]= 0;
+  con->zlib_stream= NULL;
+  con->zlib_buffer= NULL;
 
   return con;
 }
@@ -107,8 +199,16 @@ gearman_con_st *gearman_con_clone(gearman_st *gearman, gearman_con_st *con,
     return NULL;
 
   con->options|= (from->options &
-                  (gearman_con_options_t)~GEARMAN_CON_ALLOCATED);
-  strcpy(con->host, from->host);
+                  (gearman_con_options_t)~(GEARMAN_CON_ALLOCATED |
+                                           GEARMAN_CON_COMPRESS |
+                                           GEARMAN_CON_RECV_INPUT));
+  if (from->host != NULL && gearman_con_set_host(con, from->host) !=
+      GEARMAN_SUCCESS)
+  {
+    gearman_con_free(con);
+    return NULL;
+  }
+
   con->port= from->port;
 
   return con;
@@ -129,17 +229,42 @@ void gearman_con_free(gearman_con_st *con)
   if (con->options & GEARMAN_CON_PACKET_IN_USE)
     gearman_packet_free(&(con->packet));
 
+  if (con->host != NULL)
+    free(con->host);
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  if (con->zlib_stream != NULL)
+  {
+    (void)deflateEnd(con->zlib_stream);
+    free(con->zlib_stream);
+  }
+#endif
+
+  if (con->zlib_buffer != NULL)
+    free(con->zlib_buffer);
+
   if (con->options & GEARMAN_CON_ALLOCATED)
     free(con);
 }
 
-void gearman_con_set_host(gearman_con_st *con, const char *host)
+gearman_return_t gearman_con_set_host(gearman_con_st *con, const char *host)
 {
+  char *copy;
+
   gearman_con_reset_addrinfo(con);
 
-  strncpy(con->host, host == NULL ? GEARMAN_DEFAULT_TCP_HOST : host,
-          NI_MAXHOST);
-  con->host[NI_MAXHOST - 1]= 0;
+  copy= strdup(host == NULL ? GEARMAN_DEFAULT_TCP_HOST : host);
+  if (copy == NULL)
+  {
+    GEARMAN_ERROR_SET(con->gearman, "gearman_con_set_host", "strdup")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  if (con->host != NULL)
+    free(con->host);
+  con->host= copy;
+
+  return GEARMAN_SUCCESS;
 }
 
 void gearman_con_set_port(gearman_con_st *con, in_port_t port)
@@ -186,6 +311,13 @@ void gearman_con_set_data(gearman_con_st *con, void *data)
   con->data= data;
 }
 
+void gearman_con_set_recv_input(gearman_con_st *con, const void *data,
+                                size_t data_size)
+{
+  con->recv_input= data;
+  con->recv_input_size= data_size;
+}
+
 gearman_return_t gearman_con_connect(gearman_con_st *con)
 {
   return gearman_con_flush(con);
@@ -207,16 +339,21 @@ void gearman_con_close(gearman_con_st *con)
   con->revents= 0;
 
   con->send_state= GEARMAN_CON_SEND_STATE_NONE;
-  con->send_buffer_ptr= con->send_buffer;
   con->send_buffer_size= 0;
   con->send_data_size= 0;
   con->send_data_offset= 0;
+  _con_send_release(con);
 
   con->recv_state= GEARMAN_CON_RECV_STATE_NONE;
   if (con->recv_packet != NULL)
     gearman_packet_free(con->recv_packet);
-  con->recv_buffer_ptr= con->recv_buffer;
   con->recv_buffer_size= 0;
+  con->recv_input_size= 0;
+  con->options&= (gearman_con_options_t)~GEARMAN_CON_RECV_PINNED;
+  _con_recv_release(con);
+
+  /* Compression is negotiated again on the next connection. */
+  con->options&= (gearman_con_options_t)~GEARMAN_CON_COMPRESS;
 }
 
 void gearman_con_reset_addrinfo(gearman_con_st *con)
@@ -235,10 +372,26 @@ gearman_return_t gearman_con_send(gearman_con_st *con,
 {
   gearman_return_t ret;
   size_t send_size;
+  uint8_t *ptr;
+  uint32_t tmp;
+  const void *data;
+  size_t data_size;
 
   if (con->send_fn != NULL)
     return (*con->send_fn)(con, packet, flush);
 
+  /* Data in a zlib frame goes out of zlib_buffer instead of the packet. */
+  if (con->send_zlib_size == 0)
+  {
+    data= packet->data;
+    data_size= packet->data_size;
+  }
+  else
+  {
+    data= con->zlib_buffer;
+    data_size= con->send_zlib_size;
+  }
+
   switch (con->send_state)
   {
   case GEARMAN_CON_SEND_STATE_NONE:
@@ -248,6 +401,43 @@ gearman_return_t gearman_con_send(gearman_con_st *con,
       return GEARMAN_INVALID_PACKET;
     }
 
+    if (con->gearman->options & GEARMAN_COMPRESS &&
+        con->state != GEARMAN_CON_STATE_CONNECTED)
+    {
+  case GEARMAN_CON_SEND_STATE_OPTION:
+  case GEARMAN_CON_SEND_STATE_OPTION_RES:
+      ret= _con_send_option(con);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+    }
+
+    con->send_frame_size= 0;
+    con->send_zlib_size= 0;
+    data= packet->data;
+    data_size= packet->data_size;
+
+    if (con->options & GEARMAN_CON_COMPRESS && gearman_packet_framed(packet))
+    {
+      _con_send_frame(con, packet);
+      if (con->send_zlib_size > 0)
+      {
+        data= con->zlib_buffer;
+        data_size= con->send_zlib_size;
+      }
+    }
+
+    if (con->send_buffer == NULL)
+    {
+      con->send_buffer= _con_buffer_get(con);
+      if (con->send_buffer == NULL)
+      {
+        GEARMAN_ERROR_SET(con->gearman, "gearman_con_send", "malloc")
+        return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+      }
+
+      con->send_buffer_ptr= con->send_buffer;
+    }
+
     /* Pack first part of packet, which is everything but the payload. */
     while (1)
     {
@@ -257,13 +447,34 @@ gearman_return_t gearman_con_send(gearman_con_st *con,
                                         GEARMAN_SEND_BUFFER_SIZE -
                                         con->send_buffer_size,
                                         &ret);
-      if (ret == GEARMAN_SUCCESS)
+      if (ret == GEARMAN_SUCCESS && con->send_frame_size == 0)
       {
         con->send_buffer_size+= send_size;
         break;
       }
+      else if (ret == GEARMAN_SUCCESS)
+      {
+        /* The frame header follows the arguments and counts in the size
+           given in the packet header. */
+        if (send_size + con->send_frame_size <=
+            GEARMAN_SEND_BUFFER_SIZE - con->send_buffer_size)
+        {
+          ptr= con->send_buffer + con->send_buffer_size;
+          tmp= htonl((uint32_t)(send_size - GEARMAN_PACKET_HEADER_SIZE +
+                                con->send_frame_size + data_size));
+          memcpy(ptr + 8, &tmp, 4);
+          memcpy(ptr + send_size, con->send_frame, con->send_frame_size);
+          con->send_buffer_size+= send_size + con->send_frame_size;
+          break;
+        }
+
+        ret= GEARMAN_FLUSH_DATA;
+      }
       else if (ret == GEARMAN_IGNORE_PACKET)
+      {
+        _con_send_release(con);
         return GEARMAN_SUCCESS;
+      }
       else if (ret != GEARMAN_FLUSH_DATA)
         return ret;
 
@@ -286,23 +497,23 @@ gearman_return_t gearman_con_send(gearman_con_st *con,
     }
 
     /* Return here if we have no data to send. */
-    if (packet->data_size == 0)
+    if (data_size == 0)
       break;
 
     /* If there is any room in the buffer, copy in data. */
-    if (packet->data != NULL &&
+    if (data != NULL &&
         (GEARMAN_SEND_BUFFER_SIZE - con->send_buffer_size) > 0)
     {
       con->send_data_offset= GEARMAN_SEND_BUFFER_SIZE - con->send_buffer_size;
-      if (con->send_data_offset > packet->data_size)
-        con->send_data_offset= packet->data_size;
+      if (con->send_data_offset > data_size)
+        con->send_data_offset= data_size;
 
-      memcpy(con->send_buffer + con->send_buffer_size, packet->data,
+      memcpy(con->send_buffer + con->send_buffer_size, data,
              con->send_data_offset);
       con->send_buffer_size+= con->send_data_offset;
 
       /* Return if all data fit in the send buffer. */
-      if (con->send_data_offset == packet->data_size)
+      if (con->send_data_offset == data_size)
       {
         con->send_data_offset= 0;
         break;
@@ -317,28 +528,27 @@ gearman_return_t gearman_con_send(gearman_con_st *con,
     if (ret != GEARMAN_SUCCESS)
       return ret;
 
-    con->send_data_size= packet->data_size;
+    con->send_data_size= data_size;
 
     /* If this is NULL, then gearman_con_send_data function will be used. */
-    if (packet->data == NULL)
+    if (data == NULL)
     {
       con->send_state= GEARMAN_CON_SEND_STATE_FLUSH_DATA;
       return GEARMAN_SUCCESS;
     }
 
     /* Copy into the buffer if it fits, otherwise flush from packet buffer. */
-    con->send_buffer_size= packet->data_size - con->send_data_offset;
+    con->send_buffer_size= data_size - con->send_data_offset;
     if (con->send_buffer_size < GEARMAN_SEND_BUFFER_SIZE)
     {
-      memcpy(con->send_buffer,
-             ((uint8_t *)(packet->data)) + con->send_data_offset,
+      memcpy(con->send_buffer, ((uint8_t *)data) + con->send_data_offset,
              con->send_buffer_size);
       con->send_data_size= 0;
       con->send_data_offset= 0;
       break;
     }
 
-    con->send_buffer_ptr= ((uint8_t *)(packet->data)) + con->send_data_offset;
+    con->send_buffer_ptr= ((uint8_t *)data) + con->send_data_offset;
     con->send_state= GEARMAN_CON_SEND_STATE_FLUSH_DATA;
 
   case GEARMAN_CON_SEND_STATE_FLUSH:
@@ -424,7 +634,8 @@ gearman_return_t gearman_con_flush(gearman_con_st *con)
       ai.ai_socktype= SOCK_STREAM;
       ai.ai_protocol= IPPROTO_TCP;
 
-      ret= getaddrinfo(con->host, port_str, &ai, &(con->addrinfo));
+      ret= getaddrinfo(con->host == NULL ? "" : con->host, port_str, &ai,
+                       &(con->addrinfo));
       if (ret != 0)
       {
         GEARMAN_ERROR_SET(con->gearman, "gearman_con_flush", "getaddrinfo:%s",
@@ -606,8 +817,17 @@ gearman_return_t gearman_con_flush(gearman_con_st *con)
         con->send_buffer_ptr+= write_size;
       }
 
+      /* Sends only flush part way through a packet in these states, and
+         still need the buffer for the rest. */
+      if (con->send_state == GEARMAN_CON_SEND_STATE_PRE_FLUSH ||
+          con->send_state == GEARMAN_CON_SEND_STATE_FORCE_FLUSH)
+      {
+        con->send_buffer_ptr= con->send_buffer;
+      }
+      else
+        _con_send_release(con);
+
       con->send_state= GEARMAN_CON_SEND_STATE_NONE;
-      con->send_buffer_ptr= con->send_buffer;
       return GEARMAN_SUCCESS;
 
     default:
@@ -618,6 +838,70 @@ gearman_return_t gearman_con_flush(gearman_con_st *con)
   }
 }
 
+gearman_return_t gearman_con_writev(gearman_con_st *con,
+                                    const struct iovec *iov, int iov_count,
+                                    size_t *write_size)
+{
+  ssize_t ret;
+  gearman_return_t gret;
+
+  *write_size= 0;
+
+  while (1)
+  {
+    ret= writev(con->fd, iov, iov_count);
+    if (ret == 0)
+    {
+      if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
+      {
+        GEARMAN_ERROR_SET(con->gearman, "gearman_con_writev",
+                          "lost connection to server (EOF)")
+      }
+      gearman_con_close(con);
+      return GEARMAN_LOST_CONNECTION;
+    }
+    else if (ret == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        gret= gearman_con_set_events(con, POLLOUT);
+        if (gret != GEARMAN_SUCCESS)
+          return gret;
+
+        if (con->gearman->options & GEARMAN_NON_BLOCKING)
+          return GEARMAN_IO_WAIT;
+
+        gret= gearman_con_wait(con->gearman, -1);
+        if (gret != GEARMAN_SUCCESS)
+          return gret;
+
+        continue;
+      }
+      else if (errno == EINTR)
+        continue;
+      else if (errno == EPIPE || errno == ECONNRESET)
+      {
+        if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
+        {
+          GEARMAN_ERROR_SET(con->gearman, "gearman_con_writev",
+                            "lost connection to server (%d)", errno)
+        }
+        gearman_con_close(con);
+        return GEARMAN_LOST_CONNECTION;
+      }
+
+      GEARMAN_ERROR_SET(con->gearman, "gearman_con_writev", "writev:%d",
+                        errno)
+      con->gearman->last_errno= errno;
+      gearman_con_close(con);
+      return GEARMAN_ERRNO;
+    }
+
+    *write_size= (size_t)ret;
+    return GEARMAN_SUCCESS;
+  }
+}
+
 gearman_return_t gearman_con_flush_all(gearman_st *gearman)
 {
   gearman_con_st *con;
@@ -709,6 +993,8 @@ gearman_packet_st *gearman_con_recv(gearman_con_st *con,
                                     gearman_return_t *ret_ptr, bool recv_data)
 {
   size_t recv_size;
+  size_t space;
+  bool full= false;
 
   if (con->recv_fn != NULL)
     return (*con->recv_fn)(con, packet, ret_ptr, recv_data);
@@ -723,6 +1009,9 @@ gearman_packet_st *gearman_con_recv(gearman_con_st *con,
       return NULL;
     }
 
+    /* The last packet is done with, so its arguments may go. */
+    con->options&= (gearman_con_options_t)~GEARMAN_CON_RECV_PINNED;
+
     con->recv_packet= gearman_packet_create(con->gearman, packet);
     if (con->recv_packet == NULL)
     {
@@ -751,18 +1040,28 @@ gearman_packet_st *gearman_con_recv(gearman_con_st *con,
         }
       }
 
-      /* Shift buffer contents if needed. */
-      if (con->recv_buffer_size > 0)
-        memmove(con->recv_buffer, con->recv_buffer_ptr, con->recv_buffer_size);
-      con->recv_buffer_ptr= con->recv_buffer;
+      *ret_ptr= _con_recv_space(con, full);
+      if (*ret_ptr != GEARMAN_SUCCESS)
+      {
+        gearman_con_close(con);
+        return NULL;
+      }
 
-      recv_size= gearman_con_read(con, con->recv_buffer + con->recv_buffer_size,
-                               GEARMAN_RECV_BUFFER_SIZE - con->recv_buffer_size,
-                               ret_ptr);
+      space= con->recv_buffer_total -
+             (size_t)(con->recv_buffer_ptr - con->recv_buffer_start) -
+             con->recv_buffer_size;
+      recv_size= gearman_con_read(con, con->recv_buffer_ptr +
+                                  con->recv_buffer_size, space, ret_ptr);
       if (*ret_ptr != GEARMAN_SUCCESS)
+      {
+        /* Nothing is in flight while waiting for a new packet to start. */
+        if (con->recv_buffer_size == 0)
+          _con_recv_release(con);
         return NULL;
+      }
 
       con->recv_buffer_size+= recv_size;
+      full= recv_size == space;
     }
 
     if (packet->data_size == 0)
@@ -809,6 +1108,17 @@ gearman_packet_st *gearman_con_recv(gearman_con_st *con,
     }
 
     con->recv_state= GEARMAN_CON_RECV_STATE_NONE;
+
+    if (con->options & GEARMAN_CON_COMPRESS && gearman_packet_framed(packet))
+    {
+      *ret_ptr= _con_recv_unframe(con, packet);
+      if (*ret_ptr != GEARMAN_SUCCESS)
+      {
+        gearman_con_close(con);
+        return NULL;
+      }
+    }
+
     break;
 
   default:
@@ -828,6 +1138,8 @@ size_t gearman_con_recv_data(gearman_con_st *con, void *data, size_t data_size,
                              gearman_return_t *ret_ptr)
 {
   size_t recv_size= 0;
+  struct iovec iov[2];
+  int iov_count= 1;
 
   if (con->recv_data_fn != NULL)
     return (*con->recv_data_fn)(con, data, data_size, ret_ptr);
@@ -855,8 +1167,29 @@ size_t gearman_con_recv_data(gearman_con_st *con, void *data, size_t data_size,
 
   if (data_size != recv_size)
   {
-    recv_size+= gearman_con_read(con, ((uint8_t *)data) + recv_size,
-                                 data_size - recv_size, ret_ptr);
+    /* The receive buffer is empty now, so read the rest straight into the
+       caller's buffer, and whatever follows into the receive buffer. Without
+       a receive buffer, only read the rest. */
+    iov[0].iov_base= ((uint8_t *)data) + recv_size;
+    iov[0].iov_len= data_size - recv_size;
+    if (_con_recv_space(con, false) == GEARMAN_SUCCESS)
+    {
+      iov[1].iov_base= con->recv_buffer_ptr;
+      iov[1].iov_len= con->recv_buffer_total -
+                      (size_t)(con->recv_buffer_ptr - con->recv_buffer_start);
+      if (iov[1].iov_len > 0)
+        iov_count= 2;
+    }
+
+    recv_size+= _con_readv(con, iov, iov_count, ret_ptr);
+    if (recv_size > data_size)
+    {
+      con->recv_buffer_size= recv_size - data_size;
+      recv_size= data_size;
+    }
+    else if (*ret_ptr != GEARMAN_SUCCESS)
+      _con_recv_release(con);
+
     con->recv_data_offset+= recv_size;
   }
   else
@@ -878,69 +1211,12 @@ size_t gearman_con_recv_data(gearman_con_st *con, void *data, size_t data_size,
 size_t gearman_con_read(gearman_con_st *con, void *data, size_t data_size,
                         gearman_return_t *ret_ptr)
 {
-  ssize_t read_size;
-
-  while (1)
-  {
-    read_size= read(con->fd, data, data_size);
-    if (read_size == 0)
-    {
-      if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
-      {
-        GEARMAN_ERROR_SET(con->gearman, "gearman_con_read",
-                          "lost connection to server (EOF)")
-      }
-      gearman_con_close(con);
-      *ret_ptr= GEARMAN_LOST_CONNECTION;
-      return 0;
-    }
-    else if (read_size == -1)
-    {
-      if (errno == EAGAIN)
-      {
-        *ret_ptr= gearman_con_set_events(con, POLLIN);
-        if (*ret_ptr != GEARMAN_SUCCESS)
-          return 0;
-
-        if (con->gearman->options & GEARMAN_NON_BLOCKING)
-        {
-          *ret_ptr= GEARMAN_IO_WAIT;
-          return 0;
-        }
-
-        *ret_ptr= gearman_con_wait(con->gearman, -1);
-        if (*ret_ptr != GEARMAN_SUCCESS)
-          return 0;
-
-        continue;
-      }
-      else if (errno == EINTR)
-        continue;
-      else if (errno == EPIPE || errno == ECONNRESET)
-      {
-        if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
-        {
-          GEARMAN_ERROR_SET(con->gearman, "gearman_con_read",
-                            "lost connection to server (%d)", errno)
-        }
-        *ret_ptr= GEARMAN_LOST_CONNECTION;
-      }
-      else
-      {
-        GEARMAN_ERROR_SET(con->gearman, "gearman_con_read", "read:%d", errno)
-        con->gearman->last_errno= errno;
-        *ret_ptr= GEARMAN_ERRNO;
-      }
+  struct iovec iov;
 
-      gearman_con_close(con);
-      return 0;
-    }
+  iov.iov_base= data;
+  iov.iov_len= data_size;
 
-    break;
-  }
-
-  *ret_ptr= GEARMAN_SUCCESS;
-  return (size_t)read_size;
+  return _con_readv(con, &iov, 1, ret_ptr);
 }
 
 gearman_return_t gearman_con_wait(gearman_st *gearman, int timeout)
@@ -1277,3 +1553,394 @@ static gearman_return_t _con_setsockopt(gearman_con_st *con)
 
   return GEARMAN_SUCCESS;
 }
+
+static uint8_t *_con_buffer_get(gearman_con_st *con)
+{
+  gearman_st *gearman= con->gearman;
+  uint8_t *buffer;
+
+  if (gearman->con_buffer_list == NULL)
+    return malloc(GEARMAN_CON_BUFFER_SIZE);
+
+  buffer= gearman->con_buffer_list;
+  gearman->con_buffer_list= *((void **)buffer);
+  gearman->con_buffer_count--;
+
+  return buffer;
+}
+
+static void _con_buffer_put(gearman_con_st *con, uint8_t *buffer,
+                            size_t size)
+{
+  gearman_st *gearman= con->gearman;
+
+  if (size != GEARMAN_CON_BUFFER_SIZE ||
+      gearman->con_buffer_count == GEARMAN_MAX_FREE_CON_BUFFER)
+  {
+    free(buffer);
+    return;
+  }
+
+  *((void **)buffer)= gearman->con_buffer_list;
+  gearman->con_buffer_list= buffer;
+  gearman->con_buffer_count++;
+}
+
+static void _con_send_release(gearman_con_st *con)
+{
+  if (con->send_buffer == NULL || con->send_buffer_size != 0)
+    return;
+
+  _con_buffer_put(con, con->send_buffer, GEARMAN_CON_BUFFER_SIZE);
+  con->send_buffer= NULL;
+  con->send_buffer_ptr= NULL;
+}
+
+static void _con_recv_release(gearman_con_st *con)
+{
+  if (con->recv_buffer_start == NULL || con->recv_buffer_size != 0 ||
+      con->options & GEARMAN_CON_RECV_PINNED)
+  {
+    return;
+  }
+
+  _con_buffer_put(con, con->recv_buffer_start, con->recv_buffer_total);
+  con->recv_buffer_start= NULL;
+  con->recv_buffer_ptr= NULL;
+  con->recv_buffer_total= 0;
+}
+
+static gearman_return_t _con_recv_space(gearman_con_st *con, bool full)
+{
+  uint8_t *buffer;
+  size_t total;
+
+  if (con->recv_buffer_start == NULL)
+  {
+    con->recv_buffer_start= _con_buffer_get(con);
+    if (con->recv_buffer_start == NULL)
+    {
+      GEARMAN_ERROR_SET(con->gearman, "_con_recv_space", "malloc")
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    con->recv_buffer_ptr= con->recv_buffer_start;
+    con->recv_buffer_total= GEARMAN_CON_BUFFER_SIZE;
+    return GEARMAN_SUCCESS;
+  }
+
+  /* Arguments of the last packet point into the buffer, leave it be. */
+  if (con->options & GEARMAN_CON_RECV_PINNED)
+    return GEARMAN_SUCCESS;
+
+  if (con->recv_buffer_size == 0)
+    con->recv_buffer_ptr= con->recv_buffer_start;
+
+  if (full && con->recv_buffer_total < GEARMAN_RECV_BUFFER_MAX)
+  {
+    total= con->recv_buffer_total * 2;
+    buffer= malloc(total);
+
+    /* Keep using the current buffer if this fails. */
+    if (buffer != NULL)
+    {
+      memcpy(buffer, con->recv_buffer_ptr, con->recv_buffer_size);
+      _con_buffer_put(con, con->recv_buffer_start, con->recv_buffer_total);
+
+      con->recv_buffer_start= buffer;
+      con->recv_buffer_ptr= buffer;
+      con->recv_buffer_total= total;
+      return GEARMAN_SUCCESS;
+    }
+  }
+
+  if ((size_t)(con->recv_buffer_ptr - con->recv_buffer_start) +
+      con->recv_buffer_size > con->recv_buffer_total / 2)
+  {
+    memmove(con->recv_buffer_start, con->recv_buffer_ptr,
+            con->recv_buffer_size);
+    con->recv_buffer_ptr= con->recv_buffer_start;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+static size_t _con_readv(gearman_con_st *con, struct iovec *iov, int iov_count,
+                         gearman_return_t *ret_ptr)
+{
+  ssize_t read_size;
+
+  if (con->options & GEARMAN_CON_RECV_INPUT)
+    return _con_readv_input(con, iov, iov_count, ret_ptr);
+
+  while (1)
+  {
+    read_size= readv(con->fd, iov, iov_count);
+    if (read_size == 0)
+    {
+      if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
+      {
+        GEARMAN_ERROR_SET(con->gearman, "gearman_con_read",
+                          "lost connection to server (EOF)")
+      }
+      gearman_con_close(con);
+      *ret_ptr= GEARMAN_LOST_CONNECTION;
+      return 0;
+    }
+    else if (read_size == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        *ret_ptr= gearman_con_set_events(con, POLLIN);
+        if (*ret_ptr != GEARMAN_SUCCESS)
+          return 0;
+
+        if (con->gearman->options & GEARMAN_NON_BLOCKING)
+        {
+          *ret_ptr= GEARMAN_IO_WAIT;
+          return 0;
+        }
+
+        *ret_ptr= gearman_con_wait(con->gearman, -1);
+        if (*ret_ptr != GEARMAN_SUCCESS)
+          return 0;
+
+        continue;
+      }
+      else if (errno == EINTR)
+        continue;
+      else if (errno == EPIPE || errno == ECONNRESET)
+      {
+        if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
+        {
+          GEARMAN_ERROR_SET(con->gearman, "gearman_con_read",
+                            "lost connection to server (%d)", errno)
+        }
+        *ret_ptr= GEARMAN_LOST_CONNECTION;
+      }
+      else
+      {
+        GEARMAN_ERROR_SET(con->gearman, "gearman_con_read", "read:%d", errno)
+        con->gearman->last_errno= errno;
+        *ret_ptr= GEARMAN_ERRNO;
+      }
+
+      gearman_con_close(con);
+      return 0;
+    }
+
+    break;
+  }
+
+  *ret_ptr= GEARMAN_SUCCESS;
+  return (size_t)read_size;
+}
+
+static size_t _con_readv_input(gearman_con_st *con, struct iovec *iov,
+                               int iov_count, gearman_return_t *ret_ptr)
+{
+  size_t read_size= 0;
+  size_t size;
+  int x;
+
+  if (con->recv_input_size == 0)
+  {
+    *ret_ptr= gearman_con_set_events(con, POLLIN);
+    if (*ret_ptr == GEARMAN_SUCCESS)
+      *ret_ptr= GEARMAN_IO_WAIT;
+    return 0;
+  }
+
+  for (x= 0; x < iov_count && con->recv_input_size > 0; x++)
+  {
+    size= iov[x].iov_len;
+    if (size > con->recv_input_size)
+      size= con->recv_input_size;
+
+    memcpy(iov[x].iov_base, con->recv_input, size);
+    con->recv_input+= size;
+    con->recv_input_size-= size;
+    read_size+= size;
+  }
+
+  /* No room for what was received, which a socket read reports as EOF. */
+  if (read_size == 0)
+  {
+    if (!(con->options & GEARMAN_CON_IGNORE_LOST_CONNECTION))
+    {
+      GEARMAN_ERROR_SET(con->gearman, "gearman_con_read",
+                        "lost connection to server (EOF)")
+    }
+    gearman_con_close(con);
+    *ret_ptr= GEARMAN_LOST_CONNECTION;
+    return 0;
+  }
+
+  *ret_ptr= GEARMAN_SUCCESS;
+  return read_size;
+}
+
+static gearman_return_t _con_send_option(gearman_con_st *con)
+{
+  gearman_options_t options= con->gearman->options;
+  gearman_return_t ret;
+
+  switch (con->send_state)
+  {
+  case GEARMAN_CON_SEND_STATE_NONE:
+    if (con->send_buffer == NULL)
+    {
+      con->send_buffer= _con_buffer_get(con);
+      if (con->send_buffer == NULL)
+      {
+        GEARMAN_ERROR_SET(con->gearman, "_con_send_option", "malloc")
+        return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+      }
+
+      con->send_buffer_ptr= con->send_buffer;
+    }
+
+    /* Nothing was sent yet on a new connection, so this always fits. */
+    memcpy(con->send_buffer + con->send_buffer_size, _con_compress_option,
+           sizeof(_con_compress_option));
+    con->send_buffer_size+= sizeof(_con_compress_option);
+    con->send_state= GEARMAN_CON_SEND_STATE_OPTION;
+    /* Fall through. */
+
+  case GEARMAN_CON_SEND_STATE_OPTION:
+    ret= gearman_con_flush(con);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    con->send_state= GEARMAN_CON_SEND_STATE_OPTION_RES;
+    /* Fall through. */
+
+  case GEARMAN_CON_SEND_STATE_OPTION_RES:
+    con->gearman->options&= (gearman_options_t)~GEARMAN_NON_BLOCKING;
+    (void)gearman_con_recv(con, &(con->packet), &ret, true);
+    con->gearman->options= options;
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    /* Servers that don't know the option answer with an error. */
+    if (con->packet.command == GEARMAN_COMMAND_OPTION_RES)
+      con->options|= GEARMAN_CON_COMPRESS;
+    else if (con->packet.command != GEARMAN_COMMAND_ERROR)
+    {
+      gearman_packet_free(&(con->packet));
+      gearman_con_close(con);
+      GEARMAN_ERROR_SET(con->gearman, "_con_send_option",
+                        "unexpected packet for option request")
+      return GEARMAN_INVALID_PACKET;
+    }
+
+    gearman_packet_free(&(con->packet));
+    break;
+
+  case GEARMAN_CON_SEND_STATE_PRE_FLUSH:
+  case GEARMAN_CON_SEND_STATE_FORCE_FLUSH:
+  case GEARMAN_CON_SEND_STATE_FLUSH:
+  case GEARMAN_CON_SEND_STATE_FLUSH_DATA:
+  default:
+    GEARMAN_ERROR_SET(con->gearman, "_con_send_option", "unknown state: %u",
+                      con->send_state)
+    return GEARMAN_UNKNOWN_STATE;
+  }
+
+  con->send_state= GEARMAN_CON_SEND_STATE_NONE;
+  return GEARMAN_SUCCESS;
+}
+
+static void _con_send_frame(gearman_con_st *con, gearman_packet_st *packet)
+{
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  z_stream *stream;
+  uint8_t *buffer;
+  uint32_t tmp;
+#endif
+
+  con->send_frame[0]= GEARMAN_FRAME_RAW;
+  con->send_frame_size= GEARMAN_FRAME_RAW_SIZE;
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  /* Data given to gearman_con_send_data() is never here in one piece. */
+  if (packet->data == NULL || packet->data_size < GEARMAN_FRAME_ZLIB_MIN)
+    return;
+
+  stream= con->zlib_stream;
+  if (stream == NULL)
+  {
+    stream= malloc(sizeof(z_stream));
+    if (stream == NULL)
+      return;
+
+    memset(stream, 0, sizeof(z_stream));
+    if (deflateInit(stream, GEARMAN_FRAME_ZLIB_LEVEL) != Z_OK)
+    {
+      free(stream);
+      return;
+    }
+
+    con->zlib_stream= stream;
+  }
+  else if (deflateReset(stream) != Z_OK)
+    return;
+
+  if (con->zlib_buffer_size < packet->data_size)
+  {
+    buffer= realloc(con->zlib_buffer, packet->data_size);
+    if (buffer == NULL)
+      return;
+
+    con->zlib_buffer= buffer;
+    con->zlib_buffer_size= packet->data_size;
+  }
+
+  /* Give up as soon as the frame would not be smaller than the data. */
+  stream->next_in= (Bytef *)(packet->data);
+  stream->avail_in= (uInt)(packet->data_size);
+  stream->next_out= con->zlib_buffer;
+  stream->avail_out= (uInt)(packet->data_size - GEARMAN_FRAME_ZLIB_SIZE);
+  if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+    return;
+
+  tmp= htonl((uint32_t)(packet->data_size));
+  con->send_frame[0]= GEARMAN_FRAME_ZLIB;
+  memcpy(con->send_frame + 1, &tmp, 4);
+  con->send_frame_size= GEARMAN_FRAME_ZLIB_SIZE;
+  con->send_zlib_size= (size_t)(stream->total_out);
+#else
+  (void)packet;
+#endif
+}
+
+static gearman_return_t _con_recv_unframe(gearman_con_st *con,
+                                          gearman_packet_st *packet)
+{
+  gearman_frame_t type;
+  size_t data_size;
+  void *data;
+  gearman_return_t ret;
+
+  ret= gearman_packet_frame_check(con->gearman, packet->data,
+                                  packet->data_size, &type, &data_size);
+  if (ret != GEARMAN_SUCCESS)
+    return ret;
+
+  /* Raw data only has to move down over the frame byte. */
+  if (type == GEARMAN_FRAME_RAW)
+  {
+    memmove((void *)(packet->data),
+            ((uint8_t *)(packet->data)) + GEARMAN_FRAME_RAW_SIZE, data_size);
+    packet->data_size= data_size;
+    return GEARMAN_SUCCESS;
+  }
+
+  data= gearman_packet_frame_decode(con->gearman, packet->data,
+                                    packet->data_size, &data_size, &ret);
+  if (ret != GEARMAN_SUCCESS)
+    return ret;
+
+  gearman_packet_give_data(packet, data, data_size);
+  return GEARMAN_SUCCESS;
+}
@@ -57,7 +57,7 @@ void gearman_con_free(gearman_con_st *con);
  * Set options for a connection.
  */
 GEARMAN_API
-void gearman_con_set_host(gearman_con_st *con, const char *host);
+gearman_return_t gearman_con_set_host(gearman_con_st *con, const char *host);
 GEARMAN_API
 void gearman_con_set_port(gearman_con_st *con, in_port_t port);
 GEARMAN_API
@@ -82,6 +82,20 @@ void *gearman_con_data(gearman_con_st *con);
 GEARMAN_API
 void gearman_con_set_data(gearman_con_st *con, void *data);
 
+/**
+ * Hand a connection data that was already received for it. With
+ * GEARMAN_CON_RECV_INPUT set, reads take from this instead of the socket,
+ * and return GEARMAN_IO_WAIT once it is used up, so the connection must be
+ * non-blocking. The data is not copied and must stay until it is used up or
+ * replaced.
+ * @param con Connection to hand the data to.
+ * @param data Data received for the connection, or NULL.
+ * @param data_size Size of the data.
+ */
+GEARMAN_API
+void gearman_con_set_recv_input(gearman_con_st *con, const void *data,
+                                size_t data_size);
+
 /**
  * Connect to server.
  */
@@ -120,6 +134,21 @@ size_t gearman_con_send_data(gearman_con_st *con, const void *data,
 GEARMAN_API
 gearman_return_t gearman_con_flush(gearman_con_st *con);
 
+/**
+ * Write buffers straight to a connected socket with one writev() call,
+ * bypassing the send buffer, which must be empty. On EAGAIN this waits for
+ * POLLOUT like gearman_con_flush.
+ * @param con Connection to write to.
+ * @param iov Buffers to write.
+ * @param iov_count Number of buffers, at most IOV_MAX.
+ * @param write_size Number of bytes written, which may end mid-buffer.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearman_con_writev(gearman_con_st *con,
+                                    const struct iovec *iov, int iov_count,
+                                    size_t *write_size);
+
 /**
  * Flush the send buffer for all connections.
  */
@@ -134,7 +163,9 @@ gearman_return_t gearman_con_send_all(gearman_st *gearman,
                                       gearman_packet_st *packet);
 
 /**
- * Receive packet from a connection.
+ * Receive packet from a connection. With GEARMAN_CON_PIN_ARGS set, the
+ * arguments of the packet may point into the receive buffer, and are only
+ * valid until the next call, see gearman_packet_unpin_args.
  */
 GEARMAN_API
 gearman_packet_st *gearman_con_recv(gearman_con_st *con,
@@ -39,15 +39,44 @@ extern "C" {
 #define GEARMAN_UNIQUE_SIZE 64
 #define GEARMAN_MAX_COMMAND_ARGS 8
 #define GEARMAN_ARGS_BUFFER_SIZE 128
-#define GEARMAN_SEND_BUFFER_SIZE 8192
-#define GEARMAN_RECV_BUFFER_SIZE 8192
+#define GEARMAN_CON_BUFFER_SIZE 8192
+#define GEARMAN_SEND_BUFFER_SIZE GEARMAN_CON_BUFFER_SIZE
+#define GEARMAN_RECV_BUFFER_SIZE GEARMAN_CON_BUFFER_SIZE
+#define GEARMAN_RECV_BUFFER_MAX 65536
+#define GEARMAN_FRAME_RAW_SIZE 1
+#define GEARMAN_FRAME_ZLIB_SIZE 5
+#define GEARMAN_FRAME_ZLIB_MIN 1024
+#define GEARMAN_FRAME_ZLIB_LEVEL 1
+#define GEARMAN_FRAME_ZLIB_RATIO 1032
+#define GEARMAN_MAX_FREE_CON_BUFFER 256
 #define GEARMAN_SERVER_CON_ID_SIZE 128
-#define GEARMAN_JOB_HASH_SIZE 383
+#define GEARMAN_SERVER_CON_HOST_SIZE 64
+#define GEARMAN_SERVER_CON_PORT_SIZE 8
+#define GEARMAN_SERVER_HASH_MIN_SIZE 512
+#define GEARMAN_SERVER_HASH_REHASH_STEP 4
+#define GEARMAN_JOB_SLOT_PAGE_SHIFT 14
+#define GEARMAN_JOB_SLOT_PAGE_SIZE (1 << GEARMAN_JOB_SLOT_PAGE_SHIFT)
+#define GEARMAN_JOB_SLOT_PAGE_MAX (1 << (32 - GEARMAN_JOB_SLOT_PAGE_SHIFT))
+#define GEARMAN_JOB_HANDLE_DIGITS 20
+#define GEARMAN_SERVER_JOB_UNIQUE_INLINE 16
+#define GEARMAN_SERVER_SLAB_SIZE 65536
+#define GEARMAN_SERVER_SLAB_ALIGN 16
+#define GEARMAN_SERVER_CACHE_LINE 64
+#define GEARMAN_SERVER_SLAB_CACHE_SIZE 64
+#define GEARMAN_SERVER_SLAB_EMPTY_MAX 2
+#define GEARMAN_SERVER_STATS_INTERVAL 100 /* Milliseconds */
+#define GEARMAN_SERVER_SHARD_MAX 64
+#define GEARMAN_SERVER_PROC_PACKETS 64
+#define GEARMAN_SERVER_PROC_BYTES 65536
+#define GEARMAN_SERVER_IOV_MAX 64
 #define GEARMAN_MAX_FREE_SERVER_CON 1000
-#define GEARMAN_MAX_FREE_SERVER_PACKET 2000
-#define GEARMAN_MAX_FREE_SERVER_JOB 1000
-#define GEARMAN_MAX_FREE_SERVER_CLIENT 1000
-#define GEARMAN_MAX_FREE_SERVER_WORKER 1000
+#define GEARMAND_LOAD_INTERVAL 1000 /* Milliseconds */
+#define GEARMAND_LOAD_PACKET_BYTES 4096
+#define GEARMAND_MOVE_MAX 16
+#define GEARMAND_LOG_RING_SIZE 256
+#define GEARMAND_URING_ENTRIES 256
+#define GEARMAND_URING_BUFFERS 128 /* Power of two */
+#define GEARMAND_EPOLL_EVENTS 256
 #define GEARMAN_TEXT_RESPONSE_SIZE 8192
 #define GEARMAN_WORKER_WAIT_TIMEOUT (10 * 1000) /* Milliseconds */
 #define GEARMAN_PIPE_BUFFER_SIZE 256
@@ -66,16 +95,33 @@ typedef struct gearman_worker_st gearman_worker_st;
 typedef struct gearman_worker_function_st gearman_worker_function_st;
 typedef struct gearman_server_st gearman_server_st;
 typedef struct gearman_server_thread_st gearman_server_thread_st;
+typedef struct gearman_server_shard_st gearman_server_shard_st;
 typedef struct gearman_server_con_st gearman_server_con_st;
+typedef struct gearman_server_con_shard_st gearman_server_con_shard_st;
+typedef struct gearman_server_con_addr_st gearman_server_con_addr_st;
 typedef struct gearman_server_packet_st gearman_server_packet_st;
+typedef struct gearman_server_payload_st gearman_server_payload_st;
 typedef struct gearman_server_function_st gearman_server_function_st;
 typedef struct gearman_server_client_st gearman_server_client_st;
 typedef struct gearman_server_worker_st gearman_server_worker_st;
 typedef struct gearman_server_job_st gearman_server_job_st;
+typedef struct gearman_server_job_slot_st gearman_server_job_slot_st;
+typedef struct gearman_server_hash_st gearman_server_hash_st;
+typedef struct gearman_server_hash_node_st gearman_server_hash_node_st;
+typedef struct gearman_server_slab_st gearman_server_slab_st;
+typedef struct gearman_server_slab_chunk_st gearman_server_slab_chunk_st;
+typedef struct gearman_server_slab_cache_st gearman_server_slab_cache_st;
+typedef struct gearman_server_stats_st gearman_server_stats_st;
+typedef struct gearman_server_stats_function_st
+               gearman_server_stats_function_st;
 typedef struct gearmand_st gearmand_st;
 typedef struct gearmand_port_st gearmand_port_st;
+typedef struct gearmand_listen_st gearmand_listen_st;
 typedef struct gearmand_con_st gearmand_con_st;
 typedef struct gearmand_thread_st gearmand_thread_st;
+typedef struct gearmand_log_entry_st gearmand_log_entry_st;
+typedef struct gearmand_log_ring_st gearmand_log_ring_st;
+typedef struct gearmand_uring_st gearmand_uring_st;
 typedef struct gearman_conf_st gearman_conf_st;
 typedef struct gearman_conf_option_st gearman_conf_option_st;
 typedef struct gearman_conf_module_st gearman_conf_module_st;
@@ -157,7 +203,8 @@ typedef enum
 {
   GEARMAN_ALLOCATED=          (1 << 0),
   GEARMAN_NON_BLOCKING=       (1 << 1),
-  GEARMAN_DONT_TRACK_PACKETS= (1 << 2)
+  GEARMAN_DONT_TRACK_PACKETS= (1 << 2),
+  GEARMAN_COMPRESS=           (1 << 3)
 } gearman_options_t;
 
 /**
@@ -171,7 +218,11 @@ typedef enum
   GEARMAN_CON_PACKET_IN_USE=          (1 << 2),
   GEARMAN_CON_EXTERNAL_FD=            (1 << 3),
   GEARMAN_CON_IGNORE_LOST_CONNECTION= (1 << 4),
-  GEARMAN_CON_CLOSE_AFTER_FLUSH=      (1 << 5)
+  GEARMAN_CON_CLOSE_AFTER_FLUSH=      (1 << 5),
+  GEARMAN_CON_PIN_ARGS=               (1 << 6),
+  GEARMAN_CON_RECV_PINNED=            (1 << 7),
+  GEARMAN_CON_COMPRESS=               (1 << 8),
+  GEARMAN_CON_RECV_INPUT=             (1 << 9)
 } gearman_con_options_t;
 
 /**
@@ -196,7 +247,9 @@ typedef enum
   GEARMAN_CON_SEND_STATE_PRE_FLUSH,
   GEARMAN_CON_SEND_STATE_FORCE_FLUSH,
   GEARMAN_CON_SEND_STATE_FLUSH,
-  GEARMAN_CON_SEND_STATE_FLUSH_DATA
+  GEARMAN_CON_SEND_STATE_FLUSH_DATA,
+  GEARMAN_CON_SEND_STATE_OPTION,
+  GEARMAN_CON_SEND_STATE_OPTION_RES
 } gearman_con_send_state_t;
 
 /**
@@ -216,11 +269,23 @@ typedef enum
  */
 typedef enum
 {
-  GEARMAN_PACKET_ALLOCATED= (1 << 0),
-  GEARMAN_PACKET_COMPLETE=  (1 << 1),
-  GEARMAN_PACKET_FREE_DATA= (1 << 2)
+  GEARMAN_PACKET_ALLOCATED=   (1 << 0),
+  GEARMAN_PACKET_COMPLETE=    (1 << 1),
+  GEARMAN_PACKET_FREE_DATA=   (1 << 2),
+  GEARMAN_PACKET_PINNED_ARGS= (1 << 3)
 } gearman_packet_options_t;
 
+/**
+ * @ingroup gearman_packet
+ * Encodings of the data in a packet, on connections that negotiated
+ * compression with the "compress" option.
+ */
+typedef enum
+{
+  GEARMAN_FRAME_RAW,
+  GEARMAN_FRAME_ZLIB
+} gearman_frame_t;
+
 /**
  * @ingroup gearman_packet
  * Magic types.
@@ -344,7 +409,8 @@ typedef enum
   GEARMAN_CLIENT_TASK_IN_USE=       (1 << 2),
   GEARMAN_CLIENT_UNBUFFERED_RESULT= (1 << 3),
   GEARMAN_CLIENT_NO_NEW=            (1 << 4),
-  GEARMAN_CLIENT_FREE_TASKS=        (1 << 5)
+  GEARMAN_CLIENT_FREE_TASKS=        (1 << 5),
+  GEARMAN_CLIENT_COMPRESS=          (1 << 6)
 } gearman_client_options_t;
 
 /**
@@ -372,7 +438,8 @@ typedef enum
   GEARMAN_WORKER_PRE_SLEEP_IN_USE= (1 << 4),
   GEARMAN_WORKER_WORK_JOB_IN_USE=  (1 << 5),
   GEARMAN_WORKER_CHANGE=           (1 << 6),
-  GEARMAN_WORKER_GRAB_UNIQ=        (1 << 7)
+  GEARMAN_WORKER_GRAB_UNIQ=        (1 << 7),
+  GEARMAN_WORKER_COMPRESS=         (1 << 8)
 } gearman_worker_options_t;
 
 /**
@@ -440,7 +507,8 @@ typedef enum
 {
   GEARMAN_SERVER_CON_SLEEPING=   (1 << 0),
   GEARMAN_SERVER_CON_EXCEPTIONS= (1 << 1),
-  GEARMAN_SERVER_CON_DEAD=       (1 << 2)
+  GEARMAN_SERVER_CON_DEAD=       (1 << 2),
+  GEARMAN_SERVER_CON_COMPRESS=   (1 << 3)
 } gearman_server_con_options_t;
 
 /**
@@ -467,7 +535,8 @@ typedef enum
  */
 typedef enum
 {
-  GEARMAN_SERVER_WORKER_ALLOCATED= (1 << 0)
+  GEARMAN_SERVER_WORKER_ALLOCATED= (1 << 0),
+  GEARMAN_SERVER_WORKER_SLEEPING=  (1 << 1)
 } gearman_server_worker_options_t;
 
 /**
@@ -478,9 +547,37 @@ typedef enum
 {
   GEARMAN_SERVER_JOB_ALLOCATED= (1 << 0),
   GEARMAN_SERVER_JOB_QUEUED=    (1 << 1),
-  GEARMAN_SERVER_JOB_IGNORE=    (1 << 2)
+  GEARMAN_SERVER_JOB_IGNORE=    (1 << 2),
+  GEARMAN_SERVER_JOB_FRAMED=    (1 << 3)
 } gearman_server_job_options_t;
 
+/**
+ * @ingroup gearman_server_hash
+ * Options for gearman_server_hash_st.
+ */
+typedef enum
+{
+  GEARMAN_SERVER_HASH_ALLOCATED= (1 << 0)
+} gearman_server_hash_options_t;
+
+/**
+ * @ingroup gearman_server_slab
+ * Options for gearman_server_slab_st.
+ */
+typedef enum
+{
+  GEARMAN_SERVER_SLAB_ALLOCATED= (1 << 0)
+} gearman_server_slab_options_t;
+
+/**
+ * @ingroup gearman_server_slab
+ * Options for gearman_server_slab_cache_st.
+ */
+typedef enum
+{
+  GEARMAN_SERVER_SLAB_CACHE_ALLOCATED= (1 << 0)
+} gearman_server_slab_cache_options_t;
+
 /**
  * @ingroup gearmand
  * Options for gearmand_st.
@@ -488,7 +585,14 @@ typedef enum
 typedef enum
 {
   GEARMAND_LISTEN_EVENT= (1 << 0),
-  GEARMAND_WAKEUP_EVENT= (1 << 1)
+  GEARMAND_WAKEUP_EVENT= (1 << 1),
+  GEARMAND_REUSEPORT=    (1 << 2),
+  GEARMAND_REBALANCE=    (1 << 3),
+  GEARMAND_LOAD_EVENT=   (1 << 4),
+  GEARMAND_LOG_RING=     (1 << 5),
+  GEARMAND_LOG_THREAD=   (1 << 6),
+  GEARMAND_IO_URING=     (1 << 7),
+  GEARMAND_EPOLL=        (1 << 8)
 } gearmand_options_t;
 
 /**
@@ -501,7 +605,8 @@ typedef enum
   GEARMAND_WAKEUP_SHUTDOWN=          (1 << 1),
   GEARMAND_WAKEUP_SHUTDOWN_GRACEFUL= (1 << 2),
   GEARMAND_WAKEUP_CON=               (1 << 3),
-  GEARMAND_WAKEUP_RUN=               (1 << 4)
+  GEARMAND_WAKEUP_RUN=               (1 << 4),
+  GEARMAND_WAKEUP_MOVE=              (1 << 5)
 } gearmand_wakeup_t;
 
 /**
@@ -511,9 +616,44 @@ typedef enum
 typedef enum
 {
   GEARMAND_THREAD_WAKEUP_EVENT= (1 << 0),
-  GEARMAND_THREAD_LOCK=         (1 << 1)
+  GEARMAND_THREAD_LOCK=         (1 << 1),
+  GEARMAND_THREAD_RUN_EVENT=    (1 << 2),
+  GEARMAND_THREAD_LISTEN_EVENT= (1 << 3),
+  GEARMAND_THREAD_URING=        (1 << 4),
+  GEARMAND_THREAD_EPOLL=        (1 << 5)
 } gearmand_thread_options_t;
 
+/**
+ * @ingroup gearmand_thread
+ * Kind of object named by the low bits of io_uring request data or epoll
+ * event data.
+ */
+typedef enum
+{
+  GEARMAND_DATA_WAKEUP= 1,
+  GEARMAND_DATA_RUN=    2,
+  GEARMAND_DATA_LISTEN= 3,
+  GEARMAND_DATA_CON=    4,
+  GEARMAND_DATA_RECV=   5,
+  GEARMAND_DATA_SEND=   6,
+  GEARMAND_DATA_MASK=   7
+} gearmand_data_t;
+
+/**
+ * @ingroup gearmand_con
+ * Options for gearmand_con_st.
+ */
+typedef enum
+{
+  GEARMAND_CON_URING_POLL= (1 << 0),
+  GEARMAND_CON_URING_BUSY= (1 << 1),
+  GEARMAND_CON_FREE=       (1 << 2),
+  GEARMAND_CON_MOVE=       (1 << 3),
+  GEARMAND_CON_EPOLL=      (1 << 4),
+  GEARMAND_CON_URING_RECV= (1 << 5),
+  GEARMAND_CON_URING_SEND= (1 << 6)
+} gearmand_con_options_t;
+
 /**
  * @ingroup gearman_conf
  * Options for gearman_conf_st.
@@ -576,6 +716,10 @@ typedef void (gearmand_log_fn)(gearmand_st *gearmand, gearman_verbose_t verbose,
 
 typedef void (gearman_server_thread_run_fn)(gearman_server_thread_st *thread,
                                             void *fn_arg);
+typedef gearman_return_t
+(gearman_server_thread_writev_fn)(gearman_server_con_st *con,
+                                  const struct iovec *iov, int iov_count,
+                                  void *fn_arg);
 
 typedef gearman_return_t (gearman_con_add_fn)(gearman_con_st *con);
 
@@ -79,11 +79,13 @@ gearman_st *gearman_create(gearman_st *gearman)
   gearman->packet_count= 0;
   gearman->pfds_size= 0;
   gearman->sending= 0;
+  gearman->con_buffer_count= 0;
   gearman->last_errno= 0;
   gearman->con_list= NULL;
   gearman->job_list= NULL;
   gearman->task_list= NULL;
   gearman->packet_list= NULL;
+  gearman->con_buffer_list= NULL;
   gearman->pfds= NULL;
   gearman->log_fn= NULL;
   gearman->log_fn_arg= NULL;
@@ -135,6 +137,7 @@ void gearman_free(gearman_st *gearman)
   gearman_job_st *job;
   gearman_task_st *task;
   gearman_packet_st *packet;
+  void *buffer;
 
   for (con= gearman->con_list; con != NULL; con= gearman->con_list)
     gearman_con_free(con);
@@ -151,6 +154,13 @@ void gearman_free(gearman_st *gearman)
     gearman_packet_free(packet);
   }
 
+  while (gearman->con_buffer_list != NULL)
+  {
+    buffer= gearman->con_buffer_list;
+    gearman->con_buffer_list= *((void **)buffer);
+    free(buffer);
+  }
+
   if (gearman->pfds != NULL)
     free(gearman->pfds);
 
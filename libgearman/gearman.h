@@ -40,6 +40,10 @@
 #include <libgearman/server_con.h>
 #include <libgearman/server_packet.h>
 #include <libgearman/server_function.h>
+#include <libgearman/server_hash.h>
+#include <libgearman/server_slab.h>
+#include <libgearman/server_stats.h>
+#include <libgearman/server_shard.h>
 #include <libgearman/server_client.h>
 #include <libgearman/server_worker.h>
 #include <libgearman/server_job.h>
@@ -48,6 +52,8 @@
 #include <libgearman/gearmand.h>
 #include <libgearman/gearmand_thread.h>
 #include <libgearman/gearmand_con.h>
+#include <libgearman/gearmand_log.h>
+#include <libgearman/gearmand_uring.h>
 #include <libgearman/conf.h>
 #include <libgearman/conf_module.h>
 
@@ -117,7 +123,11 @@ GEARMAN_API
 int gearman_errno(gearman_st *gearman);
 
 /**
- * Set options for a gearman structure.
+ * Set options for a gearman structure. With GEARMAN_COMPRESS, connections
+ * send the "compress" option before their first packet, and if the server
+ * takes it, frame all packet data as described for gearman_packet_framed().
+ * Data of GEARMAN_FRAME_ZLIB_MIN bytes or more is compressed with zlib when
+ * that makes it smaller.
  */
 GEARMAN_API
 void gearman_set_options(gearman_st *gearman, gearman_options_t options,
@@ -38,6 +38,12 @@ static gearman_return_t _wakeup_watch(gearmand_st *gearmand);
 static void _wakeup_clear(gearmand_st *gearmand);
 static void _wakeup_event(int fd, short events, void *arg);
 
+static gearman_return_t _load_watch(gearmand_st *gearmand);
+static void _load_clear(gearmand_st *gearmand);
+static void _load_event(int fd, short events, void *arg);
+
+static gearman_return_t _thread_create(gearmand_st *gearmand, uint32_t x);
+
 static gearman_return_t _watch_events(gearmand_st *gearmand);
 static void _clear_events(gearmand_st *gearmand);
 static void _close_events(gearmand_st *gearmand);
@@ -71,16 +77,22 @@ gearmand_st *gearmand_create(const char *host, in_port_t port)
   gearmand->thread_count= 0;
   gearmand->free_dcon_count= 0;
   gearmand->max_thread_free_dcon_count= 0;
+  gearmand->thread_cpu_count= 0;
   gearmand->wakeup_fd[0]= -1;
   gearmand->wakeup_fd[1]= -1;
   gearmand->host= host;
+  gearmand->log_shutdown= false;
+  gearmand->log_sleeping= false;
   gearmand->log_fn= NULL;
   gearmand->log_fn_arg= NULL;
+  gearmand->log_write_fn= NULL;
+  gearmand->log_ring_list= NULL;
   gearmand->base= NULL;
   gearmand->port_list= NULL;
   gearmand->thread_list= NULL;
   gearmand->thread_add_next= NULL;
   gearmand->free_dcon_list= NULL;
+  gearmand->thread_cpus= NULL;
 
   if (port == 0)
     port= GEARMAN_DEFAULT_TCP_PORT;
@@ -133,6 +145,8 @@ void gearmand_free(gearmand_st *gearmand)
 
   GEARMAN_INFO(gearmand, "Shutdown complete")
 
+  gearmand_log_stop(gearmand);
+
   free(gearmand);
 }
 
@@ -146,15 +160,97 @@ void gearmand_set_threads(gearmand_st *gearmand, uint32_t threads)
   gearmand->threads= threads;
 }
 
+void gearmand_set_reuseport(gearmand_st *gearmand, bool reuseport)
+{
+  if (reuseport)
+    gearmand->options|= GEARMAND_REUSEPORT;
+  else
+    gearmand->options&= (gearmand_options_t)~GEARMAND_REUSEPORT;
+}
+
+void gearmand_set_io_uring(gearmand_st *gearmand, bool io_uring)
+{
+  if (io_uring)
+    gearmand->options|= GEARMAND_IO_URING;
+  else
+    gearmand->options&= (gearmand_options_t)~GEARMAND_IO_URING;
+}
+
+void gearmand_set_epoll(gearmand_st *gearmand, bool epoll)
+{
+  if (epoll)
+    gearmand->options|= GEARMAND_EPOLL;
+  else
+    gearmand->options&= (gearmand_options_t)~GEARMAND_EPOLL;
+}
+
+void gearmand_set_rebalance(gearmand_st *gearmand, bool rebalance)
+{
+  if (rebalance)
+    gearmand->options|= GEARMAND_REBALANCE;
+  else
+    gearmand->options&= (gearmand_options_t)~GEARMAND_REBALANCE;
+}
+
+gearman_return_t gearmand_set_thread_cpus(gearmand_st *gearmand,
+                                          const uint32_t *cpus,
+                                          uint32_t cpu_count)
+{
+  uint32_t x;
+
+  for (x= 0; x < cpu_count; x++)
+  {
+    if (!gearman_server_thread_cpu_valid(cpus[x]))
+    {
+      GEARMAN_ERROR(gearmand, "Can not pin threads to CPU %u", cpus[x])
+      return GEARMAN_PTHREAD;
+    }
+  }
+
+  gearmand->thread_cpus= cpus;
+  gearmand->thread_cpu_count= cpu_count;
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t gearmand_set_proc_cpus(gearmand_st *gearmand,
+                                        const uint32_t *cpus,
+                                        uint32_t cpu_count)
+{
+  return gearman_server_set_proc_cpus(&(gearmand->server), cpus, cpu_count);
+}
+
+void gearmand_set_proc_budget(gearmand_st *gearmand, uint32_t packets,
+                              uint32_t bytes)
+{
+  gearman_server_set_proc_budget(&(gearmand->server), packets, bytes);
+}
+
+gearman_return_t gearmand_set_shards(gearmand_st *gearmand, uint32_t shards)
+{
+  return gearman_server_set_shards(&(gearmand->server), shards);
+}
+
 void gearmand_set_log(gearmand_st *gearmand, gearmand_log_fn log_fn,
                       void *log_fn_arg, gearman_verbose_t verbose)
 {
   gearman_server_set_log(&(gearmand->server), _log, gearmand, verbose);
-  gearmand->log_fn= log_fn;
+  if (gearmand->options & GEARMAND_LOG_THREAD)
+    gearmand->log_write_fn= log_fn;
+  else
+    gearmand->log_fn= log_fn;
   gearmand->log_fn_arg= log_fn_arg;
   gearmand->verbose= verbose;
 }
 
+void gearmand_set_log_ring(gearmand_st *gearmand, bool log_ring)
+{
+  if (log_ring)
+    gearmand->options|= GEARMAND_LOG_RING;
+  else
+    gearmand->options&= (gearmand_options_t)~GEARMAND_LOG_RING;
+}
+
 gearman_return_t gearmand_port_add(gearmand_st *gearmand, in_port_t port,
                                    gearman_con_add_fn *add_fn)
 {
@@ -188,6 +284,13 @@ gearman_return_t gearmand_run(gearmand_st *gearmand)
   /* Initialize server components. */
   if (gearmand->base == NULL)
   {
+    if (gearmand->options & GEARMAND_LOG_RING)
+    {
+      gearmand->ret= gearmand_log_start(gearmand);
+      if (gearmand->ret != GEARMAN_SUCCESS)
+        return gearmand->ret;
+    }
+
     GEARMAN_INFO(gearmand, "Starting up")
 
     if (gearmand->threads > 0)
@@ -205,6 +308,28 @@ gearman_return_t gearmand_run(gearmand_st *gearmand)
 #endif
     }
 
+    if (gearmand->options & GEARMAND_REUSEPORT)
+    {
+#ifdef SO_REUSEPORT
+      if (gearmand->threads == 0)
+#endif
+      {
+        GEARMAN_ERROR(gearmand, "Per-thread listening sockets need "
+                                "SO_REUSEPORT and at least one I/O thread, "
+                                "accepting on the main thread instead")
+        gearmand->options&= (gearmand_options_t)~GEARMAND_REUSEPORT;
+      }
+    }
+
+    if (gearmand->options & (GEARMAND_IO_URING | GEARMAND_EPOLL) &&
+        gearmand->threads == 0)
+    {
+      GEARMAN_ERROR(gearmand, "io_uring and epoll are only used for I/O "
+                              "threads, using libevent instead")
+      gearmand->options&= (gearmand_options_t)~(GEARMAND_IO_URING |
+                                                GEARMAND_EPOLL);
+    }
+
     GEARMAN_DEBUG(gearmand, "Initializing libevent for main thread")
 
     gearmand->base= event_base_new();
@@ -231,7 +356,7 @@ gearman_return_t gearmand_run(gearmand_st *gearmand)
     x= 0;
     do
     {
-      gearmand->ret= gearmand_thread_create(gearmand);
+      gearmand->ret= _thread_create(gearmand, x);
       if (gearmand->ret != GEARMAN_SUCCESS)
         return gearmand->ret;
       x++;
@@ -293,9 +418,15 @@ static gearman_return_t _listen_init(gearmand_st *gearmand)
   char port_str[NI_MAXSERV];
   int fd;
   int *fd_list;
+  uint32_t copies= 1;
   uint32_t x;
   uint32_t y;
 
+  /* With per-thread listeners, every thread gets its own socket for each
+     address, and takes them over in gearmand_thread_create(). */
+  if (gearmand->options & GEARMAND_REUSEPORT)
+    copies= gearmand->threads;
+
   for (x= 0; x < gearmand->port_count; x++)
   {
     port= &gearmand->port_list[x];
@@ -331,63 +462,83 @@ static gearman_return_t _listen_init(gearmand_st *gearmand)
 
       GEARMAN_DEBUG(gearmand, "Trying to listen on %s:%s", host, port_str)
 
-      /* Call to socket() can fail for some getaddrinfo results, try another. */
-      fd= socket(addrinfo_next->ai_family, addrinfo_next->ai_socktype,
-                 addrinfo_next->ai_protocol);
-      if (fd == -1)
+      for (y= 0; y < copies; y++)
       {
-        GEARMAN_ERROR(gearmand, "Failed to listen on %s:%s", host, port_str)
-        continue;
-      }
+        /* Call to socket() can fail for some getaddrinfo results, try
+           another. */
+        fd= socket(addrinfo_next->ai_family, addrinfo_next->ai_socktype,
+                   addrinfo_next->ai_protocol);
+        if (fd == -1)
+        {
+          GEARMAN_ERROR(gearmand, "Failed to listen on %s:%s", host, port_str)
+          break;
+        }
 
-      opt= 1;
-      ret= setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-      if (ret == -1)
-      {
-        close(fd);
-        GEARMAN_FATAL(gearmand, "_listen_init:setsockopt:%d", errno)
-        return GEARMAN_ERRNO;
-      }
+        opt= 1;
+        ret= setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (ret == -1)
+        {
+          close(fd);
+          GEARMAN_FATAL(gearmand, "_listen_init:setsockopt:%d", errno)
+          return GEARMAN_ERRNO;
+        }
 
-      ret= bind(fd, addrinfo_next->ai_addr, addrinfo_next->ai_addrlen);
-      if (ret == -1)
-      {
-        close(fd);
-        if (errno == EADDRINUSE)
+#ifdef SO_REUSEPORT
+        if (gearmand->options & GEARMAND_REUSEPORT)
         {
-          if (port->listen_fd == NULL)
+          /* Threads accept until there is nothing left, so don't block. */
+          ret= setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+          if (ret == -1 ||
+              fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == -1)
           {
-            GEARMAN_ERROR(gearmand, "Address already in use %s:%s", host,
-                          port_str)
+            close(fd);
+            GEARMAN_FATAL(gearmand, "_listen_init:SO_REUSEPORT:%d", errno)
+            return GEARMAN_ERRNO;
           }
-
-          continue;
         }
+#endif
 
-        GEARMAN_FATAL(gearmand, "_listen_init:bind:%d", errno)
-        return GEARMAN_ERRNO;
-      }
+        ret= bind(fd, addrinfo_next->ai_addr, addrinfo_next->ai_addrlen);
+        if (ret == -1)
+        {
+          close(fd);
+          if (errno == EADDRINUSE)
+          {
+            if (port->listen_fd == NULL)
+            {
+              GEARMAN_ERROR(gearmand, "Address already in use %s:%s", host,
+                            port_str)
+            }
 
-      if (listen(fd, gearmand->backlog) == -1)
-      {
-        close(fd);
-        GEARMAN_FATAL(gearmand, "_listen_init:listen:%d", errno)
-        return GEARMAN_ERRNO;
-      }
+            break;
+          }
 
-      fd_list= realloc(port->listen_fd, sizeof(int) * (port->listen_count + 1));
-      if (fd_list == NULL)
-      {
-        close(fd);
-        GEARMAN_FATAL(gearmand, "_listen_init:realloc:%d", errno)
-        return GEARMAN_ERRNO;
-      }
+          GEARMAN_FATAL(gearmand, "_listen_init:bind:%d", errno)
+          return GEARMAN_ERRNO;
+        }
 
-      port->listen_fd= fd_list;
-      port->listen_fd[port->listen_count]= fd;
-      port->listen_count++;
+        if (listen(fd, gearmand->backlog) == -1)
+        {
+          close(fd);
+          GEARMAN_FATAL(gearmand, "_listen_init:listen:%d", errno)
+          return GEARMAN_ERRNO;
+        }
+
+        fd_list= realloc(port->listen_fd,
+                         sizeof(int) * (port->listen_count + 1));
+        if (fd_list == NULL)
+        {
+          close(fd);
+          GEARMAN_FATAL(gearmand, "_listen_init:realloc:%d", errno)
+          return GEARMAN_ERRNO;
+        }
 
-      GEARMAN_INFO(gearmand, "Listening on %s:%s (%d)", host, port_str, fd)
+        port->listen_fd= fd_list;
+        port->listen_fd[port->listen_count]= fd;
+        port->listen_count++;
+
+        GEARMAN_INFO(gearmand, "Listening on %s:%s (%d)", host, port_str, fd)
+      }
     }
 
     freeaddrinfo(addrinfo);
@@ -400,6 +551,9 @@ static gearman_return_t _listen_init(gearmand_st *gearmand)
       return GEARMAN_ERRNO;
     }
 
+    if (gearmand->options & GEARMAND_REUSEPORT)
+      continue;
+
     port->listen_event= malloc(sizeof(struct event) * port->listen_count);
     if (port->listen_event == NULL)
     {
@@ -445,7 +599,8 @@ static gearman_return_t _listen_watch(gearmand_st *gearmand)
   uint32_t x;
   uint32_t y;
 
-  if (gearmand->options & GEARMAND_LISTEN_EVENT)
+  /* Per-thread listeners are watched by their own threads. */
+  if (gearmand->options & (GEARMAND_LISTEN_EVENT | GEARMAND_REUSEPORT))
     return GEARMAN_SUCCESS;
 
   for (x= 0; x < gearmand->port_count; x++)
@@ -492,14 +647,14 @@ static void _listen_event(int fd, short events __attribute__ ((unused)),
                           void *arg)
 {
   gearmand_port_st *port= (gearmand_port_st *)arg;
-  struct sockaddr sa;
+  struct sockaddr_storage sa;
   socklen_t sa_len;
-  char host[NI_MAXHOST];
-  char port_str[NI_MAXSERV];
-  int ret;
+  gearman_server_con_addr_st addr;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port_str[GEARMAN_SERVER_CON_PORT_SIZE];
 
   sa_len= sizeof(sa);
-  fd= accept(fd, &sa, &sa_len);
+  fd= accept(fd, (struct sockaddr *)&sa, &sa_len);
   if (fd == -1)
   {
     if (errno == EINTR)
@@ -516,21 +671,13 @@ static void _listen_event(int fd, short events __attribute__ ((unused)),
     return;
   }
 
-  /* Since this is numeric, it should never fail. Even if it did we don't want
-     to really error from it. */
-  ret= getnameinfo(&sa, sa_len, host, NI_MAXHOST, port_str, NI_MAXSERV,
-                   NI_NUMERICHOST | NI_NUMERICSERV);
-  if (ret != 0)
-  {
-    GEARMAN_ERROR(port->gearmand, "_listen_event:getnameinfo:%s",
-                  gai_strerror(ret))
-    strcpy(host, "-");
-    strcpy(port_str, "-");
-  }
-
-  GEARMAN_INFO(port->gearmand, "Accepted connection from %s:%s", host, port_str)
+  gearman_server_con_addr_set(&addr, (struct sockaddr *)&sa);
+  GEARMAN_INFO(port->gearmand, "Accepted connection from %s:%s",
+               gearman_server_con_addr_host(&addr, host),
+               gearman_server_con_addr_port(&addr, port_str))
 
-  port->gearmand->ret= gearmand_con_create(port->gearmand, fd, host, port_str,
+  port->gearmand->ret= gearmand_con_create(port->gearmand, fd,
+                                           (struct sockaddr *)&sa,
                                            port->add_fn);
   if (port->gearmand->ret != GEARMAN_SUCCESS)
     _clear_events(port->gearmand);
@@ -675,6 +822,7 @@ static void _wakeup_event(int fd, short events __attribute__ ((unused)),
 
       case GEARMAND_WAKEUP_CON:
       case GEARMAND_WAKEUP_RUN:
+      case GEARMAND_WAKEUP_MOVE:
       default:
         GEARMAN_FATAL(gearmand, "Received unknown wakeup event (%u)",
                       buffer[x])
@@ -686,6 +834,91 @@ static void _wakeup_event(int fd, short events __attribute__ ((unused)),
   }
 }
 
+static gearman_return_t _thread_create(gearmand_st *gearmand, uint32_t x)
+{
+#ifdef CPU_SETSIZE
+  cpu_set_t main_cpus;
+  cpu_set_t cpus;
+  gearman_return_t ret;
+
+  if (gearmand->threads == 0 || gearmand->thread_cpu_count == 0 ||
+      pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                             &main_cpus) != 0)
+  {
+    return gearmand_thread_create(gearmand);
+  }
+
+  /* Memory is placed on the NUMA node of the CPU that first touches it, so
+     build the thread's event base, buffers and free lists from its CPU. */
+  CPU_ZERO(&cpus);
+  CPU_SET(gearmand->thread_cpus[x % gearmand->thread_cpu_count], &cpus);
+  (void)pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+
+  ret= gearmand_thread_create(gearmand);
+
+  (void)pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                               &main_cpus);
+
+  return ret;
+#else
+  (void)x;
+  return gearmand_thread_create(gearmand);
+#endif
+}
+
+static gearman_return_t _load_watch(gearmand_st *gearmand)
+{
+  struct timeval tv;
+
+  if (gearmand->options & GEARMAND_LOAD_EVENT)
+    return GEARMAN_SUCCESS;
+
+  tv.tv_sec= GEARMAND_LOAD_INTERVAL / 1000;
+  tv.tv_usec= (GEARMAND_LOAD_INTERVAL % 1000) * 1000;
+
+  evtimer_set(&(gearmand->load_event), _load_event, gearmand);
+  event_base_set(gearmand->base, &(gearmand->load_event));
+
+  if (evtimer_add(&(gearmand->load_event), &tv) == -1)
+  {
+    GEARMAN_FATAL(gearmand, "_load_watch:evtimer_add:-1")
+    return GEARMAN_EVENT;
+  }
+
+  gearmand->options|= GEARMAND_LOAD_EVENT;
+  return GEARMAN_SUCCESS;
+}
+
+static void _load_clear(gearmand_st *gearmand)
+{
+  if (gearmand->options & GEARMAND_LOAD_EVENT)
+  {
+    assert(evtimer_del(&(gearmand->load_event)) == 0);
+    gearmand->options&= (gearmand_options_t)~GEARMAND_LOAD_EVENT;
+  }
+}
+
+static void _load_event(int fd __attribute__ ((unused)),
+                        short events __attribute__ ((unused)), void *arg)
+{
+  gearmand_st *gearmand= (gearmand_st *)arg;
+  gearmand_thread_st *thread;
+
+  for (thread= gearmand->thread_list; thread != NULL; thread= thread->next)
+    gearman_server_thread_sample(&(thread->server_thread));
+
+  if (gearmand->options & GEARMAND_REBALANCE && gearmand->threads > 1)
+    gearmand_con_rebalance(gearmand);
+
+  /* Timers are one-shot, so add it again for the next interval. */
+  gearmand->options&= (gearmand_options_t)~GEARMAND_LOAD_EVENT;
+  if (_load_watch(gearmand) != GEARMAN_SUCCESS)
+  {
+    _clear_events(gearmand);
+    gearmand->ret= GEARMAN_EVENT;
+  }
+}
+
 static gearman_return_t _watch_events(gearmand_st *gearmand)
 {
   gearman_return_t ret;
@@ -698,6 +931,10 @@ static gearman_return_t _watch_events(gearmand_st *gearmand)
   if (ret != GEARMAN_SUCCESS)
     return ret;
 
+  ret= _load_watch(gearmand);
+  if (ret != GEARMAN_SUCCESS)
+    return ret;
+
   return GEARMAN_SUCCESS;
 }
 
@@ -705,6 +942,7 @@ static void _clear_events(gearmand_st *gearmand)
 {
   _listen_clear(gearmand);
   _wakeup_clear(gearmand);
+  _load_clear(gearmand);
 
   /* If we are not threaded, tell the fake thread to shutdown now to clear
      connections. Otherwise we will never exit the libevent loop. */
@@ -716,4 +954,5 @@ static void _close_events(gearmand_st *gearmand)
 {
   _listen_close(gearmand);
   _wakeup_close(gearmand);
+  _load_clear(gearmand);
 }
@@ -59,6 +59,107 @@ void gearmand_set_backlog(gearmand_st *gearmand, int backlog);
 GEARMAN_API
 void gearmand_set_threads(gearmand_st *gearmand, uint32_t threads);
 
+/**
+ * Give each I/O thread its own listening sockets bound with SO_REUSEPORT, so
+ * threads accept their own connections instead of having the main thread
+ * accept them and hand them off. Only used with at least one I/O thread.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param reuseport Whether to use per-thread listening sockets.
+ */
+GEARMAN_API
+void gearmand_set_reuseport(gearmand_st *gearmand, bool reuseport);
+
+/**
+ * Run the I/O thread event loops on io_uring instead of libevent, with one
+ * system call per loop to submit all new accept, receive and write requests
+ * and wait for completions. Data is received into a ring of buffers shared
+ * with the kernel. Threads fall back to libevent when the kernel does not
+ * support it. Only used with at least one I/O thread.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param io_uring Whether to use io_uring for I/O threads.
+ */
+GEARMAN_API
+void gearmand_set_io_uring(gearmand_st *gearmand, bool io_uring);
+
+/**
+ * Run the I/O thread event loops directly on epoll instead of libevent.
+ * Connections are registered once, edge triggered for reading and writing,
+ * so changes between waiting to read and waiting to write need no system
+ * calls. Used when io_uring is not, and only with at least one I/O thread.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param epoll Whether to use epoll for I/O threads.
+ */
+GEARMAN_API
+void gearmand_set_epoll(gearmand_st *gearmand, bool epoll);
+
+/**
+ * Periodically move idle connections off the most loaded I/O thread onto
+ * the least loaded one. New connections are always placed by load, this
+ * also evens out connections that were placed before load shifted.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param rebalance Whether to move idle connections between threads.
+ */
+GEARMAN_API
+void gearmand_set_rebalance(gearmand_st *gearmand, bool rebalance);
+
+/**
+ * Pin I/O threads to CPUs. Threads take CPUs from the list in order,
+ * starting over if there are more threads than CPUs. Each thread's
+ * structures are also created while running on its CPU, so their memory
+ * comes from that CPU's NUMA node. The list is not copied and must stay
+ * valid until gearmand_run is called.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param cpus List of CPU numbers.
+ * @param cpu_count Number of CPUs in the list, 0 to not pin the threads.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_set_thread_cpus(gearmand_st *gearmand,
+                                          const uint32_t *cpus,
+                                          uint32_t cpu_count);
+
+/**
+ * Pin the processing thread of each shard to CPUs, see
+ * gearman_server_set_proc_cpus.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param cpus List of CPU numbers.
+ * @param cpu_count Number of CPUs in the list, 0 to not pin the threads.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_set_proc_cpus(gearmand_st *gearmand,
+                                        const uint32_t *cpus,
+                                        uint32_t cpu_count);
+
+/**
+ * Set the per-turn budget of each connection in the processing threads, see
+ * gearman_server_set_proc_budget.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param packets Packets to run per turn, 0 for the default.
+ * @param bytes Bytes of packet arguments and data to run per turn, 0 for the
+ *        default.
+ */
+GEARMAN_API
+void gearmand_set_proc_budget(gearmand_st *gearmand, uint32_t packets,
+                              uint32_t bytes);
+
+/**
+ * Set number of shards for server to partition functions and jobs across.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param shards Number of shards.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_set_shards(gearmand_st *gearmand, uint32_t shards);
+
 /**
  * Set logging callback for server instance.
  * @param gearmand Server instance structure previously initialized with
@@ -71,6 +172,18 @@ GEARMAN_API
 void gearmand_set_log(gearmand_st *gearmand, gearmand_log_fn log_fn,
                       void *log_fn_arg, gearman_verbose_t verbose);
 
+/**
+ * Queue log lines on per-thread rings and call the logging callback from a
+ * separate writer thread, so slow log writes do not hold up the I/O and
+ * processing threads. Lines are dropped and counted if a ring fills up. See
+ * gearmand_log_start.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @param log_ring Whether to log through the rings once gearmand_run starts.
+ */
+GEARMAN_API
+void gearmand_set_log_ring(gearmand_st *gearmand, bool log_ring);
+
 /**
  * Add a port to listen on when starting server with optional callback.
  * @param gearmand Server instance structure previously initialized with
@@ -25,9 +25,83 @@
 
 static void _con_ready(int fd, short events, void *arg);
 
+static void _con_init(gearmand_con_st *dcon, int fd,
+                      const struct sockaddr *sa, gearman_con_add_fn *add_fn);
+
 static gearman_return_t _con_add(gearmand_thread_st *thread,
                                  gearmand_con_st *con);
 
+/**
+ * Get the number of connections a thread has or is about to add.
+ */
+static uint32_t _con_count(gearmand_thread_st *thread);
+
+/**
+ * Update the load of each I/O thread and return the least loaded one. Load
+ * is the thread's share of all connections plus its share of the packets
+ * and bytes seen during the last sample interval, so neither needs tuning
+ * against the other. Ties go round-robin from thread_add_next.
+ */
+static gearmand_thread_st *_con_load(gearmand_st *gearmand);
+
+/**
+ * Put a freed connection structure on a free list, or release it.
+ */
+static void _con_recycle(gearmand_con_st *dcon);
+
+/**
+ * Hand a detached connection to another thread.
+ */
+static void _con_move_add(gearmand_con_st *dcon,
+                          gearmand_thread_st *move_thread);
+
+/**
+ * Queue the io_uring requests the connection is missing for its last
+ * events, a receive while it reads and a poll while it waits to write.
+ */
+static gearman_return_t _con_uring_watch(gearmand_con_st *dcon);
+
+/**
+ * Queue requests again after a completion, dropping the connection if that
+ * fails.
+ */
+static void _con_uring_again(gearmand_con_st *dcon);
+
+/**
+ * Cancel the io_uring requests still active for the connection.
+ */
+static void _con_uring_cancel(gearmand_con_st *dcon);
+
+/**
+ * Pass data received for the connection on to it, read as if it came from
+ * the socket.
+ */
+static void _con_input(gearmand_con_st *dcon, const void *data,
+                       size_t data_size);
+
+/**
+ * Keep data received while the connection moves, for the new thread to pass
+ * on.
+ */
+static bool _con_stash(gearmand_con_st *dcon, const void *data,
+                       size_t data_size);
+
+/**
+ * Free the server connection and close the socket.
+ */
+static void _con_close(gearmand_con_st *dcon);
+
+/**
+ * Finish a free or move that waited until no io_uring request or epoll event
+ * could still name the connection.
+ */
+static void _con_done(gearmand_con_st *dcon);
+
+/**
+ * Add the connection to the thread's epoll instance.
+ */
+static gearman_return_t _con_epoll_add(gearmand_con_st *dcon);
+
 /** @} */
 
 /*
@@ -35,7 +109,7 @@ static gearman_return_t _con_add(gearmand_thread_st *thread,
  */
 
 gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
-                                     const char *host, const char *port,
+                                     const struct sockaddr *sa,
                                      gearman_con_add_fn *add_fn)
 {
   gearmand_con_st *dcon;
@@ -58,16 +132,7 @@ gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
     }
   }
 
-  dcon->last_events= 0;
-  dcon->fd= fd;
-  dcon->next= NULL;
-  dcon->prev= NULL;
-  dcon->server_con= NULL;
-  dcon->con= NULL;
-  dcon->add_fn= NULL;
-  strncpy(dcon->host, host, NI_MAXHOST - 1);
-  strncpy(dcon->port, port, NI_MAXSERV - 1);
-  dcon->add_fn= add_fn;
+  _con_init(dcon, fd, sa, add_fn);
 
   /* If we are not threaded, just add the connection now. */
   if (gearmand->threads == 0)
@@ -76,15 +141,15 @@ gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
     return _con_add(gearmand->thread_list, dcon);
   }
 
-  /* We do a simple round-robin connection queue algorithm here. */
-  if (gearmand->thread_add_next == NULL)
-    gearmand->thread_add_next= gearmand->thread_list;
-
-  dcon->thread= gearmand->thread_add_next;
+  /* Place the connection on the least loaded thread. */
+  dcon->thread= _con_load(gearmand);
+  gearmand->thread_add_next= dcon->thread->next;
 
-  /* We don't need to lock if the list is empty. */
+  /* We don't need to lock if the list is empty, unless other threads may be
+     moving connections onto it. */
   if (dcon->thread->dcon_add_count == 0 &&
-      dcon->thread->free_dcon_count < gearmand->max_thread_free_dcon_count)
+      dcon->thread->free_dcon_count < gearmand->max_thread_free_dcon_count &&
+      !(gearmand->options & GEARMAND_REBALANCE))
   {
     GEARMAN_LIST_ADD(dcon->thread->dcon_add, dcon,)
     gearmand_thread_wakeup(dcon->thread, GEARMAND_WAKEUP_CON);
@@ -118,40 +183,374 @@ gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
     }
   }
 
-  gearmand->thread_add_next= gearmand->thread_add_next->next;
-
   return GEARMAN_SUCCESS;
 }
 
+gearman_return_t gearmand_con_accept(gearmand_thread_st *thread, int fd,
+                                     const struct sockaddr *sa,
+                                     gearman_con_add_fn *add_fn)
+{
+  gearmand_con_st *dcon;
+
+  /* Nobody else takes from the free list when threads accept on their own,
+     but connections freed by this thread are put there under the lock. */
+  (void ) pthread_mutex_lock(&(thread->lock));
+  dcon= thread->free_dcon_list;
+  if (dcon != NULL)
+    GEARMAN_LIST_DEL(thread->free_dcon, dcon,)
+  (void ) pthread_mutex_unlock(&(thread->lock));
+
+  if (dcon == NULL)
+  {
+    dcon= malloc(sizeof(gearmand_con_st));
+    if (dcon == NULL)
+    {
+      close(fd);
+      GEARMAN_FATAL(thread->gearmand, "gearmand_con_accept:malloc")
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+    }
+  }
+
+  _con_init(dcon, fd, sa, add_fn);
+  dcon->thread= thread;
+
+  return _con_add(thread, dcon);
+}
+
 void gearmand_con_free(gearmand_con_st *dcon)
 {
-  assert(event_del(&(dcon->event)) == 0);
+  /* Already freed, and waiting for its io_uring requests to complete. */
+  if (dcon->options & GEARMAND_CON_FREE)
+    return;
+
+  /* With epoll, closing the descriptor below is all that is needed. */
+  if (dcon->thread->options & GEARMAND_THREAD_URING)
+    _con_uring_cancel(dcon);
+  else if (!(dcon->thread->options & GEARMAND_THREAD_EPOLL))
+  {
+    assert(event_del(&(dcon->event)) == 0);
 
-  /* This gets around a libevent bug when both POLLIN and POLLOUT are set. */
-  event_set(&(dcon->event), dcon->fd, EV_READ, _con_ready, dcon);
-  event_base_set(dcon->thread->base, &(dcon->event));
-  event_add(&(dcon->event), NULL);
-  assert(event_del(&(dcon->event)) == 0);
+    /* This gets around a libevent bug when both POLLIN and POLLOUT are
+       set. */
+    event_set(&(dcon->event), dcon->fd, EV_READ, _con_ready, dcon);
+    event_base_set(dcon->thread->base, &(dcon->event));
+    event_add(&(dcon->event), NULL);
+    assert(event_del(&(dcon->event)) == 0);
+  }
 
-  gearman_server_con_free(dcon->server_con);
   GEARMAN_LIST_DEL(dcon->thread->dcon, dcon,)
+  dcon->options|= GEARMAND_CON_FREE;
 
-  close(dcon->fd);
+  /* The kernel may still be reading the packets of a write in the ring, so
+     they stay until it completes. */
+  if (!(dcon->options & GEARMAND_CON_URING_SEND))
+    _con_close(dcon);
 
-  if (dcon->thread->gearmand->free_dcon_count < GEARMAN_MAX_FREE_SERVER_CON)
+  /* The structure is named by requests still in the ring, keep it until
+     they complete. */
+  if (dcon->options & (GEARMAND_CON_URING_POLL | GEARMAND_CON_URING_RECV |
+                       GEARMAND_CON_URING_SEND | GEARMAND_CON_URING_BUSY))
   {
-    if (dcon->thread->gearmand->threads == 0)
-      GEARMAN_LIST_ADD(dcon->thread->gearmand->free_dcon, dcon,)
-    else
+    return;
+  }
+
+  /* Or by events later in the current epoll batch. */
+  if (dcon->thread->options & GEARMAND_THREAD_EPOLL)
+  {
+    dcon->next= dcon->thread->dcon_release_list;
+    dcon->thread->dcon_release_list= dcon;
+    return;
+  }
+
+  _con_recycle(dcon);
+}
+
+void gearmand_con_release(gearmand_thread_st *thread)
+{
+  gearmand_con_st *dcon;
+
+  while (thread->dcon_release_list != NULL)
+  {
+    dcon= thread->dcon_release_list;
+    thread->dcon_release_list= dcon->next;
+    _con_done(dcon);
+  }
+}
+
+void gearmand_con_epoll_ready(gearmand_con_st *dcon, uint32_t events)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  short ready= 0;
+
+  if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+    return;
+
+  /* The server reads until EAGAIN each time, so every read edge is passed
+     on. Write edges also come with any other wakeup of the socket, only pass
+     them on while the connection is waiting to write. */
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+    ready|= EV_READ;
+  if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP) &&
+      dcon->last_events & EV_WRITE)
+  {
+    ready|= EV_WRITE;
+  }
+
+  if (ready != 0)
+    _con_ready(dcon->fd, ready, dcon);
+#else
+  (void)dcon;
+  (void)events;
+#endif
+}
+
+void gearmand_con_uring_ready(gearmand_con_st *dcon, int32_t res)
+{
+  dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_POLL;
+
+  if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+  {
+    _con_done(dcon);
+    return;
+  }
+
+  /* Errors and hangups are found by the write, like with libevent. A failed
+     poll lets the connection find out for itself what it can do. */
+  if (dcon->last_events & EV_WRITE &&
+      (res >= 0 ? (res & (POLLOUT | POLLERR | POLLHUP)) != 0 :
+                  res != -ECANCELED))
+  {
+    dcon->options|= GEARMAND_CON_URING_BUSY;
+    _con_ready(dcon->fd, EV_WRITE, dcon);
+    dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_BUSY;
+
+    if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
     {
-      /* Lock here because the main thread may be emptying this. */
-      (void ) pthread_mutex_lock(&(dcon->thread->lock));
-      GEARMAN_LIST_ADD(dcon->thread->free_dcon, dcon,)
-      (void ) pthread_mutex_unlock(&(dcon->thread->lock));
+      _con_done(dcon);
+      return;
+    }
+  }
+
+  /* Polls are single shot so a connection that still can't write is seen
+     again, the same way level triggered libevent reports it. */
+  _con_uring_again(dcon);
+}
+
+void gearmand_con_uring_recv(gearmand_con_st *dcon, int32_t res,
+                             const void *buffer, bool more)
+{
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+
+  if (!more)
+    dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_RECV;
+
+  /* Without the data the connection can't go on, so make sure the new
+     thread only finds the end of it. */
+  if (dcon->options & GEARMAND_CON_MOVE && res > 0 &&
+      !_con_stash(dcon, buffer, (size_t)res))
+  {
+    GEARMAN_ERROR(dcon->thread->gearmand, "gearmand_con_uring_recv:realloc")
+    (void) shutdown(dcon->fd, SHUT_RDWR);
+  }
+
+  if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+  {
+    _con_done(dcon);
+    return;
+  }
+
+  if (res > 0)
+  {
+    _con_input(dcon, buffer, (size_t)res);
+
+    if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+    {
+      _con_done(dcon);
+      return;
     }
   }
+  else if (res == -EINVAL && gearmand_uring_recv_once(&(dcon->thread->uring)))
+  {
+    GEARMAN_ERROR(dcon->thread->gearmand,
+                  "[%4u] Multishot receive not supported, receiving once per "
+                  "request", dcon->thread->count)
+  }
+  else if (res != -ENOBUFS && res != -ECANCELED)
+  {
+    /* The end of the stream, or an error a read would also have found. */
+    GEARMAN_INFO(dcon->thread->gearmand, "[%4u] %15s:%5s Disconnected",
+                 dcon->thread->count,
+                 gearman_server_con_addr_host(&(dcon->addr), host),
+                 gearman_server_con_addr_port(&(dcon->addr), port))
+    gearmand_con_free(dcon);
+    return;
+  }
+
+  /* Buffers taken off the ring are handed back after each completion, so a
+     receive that ran out of them can go again right away. */
+  _con_uring_again(dcon);
+}
+
+gearman_return_t gearmand_con_uring_writev(gearman_server_con_st *con,
+                                           const struct iovec *iov,
+                                           int iov_count,
+                                           void *arg __attribute__ ((unused)))
+{
+  gearmand_con_st *dcon;
+  gearman_return_t ret;
+
+  dcon= (gearmand_con_st *)gearman_server_con_data(con);
+
+  ret= gearmand_uring_writev(&(dcon->thread->uring), dcon->fd, iov, iov_count,
+                             (uintptr_t)dcon | GEARMAND_DATA_SEND);
+  if (ret == GEARMAN_SUCCESS)
+    dcon->options|= GEARMAND_CON_URING_SEND;
+
+  return ret;
+}
+
+void gearmand_con_uring_sent(gearmand_con_st *dcon, int32_t res)
+{
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+
+  dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_SEND;
+
+  if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+  {
+    _con_done(dcon);
+    return;
+  }
+
+  if (res <= 0)
+  {
+    GEARMAN_INFO(dcon->thread->gearmand, "[%4u] %15s:%5s Disconnected",
+                 dcon->thread->count,
+                 gearman_server_con_addr_host(&(dcon->addr), host),
+                 gearman_server_con_addr_port(&(dcon->addr), port))
+    gearmand_con_free(dcon);
+    return;
+  }
+
+  dcon->options|= GEARMAND_CON_URING_BUSY;
+  gearman_server_thread_writev_done(dcon->server_con, (size_t)res);
+  gearmand_thread_run(dcon->thread);
+  dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_BUSY;
+
+  if (dcon->options & (GEARMAND_CON_FREE | GEARMAND_CON_MOVE))
+    _con_done(dcon);
+}
+
+void gearmand_con_rebalance(gearmand_st *gearmand)
+{
+  gearmand_thread_st *least;
+  gearmand_thread_st *most;
+  gearmand_thread_st *thread;
+  uint32_t least_count;
+  uint32_t most_count;
+  uint32_t move_count;
+
+  least= _con_load(gearmand);
+  most= least;
+
+  for (thread= gearmand->thread_list; thread != NULL; thread= thread->next)
+  {
+    if (thread->load > most->load)
+      most= thread;
+  }
+
+  /* Only act on a clear imbalance, moving connections is not free. */
+  most_count= _con_count(most);
+  if (most == least || most->load <= least->load * 2 || most_count < 2)
+    return;
+
+  least_count= _con_count(least);
+  if (most_count > least_count + 2)
+    move_count= (most_count - least_count) / 2;
   else
-    free(dcon);
+    move_count= 1;
+
+  if (move_count > GEARMAND_MOVE_MAX)
+    move_count= GEARMAND_MOVE_MAX;
+
+  GEARMAN_DEBUG(gearmand, "Moving up to %u connections from thread %u to %u",
+                move_count, most->count, least->count)
+
+  /* The thread reads these after the wakeup, which orders the writes. */
+  most->move_thread= least;
+  most->move_count= move_count;
+  gearmand_thread_wakeup(most, GEARMAND_WAKEUP_MOVE);
+}
+
+void gearmand_con_move(gearmand_thread_st *thread)
+{
+  gearmand_thread_st *move_thread= thread->move_thread;
+  uint32_t move_count= thread->move_count;
+  gearmand_con_st *dcon;
+  gearmand_con_st *next;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+  bool moved= false;
+
+  if (move_thread == NULL || move_thread == thread)
+    return;
+
+  for (dcon= thread->dcon_list; dcon != NULL && move_count > 0; dcon= next)
+  {
+    next= dcon->next;
+
+    if (!gearman_server_con_detach(dcon->server_con))
+      continue;
+
+    if (thread->options & GEARMAND_THREAD_EPOLL)
+    {
+#ifdef HAVE_SYS_EPOLL_H
+      if (dcon->options & GEARMAND_CON_EPOLL)
+        (void) epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, dcon->fd, NULL);
+#endif
+    }
+    else if (thread->options & GEARMAND_THREAD_URING)
+      _con_uring_cancel(dcon);
+    else if (dcon->last_events != 0)
+      assert(event_del(&(dcon->event)) == 0);
+    dcon->last_events= 0;
+
+    GEARMAN_LIST_DEL(thread->dcon, dcon,)
+
+    GEARMAN_INFO(thread->gearmand, "[%4u] %15s:%5s Moving to thread %u",
+                 thread->count,
+                 gearman_server_con_addr_host(&(dcon->addr), host),
+                 gearman_server_con_addr_port(&(dcon->addr), port),
+                 move_thread->count)
+
+    move_count--;
+
+    /* Requests still in the ring hand it over once they complete, and
+       events later in the current epoll batch once the batch is done. */
+    if (dcon->options & (GEARMAND_CON_URING_POLL | GEARMAND_CON_URING_RECV |
+                         GEARMAND_CON_URING_SEND))
+    {
+      dcon->options|= GEARMAND_CON_MOVE;
+      dcon->move_thread= move_thread;
+      continue;
+    }
+
+    if (thread->options & GEARMAND_THREAD_EPOLL)
+    {
+      dcon->options|= GEARMAND_CON_MOVE;
+      dcon->move_thread= move_thread;
+      dcon->next= thread->dcon_release_list;
+      thread->dcon_release_list= dcon;
+      continue;
+    }
+
+    _con_move_add(dcon, move_thread);
+    moved= true;
+  }
+
+  if (moved)
+    gearmand_thread_wakeup(move_thread, GEARMAND_WAKEUP_CON);
 }
 
 void gearmand_con_check_queue(gearmand_thread_st *thread)
@@ -182,6 +581,9 @@ gearman_return_t gearmand_con_watch(gearman_con_st *con, short events,
   (void) arg;
   gearmand_con_st *dcon;
   short set_events= 0;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+  gearman_return_t ret;
 
   dcon= (gearmand_con_st *)gearman_con_data(con);
   dcon->con= con;
@@ -191,7 +593,41 @@ gearman_return_t gearmand_con_watch(gearman_con_st *con, short events,
   if (events & POLLOUT)
     set_events|= EV_WRITE;
 
-  if (dcon->last_events != set_events)
+  if (dcon->thread->options & GEARMAND_THREAD_EPOLL)
+  {
+    /* Registered once for both directions, edge triggered, so changes only
+       need to be noted here. */
+    if (!(dcon->options & GEARMAND_CON_EPOLL) && set_events != 0 &&
+        _con_epoll_add(dcon) != GEARMAN_SUCCESS)
+    {
+      GEARMAN_FATAL(dcon->thread->gearmand, "_con_watch:epoll_ctl:%d", errno)
+      return GEARMAN_EVENT;
+    }
+
+    dcon->last_events= set_events;
+  }
+  else if (dcon->last_events != set_events &&
+           dcon->thread->options & GEARMAND_THREAD_URING)
+  {
+    dcon->last_events= set_events;
+
+    /* A poll for writing that is no longer wanted is cancelled, the receive
+       stays, see _con_uring_watch. */
+    ret= _con_uring_watch(dcon);
+    if (ret == GEARMAN_SUCCESS && !(set_events & EV_WRITE) &&
+        dcon->options & GEARMAND_CON_URING_POLL)
+    {
+      ret= gearmand_uring_cancel(&(dcon->thread->uring),
+                                 (uintptr_t)dcon | GEARMAND_DATA_CON);
+    }
+
+    if (ret != GEARMAN_SUCCESS)
+    {
+      GEARMAN_FATAL(dcon->thread->gearmand, "_con_watch:io_uring:%d", errno)
+      return GEARMAN_EVENT;
+    }
+  }
+  else if (dcon->last_events != set_events)
   {
     if (dcon->last_events != 0)
       assert(event_del(&(dcon->event)) == 0);
@@ -209,7 +645,9 @@ gearman_return_t gearmand_con_watch(gearman_con_st *con, short events,
   }
 
   GEARMAN_CRAZY(dcon->thread->gearmand, "[%4u] %15s:%5s Watching  %6s %s",
-                dcon->thread->count, dcon->host, dcon->port,
+                dcon->thread->count,
+                gearman_server_con_addr_host(&(dcon->addr), host),
+                gearman_server_con_addr_port(&(dcon->addr), port),
                 events & POLLIN ? "POLLIN" : "",
                 events & POLLOUT ? "POLLOUT" : "")
 
@@ -225,6 +663,8 @@ static void _con_ready(int fd __attribute__ ((unused)), short events,
 {
   gearmand_con_st *dcon= (gearmand_con_st *)arg;
   short revents= 0;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
   gearman_return_t ret;
 
   if (events & EV_READ)
@@ -240,18 +680,79 @@ static void _con_ready(int fd __attribute__ ((unused)), short events,
   }
 
   GEARMAN_CRAZY(dcon->thread->gearmand, "[%4u] %15s:%5s Ready     %6s %s",
-                dcon->thread->count, dcon->host, dcon->port,
+                dcon->thread->count,
+                gearman_server_con_addr_host(&(dcon->addr), host),
+                gearman_server_con_addr_port(&(dcon->addr), port),
                 revents & POLLIN ? "POLLIN" : "",
                 revents & POLLOUT ? "POLLOUT" : "")
 
   gearmand_thread_run(dcon->thread);
 }
 
+static void _con_init(gearmand_con_st *dcon, int fd,
+                      const struct sockaddr *sa, gearman_con_add_fn *add_fn)
+{
+  dcon->options= 0;
+  dcon->last_events= 0;
+  dcon->fd= fd;
+  dcon->next= NULL;
+  dcon->prev= NULL;
+  dcon->server_con= NULL;
+  dcon->con= NULL;
+  gearman_server_con_addr_set(&(dcon->addr), sa);
+  dcon->add_fn= add_fn;
+  dcon->input= NULL;
+  dcon->input_size= 0;
+}
+
 static gearman_return_t _con_add(gearmand_thread_st *thread,
                                  gearmand_con_st *dcon)
 {
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
   gearman_return_t ret;
 
+  /* Connections moved from another thread already have their state. */
+  if (dcon->server_con != NULL)
+  {
+    GEARMAN_LIST_ADD(thread->dcon, dcon,)
+
+    /* Only threads using io_uring receive data before it is read. */
+    gearman_con_set_options(gearman_server_con_con(dcon->server_con),
+                            GEARMAN_CON_RECV_INPUT,
+                            thread->options & GEARMAND_THREAD_URING ? 1 : 0);
+
+    ret= gearman_server_con_attach(dcon->server_con,
+                                   &(thread->server_thread));
+    if (ret != GEARMAN_SUCCESS)
+    {
+      GEARMAN_INFO(thread->gearmand, "[%4u] %15s:%5s Disconnected",
+                   thread->count,
+                   gearman_server_con_addr_host(&(dcon->addr), host),
+                   gearman_server_con_addr_port(&(dcon->addr), port))
+      gearmand_con_free(dcon);
+      return GEARMAN_SUCCESS;
+    }
+
+    /* Data received by the old thread comes before anything on the
+       socket. */
+    if (dcon->input != NULL)
+    {
+      _con_input(dcon, dcon->input, dcon->input_size);
+
+      if (dcon->options & GEARMAND_CON_FREE)
+        _con_done(dcon);
+      else
+      {
+        free(dcon->input);
+        dcon->input= NULL;
+        dcon->input_size= 0;
+      }
+    }
+
+    return GEARMAN_SUCCESS;
+  }
+
   dcon->server_con= gearman_server_con_add(&(thread->server_thread), dcon->fd,
                                            dcon);
   if (dcon->server_con == NULL)
@@ -261,8 +762,13 @@ static gearman_return_t _con_add(gearmand_thread_st *thread,
     return GEARMAN_MEMORY_ALLOCATION_FAILURE;
   }
 
-  gearman_server_con_set_host(dcon->server_con, dcon->host);
-  gearman_server_con_set_port(dcon->server_con, dcon->port);
+  gearman_server_con_set_addr(dcon->server_con, &(dcon->addr));
+
+  if (thread->options & GEARMAND_THREAD_URING)
+  {
+    gearman_con_set_options(gearman_server_con_con(dcon->server_con),
+                            GEARMAN_CON_RECV_INPUT, 1);
+  }
 
   if (dcon->add_fn != NULL)
   {
@@ -277,9 +783,247 @@ static gearman_return_t _con_add(gearmand_thread_st *thread,
   }
 
   GEARMAN_INFO(thread->gearmand, "[%4u] %15s:%5s Connected", thread->count,
-               dcon->host, dcon->port)
+               gearman_server_con_addr_host(&(dcon->addr), host),
+               gearman_server_con_addr_port(&(dcon->addr), port))
 
   GEARMAN_LIST_ADD(thread->dcon, dcon,)
 
   return GEARMAN_SUCCESS;
 }
+
+static uint32_t _con_count(gearmand_thread_st *thread)
+{
+  return *((volatile uint32_t *)&(thread->server_thread.con_count)) +
+         *((volatile uint32_t *)&(thread->dcon_add_count));
+}
+
+static gearmand_thread_st *_con_load(gearmand_st *gearmand)
+{
+  gearmand_thread_st *thread;
+  gearmand_thread_st *least;
+  uint64_t con_total= 0;
+  uint64_t activity_total= 0;
+  uint64_t activity;
+  uint32_t x;
+
+  for (thread= gearmand->thread_list; thread != NULL; thread= thread->next)
+  {
+    con_total+= _con_count(thread);
+    activity_total+= thread->server_thread.packet_recent +
+                     (thread->server_thread.byte_recent /
+                      GEARMAND_LOAD_PACKET_BYTES);
+  }
+
+  if (con_total == 0)
+    con_total= 1;
+  if (activity_total == 0)
+    activity_total= 1;
+
+  if (gearmand->thread_add_next == NULL)
+    gearmand->thread_add_next= gearmand->thread_list;
+
+  /* Shares are compared scaled by both totals to stay in integers. */
+  least= gearmand->thread_add_next;
+  thread= least;
+  for (x= 0; x < gearmand->thread_count; x++)
+  {
+    activity= thread->server_thread.packet_recent +
+              (thread->server_thread.byte_recent / GEARMAND_LOAD_PACKET_BYTES);
+    thread->load= (_con_count(thread) * activity_total) +
+                  (activity * con_total);
+    if (thread->load < least->load)
+      least= thread;
+
+    thread= thread->next == NULL ? gearmand->thread_list : thread->next;
+  }
+
+  return least;
+}
+
+static void _con_recycle(gearmand_con_st *dcon)
+{
+  /* Threads accepting their own connections keep what they free. */
+  if (dcon->thread->gearmand->free_dcon_count < GEARMAN_MAX_FREE_SERVER_CON &&
+      dcon->thread->free_dcon_count < GEARMAN_MAX_FREE_SERVER_CON)
+  {
+    if (dcon->thread->gearmand->threads == 0)
+      GEARMAN_LIST_ADD(dcon->thread->gearmand->free_dcon, dcon,)
+    else
+    {
+      /* Lock here because the main thread may be emptying this. */
+      (void ) pthread_mutex_lock(&(dcon->thread->lock));
+      GEARMAN_LIST_ADD(dcon->thread->free_dcon, dcon,)
+      (void ) pthread_mutex_unlock(&(dcon->thread->lock));
+    }
+  }
+  else
+    free(dcon);
+}
+
+static void _con_move_add(gearmand_con_st *dcon,
+                          gearmand_thread_st *move_thread)
+{
+  /* The new thread picks it up like any other added connection. */
+  dcon->options= 0;
+  dcon->thread= move_thread;
+  (void ) pthread_mutex_lock(&(move_thread->lock));
+  GEARMAN_LIST_ADD(move_thread->dcon_add, dcon,)
+  (void ) pthread_mutex_unlock(&(move_thread->lock));
+}
+
+static gearman_return_t _con_uring_watch(gearmand_con_st *dcon)
+{
+  gearmand_uring_st *uring= &(dcon->thread->uring);
+  gearman_return_t ret;
+
+  /* Received data is always read in full, so the receive can stay while
+     the connection is not asking for more. */
+  if (dcon->last_events & EV_READ &&
+      !(dcon->options & GEARMAND_CON_URING_RECV))
+  {
+    ret= gearmand_uring_recv(uring, dcon->fd,
+                             (uintptr_t)dcon | GEARMAND_DATA_RECV);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    dcon->options|= GEARMAND_CON_URING_RECV;
+  }
+
+  /* Queued packets are written through the ring as well, this is only for
+     the connection's own sends. */
+  if (dcon->last_events & EV_WRITE &&
+      !(dcon->options & GEARMAND_CON_URING_POLL))
+  {
+    ret= gearmand_uring_poll(uring, dcon->fd, POLLOUT,
+                             (uintptr_t)dcon | GEARMAND_DATA_CON, false);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    dcon->options|= GEARMAND_CON_URING_POLL;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _con_uring_again(gearmand_con_st *dcon)
+{
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+
+  if (_con_uring_watch(dcon) == GEARMAN_SUCCESS)
+    return;
+
+  GEARMAN_INFO(dcon->thread->gearmand, "[%4u] %15s:%5s Disconnected",
+               dcon->thread->count,
+               gearman_server_con_addr_host(&(dcon->addr), host),
+               gearman_server_con_addr_port(&(dcon->addr), port))
+  gearmand_con_free(dcon);
+}
+
+static void _con_uring_cancel(gearmand_con_st *dcon)
+{
+  gearmand_uring_st *uring= &(dcon->thread->uring);
+
+  if (dcon->options & GEARMAND_CON_URING_POLL)
+    (void) gearmand_uring_cancel(uring, (uintptr_t)dcon | GEARMAND_DATA_CON);
+  if (dcon->options & GEARMAND_CON_URING_RECV)
+    (void) gearmand_uring_cancel(uring, (uintptr_t)dcon | GEARMAND_DATA_RECV);
+  if (dcon->options & GEARMAND_CON_URING_SEND)
+    (void) gearmand_uring_cancel(uring, (uintptr_t)dcon | GEARMAND_DATA_SEND);
+}
+
+static void _con_input(gearmand_con_st *dcon, const void *data,
+                       size_t data_size)
+{
+  gearman_con_st *con= gearman_server_con_con(dcon->server_con);
+  bool input= con->options & GEARMAN_CON_RECV_INPUT;
+
+  gearman_con_set_options(con, GEARMAN_CON_RECV_INPUT, 1);
+  gearman_con_set_recv_input(con, data, data_size);
+
+  /* The server reads until it would block, which uses up all of the data. */
+  dcon->options|= GEARMAND_CON_URING_BUSY;
+  _con_ready(dcon->fd, EV_READ, dcon);
+  dcon->options&= (gearmand_con_options_t)~GEARMAND_CON_URING_BUSY;
+
+  if (dcon->options & GEARMAND_CON_FREE)
+    return;
+
+  gearman_con_set_recv_input(con, NULL, 0);
+  if (!input)
+    gearman_con_set_options(con, GEARMAN_CON_RECV_INPUT, 0);
+}
+
+static bool _con_stash(gearmand_con_st *dcon, const void *data,
+                       size_t data_size)
+{
+  uint8_t *input;
+
+  input= realloc(dcon->input, dcon->input_size + data_size);
+  if (input == NULL)
+    return false;
+
+  memcpy(input + dcon->input_size, data, data_size);
+  dcon->input= input;
+  dcon->input_size+= data_size;
+
+  return true;
+}
+
+static void _con_close(gearmand_con_st *dcon)
+{
+  gearman_server_con_free(dcon->server_con);
+  dcon->server_con= NULL;
+  close(dcon->fd);
+}
+
+static void _con_done(gearmand_con_st *dcon)
+{
+  gearmand_thread_st *move_thread= dcon->move_thread;
+
+  if (dcon->options & (GEARMAND_CON_URING_POLL | GEARMAND_CON_URING_RECV |
+                       GEARMAND_CON_URING_SEND | GEARMAND_CON_URING_BUSY))
+  {
+    return;
+  }
+
+  if (dcon->options & GEARMAND_CON_FREE)
+  {
+    if (dcon->server_con != NULL)
+      _con_close(dcon);
+
+    if (dcon->input != NULL)
+    {
+      free(dcon->input);
+      dcon->input= NULL;
+      dcon->input_size= 0;
+    }
+
+    _con_recycle(dcon);
+  }
+  else
+  {
+    _con_move_add(dcon, move_thread);
+    gearmand_thread_wakeup(move_thread, GEARMAND_WAKEUP_CON);
+  }
+}
+
+static gearman_return_t _con_epoll_add(gearmand_con_st *dcon)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event event;
+
+  event.events= EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.u64= (uintptr_t)dcon | GEARMAND_DATA_CON;
+  if (epoll_ctl(dcon->thread->epoll_fd, EPOLL_CTL_ADD, dcon->fd, &event) == -1)
+    return GEARMAN_ERRNO;
+
+  dcon->options|= GEARMAND_CON_EPOLL;
+
+  return GEARMAN_SUCCESS;
+#else
+  (void)dcon;
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+#endif
+}
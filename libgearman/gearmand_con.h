@@ -29,15 +29,30 @@ extern "C" {
  * @param gearmand Server instance structure previously initialized with
  *        gearmand_create.
  * @param fd File descriptor of new connection.
- * @param host Host of peer connection.
- * @param port Port of peer connection.
+ * @param sa Address of peer connection.
  * @param add_fn Optional callback to use when adding the connection to an
           I/O thread.
  * @return Pointer to an allocated gearmand structure.
  */
 GEARMAN_API
 gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
-                                     const char *host, const char *port,
+                                     const struct sockaddr *sa,
+                                     gearman_con_add_fn *add_fn);
+
+/**
+ * Create a new gearmand connection for a socket an I/O thread accepted
+ * itself. The connection is added to that thread right away. This must be
+ * called from the given thread.
+ * @param thread Thread that accepted the connection.
+ * @param fd File descriptor of new connection.
+ * @param sa Address of peer connection.
+ * @param add_fn Optional callback to use when adding the connection to an
+          I/O thread.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_con_accept(gearmand_thread_st *thread, int fd,
+                                     const struct sockaddr *sa,
                                      gearman_con_add_fn *add_fn);
 
 /**
@@ -47,6 +62,64 @@ gearman_return_t gearmand_con_create(gearmand_st *gearmand, int fd,
 GEARMAN_API
 void gearmand_con_free(gearmand_con_st *dcon);
 
+/**
+ * Handle the completion of a connection's io_uring poll, and poll again if
+ * the connection is still waiting to write. This must be called from the
+ * connection's thread.
+ * @param dcon Connection the poll was for.
+ * @param res Result of the poll, the ready events or a negative errno.
+ */
+GEARMAN_API
+void gearmand_con_uring_ready(gearmand_con_st *dcon, int32_t res);
+
+/**
+ * Handle a completion of a connection's io_uring receive, passing the data
+ * to the connection, and receive again if the request is done. This must be
+ * called from the connection's thread.
+ * @param dcon Connection the receive was for.
+ * @param res Result of the receive, the size of the data or a negative
+ *        errno.
+ * @param buffer Buffer holding the data.
+ * @param more Whether the receive request is still active.
+ */
+GEARMAN_API
+void gearmand_con_uring_recv(gearmand_con_st *dcon, int32_t res,
+                             const void *buffer, bool more);
+
+/**
+ * Callback function used for queueing writes of server packets in io_uring
+ * for threads using it, see gearman_server_thread_set_writev.
+ */
+GEARMAN_API
+gearman_return_t gearmand_con_uring_writev(gearman_server_con_st *con,
+                                           const struct iovec *iov,
+                                           int iov_count, void *arg);
+
+/**
+ * Handle the completion of a connection's io_uring write, and flush the
+ * connection again. This must be called from the connection's thread.
+ * @param dcon Connection the write was for.
+ * @param res Result of the write, the bytes written or a negative errno.
+ */
+GEARMAN_API
+void gearmand_con_uring_sent(gearmand_con_st *dcon, int32_t res);
+
+/**
+ * Handle an edge triggered epoll event for a connection. This must be called
+ * from the connection's thread.
+ * @param dcon Connection the event is for.
+ * @param events Events reported by epoll_wait.
+ */
+GEARMAN_API
+void gearmand_con_epoll_ready(gearmand_con_st *dcon, uint32_t events);
+
+/**
+ * Recycle or hand off connections freed or moved while handling a batch of
+ * epoll events, once no event in the batch can name them anymore.
+ */
+GEARMAN_API
+void gearmand_con_release(gearmand_thread_st *thread);
+
 /**
  * Check connection queue for a thread.
  */
@@ -54,7 +127,25 @@ GEARMAN_API
 void gearmand_con_check_queue(gearmand_thread_st *thread);
 
 /**
- * Callback function used for setting events in libevent.
+ * Ask the most loaded I/O thread to hand some idle connections to the least
+ * loaded one, if the difference is large enough. This must be called from
+ * the main thread, after gearman_server_thread_sample() for every thread.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ */
+GEARMAN_API
+void gearmand_con_rebalance(gearmand_st *gearmand);
+
+/**
+ * Move idle connections as asked by gearmand_con_rebalance(). This must be
+ * called from the given thread.
+ */
+GEARMAN_API
+void gearmand_con_move(gearmand_thread_st *thread);
+
+/**
+ * Callback function used for setting events in libevent, or in io_uring for
+ * threads using it.
  */
 GEARMAN_API
 gearman_return_t gearmand_con_watch(gearman_con_st *con, short events,
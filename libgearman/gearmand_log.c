@@ -0,0 +1,307 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Gearmand Log Definitions
+ */
+
+#include "common.h"
+
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearmand_log_private Private Gearmand Log Functions
+ * @ingroup gearmand_log
+ * @{
+ */
+
+/**
+ * Log function installed while the writer thread runs. Copies the line into
+ * the ring of the calling thread, creating the ring on first use.
+ */
+static void _log_add(gearmand_st *gearmand, gearman_verbose_t verbose,
+                     const char *line, void *fn_arg);
+
+/**
+ * Writer thread loop.
+ */
+static void *_log_thread(void *data);
+
+/**
+ * Write out all lines currently in the rings, and any drop counts.
+ * @return Number of lines written.
+ */
+static uint32_t _log_drain(gearmand_st *gearmand);
+
+/**
+ * Check if all rings are empty.
+ */
+static bool _log_empty(gearmand_st *gearmand);
+
+/** @} */
+
+/*
+ * Public definitions
+ */
+
+gearman_return_t gearmand_log_start(gearmand_st *gearmand)
+{
+  pthread_attr_t attr;
+  int pthread_ret;
+
+  if (gearmand->log_fn == NULL || gearmand->options & GEARMAND_LOG_THREAD)
+    return GEARMAN_SUCCESS;
+
+  pthread_ret= pthread_key_create(&(gearmand->log_key), NULL);
+  if (pthread_ret != 0)
+  {
+    GEARMAN_FATAL(gearmand, "gearmand_log_start:pthread_key_create:%d",
+                  pthread_ret)
+    return GEARMAN_PTHREAD;
+  }
+
+  pthread_ret= pthread_mutex_init(&(gearmand->log_lock), NULL);
+  if (pthread_ret != 0)
+  {
+    (void) pthread_key_delete(gearmand->log_key);
+    GEARMAN_FATAL(gearmand, "gearmand_log_start:pthread_mutex_init:%d",
+                  pthread_ret)
+    return GEARMAN_PTHREAD;
+  }
+
+  pthread_ret= pthread_cond_init(&(gearmand->log_cond), NULL);
+  if (pthread_ret != 0)
+  {
+    (void) pthread_mutex_destroy(&(gearmand->log_lock));
+    (void) pthread_key_delete(gearmand->log_key);
+    GEARMAN_FATAL(gearmand, "gearmand_log_start:pthread_cond_init:%d",
+                  pthread_ret)
+    return GEARMAN_PTHREAD;
+  }
+
+  gearmand->log_shutdown= false;
+  gearmand->log_sleeping= false;
+  gearmand->log_ring_list= NULL;
+  gearmand->log_write_fn= gearmand->log_fn;
+
+  /* Switch before the thread exists so it never sees the old function. */
+  gearmand->log_fn= _log_add;
+
+  pthread_ret= pthread_attr_init(&attr);
+  if (pthread_ret == 0)
+  {
+    pthread_ret= pthread_create(&(gearmand->log_id), &attr, _log_thread,
+                                gearmand);
+    (void) pthread_attr_destroy(&attr);
+  }
+
+  if (pthread_ret != 0)
+  {
+    gearmand->log_fn= gearmand->log_write_fn;
+    (void) pthread_cond_destroy(&(gearmand->log_cond));
+    (void) pthread_mutex_destroy(&(gearmand->log_lock));
+    (void) pthread_key_delete(gearmand->log_key);
+    GEARMAN_FATAL(gearmand, "gearmand_log_start:pthread_create:%d",
+                  pthread_ret)
+    return GEARMAN_PTHREAD;
+  }
+
+  gearmand->options|= GEARMAND_LOG_THREAD;
+
+  return GEARMAN_SUCCESS;
+}
+
+void gearmand_log_stop(gearmand_st *gearmand)
+{
+  gearmand_log_ring_st *ring;
+
+  if (!(gearmand->options & GEARMAND_LOG_THREAD))
+    return;
+
+  (void) pthread_mutex_lock(&(gearmand->log_lock));
+  gearmand->log_shutdown= true;
+  (void) pthread_cond_signal(&(gearmand->log_cond));
+  (void) pthread_mutex_unlock(&(gearmand->log_lock));
+
+  /* The thread drains the rings one last time before it exits. */
+  (void) pthread_join(gearmand->log_id, NULL);
+
+  while (gearmand->log_ring_list != NULL)
+  {
+    ring= gearmand->log_ring_list;
+    gearmand->log_ring_list= ring->next;
+    free(ring);
+  }
+
+  (void) pthread_cond_destroy(&(gearmand->log_cond));
+  (void) pthread_mutex_destroy(&(gearmand->log_lock));
+  (void) pthread_key_delete(gearmand->log_key);
+
+  gearmand->log_fn= gearmand->log_write_fn;
+  gearmand->options&= (gearmand_options_t)~GEARMAND_LOG_THREAD;
+}
+
+/*
+ * Private definitions
+ */
+
+static void _log_add(gearmand_st *gearmand, gearman_verbose_t verbose,
+                     const char *line,
+                     void *fn_arg __attribute__ ((unused)))
+{
+  gearmand_log_ring_st *ring;
+  gearmand_log_entry_st *entry;
+  size_t size;
+
+  ring= pthread_getspecific(gearmand->log_key);
+  if (ring == NULL)
+  {
+    ring= malloc(sizeof(gearmand_log_ring_st));
+    if (ring == NULL)
+      return;
+
+    ring->tail= 0;
+    ring->dropped= 0;
+    ring->head= 0;
+    ring->dropped_reported= 0;
+
+    if (pthread_setspecific(gearmand->log_key, ring) != 0)
+    {
+      free(ring);
+      return;
+    }
+
+    do
+      ring->next= *((gearmand_log_ring_st * volatile *)
+                    &(gearmand->log_ring_list));
+    while (!__sync_bool_compare_and_swap(&(gearmand->log_ring_list),
+                                         ring->next, ring));
+  }
+
+  /* Only this thread moves the tail, only the writer moves the head. */
+  if (ring->tail - *((volatile uint32_t *)&(ring->head)) >=
+      GEARMAND_LOG_RING_SIZE)
+  {
+    *((volatile uint32_t *)&(ring->dropped))= ring->dropped + 1;
+    return;
+  }
+
+  entry= &(ring->entry[ring->tail % GEARMAND_LOG_RING_SIZE]);
+  entry->verbose= verbose;
+  size= strlen(line);
+  if (size >= GEARMAN_MAX_ERROR_SIZE)
+    size= GEARMAN_MAX_ERROR_SIZE - 1;
+  memcpy(entry->line, line, size);
+  entry->line[size]= 0;
+
+  /* Publish the entry, then see if the writer needs waking. The writer sets
+     the flag before its final check of the rings, so one of us always sees
+     the other. */
+  __sync_synchronize();
+  *((volatile uint32_t *)&(ring->tail))= ring->tail + 1;
+  __sync_synchronize();
+
+  if (*((volatile bool *)&(gearmand->log_sleeping)))
+  {
+    (void) pthread_mutex_lock(&(gearmand->log_lock));
+    (void) pthread_cond_signal(&(gearmand->log_cond));
+    (void) pthread_mutex_unlock(&(gearmand->log_lock));
+  }
+}
+
+static void *_log_thread(void *data)
+{
+  gearmand_st *gearmand= (gearmand_st *)data;
+  bool shutdown;
+
+  while (1)
+  {
+    /* Read this first so lines logged before shutdown are still drained. */
+    shutdown= *((volatile bool *)&(gearmand->log_shutdown));
+    __sync_synchronize();
+
+    if (_log_drain(gearmand) > 0)
+      continue;
+
+    if (shutdown)
+      return NULL;
+
+    (void) pthread_mutex_lock(&(gearmand->log_lock));
+
+    gearmand->log_sleeping= true;
+    __sync_synchronize();
+
+    while (!(gearmand->log_shutdown) && _log_empty(gearmand))
+      (void) pthread_cond_wait(&(gearmand->log_cond), &(gearmand->log_lock));
+
+    gearmand->log_sleeping= false;
+    (void) pthread_mutex_unlock(&(gearmand->log_lock));
+  }
+}
+
+static uint32_t _log_drain(gearmand_st *gearmand)
+{
+  gearmand_log_ring_st *ring;
+  gearmand_log_entry_st *entry;
+  uint32_t tail;
+  uint32_t dropped;
+  uint32_t count= 0;
+  char buffer[GEARMAN_MAX_ERROR_SIZE];
+
+  for (ring= *((gearmand_log_ring_st * volatile *)&(gearmand->log_ring_list));
+       ring != NULL; ring= ring->next)
+  {
+    tail= *((volatile uint32_t *)&(ring->tail));
+    __sync_synchronize();
+
+    for (; ring->head != tail; ring->head++)
+    {
+      entry= &(ring->entry[ring->head % GEARMAND_LOG_RING_SIZE]);
+      (*gearmand->log_write_fn)(gearmand, entry->verbose, entry->line,
+                                gearmand->log_fn_arg);
+      count++;
+
+      /* Hand the slot back before the next one is written out. */
+      __sync_synchronize();
+    }
+
+    dropped= *((volatile uint32_t *)&(ring->dropped));
+    if (dropped != ring->dropped_reported)
+    {
+      snprintf(buffer, GEARMAN_MAX_ERROR_SIZE,
+               "Log ring full, dropped %u lines",
+               dropped - ring->dropped_reported);
+      (*gearmand->log_write_fn)(gearmand, GEARMAN_VERBOSE_ERROR, buffer,
+                                gearmand->log_fn_arg);
+      ring->dropped_reported= dropped;
+      count++;
+    }
+  }
+
+  return count;
+}
+
+static bool _log_empty(gearmand_st *gearmand)
+{
+  gearmand_log_ring_st *ring;
+
+  for (ring= *((gearmand_log_ring_st * volatile *)&(gearmand->log_ring_list));
+       ring != NULL; ring= ring->next)
+  {
+    if (*((volatile uint32_t *)&(ring->tail)) != ring->head ||
+        *((volatile uint32_t *)&(ring->dropped)) != ring->dropped_reported)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,58 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Gearmand Log Declarations
+ */
+
+#ifndef __GEARMAND_LOG_H__
+#define __GEARMAND_LOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearmand_log Gearmand Log Rings
+ * Asynchronous logging for gearmand. While started, every thread that logs
+ * gets its own ring of GEARMAND_LOG_RING_SIZE lines, written only by that
+ * thread and drained only by a writer thread, so neither side takes a lock.
+ * The log function given to gearmand_set_log is then only called from the
+ * writer thread. When a ring is full the line is dropped and counted, and
+ * the writer reports the count once it catches up.
+ * @{
+ */
+
+/**
+ * Start the writer thread and route gearmand log lines through the rings.
+ * Does nothing if no log function is set.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_log_start(gearmand_st *gearmand);
+
+/**
+ * Write out everything left in the rings, stop the writer thread, and go
+ * back to calling the log function directly. No other thread may log while
+ * this runs.
+ * @param gearmand Server instance structure previously initialized with
+ *        gearmand_create.
+ */
+GEARMAN_API
+void gearmand_log_stop(gearmand_st *gearmand);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAND_LOG_H__ */
@@ -34,6 +34,68 @@ static void _wakeup_clear(gearmand_thread_st *thread);
 static void _wakeup_event(int fd, short events, void *arg);
 static void _clear_events(gearmand_thread_st *thread);
 
+/**
+ * Start watching one of the thread's own descriptors for reading, with the
+ * event mechanism the thread uses. With io_uring, listening sockets get an
+ * accept request instead of a poll.
+ */
+static gearman_return_t _watch_add(gearmand_thread_st *thread,
+                                   struct event *event, int fd,
+                                   void (*callback)(int, short, void *),
+                                   void *arg, gearmand_data_t type);
+
+/**
+ * Stop watching a descriptor added with _watch_add.
+ */
+static void _watch_del(gearmand_thread_st *thread, struct event *event,
+                       int fd, void *arg, gearmand_data_t type);
+
+static gearman_return_t _run_init(gearmand_thread_st *thread);
+static void _run_close(gearmand_thread_st *thread);
+static void _run_clear(gearmand_thread_st *thread);
+static void _run_event(int fd, short events, void *arg);
+
+static gearman_return_t _listen_init(gearmand_thread_st *thread);
+static void _listen_close(gearmand_thread_st *thread);
+static void _listen_clear(gearmand_thread_st *thread);
+static void _listen_event(int fd, short events, void *arg);
+
+/**
+ * Add a connection accepted on one of the thread's listening sockets.
+ */
+static gearman_return_t _listen_con(gearmand_listen_st *dlisten, int con_fd,
+                                    struct sockaddr *sa);
+
+/**
+ * Thread event loop for threads using io_uring. All requests queued while
+ * handling one batch of completions go to the kernel with the wait for the
+ * next batch. Returns once nothing is left to wait for, like libevent.
+ */
+static void _uring_loop(gearmand_thread_st *thread);
+
+/**
+ * Handle one io_uring completion, handing its receive buffer back after.
+ */
+static void _uring_event(gearmand_thread_st *thread, uint64_t data,
+                         int32_t res, bool more, void *buffer);
+
+/**
+ * Create the epoll instance for a thread.
+ */
+static gearman_return_t _epoll_init(gearmand_thread_st *thread);
+
+/**
+ * Thread event loop for threads using epoll. Returns once nothing is left to
+ * watch, like libevent.
+ */
+static void _epoll_loop(gearmand_thread_st *thread);
+
+/**
+ * Handle one epoll event.
+ */
+static void _epoll_event(gearmand_thread_st *thread, uint64_t data,
+                         uint32_t events);
+
 /** @} */
 
 /*
@@ -44,6 +106,8 @@ gearman_return_t gearmand_thread_create(gearmand_st *gearmand)
 {
   gearmand_thread_st *thread;
   gearman_return_t ret;
+  pthread_attr_t attr;
+  uint32_t cpu;
   int pthread_ret;
 
   thread= malloc(sizeof(gearmand_thread_st));
@@ -62,8 +126,12 @@ gearman_return_t gearmand_thread_create(gearmand_st *gearmand)
     return GEARMAN_MEMORY_ALLOCATION_FAILURE;
   }
 
-  gearman_server_thread_set_log(&(thread->server_thread), _log, thread,
-                                gearmand->verbose);
+  /* Without a log function, errors are only kept as the last error. */
+  if (gearmand->log_fn != NULL)
+  {
+    gearman_server_thread_set_log(&(thread->server_thread), _log, thread,
+                                  gearmand->verbose);
+  }
   gearman_server_thread_set_event_watch(&(thread->server_thread),
                                         gearmand_con_watch, NULL);
 
@@ -72,20 +140,51 @@ gearman_return_t gearmand_thread_create(gearmand_st *gearmand)
   thread->dcon_count= 0;
   thread->dcon_add_count= 0;
   thread->free_dcon_count= 0;
+  thread->listen_count= 0;
+  thread->move_count= 0;
+  thread->load= 0;
+  thread->move_thread= NULL;
   thread->wakeup_fd[0]= -1;
   thread->wakeup_fd[1]= -1;
+  thread->run_fd= -1;
+  memset(&(thread->uring), 0, sizeof(gearmand_uring_st));
+  thread->uring.fd= -1;
+  thread->epoll_fd= -1;
   GEARMAN_LIST_ADD(gearmand->thread, thread,)
   thread->gearmand= gearmand;
+  thread->base= NULL;
   thread->dcon_list= NULL;
   thread->dcon_add_list= NULL;
   thread->free_dcon_list= NULL;
+  thread->dcon_release_list= NULL;
+  thread->listen_list= NULL;
 
   /* If we have no threads, we still create a fake thread that uses the main
      libevent instance. Otherwise create a libevent instance for each thread. */
   if (gearmand->threads == 0)
     thread->base= gearmand->base;
+  else if (gearmand->options & GEARMAND_IO_URING &&
+           gearmand_uring_init(&(thread->uring), GEARMAND_URING_ENTRIES) ==
+           GEARMAN_SUCCESS)
+  {
+    GEARMAN_INFO(gearmand, "Initialized io_uring for IO thread")
+    thread->options|= GEARMAND_THREAD_URING;
+  }
+  else if (gearmand->options & GEARMAND_EPOLL &&
+           _epoll_init(thread) == GEARMAN_SUCCESS)
+  {
+    GEARMAN_INFO(gearmand, "Initialized epoll for IO thread")
+    thread->options|= GEARMAND_THREAD_EPOLL;
+  }
   else
   {
+    if (gearmand->options & (GEARMAND_IO_URING | GEARMAND_EPOLL))
+    {
+      GEARMAN_ERROR(gearmand, "gearmand_thread_create:%s:%d, using libevent "
+                              "instead", gearmand->options & GEARMAND_EPOLL ?
+                              "epoll_create" : "gearmand_uring_init", errno)
+    }
+
     GEARMAN_INFO(gearmand, "Initializing libevent for IO thread")
 
     thread->base= event_base_new();
@@ -122,9 +221,58 @@ gearman_return_t gearmand_thread_create(gearmand_st *gearmand)
 
   thread->options|= GEARMAND_THREAD_LOCK;
 
+  ret= _run_init(thread);
+  if (ret != GEARMAN_SUCCESS)
+  {
+    thread->count= 0;
+    gearmand_thread_free(thread);
+    return ret;
+  }
+
+  if (gearmand->options & GEARMAND_REUSEPORT)
+  {
+    ret= _listen_init(thread);
+    if (ret != GEARMAN_SUCCESS)
+    {
+      thread->count= 0;
+      gearmand_thread_free(thread);
+      return ret;
+    }
+  }
+
   gearman_server_thread_set_run(&(thread->server_thread), _run, thread);
 
-  pthread_ret= pthread_create(&(thread->id), NULL, _thread, thread);
+  /* Queued packets are written through the ring, with the rest of the
+     requests of a loop. */
+  if (thread->options & GEARMAND_THREAD_URING)
+  {
+    gearman_server_thread_set_writev(&(thread->server_thread),
+                                     gearmand_con_uring_writev, thread);
+  }
+
+  pthread_ret= pthread_attr_init(&attr);
+  if (pthread_ret == 0)
+  {
+    /* Threads take the given CPUs in turn. */
+    if (gearmand->thread_cpu_count > 0)
+    {
+      cpu= gearmand->thread_cpus[(thread->count - 1) %
+                                 gearmand->thread_cpu_count];
+      if (gearman_server_thread_attr_cpu(&attr, cpu) != GEARMAN_SUCCESS)
+        pthread_ret= EINVAL;
+      else
+      {
+        GEARMAN_INFO(gearmand, "Pinning thread %u to CPU %u", thread->count,
+                     cpu)
+      }
+    }
+
+    if (pthread_ret == 0)
+      pthread_ret= pthread_create(&(thread->id), &attr, _thread, thread);
+
+    (void) pthread_attr_destroy(&attr);
+  }
+
   if (pthread_ret != 0)
   {
     thread->count= 0;
@@ -155,10 +303,17 @@ void gearmand_thread_free(gearmand_thread_st *thread)
     (void) pthread_mutex_destroy(&(thread->lock));
 
   _wakeup_close(thread);
+  _run_close(thread);
+  _listen_close(thread);
+
+  if (thread->listen_list != NULL)
+    free(thread->listen_list);
 
   while (thread->dcon_list != NULL)
     gearmand_con_free(thread->dcon_list);
 
+  gearmand_con_release(thread);
+
   while (thread->dcon_add_list != NULL)
   {
     dcon= thread->dcon_add_list;
@@ -176,6 +331,11 @@ void gearmand_thread_free(gearmand_thread_st *thread)
 
   gearman_server_thread_free(&(thread->server_thread));
 
+  gearmand_uring_free(&(thread->uring));
+
+  if (thread->epoll_fd >= 0)
+    close(thread->epoll_fd);
+
   GEARMAN_LIST_DEL(thread->gearmand->thread, thread,)
 
   if (thread->gearmand->threads > 0)
@@ -205,6 +365,8 @@ void gearmand_thread_run(gearmand_thread_st *thread)
   gearman_server_con_st *server_con;
   gearman_return_t ret;
   gearmand_con_st *dcon;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
 
   while (1)
   { 
@@ -226,7 +388,8 @@ void gearmand_thread_run(gearmand_thread_st *thread)
     dcon= (gearmand_con_st *)gearman_server_con_data(server_con);
 
     GEARMAN_INFO(thread->gearmand, "[%4u] %15s:%5s Disconnected", thread->count,
-                 dcon->host, dcon->port)
+                 gearman_server_con_addr_host(&(dcon->addr), host),
+                 gearman_server_con_addr_port(&(dcon->addr), port))
 
     gearmand_con_free(dcon);
   }
@@ -243,7 +406,11 @@ static void *_thread(void *data)
   GEARMAN_INFO(thread->gearmand, "[%4u] Entering thread event loop",
                thread->count)
 
-  if (event_base_loop(thread->base, 0) == -1)
+  if (thread->options & GEARMAND_THREAD_URING)
+    _uring_loop(thread);
+  else if (thread->options & GEARMAND_THREAD_EPOLL)
+    _epoll_loop(thread);
+  else if (event_base_loop(thread->base, 0) == -1)
   {
     GEARMAN_FATAL(thread->gearmand, "_io_thread:event_base_loop:-1")
     thread->gearmand->ret= GEARMAN_EVENT;
@@ -270,6 +437,19 @@ static void _run(gearman_server_thread_st *thread __attribute__ ((unused)),
                  void *fn_arg)
 {
   gearmand_thread_st *dthread= (gearmand_thread_st *)fn_arg;
+#ifdef HAVE_SYS_EVENTFD_H
+  uint64_t value= 1;
+
+  if (dthread->run_fd >= 0)
+  {
+    /* If this fails, there is not much we can really do. This should never
+       fail though if the thread is still active. */
+    if (write(dthread->run_fd, &value, sizeof(value)) != sizeof(value))
+      GEARMAN_ERROR(dthread->gearmand, "_run:write:%d", errno)
+    return;
+  }
+#endif
+
   gearmand_thread_wakeup(dthread, GEARMAND_WAKEUP_RUN);
 }
 
@@ -300,13 +480,11 @@ static gearman_return_t _wakeup_init(gearmand_thread_st *thread)
     return GEARMAN_ERRNO;
   }
 
-  event_set(&(thread->wakeup_event), thread->wakeup_fd[0], EV_READ | EV_PERSIST,
-            _wakeup_event, thread);
-  event_base_set(thread->base, &(thread->wakeup_event));
-
-  if (event_add(&(thread->wakeup_event), NULL) == -1)
+  if (_watch_add(thread, &(thread->wakeup_event), thread->wakeup_fd[0],
+                 _wakeup_event, thread, GEARMAND_DATA_WAKEUP) !=
+      GEARMAN_SUCCESS)
   {
-    GEARMAN_FATAL(thread->gearmand, "_wakeup_init:event_add:-1")
+    GEARMAN_FATAL(thread->gearmand, "_wakeup_init:_watch_add:%d", errno)
     return GEARMAN_EVENT;
   }
 
@@ -336,7 +514,8 @@ static void _wakeup_clear(gearmand_thread_st *thread)
     GEARMAN_INFO(thread->gearmand,
                  "[%4u] Clearing event for IO thread wakeup pipe",
                  thread->count)
-    assert(event_del(&(thread->wakeup_event)) == 0);
+    _watch_del(thread, &(thread->wakeup_event), thread->wakeup_fd[0], thread,
+               GEARMAND_DATA_WAKEUP);
     thread->options&= (gearmand_thread_options_t)~GEARMAND_THREAD_WAKEUP_EVENT;
   }
 }
@@ -386,6 +565,7 @@ static void _wakeup_event(int fd, short events __attribute__ ((unused)),
         GEARMAN_INFO(thread->gearmand,
                      "[%4u] Received SHUTDOWN_GRACEFUL wakeup event",
                      thread->count)
+        _listen_close(thread);
         if (gearman_server_shutdown_graceful(&(thread->gearmand->server)) ==
             GEARMAN_SHUTDOWN)
         {
@@ -411,6 +591,12 @@ static void _wakeup_event(int fd, short events __attribute__ ((unused)),
         gearmand_thread_run(thread);
         break;
 
+      case GEARMAND_WAKEUP_MOVE:
+        GEARMAN_DEBUG(thread->gearmand, "[%4u] Received MOVE wakeup event",
+                      thread->count)
+        gearmand_con_move(thread);
+        break;
+
       default:
         GEARMAN_FATAL(thread->gearmand,
                      "[%4u] Received unknown wakeup event (%u)", thread->count,
@@ -423,10 +609,519 @@ static void _wakeup_event(int fd, short events __attribute__ ((unused)),
   }
 }
 
+static gearman_return_t _run_init(gearmand_thread_st *thread)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  GEARMAN_INFO(thread->gearmand, "Creating IO thread run eventfd")
+
+  thread->run_fd= eventfd(0, EFD_NONBLOCK);
+  if (thread->run_fd == -1)
+  {
+    /* Fall back to run wakeups through the wakeup pipe. */
+    GEARMAN_ERROR(thread->gearmand, "_run_init:eventfd:%d", errno)
+    return GEARMAN_SUCCESS;
+  }
+
+  if (_watch_add(thread, &(thread->run_event), thread->run_fd, _run_event,
+                 thread, GEARMAND_DATA_RUN) != GEARMAN_SUCCESS)
+  {
+    GEARMAN_FATAL(thread->gearmand, "_run_init:_watch_add:%d", errno)
+    return GEARMAN_EVENT;
+  }
+
+  thread->options|= GEARMAND_THREAD_RUN_EVENT;
+#else
+  (void)thread;
+#endif
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _run_close(gearmand_thread_st *thread)
+{
+  _run_clear(thread);
+
+  if (thread->run_fd >= 0)
+  {
+    GEARMAN_INFO(thread->gearmand, "Closing IO thread run eventfd")
+    close(thread->run_fd);
+    thread->run_fd= -1;
+  }
+}
+
+static void _run_clear(gearmand_thread_st *thread)
+{
+  if (thread->options & GEARMAND_THREAD_RUN_EVENT)
+  {
+    GEARMAN_INFO(thread->gearmand,
+                 "[%4u] Clearing event for IO thread run eventfd",
+                 thread->count)
+    _watch_del(thread, &(thread->run_event), thread->run_fd, thread,
+               GEARMAND_DATA_RUN);
+    thread->options&= (gearmand_thread_options_t)~GEARMAND_THREAD_RUN_EVENT;
+  }
+}
+
+static void _run_event(int fd, short events __attribute__ ((unused)),
+                       void *arg)
+{
+  gearmand_thread_st *thread= (gearmand_thread_st *)arg;
+  uint64_t value;
+
+  /* The counter is reset by the read, so any number of wakeups since the
+     last one are handled by a single run. */
+  if (read(fd, &value, sizeof(value)) == -1 && errno != EAGAIN &&
+      errno != EINTR)
+  {
+    _clear_events(thread);
+    GEARMAN_FATAL(thread->gearmand, "_run_event:read:%d", errno)
+    thread->gearmand->ret= GEARMAN_ERRNO;
+    return;
+  }
+
+  GEARMAN_DEBUG(thread->gearmand, "[%4u] Received RUN wakeup event",
+                thread->count)
+  gearmand_thread_run(thread);
+}
+
+static gearman_return_t _listen_init(gearmand_thread_st *thread)
+{
+  gearmand_st *gearmand= thread->gearmand;
+  gearmand_port_st *port;
+  gearmand_listen_st *dlisten;
+  uint32_t count= 0;
+  uint32_t x;
+  uint32_t y;
+
+  /* Take every threads'th socket of each port, the main thread opened one
+     per thread for each address. */
+  for (x= 0; x < gearmand->port_count; x++)
+  {
+    for (y= thread->count - 1; y < gearmand->port_list[x].listen_count;
+         y+= gearmand->threads)
+    {
+      count++;
+    }
+  }
+
+  if (count == 0)
+    return GEARMAN_SUCCESS;
+
+  thread->listen_list= malloc(sizeof(gearmand_listen_st) * count);
+  if (thread->listen_list == NULL)
+  {
+    GEARMAN_FATAL(gearmand, "_listen_init:malloc")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  for (x= 0; x < gearmand->port_count; x++)
+  {
+    port= &(gearmand->port_list[x]);
+
+    for (y= thread->count - 1; y < port->listen_count; y+= gearmand->threads)
+    {
+      dlisten= &(thread->listen_list[thread->listen_count]);
+      dlisten->fd= port->listen_fd[y];
+      dlisten->port= port;
+      dlisten->thread= thread;
+      port->listen_fd[y]= -1;
+      thread->listen_count++;
+
+      GEARMAN_INFO(gearmand, "[%4u] Adding event for listening socket (%d)",
+                   thread->count, dlisten->fd)
+
+      if (_watch_add(thread, &(dlisten->event), dlisten->fd, _listen_event,
+                     dlisten, GEARMAND_DATA_LISTEN) != GEARMAN_SUCCESS)
+      {
+        GEARMAN_FATAL(gearmand, "_listen_init:_watch_add:%d", errno)
+        return GEARMAN_EVENT;
+      }
+
+      thread->options|= GEARMAND_THREAD_LISTEN_EVENT;
+    }
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _listen_close(gearmand_thread_st *thread)
+{
+  uint32_t x;
+
+  _listen_clear(thread);
+
+  for (x= 0; x < thread->listen_count; x++)
+  {
+    if (thread->listen_list[x].fd >= 0)
+    {
+      GEARMAN_INFO(thread->gearmand, "[%4u] Closing listening socket (%d)",
+                   thread->count, thread->listen_list[x].fd)
+      close(thread->listen_list[x].fd);
+      thread->listen_list[x].fd= -1;
+    }
+  }
+}
+
+static void _listen_clear(gearmand_thread_st *thread)
+{
+  uint32_t x;
+
+  if (!(thread->options & GEARMAND_THREAD_LISTEN_EVENT))
+    return;
+
+  for (x= 0; x < thread->listen_count; x++)
+  {
+    GEARMAN_INFO(thread->gearmand,
+                 "[%4u] Clearing event for listening socket (%d)",
+                 thread->count, thread->listen_list[x].fd)
+    _watch_del(thread, &(thread->listen_list[x].event),
+               thread->listen_list[x].fd, &(thread->listen_list[x]),
+               GEARMAND_DATA_LISTEN);
+  }
+
+  thread->options&= (gearmand_thread_options_t)~GEARMAND_THREAD_LISTEN_EVENT;
+}
+
+static void _listen_event(int fd, short events __attribute__ ((unused)),
+                          void *arg)
+{
+  gearmand_listen_st *dlisten= (gearmand_listen_st *)arg;
+  gearmand_thread_st *thread= dlisten->thread;
+  struct sockaddr_storage sa;
+  socklen_t sa_len;
+  int con_fd;
+
+  /* The socket is not shared with other threads, so take everything that
+     is waiting before going back to the event loop. */
+  while (1)
+  {
+    sa_len= sizeof(sa);
+    con_fd= accept(fd, (struct sockaddr *)&sa, &sa_len);
+    if (con_fd == -1)
+    {
+      if (errno == EAGAIN || errno == ECONNABORTED)
+        return;
+#if EWOULDBLOCK != EAGAIN
+      else if (errno == EWOULDBLOCK)
+        return;
+#endif
+      else if (errno == EINTR)
+        continue;
+      else if (errno == EMFILE)
+      {
+        GEARMAN_ERROR(thread->gearmand,
+                      "_listen_event:accept:too many open files")
+        return;
+      }
+
+      GEARMAN_FATAL(thread->gearmand, "_listen_event:accept:%d", errno)
+      gearmand_wakeup(thread->gearmand, GEARMAND_WAKEUP_SHUTDOWN);
+      return;
+    }
+
+    if (_listen_con(dlisten, con_fd, (struct sockaddr *)&sa) !=
+        GEARMAN_SUCCESS)
+    {
+      gearmand_wakeup(thread->gearmand, GEARMAND_WAKEUP_SHUTDOWN);
+      return;
+    }
+  }
+}
+
+static gearman_return_t _listen_con(gearmand_listen_st *dlisten, int con_fd,
+                                    struct sockaddr *sa)
+{
+  gearmand_thread_st *thread= dlisten->thread;
+  gearman_server_con_addr_st addr;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+
+  gearman_server_con_addr_set(&addr, sa);
+  GEARMAN_INFO(thread->gearmand, "[%4u] Accepted connection from %s:%s",
+               thread->count, gearman_server_con_addr_host(&addr, host),
+               gearman_server_con_addr_port(&addr, port))
+
+  return gearmand_con_accept(thread, con_fd, sa, dlisten->port->add_fn);
+}
+
 static void _clear_events(gearmand_thread_st *thread)
 {
   _wakeup_clear(thread);
+  _run_clear(thread);
+  _listen_clear(thread);
 
   while (thread->dcon_list != NULL)
     gearmand_con_free(thread->dcon_list);
 }
+
+static gearman_return_t _watch_add(gearmand_thread_st *thread,
+                                   struct event *event, int fd,
+                                   void (*callback)(int, short, void *),
+                                   void *arg, gearmand_data_t type)
+{
+  uint64_t data= (uintptr_t)arg | type;
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event epoll_event;
+#endif
+
+  if (thread->options & GEARMAND_THREAD_URING)
+  {
+    if (type == GEARMAND_DATA_LISTEN)
+      return gearmand_uring_accept(&(thread->uring), fd, data);
+
+    return gearmand_uring_poll(&(thread->uring), fd, POLLIN, data, true);
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  if (thread->options & GEARMAND_THREAD_EPOLL)
+  {
+    /* These are all read until empty or handled in batches, so they stay
+       level triggered. */
+    epoll_event.events= EPOLLIN;
+    epoll_event.data.u64= data;
+    if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, fd, &epoll_event) == -1)
+      return GEARMAN_ERRNO;
+
+    return GEARMAN_SUCCESS;
+  }
+#endif
+
+  event_set(event, fd, EV_READ | EV_PERSIST, callback, arg);
+  event_base_set(thread->base, event);
+
+  if (event_add(event, NULL) == -1)
+    return GEARMAN_EVENT;
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _watch_del(gearmand_thread_st *thread, struct event *event,
+                       int fd __attribute__ ((unused)), void *arg,
+                       gearmand_data_t type)
+{
+  if (thread->options & GEARMAND_THREAD_URING)
+    (void) gearmand_uring_cancel(&(thread->uring), (uintptr_t)arg | type);
+#ifdef HAVE_SYS_EPOLL_H
+  else if (thread->options & GEARMAND_THREAD_EPOLL)
+    (void) epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+  else
+    assert(event_del(event) == 0);
+}
+
+static void _uring_loop(gearmand_thread_st *thread)
+{
+  uint64_t data;
+  int32_t res;
+  bool more;
+  void *buffer;
+
+  while (gearmand_uring_active(&(thread->uring)) > 0)
+  {
+    if (gearmand_uring_wait(&(thread->uring)) != GEARMAN_SUCCESS)
+    {
+      GEARMAN_FATAL(thread->gearmand, "_uring_loop:gearmand_uring_wait:%d",
+                    errno)
+      thread->gearmand->ret= GEARMAN_EVENT;
+      return;
+    }
+
+    while (gearmand_uring_next(&(thread->uring), &data, &res, &more,
+                               &buffer))
+    {
+      _uring_event(thread, data, res, more, buffer);
+    }
+  }
+}
+
+static void _uring_event(gearmand_thread_st *thread, uint64_t data,
+                         int32_t res, bool more, void *buffer)
+{
+  gearmand_listen_st *dlisten;
+  struct sockaddr_storage sa;
+  socklen_t sa_len;
+  gearman_return_t ret= GEARMAN_SUCCESS;
+  void *ptr= (void *)(uintptr_t)(data & ~(uint64_t)GEARMAND_DATA_MASK);
+
+  switch ((gearmand_data_t)(data & GEARMAND_DATA_MASK))
+  {
+  case GEARMAND_DATA_WAKEUP:
+    /* Poll again first, handling the wakeup may cancel it. */
+    if (!more && thread->options & GEARMAND_THREAD_WAKEUP_EVENT)
+    {
+      ret= gearmand_uring_poll(&(thread->uring), thread->wakeup_fd[0], POLLIN,
+                               data, true);
+    }
+
+    if (res > 0)
+      _wakeup_event(thread->wakeup_fd[0], EV_READ, thread);
+    break;
+
+  case GEARMAND_DATA_RUN:
+    if (!more && thread->options & GEARMAND_THREAD_RUN_EVENT)
+    {
+      ret= gearmand_uring_poll(&(thread->uring), thread->run_fd, POLLIN, data,
+                               true);
+    }
+
+    if (res > 0)
+      _run_event(thread->run_fd, EV_READ, thread);
+    break;
+
+  case GEARMAND_DATA_LISTEN:
+    dlisten= (gearmand_listen_st *)ptr;
+
+    if (res >= 0)
+    {
+      sa_len= sizeof(sa);
+      if (getpeername(res, (struct sockaddr *)&sa, &sa_len) == -1)
+        sa.ss_family= AF_UNSPEC;
+
+      if (_listen_con(dlisten, res, (struct sockaddr *)&sa) !=
+          GEARMAN_SUCCESS)
+      {
+        gearmand_wakeup(thread->gearmand, GEARMAND_WAKEUP_SHUTDOWN);
+        return;
+      }
+    }
+    else if (res == -EINVAL && gearmand_uring_accept_once(&(thread->uring)))
+    {
+      GEARMAN_ERROR(thread->gearmand,
+                    "[%4u] Multishot accept not supported, accepting one "
+                    "connection per request", thread->count)
+    }
+    else if (res == -EMFILE)
+    {
+      GEARMAN_ERROR(thread->gearmand,
+                    "_uring_event:accept:too many open files")
+    }
+    else if (res != -ECANCELED && res != -EAGAIN && res != -ECONNABORTED &&
+             res != -EINTR)
+    {
+      GEARMAN_FATAL(thread->gearmand, "_uring_event:accept:%d", -res)
+      gearmand_wakeup(thread->gearmand, GEARMAND_WAKEUP_SHUTDOWN);
+      return;
+    }
+
+    if (!more && thread->options & GEARMAND_THREAD_LISTEN_EVENT &&
+        dlisten->fd >= 0)
+    {
+      ret= gearmand_uring_accept(&(thread->uring), dlisten->fd, data);
+    }
+    break;
+
+  case GEARMAND_DATA_CON:
+    gearmand_con_uring_ready((gearmand_con_st *)ptr, res);
+    break;
+
+  case GEARMAND_DATA_RECV:
+    gearmand_con_uring_recv((gearmand_con_st *)ptr, res, buffer, more);
+    if (buffer != NULL)
+      gearmand_uring_release(&(thread->uring), buffer);
+    break;
+
+  case GEARMAND_DATA_SEND:
+    gearmand_con_uring_sent((gearmand_con_st *)ptr, res);
+    break;
+
+  case GEARMAND_DATA_MASK:
+  default:
+    /* Completions of cancels. */
+    break;
+  }
+
+  /* Only a failed system call can fail to queue a request again. */
+  if (ret != GEARMAN_SUCCESS)
+  {
+    GEARMAN_FATAL(thread->gearmand, "_uring_event:io_uring:%d", errno)
+    gearmand_wakeup(thread->gearmand, GEARMAND_WAKEUP_SHUTDOWN);
+  }
+}
+
+static gearman_return_t _epoll_init(gearmand_thread_st *thread)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  thread->epoll_fd= epoll_create(GEARMAND_EPOLL_EVENTS);
+  if (thread->epoll_fd == -1)
+    return GEARMAN_ERRNO;
+
+  return GEARMAN_SUCCESS;
+#else
+  (void)thread;
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+#endif
+}
+
+static void _epoll_loop(gearmand_thread_st *thread)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event events[GEARMAND_EPOLL_EVENTS];
+  int count;
+  int x;
+
+  while (thread->options & (GEARMAND_THREAD_WAKEUP_EVENT |
+                            GEARMAND_THREAD_RUN_EVENT |
+                            GEARMAND_THREAD_LISTEN_EVENT) ||
+         thread->dcon_list != NULL)
+  {
+    count= epoll_wait(thread->epoll_fd, events, GEARMAND_EPOLL_EVENTS, -1);
+    if (count == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      GEARMAN_FATAL(thread->gearmand, "_epoll_loop:epoll_wait:%d", errno)
+      thread->gearmand->ret= GEARMAN_EVENT;
+      return;
+    }
+
+    for (x= 0; x < count; x++)
+      _epoll_event(thread, events[x].data.u64, events[x].events);
+
+    /* Later events in the batch may have named connections freed or moved
+       while handling earlier ones. */
+    gearmand_con_release(thread);
+  }
+#else
+  (void)thread;
+#endif
+}
+
+static void _epoll_event(gearmand_thread_st *thread, uint64_t data,
+                         uint32_t events)
+{
+  gearmand_listen_st *dlisten;
+  void *ptr= (void *)(uintptr_t)(data & ~(uint64_t)GEARMAND_DATA_MASK);
+
+  /* Anything cleared earlier in the batch is skipped, like libevent does for
+     deleted events. */
+  switch ((gearmand_data_t)(data & GEARMAND_DATA_MASK))
+  {
+  case GEARMAND_DATA_WAKEUP:
+    if (thread->options & GEARMAND_THREAD_WAKEUP_EVENT)
+      _wakeup_event(thread->wakeup_fd[0], EV_READ, thread);
+    break;
+
+  case GEARMAND_DATA_RUN:
+    if (thread->options & GEARMAND_THREAD_RUN_EVENT)
+      _run_event(thread->run_fd, EV_READ, thread);
+    break;
+
+  case GEARMAND_DATA_LISTEN:
+    dlisten= (gearmand_listen_st *)ptr;
+    if (thread->options & GEARMAND_THREAD_LISTEN_EVENT && dlisten->fd >= 0)
+      _listen_event(dlisten->fd, EV_READ, dlisten);
+    break;
+
+  case GEARMAND_DATA_CON:
+    gearmand_con_epoll_ready((gearmand_con_st *)ptr, events);
+    break;
+
+  case GEARMAND_DATA_RECV:
+  case GEARMAND_DATA_SEND:
+  case GEARMAND_DATA_MASK:
+  default:
+    break;
+  }
+}
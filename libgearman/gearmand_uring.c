@@ -0,0 +1,690 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Gearmand io_uring Definitions
+ */
+
+#include "common.h"
+
+/* Multishot accept and provided buffer rings need Linux 5.19 and multishot
+   receive 6.0, so build against headers that know about all of them. */
+#if defined(HAVE_LINUX_IO_URING_H) && defined(IORING_ACCEPT_MULTISHOT) && \
+    defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define GEARMAND_URING_SUPPORTED 1
+#endif
+
+#ifdef GEARMAND_URING_SUPPORTED
+
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearmand_uring_private Private Gearmand io_uring Functions
+ * @ingroup gearmand_uring
+ * @{
+ */
+
+/**
+ * Map the rings shared with the kernel.
+ */
+static gearman_return_t _uring_map(gearmand_uring_st *uring,
+                                   struct io_uring_params *params);
+
+/**
+ * Check that the kernel supports every operation used.
+ */
+static bool _uring_probe(gearmand_uring_st *uring);
+
+/**
+ * Set up the receive buffers and register them with the kernel as a
+ * provided buffer ring.
+ */
+static gearman_return_t _uring_buffers(gearmand_uring_st *uring);
+
+/**
+ * Put a receive buffer at the tail of the provided buffer ring. The kernel
+ * only sees it once the tail is published.
+ */
+static void _uring_buffer_add(gearmand_uring_st *uring, uint16_t bid);
+
+/**
+ * Get the next free submission queue entry, cleared. Queued entries are
+ * submitted early if the queue is full.
+ * @return Entry, or NULL with errno set.
+ */
+static struct io_uring_sqe *_uring_sqe(gearmand_uring_st *uring);
+
+/**
+ * Make the entry returned by the last _uring_sqe call visible to the kernel.
+ */
+static void _uring_push(gearmand_uring_st *uring);
+
+/**
+ * Submit queued entries.
+ */
+static int _uring_enter(gearmand_uring_st *uring, uint32_t min_complete,
+                        uint32_t flags);
+
+/** @} */
+
+/*
+ * Public definitions
+ */
+
+gearman_return_t gearmand_uring_init(gearmand_uring_st *uring,
+                                     uint32_t entries)
+{
+  struct io_uring_params params;
+
+  memset(uring, 0, sizeof(gearmand_uring_st));
+  memset(&params, 0, sizeof(params));
+
+  uring->fd= (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (uring->fd == -1)
+    return GEARMAN_ERRNO;
+
+  /* Completions must not be lost when the queue overflows, and writes must
+     be done with their buffer lists once they are submitted. */
+  if (!(params.features & IORING_FEAT_NODROP) ||
+      !(params.features & IORING_FEAT_SUBMIT_STABLE) || !_uring_probe(uring))
+  {
+    gearmand_uring_free(uring);
+    errno= ENOSYS;
+    return GEARMAN_ERRNO;
+  }
+
+  if (_uring_map(uring, &params) != GEARMAN_SUCCESS ||
+      _uring_buffers(uring) != GEARMAN_SUCCESS)
+  {
+    gearmand_uring_free(uring);
+    return GEARMAN_ERRNO;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+void gearmand_uring_free(gearmand_uring_st *uring)
+{
+  if (uring->buf_ring != NULL)
+  {
+    (void) munmap(uring->buf_ring,
+                  GEARMAND_URING_BUFFERS * sizeof(struct io_uring_buf));
+  }
+  if (uring->buffers != NULL)
+    free(uring->buffers);
+  if (uring->iovs != NULL)
+    free(uring->iovs);
+
+  uring->buf_ring= NULL;
+  uring->buffers= NULL;
+  uring->iovs= NULL;
+
+  if (uring->sqes != NULL)
+    (void) munmap(uring->sqes, uring->sqes_size);
+  if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring)
+    (void) munmap(uring->cq_ring, uring->cq_ring_size);
+  if (uring->sq_ring != NULL)
+    (void) munmap(uring->sq_ring, uring->sq_ring_size);
+
+  uring->sqes= NULL;
+  uring->cq_ring= NULL;
+  uring->sq_ring= NULL;
+
+  if (uring->fd >= 0)
+  {
+    close(uring->fd);
+    uring->fd= -1;
+  }
+}
+
+gearman_return_t gearmand_uring_poll(gearmand_uring_st *uring, int fd,
+                                     short events, uint64_t data,
+                                     bool multishot)
+{
+  struct io_uring_sqe *sqe;
+  uint32_t poll_events= (uint16_t)events;
+
+  sqe= _uring_sqe(uring);
+  if (sqe == NULL)
+    return GEARMAN_ERRNO;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+  poll_events= (poll_events << 16) | (poll_events >> 16);
+#endif
+
+  sqe->opcode= IORING_OP_POLL_ADD;
+  sqe->fd= fd;
+  sqe->poll32_events= poll_events;
+  sqe->len= multishot ? IORING_POLL_ADD_MULTI : 0;
+  sqe->user_data= data;
+  _uring_push(uring);
+
+  uring->active++;
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t gearmand_uring_accept(gearmand_uring_st *uring, int fd,
+                                       uint64_t data)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe= _uring_sqe(uring);
+  if (sqe == NULL)
+    return GEARMAN_ERRNO;
+
+  sqe->opcode= IORING_OP_ACCEPT;
+  sqe->fd= fd;
+  if (!uring->accept_once)
+    sqe->ioprio= IORING_ACCEPT_MULTISHOT;
+  sqe->user_data= data;
+  _uring_push(uring);
+
+  uring->active++;
+
+  return GEARMAN_SUCCESS;
+}
+
+bool gearmand_uring_accept_once(gearmand_uring_st *uring)
+{
+  if (uring->accept_once)
+    return false;
+
+  uring->accept_once= true;
+  return true;
+}
+
+gearman_return_t gearmand_uring_recv(gearmand_uring_st *uring, int fd,
+                                     uint64_t data)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe= _uring_sqe(uring);
+  if (sqe == NULL)
+    return GEARMAN_ERRNO;
+
+  /* The kernel picks a buffer from the ring for each completion, so nothing
+     is held for connections with no data waiting. */
+  sqe->opcode= IORING_OP_RECV;
+  sqe->fd= fd;
+  sqe->flags= IOSQE_BUFFER_SELECT;
+  sqe->buf_group= 0;
+  if (!uring->recv_once)
+    sqe->ioprio= IORING_RECV_MULTISHOT;
+  sqe->user_data= data;
+  _uring_push(uring);
+
+  uring->active++;
+
+  return GEARMAN_SUCCESS;
+}
+
+bool gearmand_uring_recv_once(gearmand_uring_st *uring)
+{
+  if (uring->recv_once)
+    return false;
+
+  uring->recv_once= true;
+  return true;
+}
+
+gearman_return_t gearmand_uring_writev(gearmand_uring_st *uring, int fd,
+                                       const struct iovec *iov, int iov_count,
+                                       uint64_t data)
+{
+  struct io_uring_sqe *sqe;
+  struct iovec *sqe_iov;
+
+  if (iov_count > GEARMAN_SERVER_IOV_MAX)
+  {
+    errno= EINVAL;
+    return GEARMAN_ERRNO;
+  }
+
+  sqe= _uring_sqe(uring);
+  if (sqe == NULL)
+    return GEARMAN_ERRNO;
+
+  /* Each entry has its own buffer list, which is free again by the time the
+     entry is reused since submission is stable. */
+  sqe_iov= &(uring->iovs[(uring->sq_tail & uring->sq_mask) *
+                         GEARMAN_SERVER_IOV_MAX]);
+  memcpy(sqe_iov, iov, (size_t)iov_count * sizeof(struct iovec));
+
+  sqe->opcode= IORING_OP_WRITEV;
+  sqe->fd= fd;
+  sqe->addr= (uintptr_t)sqe_iov;
+  sqe->len= (uint32_t)iov_count;
+  sqe->user_data= data;
+  _uring_push(uring);
+
+  uring->active++;
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t gearmand_uring_cancel(gearmand_uring_st *uring,
+                                       uint64_t data)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe= _uring_sqe(uring);
+  if (sqe == NULL)
+    return GEARMAN_ERRNO;
+
+  sqe->opcode= IORING_OP_ASYNC_CANCEL;
+  sqe->fd= -1;
+  sqe->addr= data;
+  _uring_push(uring);
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t gearmand_uring_wait(gearmand_uring_st *uring)
+{
+  if (_uring_enter(uring, 1, IORING_ENTER_GETEVENTS) == -1)
+  {
+    /* Signals and a full completion queue just mean there is nothing new
+       yet, or that completions need to be taken off first. */
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+      return GEARMAN_SUCCESS;
+
+    return GEARMAN_ERRNO;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+bool gearmand_uring_next(gearmand_uring_st *uring, uint64_t *data,
+                         int32_t *res, bool *more, void **buffer)
+{
+  struct io_uring_cqe *cqe;
+  uint32_t head= *(uring->cq_khead);
+
+  if (head == *((volatile uint32_t *)(uring->cq_ktail)))
+    return false;
+
+  /* Read the entry only after seeing the kernel's tail. */
+  __sync_synchronize();
+
+  cqe= &(((struct io_uring_cqe *)(uring->cqes))[head & uring->cq_mask]);
+  *data= cqe->user_data;
+  *res= cqe->res;
+  *more= cqe->flags & IORING_CQE_F_MORE;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+  {
+    *buffer= uring->buffers + ((size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) *
+                               GEARMAN_CON_BUFFER_SIZE);
+  }
+  else
+    *buffer= NULL;
+
+  /* Hand the entry back only after it was read. */
+  __sync_synchronize();
+  *((volatile uint32_t *)(uring->cq_khead))= head + 1;
+
+  if (*data != 0 && !*more)
+    uring->active--;
+
+  return true;
+}
+
+void gearmand_uring_release(gearmand_uring_st *uring, void *buffer)
+{
+  struct io_uring_buf_ring *buf_ring= uring->buf_ring;
+
+  _uring_buffer_add(uring, (uint16_t)(((uint8_t *)buffer - uring->buffers) /
+                                      GEARMAN_CON_BUFFER_SIZE));
+
+  /* Publish the buffer before the tail that covers it. */
+  __sync_synchronize();
+  *((volatile uint16_t *)&(buf_ring->tail))= uring->buf_tail;
+}
+
+uint32_t gearmand_uring_active(gearmand_uring_st *uring)
+{
+  return uring->active;
+}
+
+/*
+ * Private definitions
+ */
+
+static gearman_return_t _uring_map(gearmand_uring_st *uring,
+                                   struct io_uring_params *params)
+{
+  uint32_t *sq_array;
+  uint32_t x;
+
+  uring->sq_ring_size= params->sq_off.array +
+                       params->sq_entries * sizeof(uint32_t);
+  uring->cq_ring_size= params->cq_off.cqes +
+                       params->cq_entries * sizeof(struct io_uring_cqe);
+  uring->sqes_size= params->sq_entries * sizeof(struct io_uring_sqe);
+
+  /* Newer kernels share one mapping between both rings. */
+  if (params->features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (uring->cq_ring_size > uring->sq_ring_size)
+      uring->sq_ring_size= uring->cq_ring_size;
+    uring->cq_ring_size= uring->sq_ring_size;
+  }
+
+  uring->sq_ring= mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring->fd,
+                       IORING_OFF_SQ_RING);
+  if (uring->sq_ring == MAP_FAILED)
+  {
+    uring->sq_ring= NULL;
+    return GEARMAN_ERRNO;
+  }
+
+  if (params->features & IORING_FEAT_SINGLE_MMAP)
+    uring->cq_ring= uring->sq_ring;
+  else
+  {
+    uring->cq_ring= mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->fd,
+                         IORING_OFF_CQ_RING);
+    if (uring->cq_ring == MAP_FAILED)
+    {
+      uring->cq_ring= NULL;
+      return GEARMAN_ERRNO;
+    }
+  }
+
+  uring->sqes= mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+  if (uring->sqes == MAP_FAILED)
+  {
+    uring->sqes= NULL;
+    return GEARMAN_ERRNO;
+  }
+
+  uring->entries= params->sq_entries;
+  uring->sq_mask= *((uint32_t *)((char *)(uring->sq_ring) +
+                                 params->sq_off.ring_mask));
+  uring->cq_mask= *((uint32_t *)((char *)(uring->cq_ring) +
+                                 params->cq_off.ring_mask));
+  uring->sq_khead= (uint32_t *)((char *)(uring->sq_ring) +
+                                params->sq_off.head);
+  uring->sq_ktail= (uint32_t *)((char *)(uring->sq_ring) +
+                                params->sq_off.tail);
+  uring->cq_khead= (uint32_t *)((char *)(uring->cq_ring) +
+                                params->cq_off.head);
+  uring->cq_ktail= (uint32_t *)((char *)(uring->cq_ring) +
+                                params->cq_off.tail);
+  uring->cqes= (char *)(uring->cq_ring) + params->cq_off.cqes;
+  uring->sq_tail= *(uring->sq_ktail);
+
+  /* Entries are always used in ring order, so the index array never
+     changes. */
+  sq_array= (uint32_t *)((char *)(uring->sq_ring) + params->sq_off.array);
+  for (x= 0; x < uring->entries; x++)
+    sq_array[x]= x;
+
+  return GEARMAN_SUCCESS;
+}
+
+static bool _uring_probe(gearmand_uring_st *uring)
+{
+  struct io_uring_probe *probe;
+  size_t size;
+  bool ret;
+
+  size= sizeof(struct io_uring_probe) +
+        (IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+  probe= calloc(1, size);
+  if (probe == NULL)
+    return false;
+
+  if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE,
+              probe, IORING_OP_LAST) == -1)
+  {
+    free(probe);
+    return false;
+  }
+
+  ret= probe->last_op >= IORING_OP_ACCEPT &&
+       probe->ops[IORING_OP_POLL_ADD].flags & IO_URING_OP_SUPPORTED &&
+       probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED &&
+       probe->ops[IORING_OP_ACCEPT].flags & IO_URING_OP_SUPPORTED &&
+       probe->last_op >= IORING_OP_RECV &&
+       probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED &&
+       probe->ops[IORING_OP_WRITEV].flags & IO_URING_OP_SUPPORTED;
+
+  free(probe);
+
+  return ret;
+}
+
+static gearman_return_t _uring_buffers(gearmand_uring_st *uring)
+{
+  struct io_uring_buf_reg reg;
+  struct io_uring_buf_ring *buf_ring;
+  uint32_t x;
+
+  /* The ring is shared with the kernel, so it must be page aligned. */
+  uring->buf_ring= mmap(NULL,
+                        GEARMAND_URING_BUFFERS * sizeof(struct io_uring_buf),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+  if (uring->buf_ring == MAP_FAILED)
+  {
+    uring->buf_ring= NULL;
+    return GEARMAN_ERRNO;
+  }
+
+  uring->buffers= malloc(GEARMAND_URING_BUFFERS * GEARMAN_CON_BUFFER_SIZE);
+  uring->iovs= malloc(uring->entries * GEARMAN_SERVER_IOV_MAX *
+                      sizeof(struct iovec));
+  if (uring->buffers == NULL || uring->iovs == NULL)
+  {
+    errno= ENOMEM;
+    return GEARMAN_ERRNO;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr= (uintptr_t)(uring->buf_ring);
+  reg.ring_entries= GEARMAND_URING_BUFFERS;
+  reg.bgid= 0;
+
+  if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) == -1)
+  {
+    return GEARMAN_ERRNO;
+  }
+
+  for (x= 0; x < GEARMAND_URING_BUFFERS; x++)
+    _uring_buffer_add(uring, (uint16_t)x);
+
+  buf_ring= uring->buf_ring;
+  __sync_synchronize();
+  *((volatile uint16_t *)&(buf_ring->tail))= uring->buf_tail;
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _uring_buffer_add(gearmand_uring_st *uring, uint16_t bid)
+{
+  struct io_uring_buf_ring *buf_ring= uring->buf_ring;
+  struct io_uring_buf *buf;
+
+  /* The first entry shares its reserved field with the tail, so only the
+     other fields are written. */
+  buf= &(buf_ring->bufs[uring->buf_tail & (GEARMAND_URING_BUFFERS - 1)]);
+  buf->addr= (uintptr_t)(uring->buffers +
+                         ((size_t)bid * GEARMAN_CON_BUFFER_SIZE));
+  buf->len= GEARMAN_CON_BUFFER_SIZE;
+  buf->bid= bid;
+  uring->buf_tail++;
+}
+
+static struct io_uring_sqe *_uring_sqe(gearmand_uring_st *uring)
+{
+  struct io_uring_sqe *sqe;
+  uint32_t head;
+
+  head= *((volatile uint32_t *)(uring->sq_khead));
+  if (uring->sq_tail - head >= uring->entries)
+  {
+    if (_uring_enter(uring, 0, 0) == -1 && errno != EINTR &&
+        errno != EAGAIN && errno != EBUSY)
+    {
+      return NULL;
+    }
+
+    head= *((volatile uint32_t *)(uring->sq_khead));
+    if (uring->sq_tail - head >= uring->entries)
+    {
+      errno= EBUSY;
+      return NULL;
+    }
+  }
+
+  /* Make sure the kernel is done reading the entry before reusing it. */
+  __sync_synchronize();
+
+  sqe= &(((struct io_uring_sqe *)(uring->sqes))[uring->sq_tail &
+                                                 uring->sq_mask]);
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  return sqe;
+}
+
+static void _uring_push(gearmand_uring_st *uring)
+{
+  uring->sq_tail++;
+  uring->pending++;
+
+  /* Publish the entry before the tail that covers it. */
+  __sync_synchronize();
+  *((volatile uint32_t *)(uring->sq_ktail))= uring->sq_tail;
+}
+
+static int _uring_enter(gearmand_uring_st *uring, uint32_t min_complete,
+                        uint32_t flags)
+{
+  int ret;
+
+  ret= (int)syscall(__NR_io_uring_enter, uring->fd, uring->pending,
+                    min_complete, flags, NULL, 0);
+  if (ret > 0)
+    uring->pending-= (uint32_t)ret;
+
+  return ret;
+}
+
+#else /* !GEARMAND_URING_SUPPORTED */
+
+gearman_return_t gearmand_uring_init(gearmand_uring_st *uring,
+                                     uint32_t entries __attribute__ ((unused)))
+{
+  memset(uring, 0, sizeof(gearmand_uring_st));
+  uring->fd= -1;
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+void gearmand_uring_free(gearmand_uring_st *uring __attribute__ ((unused)))
+{
+}
+
+gearman_return_t gearmand_uring_poll(gearmand_uring_st *uring
+                                     __attribute__ ((unused)),
+                                     int fd __attribute__ ((unused)),
+                                     short events __attribute__ ((unused)),
+                                     uint64_t data __attribute__ ((unused)),
+                                     bool multishot __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+gearman_return_t gearmand_uring_accept(gearmand_uring_st *uring
+                                       __attribute__ ((unused)),
+                                       int fd __attribute__ ((unused)),
+                                       uint64_t data __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+bool gearmand_uring_accept_once(gearmand_uring_st *uring
+                                __attribute__ ((unused)))
+{
+  return false;
+}
+
+gearman_return_t gearmand_uring_recv(gearmand_uring_st *uring
+                                     __attribute__ ((unused)),
+                                     int fd __attribute__ ((unused)),
+                                     uint64_t data __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+bool gearmand_uring_recv_once(gearmand_uring_st *uring
+                              __attribute__ ((unused)))
+{
+  return false;
+}
+
+gearman_return_t gearmand_uring_writev(gearmand_uring_st *uring
+                                       __attribute__ ((unused)),
+                                       int fd __attribute__ ((unused)),
+                                       const struct iovec *iov
+                                       __attribute__ ((unused)),
+                                       int iov_count __attribute__ ((unused)),
+                                       uint64_t data __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+gearman_return_t gearmand_uring_cancel(gearmand_uring_st *uring
+                                       __attribute__ ((unused)),
+                                       uint64_t data __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+gearman_return_t gearmand_uring_wait(gearmand_uring_st *uring
+                                     __attribute__ ((unused)))
+{
+  errno= ENOSYS;
+  return GEARMAN_ERRNO;
+}
+
+bool gearmand_uring_next(gearmand_uring_st *uring __attribute__ ((unused)),
+                         uint64_t *data __attribute__ ((unused)),
+                         int32_t *res __attribute__ ((unused)),
+                         bool *more __attribute__ ((unused)),
+                         void **buffer __attribute__ ((unused)))
+{
+  return false;
+}
+
+void gearmand_uring_release(gearmand_uring_st *uring __attribute__ ((unused)),
+                            void *buffer __attribute__ ((unused)))
+{
+}
+
+uint32_t gearmand_uring_active(gearmand_uring_st *uring
+                               __attribute__ ((unused)))
+{
+  return 0;
+}
+
+#endif /* GEARMAND_URING_SUPPORTED */
@@ -0,0 +1,183 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Gearmand io_uring Declarations
+ */
+
+#ifndef __GEARMAND_URING_H__
+#define __GEARMAND_URING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearmand_uring Gearmand io_uring Rings
+ * Thin wrapper around a Linux io_uring instance for the I/O thread loop.
+ * Requests are only queued by the functions below, and all of them are
+ * handed to the kernel by the next gearmand_uring_wait call. Each request
+ * carries a data value that comes back with its completions. A data value of
+ * 0 is reserved for requests whose completions are not interesting, all
+ * others are counted as active until their last completion is seen. Data
+ * is received into buffers from a ring registered with the kernel, which
+ * are handed back with gearmand_uring_release. Only one thread may use a
+ * ring.
+ * @{
+ */
+
+/**
+ * Set up a ring. On failure errno is set, ENOSYS if io_uring or one of the
+ * operations used is not available.
+ * @param uring Ring structure to initialize.
+ * @param entries Number of submission queue entries.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_init(gearmand_uring_st *uring,
+                                     uint32_t entries);
+
+/**
+ * Free a ring. Requests still active are cancelled by the kernel.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ */
+GEARMAN_API
+void gearmand_uring_free(gearmand_uring_st *uring);
+
+/**
+ * Queue a poll request for a file descriptor.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param fd File descriptor to poll.
+ * @param events Poll events to wait for.
+ * @param data Value to return with completions, not 0.
+ * @param multishot Whether to keep polling after each completion.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_poll(gearmand_uring_st *uring, int fd,
+                                     short events, uint64_t data,
+                                     bool multishot);
+
+/**
+ * Queue an accept request for a listening socket. The request is multishot
+ * unless the kernel turned that down before, see gearmand_uring_accept_once.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param fd Listening socket.
+ * @param data Value to return with completions, not 0.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_accept(gearmand_uring_st *uring, int fd,
+                                       uint64_t data);
+
+/**
+ * Use single shot accept requests from now on. Call this when an accept
+ * request completes with -EINVAL on kernels without multishot accept.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @return Whether accept requests were multishot before.
+ */
+GEARMAN_API
+bool gearmand_uring_accept_once(gearmand_uring_st *uring);
+
+/**
+ * Queue a receive request for a socket. Each completion with data comes
+ * with one of the ring's buffers, and a request that runs out of buffers
+ * completes with -ENOBUFS. The request is multishot unless the kernel
+ * turned that down before, see gearmand_uring_recv_once.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param fd Socket to receive from.
+ * @param data Value to return with completions, not 0.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_recv(gearmand_uring_st *uring, int fd,
+                                     uint64_t data);
+
+/**
+ * Use single shot receive requests from now on. Call this when a receive
+ * request completes with -EINVAL on kernels without multishot receive.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @return Whether receive requests were multishot before.
+ */
+GEARMAN_API
+bool gearmand_uring_recv_once(gearmand_uring_st *uring);
+
+/**
+ * Queue a write request for a list of buffers. The list is copied, the data
+ * it points to must stay until the request completes with the number of
+ * bytes written.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param fd File descriptor to write to.
+ * @param iov Buffers to write.
+ * @param iov_count Number of buffers, at most GEARMAN_SERVER_IOV_MAX.
+ * @param data Value to return with the completion, not 0.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_writev(gearmand_uring_st *uring, int fd,
+                                       const struct iovec *iov, int iov_count,
+                                       uint64_t data);
+
+/**
+ * Queue cancellation of an active request. The request still completes,
+ * with -ECANCELED if it had not already finished.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param data Value given when the request was queued.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_cancel(gearmand_uring_st *uring,
+                                       uint64_t data);
+
+/**
+ * Submit all queued requests and wait for at least one completion, in a
+ * single system call.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearmand_uring_wait(gearmand_uring_st *uring);
+
+/**
+ * Take the next completion off the ring.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param data Value given when the request was queued.
+ * @param res Result of the request, a negative errno on failure.
+ * @param more Whether the request is still active.
+ * @param buffer Receive buffer holding the data, or NULL. It must be handed
+ *        back with gearmand_uring_release once the data is used.
+ * @return Whether there was a completion.
+ */
+GEARMAN_API
+bool gearmand_uring_next(gearmand_uring_st *uring, uint64_t *data,
+                         int32_t *res, bool *more, void **buffer);
+
+/**
+ * Hand a receive buffer back to the kernel.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @param buffer Buffer returned by gearmand_uring_next.
+ */
+GEARMAN_API
+void gearmand_uring_release(gearmand_uring_st *uring, void *buffer);
+
+/**
+ * Get the number of requests that have not completed for the last time.
+ * @param uring Ring structure previously initialized with gearmand_uring_init.
+ * @return Number of active requests.
+ */
+GEARMAN_API
+uint32_t gearmand_uring_active(gearmand_uring_st *uring);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAND_URING_H__ */
@@ -68,6 +68,14 @@ gearman_command_info_st gearman_command_info_list[GEARMAN_COMMAND_MAX]=
   { "SUBMIT_JOB_EPOCH",   3, true  }
 };
 
+/**
+ * Point the arguments of a binary packet at the input data, if all of them
+ * are there already.
+ * @return Size of the arguments, or 0 if they were not all there.
+ */
+static size_t _packet_pin_args(gearman_packet_st *packet, const uint8_t *data,
+                               size_t data_size);
+
 /** @} */
 
 /*
@@ -183,6 +191,7 @@ gearman_return_t gearman_packet_add_arg(gearman_packet_st *packet,
                                         const void *arg, size_t arg_size)
 {
   void *new_args;
+  bool from_buffer;
   size_t offset;
   uint8_t x;
 
@@ -209,17 +218,18 @@ gearman_return_t gearman_packet_add_arg(gearman_packet_st *packet,
     packet->args= packet->args_buffer;
   else
   {
-    if (packet->args == packet->args_buffer)
-      packet->args= NULL;
-
-    new_args= realloc(packet->args, packet->args_size + arg_size);
+    /* Only the first move to the heap copies from args_buffer, realloc
+       keeps what is there after that. */
+    from_buffer= packet->args == NULL || packet->args == packet->args_buffer;
+    new_args= realloc(from_buffer ? NULL : packet->args,
+                      packet->args_size + arg_size);
     if (new_args == NULL)
     {
       GEARMAN_ERROR_SET(packet->gearman, "gearman_packet_add_arg", "realloc")
       return GEARMAN_MEMORY_ALLOCATION_FAILURE;
     }
 
-    if (packet->args_size > 0)
+    if (from_buffer && packet->args_size > 0)
       memcpy(new_args, packet->args_buffer, packet->args_size);
 
     packet->args= new_args;
@@ -356,7 +366,7 @@ size_t gearman_packet_pack(gearman_packet_st *packet,
 }
 
 size_t gearman_packet_unpack(gearman_packet_st *packet,
-                             gearman_con_st *con __attribute__ ((unused)),
+                             gearman_con_st *con,
                              const void *data, size_t data_size,
                              gearman_return_t *ret_ptr)
 {
@@ -420,6 +430,21 @@ size_t gearman_packet_unpack(gearman_packet_st *packet,
       return 0;
 
     used_size= GEARMAN_PACKET_HEADER_SIZE;
+
+    /* Skip copying the arguments if the connection keeps its receive buffer
+       in place until the packet is done with. */
+    if (con != NULL && con->options & GEARMAN_CON_PIN_ARGS &&
+        gearman_command_info_list[packet->command].argc > 0)
+    {
+      arg_size= _packet_pin_args(packet, ((uint8_t *)data) + used_size,
+                                 data_size - used_size);
+      if (arg_size > 0)
+      {
+        con->options|= GEARMAN_CON_RECV_PINNED;
+        *ret_ptr= GEARMAN_SUCCESS;
+        return used_size + arg_size;
+      }
+    }
   }
   else
     used_size= 0;
@@ -479,3 +504,210 @@ void *gearman_packet_take_data(gearman_packet_st *packet, size_t *size)
 
   return data;
 }
+
+gearman_return_t gearman_packet_unpin_args(gearman_packet_st *packet)
+{
+  uint8_t *arg[GEARMAN_MAX_COMMAND_ARGS];
+  size_t arg_size[GEARMAN_MAX_COMMAND_ARGS];
+  uint8_t argc= packet->argc;
+  gearman_return_t ret;
+  uint8_t x;
+
+  if (!(packet->options & GEARMAN_PACKET_PINNED_ARGS))
+    return GEARMAN_SUCCESS;
+
+  memcpy(arg, packet->arg, sizeof(uint8_t *) * argc);
+  memcpy(arg_size, packet->arg_size, sizeof(size_t) * argc);
+
+  /* The header is still in args_buffer, add the arguments after it. */
+  packet->options&= (gearman_packet_options_t)~GEARMAN_PACKET_PINNED_ARGS;
+  packet->argc= 0;
+  packet->args_size= 0;
+
+  for (x= 0; x < argc; x++)
+  {
+    ret= gearman_packet_add_arg(packet, arg[x], arg_size[x]);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
+bool gearman_packet_framed(gearman_packet_st *packet)
+{
+  return packet->magic != GEARMAN_MAGIC_TEXT && packet->data_size > 0 &&
+         gearman_command_info_list[packet->command].data;
+}
+
+gearman_return_t gearman_packet_frame_check(gearman_st *gearman,
+                                            const void *frame,
+                                            size_t frame_size,
+                                            gearman_frame_t *type,
+                                            size_t *data_size)
+{
+  const uint8_t *ptr= frame;
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  uint32_t tmp;
+#endif
+
+  if (frame_size >= GEARMAN_FRAME_RAW_SIZE && ptr[0] == GEARMAN_FRAME_RAW)
+  {
+    *type= GEARMAN_FRAME_RAW;
+    *data_size= frame_size - GEARMAN_FRAME_RAW_SIZE;
+    return GEARMAN_SUCCESS;
+  }
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  if (frame_size > GEARMAN_FRAME_ZLIB_SIZE && ptr[0] == GEARMAN_FRAME_ZLIB)
+  {
+    memcpy(&tmp, ptr + 1, 4);
+    tmp= ntohl(tmp);
+
+    /* A size zlib could never inflate to is not trusted with a buffer. */
+    if (tmp > 0 && tmp / GEARMAN_FRAME_ZLIB_RATIO <=
+                   frame_size - GEARMAN_FRAME_ZLIB_SIZE)
+    {
+      *type= GEARMAN_FRAME_ZLIB;
+      *data_size= tmp;
+      return GEARMAN_SUCCESS;
+    }
+  }
+#endif
+
+  GEARMAN_ERROR_SET(gearman, "gearman_packet_frame_check", "invalid frame")
+  return GEARMAN_INVALID_PACKET;
+}
+
+void *gearman_packet_frame_decode(gearman_st *gearman, const void *frame,
+                                  size_t frame_size, size_t *data_size,
+                                  gearman_return_t *ret_ptr)
+{
+  const uint8_t *ptr= frame;
+  gearman_frame_t type;
+  void *data;
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  z_stream stream;
+  int ret;
+#endif
+
+  *ret_ptr= gearman_packet_frame_check(gearman, frame, frame_size, &type,
+                                       data_size);
+  if (*ret_ptr != GEARMAN_SUCCESS || *data_size == 0)
+    return NULL;
+
+  if (gearman->workload_malloc == NULL)
+    data= malloc(*data_size);
+  else
+  {
+    data= gearman->workload_malloc(*data_size,
+                                   (void *)(gearman->workload_malloc_arg));
+  }
+  if (data == NULL)
+  {
+    GEARMAN_ERROR_SET(gearman, "gearman_packet_frame_decode", "malloc")
+    *ret_ptr= GEARMAN_MEMORY_ALLOCATION_FAILURE;
+    return NULL;
+  }
+
+  if (type == GEARMAN_FRAME_RAW)
+  {
+    memcpy(data, ptr + GEARMAN_FRAME_RAW_SIZE, *data_size);
+    return data;
+  }
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  memset(&stream, 0, sizeof(z_stream));
+  if (inflateInit(&stream) == Z_OK)
+  {
+    stream.next_in= (Bytef *)(ptr + GEARMAN_FRAME_ZLIB_SIZE);
+    stream.avail_in= (uInt)(frame_size - GEARMAN_FRAME_ZLIB_SIZE);
+    stream.next_out= data;
+    stream.avail_out= (uInt)(*data_size);
+
+    ret= inflate(&stream, Z_FINISH);
+    (void)inflateEnd(&stream);
+
+    if (ret == Z_STREAM_END && stream.avail_in == 0 && stream.avail_out == 0)
+      return data;
+  }
+#endif
+
+  if (gearman->workload_free == NULL)
+    free(data);
+  else
+    gearman->workload_free(data, (void *)(gearman->workload_free_arg));
+
+  GEARMAN_ERROR_SET(gearman, "gearman_packet_frame_decode", "corrupt frame")
+  *ret_ptr= GEARMAN_INVALID_PACKET;
+  return NULL;
+}
+
+void gearman_packet_give_data(gearman_packet_st *packet, void *data,
+                              size_t data_size)
+{
+  if (packet->options & GEARMAN_PACKET_FREE_DATA && packet->data != NULL)
+  {
+    if (packet->gearman->workload_free == NULL)
+      free((void *)(packet->data));
+    else
+    {
+      packet->gearman->workload_free((void *)(packet->data),
+                                  (void *)(packet->gearman->workload_free_arg));
+    }
+  }
+
+  packet->data= data;
+  packet->data_size= data_size;
+  packet->options|= GEARMAN_PACKET_FREE_DATA;
+}
+
+/*
+ * Private definitions
+ */
+
+static size_t _packet_pin_args(gearman_packet_st *packet, const uint8_t *data,
+                               size_t data_size)
+{
+  uint8_t argc= gearman_command_info_list[packet->command].argc;
+  bool has_data= gearman_command_info_list[packet->command].data;
+  const uint8_t *ptr;
+  size_t used_size= 0;
+  uint8_t x;
+
+  /* Only look inside this packet, anything odd is left to the copying
+     parser. */
+  if (data_size > packet->data_size)
+    data_size= packet->data_size;
+
+  /* Arguments are NUL terminated, except the last one of a command without
+     data, which is whatever is left of the packet. */
+  for (x= 0; x < argc; x++)
+  {
+    if (x == argc - 1 && !has_data)
+    {
+      if (data_size < packet->data_size)
+        return 0;
+
+      packet->arg_size[x]= packet->data_size - used_size;
+    }
+    else
+    {
+      ptr= memchr(data + used_size, 0, data_size - used_size);
+      if (ptr == NULL)
+        return 0;
+
+      packet->arg_size[x]= (size_t)(ptr - (data + used_size)) + 1;
+    }
+
+    packet->arg[x]= (uint8_t *)(data + used_size);
+    used_size+= packet->arg_size[x];
+  }
+
+  packet->argc= argc;
+  packet->args_size+= used_size;
+  packet->data_size-= used_size;
+  packet->options|= GEARMAN_PACKET_PINNED_ARGS;
+
+  return used_size;
+}
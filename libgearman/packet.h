@@ -109,6 +109,53 @@ size_t gearman_packet_unpack(gearman_packet_st *packet, gearman_con_st *con,
 GEARMAN_API
 void *gearman_packet_take_data(gearman_packet_st *packet, size_t *size);
 
+/**
+ * Copy arguments that still point into the receive buffer of a connection
+ * with GEARMAN_CON_PIN_ARGS set into the packet, so it can be kept past the
+ * next gearman_con_recv call on that connection.
+ */
+GEARMAN_API
+gearman_return_t gearman_packet_unpin_args(gearman_packet_st *packet);
+
+/**
+ * See if the data of a packet is framed on a connection that negotiated
+ * compression. Every packet of a command that carries data is, unless the
+ * data is empty. A frame is a gearman_frame_t byte, then for
+ * GEARMAN_FRAME_RAW the data as is, or for GEARMAN_FRAME_ZLIB the size of
+ * the data as a 32-bit big-endian integer and a zlib stream of it.
+ */
+GEARMAN_API
+bool gearman_packet_framed(gearman_packet_st *packet);
+
+/**
+ * Check a frame, and get its encoding and the size of the data it holds.
+ * Frames using zlib are only accepted if the library was built with it.
+ */
+GEARMAN_API
+gearman_return_t gearman_packet_frame_check(gearman_st *gearman,
+                                            const void *frame,
+                                            size_t frame_size,
+                                            gearman_frame_t *type,
+                                            size_t *data_size);
+
+/**
+ * Decode a frame into a buffer from the workload malloc function, which the
+ * caller has to free. NULL is also returned with GEARMAN_SUCCESS for a frame
+ * holding no data.
+ */
+GEARMAN_API
+void *gearman_packet_frame_decode(gearman_st *gearman, const void *frame,
+                                  size_t frame_size, size_t *data_size,
+                                  gearman_return_t *ret_ptr);
+
+/**
+ * Give a packet data allocated with the workload malloc function, freeing
+ * the data it had if it owned it.
+ */
+GEARMAN_API
+void gearman_packet_give_data(gearman_packet_st *packet, void *data,
+                              size_t data_size);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -33,10 +33,16 @@ gearman_return_t _queue_replay_add(gearman_st *gearman, void *fn_arg,
                                    size_t data_size,
                                    gearman_job_priority_t priority);
 
+/**
+ * Create the slab depots for server objects.
+ */
+static gearman_return_t _server_slab_create(gearman_server_st *server);
+
 /**
  * Queue an error packet.
  */
 static gearman_return_t _server_error_packet(gearman_server_con_st *server_con,
+                                             gearman_server_shard_st *shard,
                                              const char *error_code,
                                              const char *error_string);
 
@@ -44,13 +50,57 @@ static gearman_return_t _server_error_packet(gearman_server_con_st *server_con,
  * Process text commands for a connection.
  */
 static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
+                                         gearman_server_shard_st *shard,
                                          gearman_packet_st *packet);
 
+/**
+ * Make sure a text response buffer has room for at least need more bytes
+ * after size.
+ */
+static gearman_return_t _server_text_reserve(gearman_packet_st *packet,
+                                             char **data, size_t *total,
+                                             size_t size, size_t need);
+
+/**
+ * Check the frame header of a packet from a connection that negotiated
+ * compression, and with decode set replace the data with what it holds.
+ * Without decode zlib data is left compressed, it is only inflated for
+ * connections that did not negotiate compression.
+ */
+static gearman_return_t _server_packet_unframe(gearman_packet_st *packet,
+                                               bool decode);
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+/**
+ * See if compression can be turned on for a connection. Shards frame data
+ * as they queue it, so it is only safe when no shard can be queueing data
+ * for the connection. Anything they queued before is moved onto the
+ * connection first, so it goes out ahead of the option response.
+ */
+static bool _server_con_compress_ready(gearman_server_con_st *server_con,
+                                       gearman_server_shard_st *shard);
+#endif
+
+/**
+ * Fail a job for all its clients and remove it.
+ */
+static gearman_return_t _server_job_fail(gearman_server_shard_st *shard,
+                                         gearman_server_job_st *server_job);
+
+/**
+ * Send a client WORK_FAIL in place of a work result whose data does not
+ * decode for it.
+ */
+static gearman_return_t
+_server_client_fail(gearman_server_client_st *server_client,
+                    gearman_server_shard_st *shard, gearman_packet_st *packet);
+
 /**
  * Send work result packets with data back to clients.
  */
 static gearman_return_t
-_server_queue_work_data(gearman_server_job_st *server_job,
+_server_queue_work_data(gearman_server_con_st *server_con,
+                        gearman_server_job_st *server_job,
                         gearman_packet_st *packet, gearman_command_t command);
 
 /**
@@ -82,28 +132,36 @@ gearman_server_st *gearman_server_create(gearman_server_st *server)
 
   server->shutdown= false;
   server->shutdown_graceful= false;
-  server->proc_wakeup= false;
   server->proc_shutdown= false;
   server->thread_count= 0;
-  server->free_packet_count= 0;
-  server->function_count= 0;
-  server->job_count= 0;
-  server->unique_count= 0;
-  server->free_job_count= 0;
-  server->free_client_count= 0;
-  server->free_worker_count= 0;
+  server->shard_count= 0;
+  server->proc_cpu_count= 0;
+  server->proc_packets= GEARMAN_SERVER_PROC_PACKETS;
+  server->proc_bytes= GEARMAN_SERVER_PROC_BYTES;
+  server->proc_cpus= NULL;
+  server->gearman= NULL;
   server->thread_list= NULL;
-  server->free_packet_list= NULL;
-  server->function_list= NULL;
-  server->free_job_list= NULL;
-  server->free_client_list= NULL;
-  server->free_worker_list= NULL;
+  server->shard= NULL;
   server->log_fn= NULL;
   server->log_fn_arg= NULL;
-  memset(server->job_hash, 0,
-         sizeof(gearman_server_job_st *) * GEARMAN_JOB_HASH_SIZE);
-  memset(server->unique_hash, 0,
-         sizeof(gearman_server_job_st *) * GEARMAN_JOB_HASH_SIZE);
+
+  if (_server_slab_create(server) != GEARMAN_SUCCESS)
+  {
+    if (server->options & GEARMAN_SERVER_ALLOCATED)
+      free(server);
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&(server->queue_lock), NULL) != 0)
+  {
+    gearman_server_slab_free(&(server->worker_slab));
+    gearman_server_slab_free(&(server->client_slab));
+    gearman_server_slab_free(&(server->job_slab));
+    gearman_server_slab_free(&(server->packet_slab));
+    if (server->options & GEARMAN_SERVER_ALLOCATED)
+      free(server);
+    return NULL;
+  }
 
   server->gearman= gearman_create(&(server->gearman_static));
   if (server->gearman == NULL)
@@ -112,66 +170,46 @@ gearman_server_st *gearman_server_create(gearman_server_st *server)
     return NULL;
   }
 
+  if (gearman_server_set_shards(server, 1) != GEARMAN_SUCCESS)
+  {
+    gearman_server_free(server);
+    return NULL;
+  }
+
   if (uname(&un) == -1)
   {
     gearman_server_free(server);
     return NULL;
   }
 
-  snprintf(server->job_handle_prefix, GEARMAN_JOB_HANDLE_SIZE, "H:%s",
+  /* Leave room for "H:", ":", the largest job handle number and the NUL. */
+  snprintf(server->job_handle_prefix, GEARMAN_JOB_HANDLE_SIZE, "H:%.*s:",
+           (int)(GEARMAN_JOB_HANDLE_SIZE - GEARMAN_JOB_HANDLE_DIGITS - 4),
            un.nodename);
-  server->job_handle_count= 1;
+  server->job_handle_prefix_size= strlen(server->job_handle_prefix);
 
   return server;
 }
 
 void gearman_server_free(gearman_server_st *server)
 {
-  uint32_t key;
-  gearman_server_packet_st *packet;
-  gearman_server_job_st *job;
-  gearman_server_client_st *client;
-  gearman_server_worker_st *worker;
+  uint32_t x;
 
   /* All threads should be cleaned up before calling this. */
   assert(server->thread_list == NULL);
 
-  for (key= 0; key < GEARMAN_JOB_HASH_SIZE; key++)
-  {
-    while (server->job_hash[key] != NULL)
-      gearman_server_job_free(server->job_hash[key]);
-  }
-
-  while (server->function_list != NULL)
-    gearman_server_function_free(server->function_list);
+  for (x= 0; x < server->shard_count; x++)
+    gearman_server_shard_free(&(server->shard[x]));
 
-  while (server->free_packet_list != NULL)
-  {
-    packet= server->free_packet_list;
-    server->free_packet_list= packet->next;
-    free(packet);
-  }
+  if (server->shard != NULL)
+    free(server->shard);
 
-  while (server->free_job_list != NULL)
-  {
-    job= server->free_job_list;
-    server->free_job_list= job->next;
-    free(job);
-  }
+  gearman_server_slab_free(&(server->packet_slab));
+  gearman_server_slab_free(&(server->job_slab));
+  gearman_server_slab_free(&(server->client_slab));
+  gearman_server_slab_free(&(server->worker_slab));
 
-  while (server->free_client_list != NULL)
-  {
-    client= server->free_client_list;
-    server->free_client_list= client->con_next;
-    free(client);
-  }
-
-  while (server->free_worker_list != NULL)
-  {
-    worker= server->free_worker_list;
-    server->free_worker_list= worker->con_next;
-    free(worker);
-  }
+  (void) pthread_mutex_destroy(&(server->queue_lock));
 
   if (server->gearman != NULL)
     gearman_free(server->gearman);
@@ -189,7 +227,116 @@ void gearman_server_set_log(gearman_server_st *server,
   gearman_set_log(server->gearman, _log, server, verbose);
 }
 
+gearman_return_t gearman_server_set_shards(gearman_server_st *server,
+                                           uint32_t shard_count)
+{
+  gearman_server_shard_st *shard;
+  uint32_t x;
+
+  if (shard_count == 0)
+    shard_count= 1;
+  else if (shard_count > GEARMAN_SERVER_SHARD_MAX)
+    shard_count= GEARMAN_SERVER_SHARD_MAX;
+
+  /* Connections and functions are laid out for the current shard count. */
+  if (server->thread_list != NULL)
+    return GEARMAN_UNKNOWN_STATE;
+
+  for (x= 0; x < server->shard_count; x++)
+  {
+    if (server->shard[x].function_list != NULL)
+      return GEARMAN_UNKNOWN_STATE;
+  }
+
+  shard= malloc(sizeof(gearman_server_shard_st) * shard_count);
+  if (shard == NULL)
+  {
+    GEARMAN_ERROR_SET(server->gearman, "gearman_server_set_shards", "malloc")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  for (x= 0; x < shard_count; x++)
+  {
+    if (gearman_server_shard_create(server, &(shard[x]), x) == NULL)
+    {
+      while (x > 0)
+        gearman_server_shard_free(&(shard[--x]));
+      free(shard);
+      GEARMAN_ERROR_SET(server->gearman, "gearman_server_set_shards",
+                        "gearman_server_shard_create")
+      return GEARMAN_PTHREAD;
+    }
+  }
+
+  for (x= 0; x < server->shard_count; x++)
+    gearman_server_shard_free(&(server->shard[x]));
+
+  if (server->shard != NULL)
+    free(server->shard);
+
+  server->shard= shard;
+  server->shard_count= shard_count;
+
+  return GEARMAN_SUCCESS;
+}
+
+void gearman_server_set_proc_budget(gearman_server_st *server,
+                                    uint32_t packets, uint32_t bytes)
+{
+  server->proc_packets= packets == 0 ? GEARMAN_SERVER_PROC_PACKETS : packets;
+  server->proc_bytes= bytes == 0 ? GEARMAN_SERVER_PROC_BYTES : bytes;
+}
+
+gearman_return_t gearman_server_set_proc_cpus(gearman_server_st *server,
+                                              const uint32_t *cpus,
+                                              uint32_t cpu_count)
+{
+  uint32_t x;
+
+  /* Processing threads start with the second I/O thread. */
+  if (server->options & GEARMAN_SERVER_PROC_THREAD)
+    return GEARMAN_UNKNOWN_STATE;
+
+  for (x= 0; x < cpu_count; x++)
+  {
+    if (!gearman_server_thread_cpu_valid(cpus[x]))
+    {
+      GEARMAN_ERROR_SET(server->gearman, "gearman_server_set_proc_cpus",
+                        "can not pin threads to CPU %u", cpus[x])
+      return GEARMAN_PTHREAD;
+    }
+  }
+
+  server->proc_cpus= cpus;
+  server->proc_cpu_count= cpu_count;
+
+  return GEARMAN_SUCCESS;
+}
+
+uint32_t gearman_server_job_count(gearman_server_st *server)
+{
+  uint32_t job_count= 0;
+  uint32_t x;
+
+  for (x= 0; x < server->shard_count; x++)
+    job_count+= *((volatile uint32_t *)&(server->shard[x].job_count));
+
+  return job_count;
+}
+
+bool gearman_server_run_inline(gearman_packet_st *packet)
+{
+  if (packet->magic != GEARMAN_MAGIC_REQUEST)
+    return false;
+
+  /* Job status comes from the job slots, see gearman_server_job_status(). */
+  return packet->command == GEARMAN_COMMAND_ECHO_REQ ||
+         packet->command == GEARMAN_COMMAND_GET_STATUS ||
+         packet->command == GEARMAN_COMMAND_OPTION_REQ;
+}
+
 gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
+                                            gearman_server_shard_st *shard,
                                             gearman_packet_st *packet)
 {
   gearman_return_t ret;
@@ -199,12 +346,22 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
   gearman_server_client_st *server_client;
   char numerator_buffer[11]; /* Max string size to hold a uint32_t. */
   char denominator_buffer[11]; /* Max string size to hold a uint32_t. */
+  uint32_t numerator;
+  uint32_t denominator;
+  bool running;
+  bool background;
+  bool framed;
   gearman_job_priority_t priority;
+  gearman_server_shard_st *next;
   gearman_st *gearman= gearman= server_con->thread->server->gearman;
 
+  /* Shards report the connections that sent them packets. */
+  if (shard != NULL)
+    gearman_server_con_list_add(server_con, shard);
+
   if (packet->magic == GEARMAN_MAGIC_RESPONSE)
   {
-    return _server_error_packet(server_con, "bad_magic",
+    return _server_error_packet(server_con, shard, "bad_magic",
                                 "Request magic expected");
   }
 
@@ -213,7 +370,8 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
   /* Client/worker requests. */
   case GEARMAN_COMMAND_ECHO_REQ:
     /* Reuse the data buffer and just shove the data back. */
-    ret= gearman_server_io_packet_add(server_con, true, GEARMAN_MAGIC_RESPONSE,
+    ret= gearman_server_io_packet_add(server_con, shard, true,
+                                      GEARMAN_MAGIC_RESPONSE,
                                       GEARMAN_COMMAND_ECHO_RES, packet->data,
                                       packet->data_size, NULL);
     if (ret != GEARMAN_SUCCESS)
@@ -244,43 +402,65 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     else
       priority= GEARMAN_JOB_PRIORITY_LOW;
 
-    if (packet->command == GEARMAN_COMMAND_SUBMIT_JOB_BG ||
-        packet->command == GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG ||
-        packet->command == GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG)
+    background= packet->command == GEARMAN_COMMAND_SUBMIT_JOB_BG ||
+                packet->command == GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG ||
+                packet->command == GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG;
+
+    /* Jobs keep framed data for workers, unless something else needs to
+       look into it: the persistent queue or a unique key taken from it. */
+    framed= (server_con->options & GEARMAN_SERVER_CON_COMPRESS) &&
+            gearman_packet_framed(packet);
+    if (framed)
     {
-      server_client= NULL;
+      if ((background && gearman->queue_add_fn != NULL) ||
+          (packet->arg_size[1] == 2 && *((char *)(packet->arg[1])) == '-'))
+      {
+        framed= false;
+      }
+
+      ret= _server_packet_unframe(packet, !framed);
+      if (ret == GEARMAN_INVALID_PACKET)
+      {
+        return _server_error_packet(server_con, shard, "invalid_frame",
+                                    "Job data is not a valid frame");
+      }
+      else if (ret != GEARMAN_SUCCESS)
+        return ret;
     }
+
+    if (background)
+      server_client= NULL;
     else
     {
-      server_client= gearman_server_client_add(server_con);
+      server_client= gearman_server_client_add(server_con, shard);
       if (server_client == NULL)
         return GEARMAN_MEMORY_ALLOCATION_FAILURE;
     }
 
     /* Create a job. */
-    server_job= gearman_server_job_add(server_con->thread->server,
-                                       (char *)(packet->arg[0]),
+    server_job= gearman_server_job_add(shard, (char *)(packet->arg[0]),
                                        packet->arg_size[0] - 1,
                                        (char *)(packet->arg[1]),
                                        packet->arg_size[1] - 1, packet->data,
                                        packet->data_size, priority,
                                        server_client, &ret);
     if (ret == GEARMAN_SUCCESS)
+    {
       packet->options&= (gearman_packet_options_t)~GEARMAN_PACKET_FREE_DATA;
+      if (framed)
+        server_job->options|= GEARMAN_SERVER_JOB_FRAMED;
+    }
     else if (ret == GEARMAN_JOB_QUEUE_FULL)
     {
-      return _server_error_packet(server_con, "queue_full",
+      return _server_error_packet(server_con, shard, "queue_full",
                                   "Job queue is full");
     }
     else if (ret != GEARMAN_JOB_EXISTS)
       return ret;
 
     /* Queue the job created packet. */
-    ret= gearman_server_io_packet_add(server_con, false, GEARMAN_MAGIC_RESPONSE,
-                                      GEARMAN_COMMAND_JOB_CREATED,
-                                      server_job->job_handle,
-                                      (size_t)strlen(server_job->job_handle),
-                                      NULL);
+    ret= gearman_server_io_packet_add_job_created(server_con, shard,
+                                                  server_job);
     if (ret != GEARMAN_SUCCESS)
       return ret;
 
@@ -291,12 +471,13 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     snprintf(job_handle, GEARMAN_JOB_HANDLE_SIZE, "%.*s",
              (uint32_t)(packet->arg_size[0]), (char *)(packet->arg[0]));
 
-    server_job= gearman_server_job_get(server_con->thread->server, job_handle);
-
     /* Queue status result packet. */
-    if (server_job == NULL)
+    if (!gearman_server_job_status(server_con->thread->server,
+                                   (char *)(packet->arg[0]),
+                                   packet->arg_size[0], &running, &numerator,
+                                   &denominator))
     {
-      ret= gearman_server_io_packet_add(server_con, false,
+      ret= gearman_server_io_packet_add(server_con, shard, false,
                                         GEARMAN_MAGIC_RESPONSE,
                                         GEARMAN_COMMAND_STATUS_RES, job_handle,
                                         (size_t)(strlen(job_handle) + 1),
@@ -305,15 +486,14 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     }
     else
     {
-      snprintf(numerator_buffer, 11, "%u", server_job->numerator);
-      snprintf(denominator_buffer, 11, "%u", server_job->denominator);
+      snprintf(numerator_buffer, 11, "%u", numerator);
+      snprintf(denominator_buffer, 11, "%u", denominator);
 
-      ret= gearman_server_io_packet_add(server_con, false,
+      ret= gearman_server_io_packet_add(server_con, shard, false,
                                         GEARMAN_MAGIC_RESPONSE,
                                         GEARMAN_COMMAND_STATUS_RES, job_handle,
                                         (size_t)(strlen(job_handle) + 1),
-                                        "1", (size_t)2,
-                                        server_job->worker == NULL ? "0" : "1",
+                                        "1", (size_t)2, running ? "1" : "0",
                                         (size_t)2, numerator_buffer,
                                         (size_t)(strlen(numerator_buffer) + 1),
                                         denominator_buffer,
@@ -332,13 +512,27 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
              (uint32_t)(packet->arg_size[0]), (char *)(packet->arg[0]));
     if (!strcasecmp(option, "exceptions"))
       server_con->options|= GEARMAN_SERVER_CON_EXCEPTIONS;
+#ifdef GEARMAN_ZLIB_SUPPORTED
+    else if (!strcasecmp(option, "compress"))
+    {
+      if (!_server_con_compress_ready(server_con, shard))
+      {
+        return _server_error_packet(server_con, shard, "option_busy",
+                                    "Compression can't be turned on while "
+                                    "results are pending");
+      }
+
+      server_con->options|= GEARMAN_SERVER_CON_COMPRESS;
+    }
+#endif
     else
     {
-      return _server_error_packet(server_con, "unknown_option",
+      return _server_error_packet(server_con, shard, "unknown_option",
                                   "Server does not recognize given option");
     }
 
-    ret= gearman_server_io_packet_add(server_con, false, GEARMAN_MAGIC_RESPONSE,
+    ret= gearman_server_io_packet_add(server_con, shard, false,
+                                      GEARMAN_MAGIC_RESPONSE,
                                       GEARMAN_COMMAND_OPTION_RES,
                                       packet->arg[0], packet->arg_size[0],
                                       NULL);
@@ -349,7 +543,8 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
 
   /* Worker requests. */
   case GEARMAN_COMMAND_CAN_DO:
-    if (gearman_server_worker_add(server_con, (char *)(packet->arg[0]),
+    if (gearman_server_worker_add(server_con, shard,
+                                  (char *)(packet->arg[0]),
                                   packet->arg_size[0], 0) == NULL)
     {
       return GEARMAN_MEMORY_ALLOCATION_FAILURE;
@@ -358,7 +553,8 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_CAN_DO_TIMEOUT:
-    if (gearman_server_worker_add(server_con, (char *)(packet->arg[0]),
+    if (gearman_server_worker_add(server_con, shard,
+                                  (char *)(packet->arg[0]),
                                   packet->arg_size[0] - 1,
                                   (in_port_t)atoi((char *)(packet->arg[1])))
          == NULL)
@@ -369,72 +565,92 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_CANT_DO:
-    gearman_server_con_free_worker(server_con, (char *)(packet->arg[0]),
+    gearman_server_con_free_worker(server_con, shard,
+                                   (char *)(packet->arg[0]),
                                    packet->arg_size[0]);
     break;
 
+  /* The next three are run by each shard the worker has functions in, lowest
+     first, with each shard forwarding to the next one as needed. */
   case GEARMAN_COMMAND_RESET_ABILITIES:
-    gearman_server_con_free_workers(server_con);
+    gearman_server_con_free_workers(server_con, shard);
+
+    next= gearman_server_shard_next(shard, server_con);
+    if (next != NULL)
+      return gearman_server_shard_forward(shard, next, server_con,
+                                          packet->command);
+
     break;
 
   case GEARMAN_COMMAND_PRE_SLEEP:
-    server_job= gearman_server_job_peek(server_con);
+    server_job= gearman_server_job_peek(server_con, shard);
     if (server_job == NULL)
-      server_con->options|= GEARMAN_SERVER_CON_SLEEPING;
+    {
+      ret= gearman_server_con_sleep(server_con, shard);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      next= gearman_server_shard_next(shard, server_con);
+      if (next != NULL)
+        ret= gearman_server_shard_forward(shard, next, server_con,
+                                          packet->command);
+    }
     else
     {
       /* If there are jobs that could be run, queue a NOOP packet to wake the
          worker up. This could be the result of a race codition. */
-      ret= gearman_server_io_packet_add(server_con, false,
-                                        GEARMAN_MAGIC_RESPONSE,
-                                        GEARMAN_COMMAND_NOOP, NULL);
-      if (ret != GEARMAN_SUCCESS)
-        return ret;
+      ret= gearman_server_con_wake(server_con, server_job->function);
     }
 
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
     break;
 
   case GEARMAN_COMMAND_GRAB_JOB:
   case GEARMAN_COMMAND_GRAB_JOB_UNIQ:
-    server_con->options&=
-                     (gearman_server_con_options_t)~GEARMAN_SERVER_CON_SLEEPING;
+    gearman_server_con_awake(server_con, shard);
+
+    server_job= gearman_server_job_take(server_con, shard);
+    if (server_job == NULL &&
+        (next= gearman_server_shard_next(shard, server_con)) != NULL)
+    {
+      /* Nothing here, let the next shard try before answering. */
+      ret= gearman_server_con_wake_clear(server_con, shard);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      return gearman_server_shard_forward(shard, next, server_con,
+                                          packet->command);
+    }
 
-    server_job= gearman_server_job_take(server_con);
     if (server_job == NULL)
     {
       /* No jobs found, queue no job packet. */
-      ret= gearman_server_io_packet_add(server_con, false,
-                                        GEARMAN_MAGIC_RESPONSE,
-                                        GEARMAN_COMMAND_NO_JOB, NULL);
-    }
-    else if (packet->command == GEARMAN_COMMAND_GRAB_JOB_UNIQ)
-    {
-      /* We found a runnable job, queue job assigned packet and take the job
-         off the queue. */
-      ret= gearman_server_io_packet_add(server_con, false,
-                                   GEARMAN_MAGIC_RESPONSE,
-                                   GEARMAN_COMMAND_JOB_ASSIGN_UNIQ,
-                                   server_job->job_handle,
-                                   (size_t)(strlen(server_job->job_handle) + 1),
-                                   server_job->function->function_name,
-                                   server_job->function->function_name_size + 1,
-                                   server_job->unique,
-                                   (size_t)(strlen(server_job->unique) + 1),
-                                   server_job->data, server_job->data_size,
-                                   NULL);
+      ret= gearman_server_io_packet_add_const(server_con, shard,
+                                              GEARMAN_COMMAND_NO_JOB);
     }
     else
     {
-      /* Same, but without unique ID. */
-      ret= gearman_server_io_packet_add(server_con, false,
-                                   GEARMAN_MAGIC_RESPONSE,
-                                   GEARMAN_COMMAND_JOB_ASSIGN,
-                                   server_job->job_handle,
-                                   (size_t)(strlen(server_job->job_handle) + 1),
-                                   server_job->function->function_name,
-                                   server_job->function->function_name_size + 1,
-                                   server_job->data, server_job->data_size,
-                                   NULL);
+      /* We found a runnable job, queue job assigned packet, with the unique
+         ID if asked for, and take the job off the queue. */
+      ret= gearman_server_io_packet_add_job_assign(server_con, shard,
+                                   server_job,
+                                   packet->command ==
+                                   GEARMAN_COMMAND_GRAB_JOB_UNIQ);
+    }
+
+    /* Job data that doesn't decode for this worker can never run, the
+       worker is told there was no job. */
+    if (ret == GEARMAN_INVALID_PACKET && server_job != NULL)
+    {
+      ret= _server_job_fail(shard, server_job);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      server_job= NULL;
+      ret= gearman_server_io_packet_add_const(server_con, shard,
+                                              GEARMAN_COMMAND_NO_JOB);
     }
 
     if (ret != GEARMAN_SUCCESS)
@@ -444,31 +660,51 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
       return ret;
     }
 
+    if (server_job == NULL)
+      shard->no_job_count++;
+    else
+      shard->job_assign_count++;
+
+    /* If this worker was woken for a job that someone else took, or it took
+       a job for another function, wake another worker for that job. */
+    ret= gearman_server_con_wake_clear(server_con, shard);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    /* Shards the worker was also woken from will not see this GRAB. */
+    if (server_job != NULL)
+    {
+      ret= gearman_server_shard_wake_clear(shard, server_con);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+    }
+
     break;
 
   case GEARMAN_COMMAND_WORK_DATA:
   case GEARMAN_COMMAND_WORK_WARNING:
-    server_job= gearman_server_job_get(server_con->thread->server,
-                                       (char *)(packet->arg[0]));
+    server_job= gearman_server_job_get(shard, (char *)(packet->arg[0]),
+                                       packet->arg_size[0]);
     if (server_job == NULL)
     {
-      return _server_error_packet(server_con, "job_not_found",
+      return _server_error_packet(server_con, shard, "job_not_found",
                                   "Job given in work result not found");
     }
 
     /* Queue the data/warning packet for all clients. */
-    ret= _server_queue_work_data(server_job, packet, packet->command);
+    ret= _server_queue_work_data(server_con, server_job, packet,
+                                 packet->command);
     if (ret != GEARMAN_SUCCESS)
       return ret;
 
     break;
 
   case GEARMAN_COMMAND_WORK_STATUS:
-    server_job= gearman_server_job_get(server_con->thread->server,
-                                       (char *)(packet->arg[0]));
+    server_job= gearman_server_job_get(shard, (char *)(packet->arg[0]),
+                                       packet->arg_size[0]);
     if (server_job == NULL)
     {
-      return _server_error_packet(server_con, "job_not_found",
+      return _server_error_packet(server_con, shard, "job_not_found",
                                   "Job given in work result not found");
     }
 
@@ -479,12 +715,14 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     snprintf(denominator_buffer, 11, "%.*s", (uint32_t)(packet->arg_size[2]),
              (char *)(packet->arg[2]));
     server_job->denominator= (uint32_t)atoi(denominator_buffer);
+    gearman_server_job_publish(server_job);
 
     /* Queue the status packet for all clients. */
     for (server_client= server_job->client_list; server_client;
          server_client= server_client->job_next)
     {
-      ret= gearman_server_io_packet_add(server_client->con, false,
+      ret= gearman_server_io_packet_add(server_client->con, shard,
+                                        false,
                                         GEARMAN_MAGIC_RESPONSE,
                                         GEARMAN_COMMAND_WORK_STATUS,
                                         packet->arg[0], packet->arg_size[0],
@@ -498,16 +736,16 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_WORK_COMPLETE:
-    server_job= gearman_server_job_get(server_con->thread->server,
-                                       (char *)(packet->arg[0]));
+    server_job= gearman_server_job_get(shard, (char *)(packet->arg[0]),
+                                       packet->arg_size[0]);
     if (server_job == NULL)
     {
-      return _server_error_packet(server_con, "job_not_found",
+      return _server_error_packet(server_con, shard, "job_not_found",
                                   "Job given in work result not found");
     }
 
     /* Queue the complete packet for all clients. */
-    ret= _server_queue_work_data(server_job, packet,
+    ret= _server_queue_work_data(server_con, server_job, packet,
                                  GEARMAN_COMMAND_WORK_COMPLETE);
     if (ret != GEARMAN_SUCCESS)
       return ret;
@@ -516,11 +754,13 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     if (server_job->options & GEARMAN_SERVER_JOB_QUEUED &&
         gearman->queue_done_fn != NULL)
     {
+      GEARMAN_SERVER_QUEUE_LOCK(shard->server)
       ret= (*(gearman->queue_done_fn))(gearman, (void *)gearman->queue_fn_arg,
-                                      server_job->unique,
-                                      (size_t)strlen(server_job->unique),
+                                      GEARMAN_SERVER_JOB_UNIQUE(server_job),
+                                      (size_t)(server_job->unique_size),
                                       server_job->function->function_name,
                                       server_job->function->function_name_size);
+      GEARMAN_SERVER_QUEUE_UNLOCK(shard->server)
       if (ret != GEARMAN_SUCCESS)
         return ret;
     }
@@ -530,61 +770,34 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_WORK_EXCEPTION:
-    server_job= gearman_server_job_get(server_con->thread->server,
-                                       (char *)(packet->arg[0]));
+    server_job= gearman_server_job_get(shard, (char *)(packet->arg[0]),
+                                       packet->arg_size[0]);
     if (server_job == NULL)
     {
-      return _server_error_packet(server_con, "job_not_found",
+      return _server_error_packet(server_con, shard, "job_not_found",
                                   "Job given in work result not found");
     }
 
     /* Queue the exception packet for all clients. */
-    ret= _server_queue_work_data(server_job, packet,
+    ret= _server_queue_work_data(server_con, server_job, packet,
                                  GEARMAN_COMMAND_WORK_EXCEPTION);
     if (ret != GEARMAN_SUCCESS)
       return ret;
     break;
 
   case GEARMAN_COMMAND_WORK_FAIL:
-    /* This may not be NULL terminated, so copy to make sure it is. */
-    snprintf(job_handle, GEARMAN_JOB_HANDLE_SIZE, "%.*s",
-             (uint32_t)(packet->arg_size[0]), (char *)(packet->arg[0]));
-
-    server_job= gearman_server_job_get(server_con->thread->server, job_handle);
+    server_job= gearman_server_job_get(shard, (char *)(packet->arg[0]),
+                                       packet->arg_size[0]);
     if (server_job == NULL)
     {
-      return _server_error_packet(server_con, "job_not_found",
+      return _server_error_packet(server_con, shard, "job_not_found",
                                   "Job given in work result not found");
     }
 
-    /* Queue the fail packet for all clients. */
-    for (server_client= server_job->client_list; server_client;
-         server_client= server_client->job_next)
-    {
-      ret= gearman_server_io_packet_add(server_client->con, false,
-                                        GEARMAN_MAGIC_RESPONSE,
-                                        GEARMAN_COMMAND_WORK_FAIL,
-                                        packet->arg[0], packet->arg_size[0],
-                                        NULL);
-      if (ret != GEARMAN_SUCCESS)
-        return ret;
-    }
-
-    /* Remove from persistent queue if one exists. */
-    if (server_job->options & GEARMAN_SERVER_JOB_QUEUED &&
-        gearman->queue_done_fn != NULL)
-    {
-      ret= (*(gearman->queue_done_fn))(gearman, (void *)gearman->queue_fn_arg,
-                                      server_job->unique,
-                                      (size_t)strlen(server_job->unique),
-                                      server_job->function->function_name,
-                                      server_job->function->function_name_size);
-      if (ret != GEARMAN_SUCCESS)
-        return ret;
-    }
+    ret= _server_job_fail(shard, server_job);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
 
-    /* Job is done, remove it. */
-    gearman_server_job_free(server_job);
     break;
 
   case GEARMAN_COMMAND_SET_CLIENT_ID:
@@ -593,7 +806,7 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
     break;
 
   case GEARMAN_COMMAND_TEXT:
-    return _server_run_text(server_con, packet);
+    return _server_run_text(server_con, shard, packet);
 
   case GEARMAN_COMMAND_UNUSED:
   case GEARMAN_COMMAND_NOOP:
@@ -610,7 +823,7 @@ gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
   case GEARMAN_COMMAND_JOB_ASSIGN_UNIQ:
   case GEARMAN_COMMAND_MAX:
   default:
-    return _server_error_packet(server_con, "bad_command",
+    return _server_error_packet(server_con, shard, "bad_command",
                                 "Command not expected");
   }
 
@@ -621,7 +834,7 @@ gearman_return_t gearman_server_shutdown_graceful(gearman_server_st *server)
 {
   server->shutdown_graceful= true;
 
-  if (server->job_count == 0)
+  if (gearman_server_job_count(server) == 0)
     return GEARMAN_SHUTDOWN;
 
   return GEARMAN_SHUTDOWN_GRACEFUL;
@@ -660,17 +873,57 @@ gearman_return_t _queue_replay_add(gearman_st *gearman __attribute__ ((unused)),
   gearman_server_st *server= (gearman_server_st *)fn_arg;
   gearman_return_t ret;
 
-  (void)gearman_server_job_add(server, (char *)function_name,
-                               function_name_size, (char *)unique, unique_size,
-                               data, data_size, priority, NULL, &ret);
+  (void)gearman_server_job_add(gearman_server_shard_find(server,
+                                                         (char *)function_name,
+                                                         function_name_size),
+                               (char *)function_name, function_name_size,
+                               (char *)unique, unique_size, data, data_size,
+                               priority, NULL, &ret);
   return ret;
 }
 
+static gearman_return_t _server_slab_create(gearman_server_st *server)
+{
+  if (gearman_server_slab_create(&(server->packet_slab), "packet",
+                                 sizeof(gearman_server_packet_st)) == NULL)
+  {
+    return GEARMAN_PTHREAD;
+  }
+
+  if (gearman_server_slab_create(&(server->job_slab), "job",
+                                 sizeof(gearman_server_job_st)) == NULL)
+  {
+    gearman_server_slab_free(&(server->packet_slab));
+    return GEARMAN_PTHREAD;
+  }
+
+  if (gearman_server_slab_create(&(server->client_slab), "client",
+                                 sizeof(gearman_server_client_st)) == NULL)
+  {
+    gearman_server_slab_free(&(server->job_slab));
+    gearman_server_slab_free(&(server->packet_slab));
+    return GEARMAN_PTHREAD;
+  }
+
+  if (gearman_server_slab_create(&(server->worker_slab), "worker",
+                                 sizeof(gearman_server_worker_st)) == NULL)
+  {
+    gearman_server_slab_free(&(server->client_slab));
+    gearman_server_slab_free(&(server->job_slab));
+    gearman_server_slab_free(&(server->packet_slab));
+    return GEARMAN_PTHREAD;
+  }
+
+  return GEARMAN_SUCCESS;
+}
+
 static gearman_return_t _server_error_packet(gearman_server_con_st *server_con,
+                                             gearman_server_shard_st *shard,
                                              const char *error_code,
                                              const char *error_string)
 {
-  return gearman_server_io_packet_add(server_con, false, GEARMAN_MAGIC_RESPONSE,
+  return gearman_server_io_packet_add(server_con, shard, false,
+                                      GEARMAN_MAGIC_RESPONSE,
                                       GEARMAN_COMMAND_ERROR, error_code,
                                       (size_t)(strlen(error_code) + 1),
                                       error_string,
@@ -678,18 +931,29 @@ static gearman_return_t _server_error_packet(gearman_server_con_st *server_con,
 }
 
 static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
+                                         gearman_server_shard_st *shard,
                                          gearman_packet_st *packet)
 {
+  gearman_server_st *server= server_con->thread->server;
   char *data;
-  char *new_data;
   size_t size;
   size_t total;
   int max_queue_size;
-  gearman_server_thread_st *thread;
-  gearman_server_con_st *con;
-  gearman_server_worker_st *worker;
   gearman_server_function_st *function;
+  const gearman_server_stats_st *stats;
+  const gearman_server_stats_function_st *stats_function;
   gearman_server_packet_st *server_packet;
+  gearman_server_slab_cache_st *cache_list[4];
+  gearman_server_slab_st *slab;
+  gearman_server_thread_st *thread;
+  uint64_t noop_count= 0;
+  uint64_t no_job_count= 0;
+  uint64_t job_assign_count= 0;
+  uint32_t chunk_count;
+  uint32_t con_count;
+  uint32_t x;
+  uint32_t y;
+  gearman_return_t ret= GEARMAN_SUCCESS;
 
   data= malloc(GEARMAN_TEXT_RESPONSE_SIZE);
   if (data == NULL)
@@ -704,96 +968,162 @@ static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
     snprintf(data, GEARMAN_TEXT_RESPONSE_SIZE,
              "ERR unknown_command Unknown+server+command\n");
   }
-  else if (!strcasecmp("workers", (char *)(packet->arg[0])))
+  else if (!strcasecmp("workers", (char *)(packet->arg[0])) ||
+           !strcasecmp("status", (char *)(packet->arg[0])) ||
+           !strcasecmp("stats", (char *)(packet->arg[0])) ||
+           !strcasecmp("waits", (char *)(packet->arg[0])))
   {
+    /* Processing threads publish their own snapshots, so only refresh the
+       one for the shard this thread owns and take the others as they are.
+       Without processing threads every shard is owned by this thread. */
+    if (server->options & GEARMAN_SERVER_PROC_THREAD)
+      (void)gearman_server_stats_publish(shard);
+    else
+    {
+      for (x= 0; x < server->shard_count; x++)
+        (void)gearman_server_stats_publish(&(server->shard[x]));
+    }
+
     size= 0;
 
-    for (thread= server_con->thread->server->thread_list; thread != NULL;
-         thread= thread->next)
+    for (x= 0; x < server->shard_count && ret == GEARMAN_SUCCESS; x++)
     {
-      GEARMAN_SERVER_THREAD_LOCK(thread)
-
-      for (con= thread->con_list; con != NULL; con= con->next)
+      stats= gearman_server_stats_acquire(&(server->shard[x]));
+      if (stats == NULL)
       {
-        if (con->host == NULL)
-          continue;
-
-        if (size > total)
-          size= total;
+        gearman_server_stats_release(&(server->shard[x]));
+        continue;
+      }
 
-        /* Make sure we have at least GEARMAN_TEXT_RESPONSE_SIZE bytes. */
-        if (size + GEARMAN_TEXT_RESPONSE_SIZE > total)
+      if (!strcasecmp("workers", (char *)(packet->arg[0])))
+      {
+        ret= _server_text_reserve(packet, &data, &total, size,
+                                  stats->workers_size);
+        if (ret == GEARMAN_SUCCESS && stats->workers_size > 0)
         {
-          new_data= realloc(data, total + GEARMAN_TEXT_RESPONSE_SIZE);
-          if (new_data == NULL)
-          {
-            GEARMAN_SERVER_THREAD_UNLOCK(thread)
-            free(data);
-            GEARMAN_ERROR_SET(packet->gearman, "_server_run_text", "malloc")
-            return GEARMAN_MEMORY_ALLOCATION_FAILURE;
-          }
-
-          data= new_data;
-          total+= GEARMAN_TEXT_RESPONSE_SIZE;
+          memcpy(data + size, stats->workers, stats->workers_size);
+          size+= stats->workers_size;
         }
-
-        size+= (size_t)snprintf(data + size, total - size, "%d %s %s :",
-                                con->con.fd, con->host, con->id);
-        if (size > total)
-          continue;
-
-        for (worker= con->worker_list; worker != NULL; worker= worker->con_next)
+      }
+      else if (!strcasecmp("waits", (char *)(packet->arg[0])))
+      {
+        /* Columns: fd, host, id, shard, and the longest time in
+           microseconds a packet from the connection waited for the shard
+           processing thread. */
+        ret= _server_text_reserve(packet, &data, &total, size,
+                                  stats->waits_size);
+        if (ret == GEARMAN_SUCCESS && stats->waits_size > 0)
         {
-          size+= (size_t)snprintf(data + size, total - size, " %.*s",
-                                  (int)(worker->function->function_name_size),
-                                  worker->function->function_name);
-          if (size > total)
-            break;
+          memcpy(data + size, stats->waits, stats->waits_size);
+          size+= stats->waits_size;
         }
+      }
+      else if (!strcasecmp("status", (char *)(packet->arg[0])))
+      {
+        for (y= 0; y < stats->function_count; y++)
+        {
+          stats_function= &(stats->function[y]);
 
-        if (size > total)
-          continue;
+          ret= _server_text_reserve(packet, &data, &total, size,
+                                    stats_function->function_name_size);
+          if (ret != GEARMAN_SUCCESS)
+            break;
 
-        size+= (size_t)snprintf(data + size, total - size, "\n");
+          size+= (size_t)snprintf(data + size, total - size,
+                                  "%.*s\t%u\t%u\t%u\n",
+                                  (int)(stats_function->function_name_size),
+                                  stats_function->function_name,
+                                  stats_function->job_total,
+                                  stats_function->job_running,
+                                  stats_function->worker_count);
+        }
+      }
+      else
+      {
+        noop_count+= stats->noop_count;
+        no_job_count+= stats->no_job_count;
+        job_assign_count+= stats->job_assign_count;
       }
 
-      GEARMAN_SERVER_THREAD_UNLOCK(thread)
+      gearman_server_stats_release(&(server->shard[x]));
     }
 
-    if (size < total)
+    if (ret != GEARMAN_SUCCESS)
+    {
+      free(data);
+      return ret;
+    }
+
+    if (!strcasecmp("stats", (char *)(packet->arg[0])))
+    {
+      snprintf(data, GEARMAN_TEXT_RESPONSE_SIZE,
+               "noop\t%" PRIu64 "\nno_job\t%" PRIu64 "\njob_assign\t%" PRIu64
+               "\n.\n", noop_count, no_job_count, job_assign_count);
+    }
+    else
       snprintf(data + size, total - size, ".\n");
   }
-  else if (!strcasecmp("status", (char *)(packet->arg[0])))
+  else if (!strcasecmp("slabs", (char *)(packet->arg[0])))
   {
+    cache_list[0]= &(shard->packet_cache);
+    cache_list[1]= &(shard->job_cache);
+    cache_list[2]= &(shard->client_cache);
+    cache_list[3]= &(shard->worker_cache);
     size= 0;
 
-    for (function= server_con->thread->server->function_list; function != NULL;
-         function= function->next)
+    /* Columns: name, object size, chunks, objects in use, objects cached by
+       threads, and objects free in the depot. Text commands run in the
+       thread that owns the shard caches, so those are always exact. */
+    for (x= 0; x < 4; x++)
     {
-      if (size + GEARMAN_TEXT_RESPONSE_SIZE > total)
-      {
-        new_data= realloc(data, total + GEARMAN_TEXT_RESPONSE_SIZE);
-        if (new_data == NULL)
-        {
-          free(data);
-          GEARMAN_ERROR_SET(packet->gearman, "_server_run_text", "malloc")
-          return GEARMAN_MEMORY_ALLOCATION_FAILURE;
-        }
+      gearman_server_slab_cache_sync(cache_list[x]);
+      slab= cache_list[x]->slab;
+      (void) pthread_mutex_lock(&(slab->lock));
+      chunk_count= slab->full_count + slab->partial_count + slab->empty_count;
+      size+= (size_t)snprintf(data + size, total - size,
+                              "%s\t%zu\t%u\t%u\t%u\t%u\n", slab->name,
+                              slab->size, chunk_count,
+                              (chunk_count * slab->chunk_objects) -
+                              slab->cached_count - slab->free_count,
+                              slab->cached_count, slab->free_count);
+      (void) pthread_mutex_unlock(&(slab->lock));
+    }
 
-        data= new_data;
-        total+= GEARMAN_TEXT_RESPONSE_SIZE;
-      }
+    snprintf(data + size, total - size, ".\n");
+  }
+  else if (!strcasecmp("threads", (char *)(packet->arg[0])))
+  {
+    size= 0;
+
+    /* Columns: thread, connections, packets and bytes since start, and
+       packets and bytes during the last sample interval. Each counter is
+       read as last published by the thread that updates it, without taking
+       any thread's lock, so these are only a recent view. */
+    for (thread= server->thread_list; thread != NULL && ret == GEARMAN_SUCCESS;
+         thread= thread->next)
+    {
+      ret= _server_text_reserve(packet, &data, &total, size, 0);
+      if (ret != GEARMAN_SUCCESS)
+        break;
 
-      size+= (size_t)snprintf(data + size, total - size, "%.*s\t%u\t%u\t%u\n",
-                              (int)(function->function_name_size),
-                              function->function_name, function->job_total,
-                              function->job_running, function->worker_count);
-      if (size > total)
-        size= total;
+      con_count= *((volatile uint32_t *)&(thread->con_count));
+
+      size+= (size_t)snprintf(data + size, total - size,
+                              "%u\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+                              "\t%" PRIu64 "\n", thread->index, con_count,
+                              *((volatile uint64_t *)&(thread->packet_count)),
+                              *((volatile uint64_t *)&(thread->byte_count)),
+                              *((volatile uint64_t *)&(thread->packet_recent)),
+                              *((volatile uint64_t *)&(thread->byte_recent)));
     }
 
-    if (size < total)
-      snprintf(data + size, total - size, ".\n");
+    if (ret != GEARMAN_SUCCESS)
+    {
+      free(data);
+      return ret;
+    }
+
+    snprintf(data + size, total - size, ".\n");
   }
   else if (!strcasecmp("maxqueue", (char *)(packet->arg[0])))
   {
@@ -813,16 +1143,10 @@ static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
           max_queue_size= 0;
       }
 
-      for (function= server_con->thread->server->function_list;
-           function != NULL; function= function->next)
-      {
-        if (strlen((char *)(packet->arg[1])) == function->function_name_size &&
-            !memcmp(packet->arg[1], function->function_name,
-                    function->function_name_size))
-        {
-          function->max_queue_size= (uint32_t)max_queue_size;
-        }
-      }
+      function= gearman_server_function_find(shard, (char *)(packet->arg[1]),
+                                             strlen((char *)(packet->arg[1])));
+      if (function != NULL)
+        function->max_queue_size= (uint32_t)max_queue_size;
 
       snprintf(data, GEARMAN_TEXT_RESPONSE_SIZE, "OK\n");
     }
@@ -854,7 +1178,7 @@ static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
              "ERR unknown_command Unknown+server+command\n");
   }
 
-  server_packet= gearman_server_packet_create(server_con->thread, false);
+  server_packet= gearman_server_packet_create(server_con->thread, shard);
   if (server_packet == NULL)
   {
     free(data);
@@ -865,7 +1189,7 @@ static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
                             &(server_packet->packet)) == NULL)
   {
     free(data);
-    gearman_server_packet_free(server_packet, server_con->thread, false);
+    gearman_server_packet_free(server_packet, server_con->thread, shard);
     return GEARMAN_MEMORY_ALLOCATION_FAILURE;
   }
   
@@ -876,22 +1200,176 @@ static gearman_return_t _server_run_text(gearman_server_con_st *server_con,
   server_packet->packet.data= data;
   server_packet->packet.data_size= strlen(data);
 
-  GEARMAN_SERVER_THREAD_LOCK(server_con->thread)
-  GEARMAN_FIFO_ADD(server_con->io_packet, server_packet,)
-  GEARMAN_SERVER_THREAD_UNLOCK(server_con->thread)
+  gearman_server_io_packet_queue(server_con, server_packet);
+
+  return GEARMAN_SUCCESS;
+}
+
+static gearman_return_t _server_text_reserve(gearman_packet_st *packet,
+                                             char **data, size_t *total,
+                                             size_t size, size_t need)
+{
+  char *new_data;
+
+  /* Leave room for the formatting around what is being added. */
+  need+= GEARMAN_TEXT_RESPONSE_SIZE;
+  if (size + need <= *total)
+    return GEARMAN_SUCCESS;
+
+  new_data= realloc(*data, size + need);
+  if (new_data == NULL)
+  {
+    GEARMAN_ERROR_SET(packet->gearman, "_server_run_text", "realloc")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  *data= new_data;
+  *total= size + need;
+
+  return GEARMAN_SUCCESS;
+}
+
+static gearman_return_t _server_packet_unframe(gearman_packet_st *packet,
+                                               bool decode)
+{
+  gearman_st *gearman= packet->gearman;
+  gearman_frame_t type;
+  size_t data_size;
+  void *data;
+  gearman_return_t ret;
+
+  ret= gearman_packet_frame_check(gearman, packet->data, packet->data_size,
+                                  &type, &data_size);
+  if (ret != GEARMAN_SUCCESS || !decode)
+    return ret;
+
+  data= gearman_packet_frame_decode(gearman, packet->data, packet->data_size,
+                                    &data_size, &ret);
+  if (ret != GEARMAN_SUCCESS)
+    return ret;
+
+  gearman_packet_give_data(packet, data, data_size);
+
+  return GEARMAN_SUCCESS;
+}
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+static bool _server_con_compress_ready(gearman_server_con_st *server_con,
+                                       gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+  uint64_t mask;
+
+  if (!(server_con->thread->server->options & GEARMAN_SERVER_PROC_THREAD))
+    return true;
+
+  /* Run on a processing thread because other packets were in flight. */
+  if (shard != NULL)
+    return false;
+
+  /* Data only comes unasked for as results for the connection's jobs. Other
+     data packets answer requests, and nothing is in flight. */
+  for (mask= server_con->shard_used; mask != 0; mask&= mask - 1)
+  {
+    con_shard= &(server_con->shard[__builtin_ctzll(mask)]);
+    if (*((volatile uint32_t *)&(con_shard->client_count)) != 0)
+      return false;
+  }
+
+  /* Results are queued before their job is removed. */
+  __sync_synchronize();
+  gearman_server_thread_io_drain(server_con->thread);
+
+  return true;
+}
+#endif
+
+static gearman_return_t _server_job_fail(gearman_server_shard_st *shard,
+                                         gearman_server_job_st *server_job)
+{
+  gearman_st *gearman= shard->server->gearman;
+  gearman_server_client_st *server_client;
+  char job_handle[GEARMAN_JOB_HANDLE_SIZE];
+  size_t job_handle_size;
+  gearman_return_t ret;
+
+  job_handle_size= gearman_server_job_handle(server_job, job_handle);
 
-  gearman_server_con_io_add(server_con);
+  /* Queue the fail packet for all clients. */
+  for (server_client= server_job->client_list; server_client;
+       server_client= server_client->job_next)
+  {
+    ret= gearman_server_io_packet_add(server_client->con, shard, false,
+                                      GEARMAN_MAGIC_RESPONSE,
+                                      GEARMAN_COMMAND_WORK_FAIL, job_handle,
+                                      job_handle_size + 1, NULL);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  /* Remove from persistent queue if one exists. */
+  if (server_job->options & GEARMAN_SERVER_JOB_QUEUED &&
+      gearman->queue_done_fn != NULL)
+  {
+    GEARMAN_SERVER_QUEUE_LOCK(shard->server)
+    ret= (*(gearman->queue_done_fn))(gearman, (void *)gearman->queue_fn_arg,
+                                    GEARMAN_SERVER_JOB_UNIQUE(server_job),
+                                    (size_t)(server_job->unique_size),
+                                    server_job->function->function_name,
+                                    server_job->function->function_name_size);
+    GEARMAN_SERVER_QUEUE_UNLOCK(shard->server)
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  /* Job is done, remove it. */
+  gearman_server_job_free(server_job);
 
   return GEARMAN_SUCCESS;
 }
 
 static gearman_return_t
-_server_queue_work_data(gearman_server_job_st *server_job,
+_server_client_fail(gearman_server_client_st *server_client,
+                    gearman_server_shard_st *shard, gearman_packet_st *packet)
+{
+  return gearman_server_io_packet_add(server_client->con, shard, false,
+                                      GEARMAN_MAGIC_RESPONSE,
+                                      GEARMAN_COMMAND_WORK_FAIL,
+                                      packet->arg[0], packet->arg_size[0],
+                                      NULL);
+}
+
+static gearman_return_t
+_server_queue_work_data(gearman_server_con_st *server_con,
+                        gearman_server_job_st *server_job,
                         gearman_packet_st *packet, gearman_command_t command)
 {
   gearman_server_client_st *server_client;
+  gearman_server_payload_st *payload= NULL;
   uint8_t *data;
-  gearman_return_t ret;
+  bool framed;
+  gearman_return_t ret= GEARMAN_SUCCESS;
+
+  framed= (server_con->options & GEARMAN_SERVER_CON_COMPRESS) &&
+          gearman_packet_framed(packet);
+  if (framed)
+  {
+    ret= _server_packet_unframe(packet, false);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  /* Clients attached to the same job all share one copy of the data, which
+     also takes care of framing it for each of them. */
+  if (packet->data_size > 0 && server_job->client_list != NULL &&
+      (server_job->client_list->job_next != NULL ||
+       framed != ((server_job->client_list->con->options &
+                   GEARMAN_SERVER_CON_COMPRESS) != 0)))
+  {
+    payload= gearman_server_payload_create(packet);
+    if (payload == NULL)
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
 
   for (server_client= server_job->client_list; server_client;
        server_client= server_client->job_next)
@@ -903,6 +1381,25 @@ _server_queue_work_data(gearman_server_job_st *server_job,
     //   continue;
     // }
 
+    if (payload != NULL)
+    {
+      ret= gearman_server_io_packet_add_payload(server_client->con,
+                                                server_job->function->shard,
+                                                payload, framed,
+                                                GEARMAN_MAGIC_RESPONSE, command,
+                                                packet->arg[0],
+                                                packet->arg_size[0], NULL);
+      if (ret == GEARMAN_INVALID_PACKET)
+      {
+        ret= _server_client_fail(server_client, server_job->function->shard,
+                                 packet);
+      }
+      if (ret != GEARMAN_SUCCESS)
+        break;
+
+      continue;
+    }
+
     if (packet->data_size > 0)
     {
       if (packet->options & GEARMAN_PACKET_FREE_DATA &&
@@ -926,15 +1423,24 @@ _server_queue_work_data(gearman_server_job_st *server_job,
     else
       data= NULL;
 
-    ret= gearman_server_io_packet_add(server_client->con, true,
+    ret= gearman_server_io_packet_add(server_client->con,
+                                      server_job->function->shard, true,
                                       GEARMAN_MAGIC_RESPONSE, command,
                                       packet->arg[0], packet->arg_size[0],
                                       data, packet->data_size, NULL);
+    if (ret == GEARMAN_INVALID_PACKET)
+    {
+      ret= _server_client_fail(server_client, server_job->function->shard,
+                               packet);
+    }
     if (ret != GEARMAN_SUCCESS)
       return ret;
   }
 
-  return GEARMAN_SUCCESS;
+  if (payload != NULL)
+    gearman_server_payload_free(payload);
+
+  return ret;
 }
 
 static void _log(gearman_st *gearman __attribute__ ((unused)),
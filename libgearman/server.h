@@ -55,16 +55,79 @@ void gearman_server_set_log(gearman_server_st *server,
                             gearman_server_log_fn log_fn, void *log_fn_arg,
                             gearman_verbose_t verbose);
 
+/**
+ * Set the number of shards functions and jobs are partitioned across. Each
+ * shard gets its own processing thread once I/O threads are started, so this
+ * must be called before any threads or functions are created.
+ * @param server Server structure previously initialized with
+ *        gearman_server_create.
+ * @param shard_count Number of shards, between 1 and GEARMAN_SERVER_SHARD_MAX.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_set_shards(gearman_server_st *server,
+                                           uint32_t shard_count);
+
+/**
+ * Set how much each connection may run per turn in a processing thread.
+ * Connections with queued packets take turns, and each turn runs packets
+ * until either budget is used up. Bytes left over carry to the next turn,
+ * so large packets still run once enough has built up.
+ * @param server Server structure previously initialized with
+ *        gearman_server_create.
+ * @param packets Packets per turn, 0 for GEARMAN_SERVER_PROC_PACKETS.
+ * @param bytes Bytes per turn, 0 for GEARMAN_SERVER_PROC_BYTES.
+ */
+GEARMAN_API
+void gearman_server_set_proc_budget(gearman_server_st *server,
+                                    uint32_t packets, uint32_t bytes);
+
+/**
+ * Pin the processing thread of each shard to a CPU. Shards take CPUs from
+ * the list in order, starting over if there are more shards than CPUs. The
+ * list is not copied and must stay valid until the threads are started.
+ * @param server Server structure previously initialized with
+ *        gearman_server_create.
+ * @param cpus List of CPU numbers.
+ * @param cpu_count Number of CPUs in the list, 0 to not pin the threads.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_set_proc_cpus(gearman_server_st *server,
+                                              const uint32_t *cpus,
+                                              uint32_t cpu_count);
+
+/**
+ * Get the number of jobs in the server, summed across all shards.
+ * @param server Server structure previously initialized with
+ *        gearman_server_create.
+ * @return Number of jobs.
+ */
+GEARMAN_API
+uint32_t gearman_server_job_count(gearman_server_st *server);
+
 /**
  * Process commands for a connection.
  * @param server_con Server connection that has a packet to process.
+ * @param shard Shard the packet was routed to, or NULL for a command
+ *        gearman_server_run_inline() allows to run on an I/O thread.
  * @param packet The packet that needs processing.
  * @return Standard gearman return value.
  */
 GEARMAN_API
 gearman_return_t gearman_server_run_command(gearman_server_con_st *server_con,
+                                            gearman_server_shard_st *shard,
                                             gearman_packet_st *packet);
 
+/**
+ * See if a command can run right on the I/O thread of its connection,
+ * because it only reads state that is safe to read from any thread.
+ * @param packet The packet that needs processing.
+ * @return True if the command does not need a processing thread.
+ */
+GEARMAN_API
+bool gearman_server_run_inline(gearman_packet_st *packet);
+
 /**
  * Tell server that it should enter a graceful shutdown state.
  * @param server Server structure previously initialized with
@@ -18,11 +18,12 @@
  */
 
 gearman_server_client_st *
-gearman_server_client_add(gearman_server_con_st *con)
+gearman_server_client_add(gearman_server_con_st *con,
+                          gearman_server_shard_st *shard)
 {
   gearman_server_client_st *client;
 
-  client= gearman_server_client_create(con, NULL);
+  client= gearman_server_client_create(con, shard, NULL);
   if (client == NULL)
     return NULL;
 
@@ -31,26 +32,17 @@ gearman_server_client_add(gearman_server_con_st *con)
 
 gearman_server_client_st *
 gearman_server_client_create(gearman_server_con_st *con,
+                             gearman_server_shard_st *shard,
                              gearman_server_client_st *client)
 {
-  gearman_server_st *server= con->thread->server;
-
   if (client == NULL)
   {
-    if (server->free_client_count > 0)
-    {
-      client= server->free_client_list;
-      GEARMAN_LIST_DEL(server->free_client, client, con_)
-    }
-    else
+    client= gearman_server_slab_alloc(&(shard->client_cache));
+    if (client == NULL)
     {
-      client= malloc(sizeof(gearman_server_client_st));
-      if (client == NULL)
-      {
-        GEARMAN_ERROR_SET(con->thread->gearman, "gearman_server_client_create",
-                          "malloc")
-        return NULL;
-      }
+      GEARMAN_ERROR_SET(con->thread->gearman, "gearman_server_client_create",
+                        "gearman_server_slab_alloc")
+      return NULL;
     }
 
     client->options= GEARMAN_SERVER_CLIENT_ALLOCATED;
@@ -59,7 +51,8 @@ gearman_server_client_create(gearman_server_con_st *con,
     client->options= 0;
 
   client->con= con;
-  GEARMAN_LIST_ADD(con->client, client, con_)
+  client->shard= shard;
+  GEARMAN_LIST_ADD(GEARMAN_SERVER_CON_SHARD(con, shard)->client, client, con_)
   client->job= NULL;
   client->job_next= NULL;
   client->job_prev= NULL;
@@ -69,24 +62,26 @@ gearman_server_client_create(gearman_server_con_st *con,
 
 void gearman_server_client_free(gearman_server_client_st *client)
 {
-  gearman_server_st *server= client->con->thread->server;
+  gearman_server_shard_st *shard= client->shard;
 
-  GEARMAN_LIST_DEL(client->con->client, client, con_)
+  GEARMAN_LIST_DEL(GEARMAN_SERVER_CON_SHARD(client->con, shard)->client,
+                   client, con_)
 
   if (client->job != NULL)
   {
     GEARMAN_LIST_DEL(client->job->client, client, job_)
 
-    /* If this was a foreground job and is now abandoned, mark to not run. */
+    /* If this was a foreground job and is now abandoned, drop it if it is
+       still queued, or mark it to not run again if a worker has it. */
     if (client->job->client_list == NULL)
-      client->job->options|= GEARMAN_SERVER_JOB_IGNORE;
+    {
+      if (client->job->worker == NULL)
+        gearman_server_job_free(client->job);
+      else
+        client->job->options|= GEARMAN_SERVER_JOB_IGNORE;
+    }
   }
 
   if (client->options & GEARMAN_SERVER_CLIENT_ALLOCATED)
-  {
-    if (server->free_client_count < GEARMAN_MAX_FREE_SERVER_CLIENT)
-      GEARMAN_LIST_ADD(server->free_client, client, con_)
-    else
-      free(client);
-  }
+    gearman_server_slab_dealloc(&(shard->client_cache), client);
 }
@@ -27,11 +27,12 @@ extern "C" {
  */
 
 /**
- * Add a new client to a server instance.
+ * Add a new client to a shard of a server instance.
  */
 GEARMAN_API
 gearman_server_client_st *
-gearman_server_client_add(gearman_server_con_st *con);
+gearman_server_client_add(gearman_server_con_st *con,
+                          gearman_server_shard_st *shard);
 
 /**
  * Initialize a server client structure.
@@ -39,6 +40,7 @@ gearman_server_client_add(gearman_server_con_st *con);
 GEARMAN_API
 gearman_server_client_st *
 gearman_server_client_create(gearman_server_con_st *con,
+                             gearman_server_shard_st *shard,
                              gearman_server_client_st *client);
 
 /**
@@ -13,6 +13,25 @@
 
 #include "common.h"
 
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearman_server_con_private Private Server Connection Functions
+ * @ingroup gearman_server_con
+ * @{
+ */
+
+/**
+ * Format a peer address numerically into host and port, each unless NULL.
+ * Returns 0 on success, like getnameinfo.
+ */
+static int _con_addr_format(const gearman_server_con_addr_st *addr,
+                            char *host, char *port);
+
+/** @} */
+
 /*
  * Public definitions
  */
@@ -42,6 +61,16 @@ gearman_server_con_st *gearman_server_con_add(gearman_server_thread_st *thread,
     return NULL;
   }
 
+  /* The first shard lists every connection, so it has to hear about this one
+     even if no packet is ever routed there. */
+  if (thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+  {
+    con->shard_used|= 1;
+    gearman_server_con_proc_add(con, thread->server->shard);
+  }
+  else
+    gearman_server_con_list_add(con, thread->server->shard);
+
   return con;
 }
 
@@ -49,6 +78,8 @@ gearman_server_con_st *
 gearman_server_con_create(gearman_server_thread_st *thread)
 {
   gearman_server_con_st *con;
+  gearman_server_con_shard_st *con_shard;
+  uint32_t x;
 
   if (thread->free_con_count > 0)
   {
@@ -57,13 +88,18 @@ gearman_server_con_create(gearman_server_thread_st *thread)
   }
   else
   {
-    con= malloc(sizeof(gearman_server_con_st));
+    /* The state for each shard is kept right after the connection. */
+    con= malloc(sizeof(gearman_server_con_st) +
+                (sizeof(gearman_server_con_shard_st) *
+                 thread->server->shard_count));
     if (con == NULL)
     {
       GEARMAN_ERROR_SET(thread->gearman, "gearman_server_con_create",
                         "malloc")
       return NULL;
     }
+
+    con->shard= (gearman_server_con_shard_st *)(con + 1);
   }
 
   if (gearman_con_create(thread->gearman, &(con->con)) == NULL)
@@ -74,32 +110,66 @@ gearman_server_con_create(gearman_server_thread_st *thread)
 
   gearman_con_set_options(&(con->con), GEARMAN_CON_IGNORE_LOST_CONNECTION, 1);
 
+  /* Commands run before the next packet is read, unless they are queued for
+     a processing thread, so arguments can stay in the receive buffer. */
+  gearman_con_set_options(&(con->con), GEARMAN_CON_PIN_ARGS, 1);
+
   con->options= 0;
   con->ret= 0;
-  con->noop_queued= false;
   con->io_list= false;
-  con->proc_list= false;
+  con->io_writev= false;
   con->proc_removed= false;
   con->io_packet_count= 0;
-  con->proc_packet_count= 0;
-  con->worker_count= 0;
-  con->client_count= 0;
+  con->io_packet_offset= 0;
+  con->hold_packet_count= 0;
+  con->proc_pending= 0;
+  con->shard_busy= 0;
+  con->shard_used= 0;
+  con->shard_mask= 0;
+  con->shard_woken= 0;
   con->thread= thread;
   con->packet= NULL;
   con->io_packet_list= NULL;
   con->io_packet_end= NULL;
-  con->proc_packet_list= NULL;
-  con->proc_packet_end= NULL;
+  con->hold_packet_list= NULL;
+  con->hold_packet_end= NULL;
   con->io_next= NULL;
   con->io_prev= NULL;
-  con->proc_next= NULL;
-  con->proc_prev= NULL;
-  con->worker_list= NULL;
-  con->client_list= NULL;
-  con->host= NULL;
-  con->port= NULL;
+  con->shard_last= NULL;
+  con->addr= NULL;
   strcpy(con->id, "-");
 
+  for (x= 0; x < thread->server->shard_count; x++)
+  {
+    con_shard= &(con->shard[x]);
+    con_shard->con_list= false;
+    con_shard->proc_list= false;
+    con_shard->proc_removed= false;
+    con_shard->proc_active= false;
+    con_shard->sleeping= false;
+    con_shard->wake_clear= false;
+    con_shard->worker_count= 0;
+    con_shard->client_count= 0;
+    con_shard->proc_packet_count= 0;
+    con_shard->proc_deficit= 0;
+    con_shard->proc_wait_max= 0;
+    con_shard->con= con;
+    con_shard->con_next= NULL;
+    con_shard->con_prev= NULL;
+    con_shard->proc_next= NULL;
+    con_shard->proc_prev= NULL;
+    con_shard->proc_active_next= NULL;
+    con_shard->proc_packet_list= NULL;
+    con_shard->proc_packet_end= NULL;
+    con_shard->worker_list= NULL;
+    con_shard->client_list= NULL;
+    con_shard->woken_function= NULL;
+    memset(con_shard->ready_list, 0,
+           sizeof(gearman_server_worker_st *) * GEARMAN_JOB_PRIORITY_MAX);
+    memset(con_shard->ready_end, 0,
+           sizeof(gearman_server_worker_st *) * GEARMAN_JOB_PRIORITY_MAX);
+  }
+
   GEARMAN_SERVER_THREAD_LOCK(thread)
   GEARMAN_LIST_ADD(thread->con, con,)
   GEARMAN_SERVER_THREAD_UNLOCK(thread)
@@ -110,24 +180,31 @@ gearman_server_con_create(gearman_server_thread_st *thread)
 void gearman_server_con_free(gearman_server_con_st *con)
 {
   gearman_server_thread_st *thread= con->thread;
+  gearman_server_st *server= thread->server;
+  gearman_server_shard_st *shard;
+  gearman_server_con_shard_st *con_shard;
   gearman_server_packet_st *packet;
+  uint64_t mask;
+  uint32_t x;
 
-  con->host= NULL;
-  con->port= NULL;
+  con->addr= NULL;
 
-  if (thread->server->options & GEARMAN_SERVER_PROC_THREAD &&
-      !(con->proc_removed) && !(thread->server->proc_shutdown))
+  /* Each shard the connection sent packets to cleans up its own part, and
+     the last one to finish hands the connection back to this thread. */
+  if (server->options & GEARMAN_SERVER_PROC_THREAD &&
+      !(con->proc_removed) && !(server->proc_shutdown) && con->shard_used != 0)
   {
     con->options= GEARMAN_SERVER_CON_DEAD;
-    gearman_server_con_proc_add(con);
+    con->proc_pending= (uint32_t)__builtin_popcountll(con->shard_used);
+
+    for (mask= con->shard_used; mask != 0; mask&= mask - 1)
+      gearman_server_con_proc_add(con, &(server->shard[__builtin_ctzll(mask)]));
+
     return;
   }
 
   gearman_con_free(&(con->con));
 
-  if (con->proc_list)
-    gearman_server_con_proc_remove(con);
-
   if (con->io_list)
     gearman_server_con_io_remove(con);
 
@@ -135,23 +212,33 @@ void gearman_server_con_free(gearman_server_con_st *con)
   {
     if (&(con->packet->packet) != con->con.recv_packet)
       gearman_packet_free(&(con->packet->packet));
-    gearman_server_packet_free(con->packet, con->thread, true); 
+    gearman_server_packet_free(con->packet, con->thread, NULL); 
   }
 
   while (con->io_packet_list != NULL)
     gearman_server_io_packet_remove(con);
 
-  while (con->proc_packet_list != NULL)
+  while ((packet= con->hold_packet_list) != NULL)
   {
-    packet= gearman_server_proc_packet_remove(con);
+    GEARMAN_FIFO_DEL(con->hold_packet, packet,)
     gearman_packet_free(&(packet->packet));
-    gearman_server_packet_free(packet, con->thread, true); 
+    gearman_server_packet_free(packet, con->thread, NULL);
   }
 
-  gearman_server_con_free_workers(con);
+  for (x= 0; x < server->shard_count; x++)
+  {
+    shard= &(server->shard[x]);
+    con_shard= &(con->shard[x]);
+
+    if (con_shard->proc_list)
+      gearman_server_con_proc_remove(con, shard);
+
+    gearman_server_con_list_remove(con, shard);
+    gearman_server_con_free_workers(con, shard);
 
-  while (con->client_list != NULL)
-    gearman_server_client_free(con->client_list);
+    while (con_shard->client_list != NULL)
+      gearman_server_client_free(con_shard->client_list);
+  }
 
   GEARMAN_SERVER_THREAD_LOCK(thread)
   GEARMAN_LIST_DEL(con->thread->con, con,)
@@ -163,6 +250,89 @@ void gearman_server_con_free(gearman_server_con_st *con)
     free(con);
 }
 
+bool gearman_server_con_detach(gearman_server_con_st *con)
+{
+  gearman_server_thread_st *thread= con->thread;
+  gearman_server_con_shard_st *con_shard;
+  gearman_con_st *gearman_con= &(con->con);
+  uint64_t mask;
+
+  if (con->options & GEARMAN_SERVER_CON_DEAD || con->ret != GEARMAN_SUCCESS ||
+      con->io_list || con->con.protocol_data != NULL ||
+      con->con.options & GEARMAN_CON_READY ||
+      con->con.recv_buffer_size > 0 ||
+      con->con.recv_state == GEARMAN_CON_RECV_STATE_READ_DATA ||
+      con->con.send_state != GEARMAN_CON_SEND_STATE_NONE ||
+      con->con.send_buffer_size > 0 ||
+      *((volatile uint32_t *)&(con->shard_busy)) != 0)
+  {
+    return false;
+  }
+
+  /* With nothing in flight, shards only touch the connection for workers
+     and jobs it already has. The decrement of shard_busy was a barrier, so
+     these are as current as the last packet the shards finished. */
+  for (mask= con->shard_used; mask != 0; mask&= mask - 1)
+  {
+    con_shard= &(con->shard[__builtin_ctzll(mask)]);
+    if (*((volatile uint32_t *)&(con_shard->worker_count)) != 0 ||
+        *((volatile uint32_t *)&(con_shard->client_count)) != 0 ||
+        con_shard->sleeping || con_shard->proc_list)
+    {
+      return false;
+    }
+  }
+
+  /* Packets a shard queued before its last job went away may still be on the
+     thread queue rather than the connection. */
+  __sync_synchronize();
+  if (*((gearman_server_packet_st * volatile *)&(thread->io_queue)) != NULL ||
+      con->io_packet_list != NULL || con->hold_packet_list != NULL)
+  {
+    return false;
+  }
+
+  /* A read may have started a packet without getting any of it yet. */
+  if (con->packet != NULL)
+  {
+    if (con->packet->packet.args_size > 0)
+      return false;
+
+    if (&(con->packet->packet) == con->con.recv_packet)
+      gearman_packet_free(&(con->packet->packet));
+    gearman_server_packet_free(con->packet, thread, NULL);
+    con->packet= NULL;
+    con->con.recv_packet= NULL;
+    con->con.recv_state= GEARMAN_CON_RECV_STATE_NONE;
+  }
+
+  GEARMAN_SERVER_THREAD_LOCK(thread)
+  GEARMAN_LIST_DEL(thread->con, con,)
+  GEARMAN_SERVER_THREAD_UNLOCK(thread)
+
+  GEARMAN_LIST_DEL(gearman_con->gearman->con, gearman_con,)
+  gearman_con->events= 0;
+  gearman_con->revents= 0;
+
+  return true;
+}
+
+gearman_return_t gearman_server_con_attach(gearman_server_con_st *con,
+                                           gearman_server_thread_st *thread)
+{
+  gearman_con_st *gearman_con= &(con->con);
+
+  con->thread= thread;
+  gearman_con->gearman= thread->gearman;
+  GEARMAN_LIST_ADD(thread->gearman->con, gearman_con,)
+
+  GEARMAN_SERVER_THREAD_LOCK(thread)
+  GEARMAN_LIST_ADD(thread->con, con,)
+  GEARMAN_SERVER_THREAD_UNLOCK(thread)
+
+  return gearman_con_set_events(gearman_con, POLLIN);
+}
+
 gearman_con_st *gearman_server_con_con(gearman_server_con_st *con)
 {
   return &con->con;
@@ -178,24 +348,56 @@ void gearman_server_con_set_data(gearman_server_con_st *con, void *data)
   gearman_con_set_data(&(con->con), data);
 }
 
-const char *gearman_server_con_host(gearman_server_con_st *con)
+const gearman_server_con_addr_st *
+gearman_server_con_addr(gearman_server_con_st *con)
 {
-  return con->host;
+  return con->addr;
 }
 
-void gearman_server_con_set_host(gearman_server_con_st *con, const char *host)
+void gearman_server_con_set_addr(gearman_server_con_st *con,
+                                 const gearman_server_con_addr_st *addr)
 {
-  con->host= host;
+  con->addr_data= *addr;
+  con->addr= &(con->addr_data);
 }
 
-const char *gearman_server_con_port(gearman_server_con_st *con)
+void gearman_server_con_addr_set(gearman_server_con_addr_st *addr,
+                                 const struct sockaddr *sa)
 {
-  return con->port;
+  memset(addr, 0, sizeof(gearman_server_con_addr_st));
+  addr->family= sa->sa_family;
+
+  if (sa->sa_family == AF_INET)
+  {
+    addr->port= ((const struct sockaddr_in *)sa)->sin_port;
+    memcpy(addr->addr, &(((const struct sockaddr_in *)sa)->sin_addr),
+           sizeof(struct in_addr));
+  }
+  else if (sa->sa_family == AF_INET6)
+  {
+    addr->port= ((const struct sockaddr_in6 *)sa)->sin6_port;
+    addr->scope_id= ((const struct sockaddr_in6 *)sa)->sin6_scope_id;
+    memcpy(addr->addr, &(((const struct sockaddr_in6 *)sa)->sin6_addr),
+           sizeof(struct in6_addr));
+  }
 }
 
-void gearman_server_con_set_port(gearman_server_con_st *con, const char *port)
+const char *gearman_server_con_addr_host(const gearman_server_con_addr_st *addr,
+                                         char *host)
 {
-  con->port= port;
+  if (_con_addr_format(addr, host, NULL) != 0)
+    strcpy(host, "-");
+
+  return host;
+}
+
+const char *gearman_server_con_addr_port(const gearman_server_con_addr_st *addr,
+                                         char *port)
+{
+  if (_con_addr_format(addr, NULL, port) != 0)
+    strcpy(port, "-");
+
+  return port;
 }
 
 const char *gearman_server_con_id(gearman_server_con_st *con)
@@ -214,26 +416,126 @@ void gearman_server_con_set_id(gearman_server_con_st *con, char *id,
 }
 
 void gearman_server_con_free_worker(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard,
                                     char *function_name,
                                     size_t function_name_size)
 {
+  gearman_server_function_st *function;
   gearman_server_worker_st *worker;
+  gearman_server_worker_st *next;
+
+  function= gearman_server_function_find(shard, function_name,
+                                         function_name_size);
+  if (function == NULL)
+    return;
 
-  for (worker= con->worker_list; worker != NULL; worker= worker->con_next)
+  /* Function names are interned, so the pointer is enough to match. */
+  for (worker= GEARMAN_SERVER_CON_SHARD(con, shard)->worker_list;
+       worker != NULL; worker= next)
   {
-    if (worker->function->function_name_size == function_name_size &&
-        !memcmp(worker->function->function_name, function_name,
-                function_name_size))
-    {
+    next= worker->con_next;
+    if (worker->function == function)
       gearman_server_worker_free(worker);
+  }
+}
+
+void gearman_server_con_free_workers(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  while (con_shard->worker_list != NULL)
+    gearman_server_worker_free(con_shard->worker_list);
+
+  (void)gearman_server_con_wake_clear(con, shard);
+}
+
+gearman_return_t gearman_server_con_sleep(gearman_server_con_st *con,
+                                          gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_worker_st *worker;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  con_shard->sleeping= true;
+
+  for (worker= con_shard->worker_list; worker != NULL;
+       worker= worker->con_next)
+  {
+    gearman_server_worker_sleep(worker);
+  }
+
+  return gearman_server_con_wake_clear(con, shard);
+}
+
+void gearman_server_con_awake(gearman_server_con_st *con,
+                              gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_worker_st *worker;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  con_shard->sleeping= false;
+
+  for (worker= con_shard->worker_list; worker != NULL;
+       worker= worker->con_next)
+  {
+    gearman_server_worker_wake(worker);
+  }
+}
+
+gearman_return_t gearman_server_con_wake(gearman_server_con_st *con,
+                                         gearman_server_function_st *function)
+{
+  gearman_server_shard_st *shard= function->shard;
+  gearman_server_con_shard_st *con_shard;
+  gearman_return_t ret;
+
+  ret= gearman_server_io_packet_add_const(con, shard, GEARMAN_COMMAND_NOOP);
+  if (ret != GEARMAN_SUCCESS)
+    return ret;
+
+  shard->noop_count++;
+  gearman_server_con_awake(con, shard);
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  if (con_shard->woken_function == NULL)
+  {
+    con_shard->woken_function= function;
+    function->wake_count++;
+
+    if (shard->server->shard_count > 1)
+    {
+      (void)__sync_fetch_and_or(&(con->shard_woken),
+                                (uint64_t)1 << shard->index);
     }
   }
+
+  return GEARMAN_SUCCESS;
 }
 
-void gearman_server_con_free_workers(gearman_server_con_st *con)
+gearman_return_t gearman_server_con_wake_clear(gearman_server_con_st *con,
+                                               gearman_server_shard_st *shard)
 {
-  while (con->worker_list != NULL)
-    gearman_server_worker_free(con->worker_list);
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_function_st *function;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  function= con_shard->woken_function;
+  if (function == NULL)
+    return GEARMAN_SUCCESS;
+
+  con_shard->woken_function= NULL;
+  function->wake_count--;
+
+  if (shard->server->shard_count > 1)
+  {
+    (void)__sync_fetch_and_and(&(con->shard_woken),
+                               ~((uint64_t)1 << shard->index));
+  }
+
+  return gearman_server_function_wake(function);
 }
 
 void gearman_server_con_io_add(gearman_server_con_st *con)
@@ -243,17 +545,20 @@ void gearman_server_con_io_add(gearman_server_con_st *con)
 
   GEARMAN_SERVER_THREAD_LOCK(con->thread)
 
-  GEARMAN_LIST_ADD(con->thread->io, con, io_)
-  con->io_list= true;
-
-  /* Looks funny, but need to check io_count locked, but call run unlocked. */
-  if (con->thread->io_count == 1 && con->thread->run_fn)
+  /* Several shards may race to add the same connection. */
+  if (con->io_list)
   {
     GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
-    (*con->thread->run_fn)(con->thread, con->thread->run_fn_arg);
+    return;
   }
-  else
-    GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+
+  GEARMAN_LIST_ADD(con->thread->io, con, io_)
+  con->io_list= true;
+
+  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+
+  if (con->thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+    gearman_server_thread_wakeup(con->thread);
 }
 
 void gearman_server_con_io_remove(gearman_server_con_st *con)
@@ -280,58 +585,163 @@ gearman_server_con_io_next(gearman_server_thread_st *thread)
   return con;
 }
 
-void gearman_server_con_proc_add(gearman_server_con_st *con)
+void gearman_server_con_list_add(gearman_server_con_st *con,
+                                 gearman_server_shard_st *shard)
 {
-  if (con->proc_list)
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  if (con_shard->con_list)
     return;
 
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  GEARMAN_LIST_ADD(con->thread->proc, con, proc_)
-  con->proc_list= true;
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  GEARMAN_LIST_ADD(shard->con, con_shard, con_)
+  con_shard->con_list= true;
+}
 
-  if (!(con->thread->server->proc_shutdown) &&
-      !(con->thread->server->proc_wakeup))
+void gearman_server_con_list_remove(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  if (!(con_shard->con_list))
+    return;
+
+  GEARMAN_LIST_DEL(shard->con, con_shard, con_)
+  con_shard->con_list= false;
+}
+
+void gearman_server_con_proc_add(gearman_server_con_st *con,
+                                 gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+  if (con_shard->proc_list)
+    return;
+
+  (void) pthread_mutex_lock(&(shard->proc_lock));
+
+  if (!(con_shard->proc_list) && !(con_shard->proc_removed))
   {
-    (void) pthread_mutex_lock(&(con->thread->server->proc_lock));
-    con->thread->server->proc_wakeup= true;
-    (void) pthread_cond_signal(&(con->thread->server->proc_cond));
-    (void) pthread_mutex_unlock(&(con->thread->server->proc_lock));
+    GEARMAN_LIST_ADD(shard->proc, con_shard, proc_)
+    con_shard->proc_list= true;
   }
+
+  if (!(shard->server->proc_shutdown) && !(shard->proc_wakeup))
+  {
+    shard->proc_wakeup= true;
+    (void) pthread_cond_signal(&(shard->proc_cond));
+  }
+
+  (void) pthread_mutex_unlock(&(shard->proc_lock));
 }
 
-void gearman_server_con_proc_remove(gearman_server_con_st *con)
+void gearman_server_con_proc_remove(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard)
 {
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  if (con->proc_list)
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+
+  (void) pthread_mutex_lock(&(shard->proc_lock));
+  if (con_shard->proc_list)
   {
-    GEARMAN_LIST_DEL(con->thread->proc, con, proc_)
-    con->proc_list= false;
+    GEARMAN_LIST_DEL(shard->proc, con_shard, proc_)
+    con_shard->proc_list= false;
   }
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  (void) pthread_mutex_unlock(&(shard->proc_lock));
 }
 
 gearman_server_con_st *
-gearman_server_con_proc_next(gearman_server_thread_st *thread)
+gearman_server_con_proc_next(gearman_server_shard_st *shard)
 {
-  gearman_server_con_st *con;
+  gearman_server_con_shard_st *con_shard;
 
-  if (thread->proc_list == NULL)
+  if (shard->proc_list == NULL)
     return NULL;
 
-  GEARMAN_SERVER_THREAD_LOCK(thread)
+  (void) pthread_mutex_lock(&(shard->proc_lock));
 
-  con= thread->proc_list;
-  while (con != NULL)
+  con_shard= shard->proc_list;
+  while (con_shard != NULL)
   {
-    GEARMAN_LIST_DEL(thread->proc, con, proc_)
-    con->proc_list= false;
-    if (!(con->proc_removed))
+    GEARMAN_LIST_DEL(shard->proc, con_shard, proc_)
+    con_shard->proc_list= false;
+    if (!(con_shard->proc_removed))
       break;
-    con= thread->proc_list;
+    con_shard= shard->proc_list;
   }
 
-  GEARMAN_SERVER_THREAD_UNLOCK(thread)
+  (void) pthread_mutex_unlock(&(shard->proc_lock));
 
-  return con;
+  if (con_shard == NULL)
+    return NULL;
+
+  return con_shard->con;
+}
+
+void gearman_server_con_proc_free(gearman_server_con_st *con,
+                                  gearman_server_shard_st *shard)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, shard);
+
+  gearman_server_con_list_remove(con, shard);
+  gearman_server_con_free_workers(con, shard);
+
+  while (con_shard->client_list != NULL)
+    gearman_server_client_free(con_shard->client_list);
+
+  (void) pthread_mutex_lock(&(shard->proc_lock));
+  con_shard->proc_removed= true;
+  (void) pthread_mutex_unlock(&(shard->proc_lock));
+
+  if (__sync_sub_and_fetch(&(con->proc_pending), 1) == 0)
+  {
+    con->proc_removed= true;
+    gearman_server_con_io_add(con);
+  }
+}
+
+/*
+ * Private definitions
+ */
+
+static int _con_addr_format(const gearman_server_con_addr_st *addr,
+                            char *host, char *port)
+{
+  struct sockaddr_storage sa;
+  struct sockaddr_in *sin= (struct sockaddr_in *)&sa;
+  struct sockaddr_in6 *sin6= (struct sockaddr_in6 *)&sa;
+  socklen_t sa_len;
+
+  if (addr == NULL)
+    return -1;
+
+  memset(&sa, 0, sizeof(struct sockaddr_storage));
+
+  if (addr->family == AF_INET)
+  {
+    sin->sin_family= AF_INET;
+    sin->sin_port= addr->port;
+    memcpy(&(sin->sin_addr), addr->addr, sizeof(struct in_addr));
+    sa_len= sizeof(struct sockaddr_in);
+  }
+  else if (addr->family == AF_INET6)
+  {
+    sin6->sin6_family= AF_INET6;
+    sin6->sin6_port= addr->port;
+    sin6->sin6_scope_id= addr->scope_id;
+    memcpy(&(sin6->sin6_addr), addr->addr, sizeof(struct in6_addr));
+    sa_len= sizeof(struct sockaddr_in6);
+  }
+  else
+    return -1;
+
+  return getnameinfo((struct sockaddr *)&sa, sa_len,
+                     host, host == NULL ? 0 : GEARMAN_SERVER_CON_HOST_SIZE,
+                     port, port == NULL ? 0 : GEARMAN_SERVER_CON_PORT_SIZE,
+                     NI_NUMERICHOST | NI_NUMERICSERV);
 }
@@ -52,6 +52,25 @@ gearman_server_con_create(gearman_server_thread_st *thread);
 GEARMAN_API
 void gearman_server_con_free(gearman_server_con_st *con);
 
+/**
+ * Take an idle connection off its thread so it can be attached to another
+ * one. A connection is idle when nothing it sent is still being processed,
+ * nothing is waiting to be sent to it, and it has no workers or jobs that
+ * other threads could send it packets for. Must be called from the thread
+ * that owns the connection.
+ * @return true if the connection was detached, false if it is not idle.
+ */
+GEARMAN_API
+bool gearman_server_con_detach(gearman_server_con_st *con);
+
+/**
+ * Add a connection taken with gearman_server_con_detach() to a thread and
+ * start watching it for input again. Must be called from the new thread.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_con_attach(gearman_server_con_st *con,
+                                           gearman_server_thread_st *thread);
+
 /**
  * Get gearman connection pointer the server connection uses.
  */
@@ -71,28 +90,46 @@ GEARMAN_API
 void gearman_server_con_set_data(gearman_server_con_st *con, void *data);
 
 /**
- * Get client host.
+ * Get client address, NULL if not set.
+ */
+GEARMAN_API
+const gearman_server_con_addr_st *
+gearman_server_con_addr(gearman_server_con_st *con);
+
+/**
+ * Set client address. The address is copied, so shards listing the
+ * connection can still read it while it is being freed.
  */
 GEARMAN_API
-const char *gearman_server_con_host(gearman_server_con_st *con);
+void gearman_server_con_set_addr(gearman_server_con_st *con,
+                                 const gearman_server_con_addr_st *addr);
 
 /**
- * Set client host.
+ * Store a peer socket address in compact binary form.
  */
 GEARMAN_API
-void gearman_server_con_set_host(gearman_server_con_st *con, const char *host);
+void gearman_server_con_addr_set(gearman_server_con_addr_st *addr,
+                                 const struct sockaddr *sa);
 
 /**
- * Get client port.
+ * Format the host of an address, "-" if it is NULL or can't be formatted.
+ * @param addr Address to format, may be NULL.
+ * @param host Buffer of GEARMAN_SERVER_CON_HOST_SIZE bytes.
+ * @return The host buffer.
  */
 GEARMAN_API
-const char *gearman_server_con_port(gearman_server_con_st *con);
+const char *gearman_server_con_addr_host(const gearman_server_con_addr_st *addr,
+                                         char *host);
 
 /**
- * Set client port.
+ * Format the port of an address, "-" if it is NULL or can't be formatted.
+ * @param addr Address to format, may be NULL.
+ * @param port Buffer of GEARMAN_SERVER_CON_PORT_SIZE bytes.
+ * @return The port buffer.
  */
 GEARMAN_API
-void gearman_server_con_set_port(gearman_server_con_st *con, const char *port);
+const char *gearman_server_con_addr_port(const gearman_server_con_addr_st *addr,
+                                         char *port);
 
 /**
  * Get client id.
@@ -112,14 +149,49 @@ void gearman_server_con_set_id(gearman_server_con_st *con, char *id,
  */
 GEARMAN_API
 void gearman_server_con_free_worker(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard,
                                     char *function_name,
                                     size_t function_name_size);
 
 /**
- * Free all server worker structures for a server connection.
+ * Free all server worker structures a server connection has in a shard.
+ */
+GEARMAN_API
+void gearman_server_con_free_workers(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard);
+
+/**
+ * Put a worker connection to sleep in a shard, adding it to the sleeping
+ * worker list of each function it can do there.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_con_sleep(gearman_server_con_st *con,
+                                          gearman_server_shard_st *shard);
+
+/**
+ * Mark a worker connection as awake in a shard, removing it from all
+ * sleeping worker lists there.
  */
 GEARMAN_API
-void gearman_server_con_free_workers(gearman_server_con_st *con);
+void gearman_server_con_awake(gearman_server_con_st *con,
+                              gearman_server_shard_st *shard);
+
+/**
+ * Queue a NOOP to wake a worker connection for a job queued on function. The
+ * function counts the connection as on its way until it asks for a job.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_con_wake(gearman_server_con_st *con,
+                                         gearman_server_function_st *function);
+
+/**
+ * Clear any pending wakeup in a shard for a connection after it asked for a
+ * job, or went away. If the job it was woken for is still queued, another
+ * sleeping worker is woken for it.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_con_wake_clear(gearman_server_con_st *con,
+                                               gearman_server_shard_st *shard);
 
 /**
  * Add connection to the io thread list.
@@ -141,23 +213,50 @@ gearman_server_con_st *
 gearman_server_con_io_next(gearman_server_thread_st *thread);
 
 /**
- * Add connection to the proc thread list.
+ * Add connection to the list of connections a shard reports in its
+ * statistics snapshots, if it is not there yet. Must only be called from the
+ * thread that owns the shard.
+ */
+GEARMAN_API
+void gearman_server_con_list_add(gearman_server_con_st *con,
+                                 gearman_server_shard_st *shard);
+
+/**
+ * Remove connection from the list of a shard, if it is there. Same threading
+ * rules as gearman_server_con_list_add().
+ */
+GEARMAN_API
+void gearman_server_con_list_remove(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard);
+
+/**
+ * Add connection to the proc list of a shard.
  */
 GEARMAN_API
-void gearman_server_con_proc_add(gearman_server_con_st *con);
+void gearman_server_con_proc_add(gearman_server_con_st *con,
+                                 gearman_server_shard_st *shard);
 
 /**
- * Remove connection from the proc thread list.
+ * Remove connection from the proc list of a shard.
  */
 GEARMAN_API
-void gearman_server_con_proc_remove(gearman_server_con_st *con);
+void gearman_server_con_proc_remove(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard);
 
 /**
- * Get next connection from the proc thread list.
+ * Get next connection from the proc list of a shard.
  */
 GEARMAN_API
 gearman_server_con_st *
-gearman_server_con_proc_next(gearman_server_thread_st *thread);
+gearman_server_con_proc_next(gearman_server_shard_st *shard);
+
+/**
+ * Free the part of a dead connection owned by a shard. The last shard to do
+ * so hands the connection back to its I/O thread to be freed.
+ */
+GEARMAN_API
+void gearman_server_con_proc_free(gearman_server_con_st *con,
+                                  gearman_server_shard_st *shard);
 
 /** @} */
 
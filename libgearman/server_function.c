@@ -18,23 +18,19 @@
  */
 
 gearman_server_function_st *
-gearman_server_function_get(gearman_server_st *server,
+gearman_server_function_get(gearman_server_shard_st *shard,
                             const char *function_name,
                             size_t function_name_size)
 {
   gearman_server_function_st *function;
+  uint32_t key;
 
-  for (function= server->function_list; function != NULL;
-       function= function->next)
-  {
-    if (function->function_name_size == function_name_size &&
-        !memcmp(function->function_name, function_name, function_name_size))
-    {
-      return function;
-    }
-  }
+  function= gearman_server_function_find(shard, function_name,
+                                         function_name_size);
+  if (function != NULL)
+    return function;
 
-  function= gearman_server_function_create(server, NULL);
+  function= gearman_server_function_create(shard, NULL);
   if (function == NULL)
     return NULL;
 
@@ -49,11 +45,47 @@ gearman_server_function_get(gearman_server_st *server,
   function->function_name[function_name_size]= 0;
   function->function_name_size= function_name_size;
 
+  key= gearman_server_hash_key(function_name, function_name_size);
+  if (gearman_server_hash_add(&(shard->function_hash),
+                              &(function->function_node),
+                              key) != GEARMAN_SUCCESS)
+  {
+    gearman_server_function_free(function);
+    return NULL;
+  }
+
   return function;
 }
 
 gearman_server_function_st *
-gearman_server_function_create(gearman_server_st *server,
+gearman_server_function_find(gearman_server_shard_st *shard,
+                             const char *function_name,
+                             size_t function_name_size)
+{
+  gearman_server_hash_node_st *node;
+  gearman_server_function_st *function;
+  uint32_t key;
+
+  key= gearman_server_hash_key(function_name, function_name_size);
+
+  for (node= gearman_server_hash_get(&(shard->function_hash), key);
+       node != NULL; node= node->next)
+  {
+    function= GEARMAN_HASH_ENTRY(node, gearman_server_function_st,
+                                 function_node);
+    if (node->key == key &&
+        function->function_name_size == function_name_size &&
+        !memcmp(function->function_name, function_name, function_name_size))
+    {
+      return function;
+    }
+  }
+
+  return NULL;
+}
+
+gearman_server_function_st *
+gearman_server_function_create(gearman_server_shard_st *shard,
                                gearman_server_function_st *function)
 {
   if (function == NULL)
@@ -72,11 +104,16 @@ gearman_server_function_create(gearman_server_st *server,
   function->job_total= 0;
   function->job_running= 0;
   function->max_queue_size= GEARMAN_DEFAULT_MAX_QUEUE_SIZE;
+  function->sleep_count= 0;
+  function->wake_count= 0;
   function->function_name_size= 0;
-  function->server= server;
-  GEARMAN_LIST_ADD(server->function, function,)
+  function->shard= shard;
+  GEARMAN_LIST_ADD(shard->function, function,)
+  function->function_node.key= 0;
   function->function_name= NULL;
   function->worker_list= NULL;
+  function->sleep_list= NULL;
+  function->sleep_end= NULL;
   memset(function->job_list, 0,
          sizeof(gearman_server_job_st *) * GEARMAN_JOB_PRIORITY_MAX);
   memset(function->job_end, 0,
@@ -90,8 +127,30 @@ void gearman_server_function_free(gearman_server_function_st *function)
   if (function->function_name != NULL)
     free(function->function_name);
 
-  GEARMAN_LIST_DEL(function->server->function, function,)
+  if (function->function_node.key != 0)
+  {
+    gearman_server_hash_del(&(function->shard->function_hash),
+                            &(function->function_node));
+  }
+
+  GEARMAN_LIST_DEL(function->shard->function, function,)
 
   if (function->options & GEARMAN_SERVER_FUNCTION_ALLOCATED)
     free(function);
 }
+
+gearman_return_t
+gearman_server_function_wake(gearman_server_function_st *function)
+{
+  gearman_return_t ret;
+
+  while (function->job_count > function->wake_count &&
+         function->sleep_list != NULL)
+  {
+    ret= gearman_server_con_wake(function->sleep_list->con, function);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  return GEARMAN_SUCCESS;
+}
@@ -27,20 +27,32 @@ extern "C" {
  */
 
 /**
- * Add a new function to a server instance.
+ * Get a function from the shard that owns the name, adding it if it does not
+ * exist yet. Function names are interned, so there is only one function
+ * structure for each name and it can be compared by pointer.
  */
 GEARMAN_API
 gearman_server_function_st *
-gearman_server_function_get(gearman_server_st *server,
+gearman_server_function_get(gearman_server_shard_st *shard,
                             const char *function_name,
                             size_t function_name_size);
 
+/**
+ * Find an existing function in a shard, or NULL if no worker or job has used
+ * the name yet.
+ */
+GEARMAN_API
+gearman_server_function_st *
+gearman_server_function_find(gearman_server_shard_st *shard,
+                             const char *function_name,
+                             size_t function_name_size);
+
 /**
  * Initialize a server function structure.
  */
 GEARMAN_API
 gearman_server_function_st *
-gearman_server_function_create(gearman_server_st *server,
+gearman_server_function_create(gearman_server_shard_st *shard,
                                gearman_server_function_st *function);
 
 /**
@@ -49,6 +61,14 @@ gearman_server_function_create(gearman_server_st *server,
 GEARMAN_API
 void gearman_server_function_free(gearman_server_function_st *function);
 
+/**
+ * Wake sleeping workers for a function until one worker is on its way for
+ * each queued job. Workers are woken in the order they went to sleep.
+ */
+GEARMAN_API
+gearman_return_t
+gearman_server_function_wake(gearman_server_function_st *function);
+
 /** @} */
 
 #ifdef __cplusplus
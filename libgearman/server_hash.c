@@ -0,0 +1,263 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server hash table definitions
+ */
+
+#include "common.h"
+
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearman_server_hash_private Private Server Hash Functions
+ * @ingroup gearman_server_hash
+ * @{
+ */
+
+/**
+ * Start moving all nodes into a new table with the given number of buckets.
+ * If the new table can't be allocated we keep using the current one.
+ */
+static void _hash_resize(gearman_server_hash_st *hash, uint32_t size);
+
+/**
+ * Move all nodes in a bucket of the old table into the current table.
+ */
+static void _hash_move(gearman_server_hash_st *hash, uint32_t bucket);
+
+/**
+ * Move the next few buckets of the old table if a resize is in progress.
+ */
+static void _hash_rehash_step(gearman_server_hash_st *hash);
+
+/**
+ * Get the bucket in the current table for a key. Nodes for this key still in
+ * the old table are moved over first, so the chain returned is complete.
+ */
+static gearman_server_hash_node_st **
+_hash_bucket(gearman_server_hash_st *hash, uint32_t key);
+
+/** @} */
+
+/*
+ * Public definitions
+ */
+
+gearman_server_hash_st *gearman_server_hash_create(gearman_server_hash_st *hash)
+{
+  if (hash == NULL)
+  {
+    hash= malloc(sizeof(gearman_server_hash_st));
+    if (hash == NULL)
+      return NULL;
+
+    hash->options= GEARMAN_SERVER_HASH_ALLOCATED;
+  }
+  else
+    hash->options= 0;
+
+  hash->count= 0;
+  hash->size= 0;
+  hash->old_size= 0;
+  hash->rehash_bucket= 0;
+  hash->first_bucket= 0;
+  hash->table= NULL;
+  hash->old_table= NULL;
+
+  return hash;
+}
+
+void gearman_server_hash_free(gearman_server_hash_st *hash)
+{
+  if (hash->table != NULL)
+    free(hash->table);
+
+  if (hash->old_table != NULL)
+    free(hash->old_table);
+
+  if (hash->options & GEARMAN_SERVER_HASH_ALLOCATED)
+    free(hash);
+}
+
+gearman_return_t gearman_server_hash_add(gearman_server_hash_st *hash,
+                                         gearman_server_hash_node_st *node,
+                                         uint32_t key)
+{
+  gearman_server_hash_node_st **bucket;
+  uint32_t index;
+
+  if (hash->table == NULL)
+  {
+    hash->table= calloc(GEARMAN_SERVER_HASH_MIN_SIZE,
+                        sizeof(gearman_server_hash_node_st *));
+    if (hash->table == NULL)
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+    hash->size= GEARMAN_SERVER_HASH_MIN_SIZE;
+  }
+
+  bucket= _hash_bucket(hash, key);
+  index= (uint32_t)(bucket - hash->table);
+  if (index < hash->first_bucket)
+    hash->first_bucket= index;
+
+  node->key= key;
+  if (*bucket != NULL)
+    (*bucket)->prev= node;
+  node->next= *bucket;
+  node->prev= NULL;
+  *bucket= node;
+  hash->count++;
+
+  if (hash->old_table != NULL)
+    _hash_rehash_step(hash);
+  else if (hash->count > hash->size && hash->size < (UINT32_C(1) << 31))
+    _hash_resize(hash, hash->size << 1);
+
+  return GEARMAN_SUCCESS;
+}
+
+void gearman_server_hash_del(gearman_server_hash_st *hash,
+                             gearman_server_hash_node_st *node)
+{
+  gearman_server_hash_node_st **bucket;
+
+  bucket= _hash_bucket(hash, node->key);
+  if (*bucket == node)
+    *bucket= node->next;
+  if (node->prev != NULL)
+    node->prev->next= node->next;
+  if (node->next != NULL)
+    node->next->prev= node->prev;
+  hash->count--;
+
+  if (hash->old_table != NULL)
+    _hash_rehash_step(hash);
+  else if (hash->size > GEARMAN_SERVER_HASH_MIN_SIZE &&
+           hash->count < (hash->size >> 3))
+  {
+    _hash_resize(hash, hash->size >> 1);
+  }
+}
+
+gearman_server_hash_node_st *
+gearman_server_hash_get(gearman_server_hash_st *hash, uint32_t key)
+{
+  if (hash->table == NULL)
+    return NULL;
+
+  return *_hash_bucket(hash, key);
+}
+
+gearman_server_hash_node_st *
+gearman_server_hash_first(gearman_server_hash_st *hash)
+{
+  if (hash->count == 0)
+    return NULL;
+
+  /* Finish any resize so only the current table needs to be searched. */
+  while (hash->old_table != NULL)
+    _hash_rehash_step(hash);
+
+  while (hash->table[hash->first_bucket] == NULL)
+    hash->first_bucket++;
+
+  return hash->table[hash->first_bucket];
+}
+
+uint32_t gearman_server_hash_key(const char *key, size_t key_size)
+{
+  const uint8_t *ptr= (const uint8_t *)key;
+  uint32_t value= 0;
+
+  /* Jenkins one-at-a-time, unsigned so shifts bring in zeros and the high
+     bits used for shard routing are mixed as well as the low ones. */
+  while (key_size--)
+  {
+    value += *ptr++;
+    value += (value << 10);
+    value ^= (value >> 6);
+  }
+  value += (value << 3);
+  value ^= (value >> 11);
+  value += (value << 15);
+
+  return value == 0 ? 1 : value;
+}
+
+/*
+ * Private definitions
+ */
+
+static void _hash_resize(gearman_server_hash_st *hash, uint32_t size)
+{
+  gearman_server_hash_node_st **table;
+
+  table= calloc(size, sizeof(gearman_server_hash_node_st *));
+  if (table == NULL)
+    return;
+
+  hash->old_table= hash->table;
+  hash->old_size= hash->size;
+  hash->rehash_bucket= 0;
+  hash->first_bucket= 0;
+  hash->table= table;
+  hash->size= size;
+}
+
+static void _hash_move(gearman_server_hash_st *hash, uint32_t bucket)
+{
+  gearman_server_hash_node_st *node;
+  gearman_server_hash_node_st **new_bucket;
+
+  while (hash->old_table[bucket] != NULL)
+  {
+    node= hash->old_table[bucket];
+    hash->old_table[bucket]= node->next;
+
+    new_bucket= &(hash->table[node->key & (hash->size - 1)]);
+    if (*new_bucket != NULL)
+      (*new_bucket)->prev= node;
+    node->next= *new_bucket;
+    node->prev= NULL;
+    *new_bucket= node;
+  }
+}
+
+static void _hash_rehash_step(gearman_server_hash_st *hash)
+{
+  uint32_t x;
+
+  for (x= 0; x < GEARMAN_SERVER_HASH_REHASH_STEP &&
+             hash->rehash_bucket < hash->old_size; x++)
+  {
+    _hash_move(hash, hash->rehash_bucket);
+    hash->rehash_bucket++;
+  }
+
+  if (hash->rehash_bucket == hash->old_size)
+  {
+    free(hash->old_table);
+    hash->old_table= NULL;
+    hash->old_size= 0;
+    hash->rehash_bucket= 0;
+  }
+}
+
+static gearman_server_hash_node_st **
+_hash_bucket(gearman_server_hash_st *hash, uint32_t key)
+{
+  if (hash->old_table != NULL)
+    _hash_move(hash, key & (hash->old_size - 1));
+
+  return &(hash->table[key & (hash->size - 1)]);
+}
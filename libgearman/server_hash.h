@@ -0,0 +1,88 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server hash table declarations
+ */
+
+#ifndef __GEARMAN_SERVER_HASH_H__
+#define __GEARMAN_SERVER_HASH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_hash Server Hash Table Handling
+ * @ingroup gearman_server
+ * This is a low level interface for the hash tables used to index server
+ * objects. Tables start small and double or halve as entries come and go.
+ * Entries are moved to a resized table a few buckets at a time on each
+ * operation, so no single insert or delete has to rehash the whole table.
+ * Objects embed a gearman_server_hash_node_st and are found again with
+ * GEARMAN_HASH_ENTRY().
+ * @{
+ */
+
+/**
+ * Initialize a server hash structure.
+ */
+GEARMAN_API
+gearman_server_hash_st *gearman_server_hash_create(gearman_server_hash_st *hash);
+
+/**
+ * Free a server hash structure. Nodes still in the table are not touched.
+ */
+GEARMAN_API
+void gearman_server_hash_free(gearman_server_hash_st *hash);
+
+/**
+ * Add a node to a server hash with the given key.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_hash_add(gearman_server_hash_st *hash,
+                                         gearman_server_hash_node_st *node,
+                                         uint32_t key);
+
+/**
+ * Delete a node from a server hash.
+ */
+GEARMAN_API
+void gearman_server_hash_del(gearman_server_hash_st *hash,
+                             gearman_server_hash_node_st *node);
+
+/**
+ * Get the bucket chain that holds all nodes for a key. Callers walk the chain
+ * with the next pointer and must compare the key of each node.
+ */
+GEARMAN_API
+gearman_server_hash_node_st *
+gearman_server_hash_get(gearman_server_hash_st *hash, uint32_t key);
+
+/**
+ * Get any node from a server hash, or NULL if it is empty. This is used to
+ * drain a table on shutdown.
+ */
+GEARMAN_API
+gearman_server_hash_node_st *
+gearman_server_hash_first(gearman_server_hash_st *hash);
+
+/**
+ * Generate hash key for a string, such as a job handle or unique ID.
+ */
+GEARMAN_API
+uint32_t gearman_server_hash_key(const char *key, size_t key_size);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAN_SERVER_HASH_H__ */
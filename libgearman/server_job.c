@@ -24,18 +24,73 @@
  */
 
 /**
- * Generate hash key for job handles and unique IDs.
+ * Assign a free slot to a job, which gives it the number used in the job
+ * handle. Slots are allocated a page at a time and never move, so a handle
+ * can be resolved with a single array lookup.
  */
-static uint32_t _server_job_hash(const char *key, size_t key_size);
+static gearman_return_t _server_job_slot_add(gearman_server_shard_st *shard,
+                                             gearman_server_job_st *server_job);
 
 /**
- * Get a server job structure from the unique ID. If data_size is non-zero,
- * then unique points to the workload data and not a real unique key.
+ * Release the slot used by a job.
+ */
+static void _server_job_slot_del(gearman_server_shard_st *shard,
+                                 gearman_server_job_st *server_job);
+
+/**
+ * Start changing the parts of a slot read by gearman_server_job_status().
+ * The sequence is odd until _server_job_slot_end() is called.
+ */
+static inline void _server_job_slot_begin(gearman_server_job_slot_st *job_slot);
+
+/**
+ * Finish changing a slot.
+ */
+static inline void _server_job_slot_end(gearman_server_job_slot_st *job_slot);
+
+/**
+ * Get a slot structure by index.
+ */
+static inline gearman_server_job_slot_st *
+_server_job_slot(gearman_server_shard_st *shard, uint32_t slot);
+
+/**
+ * Parse a decimal number of a job handle up to end or the first character
+ * that is not a digit. Numbers must be in the form the server writes them,
+ * without leading zeros, and no larger than max.
+ */
+static bool _server_job_handle_number(const char **ptr, const char *end,
+                                      uint64_t max, uint64_t *value);
+
+/**
+ * Add a job to the end of the queue for its function and priority. If the
+ * queue was empty, the function's workers are added to the ready lists of
+ * their connections.
+ */
+static void _server_job_list_add(gearman_server_job_st *server_job);
+
+/**
+ * Remove a job from the queue for its function and priority. If the queue is
+ * now empty, the function's workers are removed from the ready lists of
+ * their connections.
+ */
+static void _server_job_list_del(gearman_server_job_st *server_job);
+
+/**
+ * Get a server job structure from the unique ID. If data is true, then unique
+ * points to the workload data and not a real unique key.
  */
 static gearman_server_job_st *
-_server_job_get_unique(gearman_server_st *server, uint32_t unique_key,
+_server_job_get_unique(gearman_server_shard_st *shard, uint32_t unique_key,
                        gearman_server_function_st *server_function,
-                       const char *unique, size_t data_size);
+                       const void *unique, size_t unique_size, bool data);
+
+/**
+ * Copy the unique ID into a job, in the job structure if it is short enough.
+ */
+static gearman_return_t
+_server_job_set_unique(gearman_server_job_st *server_job, const char *unique,
+                       size_t unique_size);
 
 /** @} */
 
@@ -44,18 +99,20 @@ _server_job_get_unique(gearman_server_st *server, uint32_t unique_key,
  */
 
 gearman_server_job_st *
-gearman_server_job_add(gearman_server_st *server, const char *function_name,
+gearman_server_job_add(gearman_server_shard_st *shard,
+                       const char *function_name,
                        size_t function_name_size, const char *unique,
                        size_t unique_size, const void *data, size_t data_size,
                        gearman_job_priority_t priority,
                        gearman_server_client_st *server_client,
                        gearman_return_t *ret_ptr)
 {
+  gearman_server_st *server= shard->server;
   gearman_server_job_st *server_job;
   gearman_server_function_st *server_function;
   uint32_t key;
 
-  server_function= gearman_server_function_get(server, function_name,
+  server_function= gearman_server_function_get(shard, function_name,
                                                function_name_size);
   if (server_function == NULL)
   {
@@ -63,6 +120,9 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
     return NULL;
   }
 
+  if (unique_size >= GEARMAN_UNIQUE_SIZE)
+    unique_size= GEARMAN_UNIQUE_SIZE - 1;
+
   if (unique_size == 0)
   {
     server_job= NULL;
@@ -80,17 +140,17 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
       else
       {
         /* Look up job via unique data when unique = '-'. */
-        key= _server_job_hash(data, data_size);
-        server_job= _server_job_get_unique(server, key, server_function, data,
-                                           data_size);
+        key= gearman_server_hash_key(data, data_size);
+        server_job= _server_job_get_unique(shard, key, server_function, data,
+                                           data_size, true);
       }
     }
     else
     {
       /* Look up job via unique ID first to make sure it's not a duplicate. */
-      key= _server_job_hash(unique, unique_size);
-      server_job= _server_job_get_unique(server, key, server_function, unique,
-                                         0);
+      key= gearman_server_hash_key(unique, unique_size);
+      server_job= _server_job_get_unique(shard, key, server_function, unique,
+                                         unique_size, false);
     }
   }
 
@@ -103,7 +163,7 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
       return NULL;
     }
 
-    server_job= gearman_server_job_create(server, NULL);
+    server_job= gearman_server_job_create(shard, NULL);
     if (server_job == NULL)
     {
       *ret_ptr= GEARMAN_MEMORY_ALLOCATION_FAILURE;
@@ -115,35 +175,49 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
     server_job->function= server_function;
     server_function->job_total++;
 
-    snprintf(server_job->job_handle, GEARMAN_JOB_HANDLE_SIZE, "%s:%u",
-             server->job_handle_prefix, server->job_handle_count);
-    snprintf(server_job->unique, GEARMAN_UNIQUE_SIZE, "%.*s",
-             (uint32_t)unique_size, unique);
-    server->job_handle_count++;
     server_job->data= data;
     server_job->data_size= data_size;
 
-    server_job->unique_key= key;
-    key= key % GEARMAN_JOB_HASH_SIZE;
-    GEARMAN_HASH_ADD(server->unique, key, server_job, unique_)
+    *ret_ptr= _server_job_set_unique(server_job, unique, unique_size);
 
-    key= _server_job_hash(server_job->job_handle,
-                          strlen(server_job->job_handle));
-    server_job->job_handle_key= key;
-    key= key % GEARMAN_JOB_HASH_SIZE;
-    GEARMAN_HASH_ADD(server->job, key, server_job,)
+    /* Jobs without a unique ID can't be looked up by one, so keep them out of
+       the unique hash. */
+    if (*ret_ptr == GEARMAN_SUCCESS && key != 0)
+    {
+      *ret_ptr= gearman_server_hash_add(&(shard->unique_hash),
+                                        &(server_job->unique_node), key);
+    }
+
+    if (*ret_ptr == GEARMAN_SUCCESS)
+      *ret_ptr= _server_job_slot_add(shard, server_job);
+
+    if (*ret_ptr != GEARMAN_SUCCESS)
+    {
+      server_job->data= NULL;
+      gearman_server_job_free(server_job);
+      return NULL;
+    }
 
     if (server->options & GEARMAN_SERVER_QUEUE_REPLAY)
       server_job->options|= GEARMAN_SERVER_JOB_QUEUED;
     else if (server_client == NULL && server->gearman->queue_add_fn != NULL)
     {
+      GEARMAN_SERVER_QUEUE_LOCK(server)
       *ret_ptr= (*(server->gearman->queue_add_fn))(server->gearman,
                                           (void *)server->gearman->queue_fn_arg,
-                                          server_job->unique,
+                                          GEARMAN_SERVER_JOB_UNIQUE(server_job),
                                           unique_size,
                                           function_name,
                                           function_name_size,
                                           data, data_size, priority);
+      if (*ret_ptr == GEARMAN_SUCCESS &&
+          server->gearman->queue_flush_fn != NULL)
+      {
+        *ret_ptr= (*(server->gearman->queue_flush_fn))(server->gearman,
+                                         (void *)server->gearman->queue_fn_arg);
+      }
+      GEARMAN_SERVER_QUEUE_UNLOCK(server)
+
       if (*ret_ptr != GEARMAN_SUCCESS)
       {
         server_job->data= NULL;
@@ -151,18 +225,6 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
         return NULL;
       }
 
-      if (server->gearman->queue_flush_fn != NULL)
-      {
-        *ret_ptr= (*(server->gearman->queue_flush_fn))(server->gearman,
-                                         (void *)server->gearman->queue_fn_arg);
-        if (*ret_ptr != GEARMAN_SUCCESS)
-        {
-          server_job->data= NULL;
-          gearman_server_job_free(server_job);
-          return NULL;
-        }
-      }
-
       server_job->options|= GEARMAN_SERVER_JOB_QUEUED;
     }
 
@@ -172,11 +234,14 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
       if (server_client == NULL && server->gearman->queue_done_fn != NULL)
       {
         /* Do our best to remove the job from the queue. */
+        GEARMAN_SERVER_QUEUE_LOCK(server)
         (void)(*(server->gearman->queue_done_fn))(server->gearman,
                                           (void *)server->gearman->queue_fn_arg,
-                                          server_job->unique, unique_size, 
+                                          GEARMAN_SERVER_JOB_UNIQUE(server_job),
+                                          unique_size,
                                           server_job->function->function_name,
                                           server_job->function->function_name_size);
+        GEARMAN_SERVER_QUEUE_UNLOCK(server)
       }
 
       gearman_server_job_free(server_job);
@@ -196,22 +261,14 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
 }
 
 gearman_server_job_st *
-gearman_server_job_create(gearman_server_st *server,
+gearman_server_job_create(gearman_server_shard_st *shard,
                           gearman_server_job_st *server_job)
 {
   if (server_job == NULL)
   {
-    if (server->free_job_count > 0)
-    {
-      server_job= server->free_job_list;
-      GEARMAN_LIST_DEL(server->free_job, server_job,)
-    }
-    else
-    {
-      server_job= malloc(sizeof(gearman_server_job_st));
-      if (server_job == NULL)
-        return NULL;
-    }
+    server_job= gearman_server_slab_alloc(&(shard->job_cache));
+    if (server_job == NULL)
+      return NULL;
 
     server_job->options= GEARMAN_SERVER_JOB_ALLOCATED;
   }
@@ -219,255 +276,499 @@ gearman_server_job_create(gearman_server_st *server,
     server_job->options= 0;
 
   server_job->priority= 0;
-  server_job->job_handle_key= 0;
-  server_job->unique_key= 0;
-  server_job->client_count= 0;
-  server_job->numerator= 0;
-  server_job->denominator= 0;
-  server_job->data_size= 0;
-  server_job->server= server;
-  server_job->next= NULL;
-  server_job->prev= NULL;
-  server_job->unique_next= NULL;
-  server_job->unique_prev= NULL;
   server_job->function= NULL;
   server_job->function_next= NULL;
-  server_job->data= NULL;
-  server_job->client_list= NULL;
+  server_job->function_prev= NULL;
   server_job->worker= NULL;
-  server_job->job_handle[0]= 0;
-  server_job->unique[0]= 0;
+  server_job->client_list= NULL;
+  server_job->client_count= 0;
+  server_job->data= NULL;
+  server_job->data_size= 0;
+  server_job->numerator= 0;
+  server_job->denominator= 0;
+  server_job->slot= UINT32_MAX;
+  server_job->unique_size= 0;
+  server_job->unique_node.key= 0;
+  server_job->unique.buffer[0]= 0;
 
   return server_job;
 }
 
 void gearman_server_job_free(gearman_server_job_st *server_job)
 {
-  uint32_t key;
+  gearman_server_shard_st *shard= server_job->function->shard;
+  gearman_server_client_st *server_client;
 
   if (server_job->worker != NULL)
     server_job->function->job_running--;
+  else if (server_job->function_prev != NULL ||
+           server_job->function->job_list[server_job->priority] == server_job)
+  {
+    _server_job_list_del(server_job);
+  }
 
   server_job->function->job_total--;
 
   if (server_job->data != NULL)
     free((void *)(server_job->data));
 
+  /* Detach clients first so freeing them doesn't try to abandon the job. */
   while (server_job->client_list != NULL)
-    gearman_server_client_free(server_job->client_list);
+  {
+    server_client= server_job->client_list;
+    GEARMAN_LIST_DEL(server_job->client, server_client, job_)
+    server_client->job= NULL;
+    gearman_server_client_free(server_client);
+  }
 
   if (server_job->worker != NULL)
     server_job->worker->job= NULL;
 
-  key= server_job->unique_key % GEARMAN_JOB_HASH_SIZE;
-  GEARMAN_HASH_DEL(server_job->server->unique, key, server_job, unique_)
+  if (server_job->unique_node.key != 0)
+    gearman_server_hash_del(&(shard->unique_hash), &(server_job->unique_node));
+
+  if (server_job->unique_size >= GEARMAN_SERVER_JOB_UNIQUE_INLINE)
+    free(server_job->unique.ptr);
 
-  key= server_job->job_handle_key % GEARMAN_JOB_HASH_SIZE;
-  GEARMAN_HASH_DEL(server_job->server->job, key, server_job,)
+  if (server_job->slot != UINT32_MAX)
+    _server_job_slot_del(shard, server_job);
 
   if (server_job->options & GEARMAN_SERVER_JOB_ALLOCATED)
+    gearman_server_slab_dealloc(&(shard->job_cache), server_job);
+}
+
+gearman_server_job_st *gearman_server_job_get(gearman_server_shard_st *shard,
+                                              const char *job_handle,
+                                              size_t job_handle_size)
+{
+  gearman_server_job_slot_st *job_slot;
+  uint32_t number;
+  uint32_t generation;
+  uint32_t slot;
+
+  if (!gearman_server_job_handle_decode(shard->server, job_handle,
+                                        job_handle_size, &number, &generation))
   {
-    if (server_job->server->free_job_count < GEARMAN_MAX_FREE_SERVER_JOB)
-      GEARMAN_LIST_ADD(server_job->server->free_job, server_job,)
-    else
-      free(server_job);
+    return NULL;
   }
+
+  /* Slots are interleaved between shards, so the slot number also tells
+     which shard owns the job. */
+  if (number % shard->server->shard_count != shard->index)
+    return NULL;
+
+  slot= number / shard->server->shard_count;
+  if (slot >= shard->job_slot_count)
+    return NULL;
+
+  job_slot= _server_job_slot(shard, slot);
+  if (job_slot->generation != generation)
+    return NULL;
+
+  return job_slot->job;
 }
 
-gearman_server_job_st *gearman_server_job_get(gearman_server_st *server,
-                                              const char *job_handle)
+bool gearman_server_job_status(gearman_server_st *server,
+                               const char *job_handle, size_t job_handle_size,
+                               bool *running, uint32_t *numerator,
+                               uint32_t *denominator)
 {
-  gearman_server_job_st *server_job;
-  uint32_t key;
+  gearman_server_shard_st *shard;
+  volatile gearman_server_job_slot_st *job_slot;
+  uint32_t number;
+  uint32_t generation;
+  uint32_t slot;
+  uint32_t sequence;
+  bool known;
+
+  if (!gearman_server_job_handle_decode(server, job_handle, job_handle_size,
+                                        &number, &generation))
+  {
+    return false;
+  }
+
+  shard= &(server->shard[number % server->shard_count]);
+  slot= number / server->shard_count;
+  if (slot >= *((volatile uint32_t *)&(shard->job_slot_count)))
+    return false;
 
-  key= _server_job_hash(job_handle, strlen(job_handle));
+  __sync_synchronize();
+  job_slot= _server_job_slot(shard, slot);
 
-  for (server_job= server->job_hash[key % GEARMAN_JOB_HASH_SIZE];
-       server_job != NULL; server_job= server_job->next)
+  /* Retry if the owning shard changed the slot while we were reading it. */
+  do
   {
-    if (server_job->job_handle_key == key &&
-        !strcmp(server_job->job_handle, job_handle))
-    {
-      return server_job;
-    }
+    sequence= job_slot->sequence;
+    __sync_synchronize();
+
+    known= job_slot->job != NULL && job_slot->generation == generation;
+    *running= job_slot->running;
+    *numerator= job_slot->numerator;
+    *denominator= job_slot->denominator;
+
+    __sync_synchronize();
   }
+  while ((sequence & 1) || job_slot->sequence != sequence);
 
-  return NULL;
+  return known;
+}
+
+void gearman_server_job_publish(gearman_server_job_st *server_job)
+{
+  gearman_server_job_slot_st *job_slot;
+
+  job_slot= _server_job_slot(server_job->function->shard, server_job->slot);
+  _server_job_slot_begin(job_slot);
+  job_slot->running= server_job->worker != NULL;
+  job_slot->numerator= server_job->numerator;
+  job_slot->denominator= server_job->denominator;
+  _server_job_slot_end(job_slot);
+}
+
+size_t gearman_server_job_handle(gearman_server_job_st *server_job,
+                                 char *job_handle)
+{
+  gearman_server_shard_st *shard= server_job->function->shard;
+  gearman_server_st *server= shard->server;
+  uint64_t value;
+  char digits[GEARMAN_JOB_HANDLE_DIGITS];
+  size_t digits_size;
+  size_t job_handle_size;
+
+  /* Format the handle by hand, this is done for every job. The number has
+     the generation of the slot in the high 32 bits and the slot number, with
+     the slots of the shards interleaved, in the low 32 bits. It is written
+     from the end. */
+  value= ((uint64_t)_server_job_slot(shard, server_job->slot)->generation <<
+          32) | ((server_job->slot * server->shard_count) + shard->index);
+  digits_size= 0;
+  do
+  {
+    digits[GEARMAN_JOB_HANDLE_DIGITS - ++digits_size]= (char)('0' + value % 10);
+    value/= 10;
+  } while (value != 0);
+
+  memcpy(job_handle, server->job_handle_prefix,
+         server->job_handle_prefix_size);
+  memcpy(job_handle + server->job_handle_prefix_size,
+         digits + GEARMAN_JOB_HANDLE_DIGITS - digits_size, digits_size);
+  job_handle_size= server->job_handle_prefix_size + digits_size;
+  job_handle[job_handle_size]= 0;
+
+  return job_handle_size;
+}
+
+bool gearman_server_job_handle_decode(gearman_server_st *server,
+                                      const char *job_handle,
+                                      size_t job_handle_size, uint32_t *number,
+                                      uint32_t *generation)
+{
+  const char *ptr;
+  const char *end;
+  uint64_t value;
+
+  if (job_handle_size > 0 && job_handle[job_handle_size - 1] == 0)
+    job_handle_size--;
+
+  if (job_handle_size <= server->job_handle_prefix_size ||
+      job_handle_size > server->job_handle_prefix_size +
+                        GEARMAN_JOB_HANDLE_DIGITS ||
+      memcmp(job_handle, server->job_handle_prefix,
+             server->job_handle_prefix_size))
+  {
+    return false;
+  }
+
+  ptr= job_handle + server->job_handle_prefix_size;
+  end= job_handle + job_handle_size;
+
+  if (!_server_job_handle_number(&ptr, end, UINT64_MAX, &value) ||
+      ptr != end)
+  {
+    return false;
+  }
+
+  *number= (uint32_t)value;
+  *generation= (uint32_t)(value >> 32);
+
+  return true;
 }
 
 gearman_server_job_st *
-gearman_server_job_peek(gearman_server_con_st *server_con)
+gearman_server_job_peek(gearman_server_con_st *server_con,
+                        gearman_server_shard_st *shard)
 {
-  gearman_server_worker_st *server_worker;
+  gearman_server_con_shard_st *con_shard;
   gearman_job_priority_t priority;
 
-  for (server_worker= server_con->worker_list; server_worker != NULL;
-       server_worker= server_worker->con_next)
+  con_shard= GEARMAN_SERVER_CON_SHARD(server_con, shard);
+
+  for (priority= GEARMAN_JOB_PRIORITY_HIGH;
+       priority != GEARMAN_JOB_PRIORITY_MAX; priority++)
   {
-    if (server_worker->function->job_count != 0)
-    {
-      for (priority= GEARMAN_JOB_PRIORITY_HIGH;
-           priority != GEARMAN_JOB_PRIORITY_MAX; priority++)
-      {
-        if (server_worker->function->job_list[priority] != NULL)
-        {
-          if (server_worker->function->job_list[priority]->options &
-              GEARMAN_SERVER_JOB_IGNORE)
-          {
-            /* This is only happens when a client disconnects from a foreground
-               job. We do this because we don't want to run the job anymore. */
-            server_worker->function->job_list[priority]->options&=
-                       (gearman_server_job_options_t)~GEARMAN_SERVER_JOB_IGNORE;
-            gearman_server_job_free(gearman_server_job_take(server_con));
-            return gearman_server_job_peek(server_con);
-          }
-          return server_worker->function->job_list[priority];
-        }
-      }
-    }
+    if (con_shard->ready_list[priority] != NULL)
+      return con_shard->ready_list[priority]->function->job_list[priority];
   }
 
   return NULL;
 }
 
 gearman_server_job_st *
-gearman_server_job_take(gearman_server_con_st *server_con)
+gearman_server_job_take(gearman_server_con_st *server_con,
+                        gearman_server_shard_st *shard)
 {
+  gearman_server_con_shard_st *con_shard;
   gearman_server_worker_st *server_worker;
   gearman_server_job_st *server_job;
   gearman_job_priority_t priority;
 
-  for (server_worker= server_con->worker_list; server_worker != NULL;
-       server_worker= server_worker->con_next)
-  {
-    if (server_worker->function->job_count != 0)
-      break;
-  }
-
-  if (server_worker == NULL)
-    return NULL;
+  con_shard= GEARMAN_SERVER_CON_SHARD(server_con, shard);
 
   for (priority= GEARMAN_JOB_PRIORITY_HIGH;
        priority != GEARMAN_JOB_PRIORITY_MAX; priority++)
   {
-    if (server_worker->function->job_list[priority] != NULL)
+    if (con_shard->ready_list[priority] != NULL)
       break;
   }
 
+  if (priority == GEARMAN_JOB_PRIORITY_MAX)
+    return NULL;
+
+  server_worker= con_shard->ready_list[priority];
   server_job= server_worker->function->job_list[priority];
-  server_job->function->job_list[priority]= server_job->function_next;
-  if (server_job->function->job_end[priority] == server_job)
-    server_job->function->job_end[priority]= NULL;
-  server_job->function->job_count--;
+  _server_job_list_del(server_job);
+
+  /* Rotate so functions with jobs of the same priority take turns. */
+  if (server_worker->function->job_list[priority] != NULL &&
+      server_worker->ready_next[priority] != NULL)
+  {
+    gearman_server_worker_ready_del(server_worker, priority);
+    gearman_server_worker_ready_add(server_worker, priority);
+  }
 
   server_job->worker= server_worker;
   server_worker->job= server_job;
   server_job->function->job_running++;
-
-  if (server_job->options & GEARMAN_SERVER_JOB_IGNORE)
-  {
-    gearman_server_job_free(server_job);
-    return gearman_server_job_take(server_con);
-  }
+  gearman_server_job_publish(server_job);
 
   return server_job;
 }
 
 gearman_return_t gearman_server_job_queue(gearman_server_job_st *server_job)
 {
-  gearman_server_worker_st *server_worker;
-  gearman_return_t ret;
-
   if (server_job->worker != NULL)
   {
     server_job->function->job_running--;
-    server_job->function_next= NULL;
+    server_job->worker->job= NULL;
   }
 
   server_job->worker= NULL;
   server_job->numerator= 0;
   server_job->denominator= 0;
+  gearman_server_job_publish(server_job);
+
+  /* All clients went away while the job was running, so drop it. */
+  if (server_job->options & GEARMAN_SERVER_JOB_IGNORE)
+  {
+    gearman_server_job_free(server_job);
+    return GEARMAN_SUCCESS;
+  }
+
+  _server_job_list_add(server_job);
+
+  /* Queue a NOOP for a sleeping worker, unless enough are already awake. */
+  return gearman_server_function_wake(server_job->function);
+}
+
+/*
+ * Private definitions
+ */
+
+static gearman_return_t _server_job_slot_add(gearman_server_shard_st *shard,
+                                             gearman_server_job_st *server_job)
+{
+  gearman_server_st *server= shard->server;
+  gearman_server_job_slot_st *job_slot;
+  gearman_server_job_slot_st *page;
+  uint32_t x;
 
-  /* Queue NOOP for possible sleeping workers. */
-  for (server_worker= server_job->function->worker_list; server_worker != NULL;
-       server_worker= server_worker->function_next)
+  if (shard->job_slot_free == 0)
   {
-    if (!(server_worker->con->noop_queued) &&
-        !(server_worker->con->options & GEARMAN_SERVER_CON_SLEEPING))
+    if (shard->job_slot_page == NULL)
     {
-      continue;
+      shard->job_slot_page= calloc(GEARMAN_JOB_SLOT_PAGE_MAX,
+                                   sizeof(gearman_server_job_slot_st *));
+      if (shard->job_slot_page == NULL)
+        return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    /* Slot numbers of all shards have to fit in the low half of a handle. */
+    if (shard->job_slot_count == (uint32_t)(GEARMAN_JOB_SLOT_PAGE_MAX - 1) *
+                                 GEARMAN_JOB_SLOT_PAGE_SIZE ||
+        shard->job_slot_count + GEARMAN_JOB_SLOT_PAGE_SIZE >
+        UINT32_MAX / server->shard_count)
+    {
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
     }
 
-    ret= gearman_server_io_packet_add(server_worker->con, false,
-                                      GEARMAN_MAGIC_RESPONSE,
-                                      GEARMAN_COMMAND_NOOP, NULL);
-    if (ret != GEARMAN_SUCCESS)
-      return ret;
+    page= calloc(GEARMAN_JOB_SLOT_PAGE_SIZE,
+                 sizeof(gearman_server_job_slot_st));
+    if (page == NULL)
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
 
-    server_worker->con->noop_queued= true;
-  }
+    /* Free list entries are stored as index + 1 so zero can end the list. */
+    for (x= GEARMAN_JOB_SLOT_PAGE_SIZE; x > 0; x--)
+    {
+      page[x - 1].next_free= shard->job_slot_free;
+      shard->job_slot_free= shard->job_slot_count + x;
+    }
 
-  /* Queue the job to be run. */
-  if (server_job->function->job_list[server_job->priority] == NULL)
-    server_job->function->job_list[server_job->priority]= server_job;
-  else
-  {
-    server_job->function->job_end[server_job->priority]->function_next=
-                                                                     server_job;
+    shard->job_slot_page[shard->job_slot_count >>
+                         GEARMAN_JOB_SLOT_PAGE_SHIFT]= page;
+
+    /* I/O threads may look up slots as soon as the count covers them. */
+    __sync_synchronize();
+    shard->job_slot_count+= GEARMAN_JOB_SLOT_PAGE_SIZE;
   }
-  server_job->function->job_end[server_job->priority]= server_job;
-  server_job->function->job_count++;
+
+  server_job->slot= shard->job_slot_free - 1;
+  job_slot= _server_job_slot(shard, server_job->slot);
+  shard->job_slot_free= job_slot->next_free;
+
+  _server_job_slot_begin(job_slot);
+  job_slot->generation++;
+  job_slot->next_free= 0;
+  job_slot->numerator= 0;
+  job_slot->denominator= 0;
+  job_slot->running= false;
+  job_slot->job= server_job;
+  _server_job_slot_end(job_slot);
+  shard->job_count++;
 
   return GEARMAN_SUCCESS;
 }
 
-/*
- * Private definitions
- */
+static void _server_job_slot_del(gearman_server_shard_st *shard,
+                                 gearman_server_job_st *server_job)
+{
+  gearman_server_job_slot_st *job_slot;
+
+  job_slot= _server_job_slot(shard, server_job->slot);
+  _server_job_slot_begin(job_slot);
+  job_slot->job= NULL;
+  _server_job_slot_end(job_slot);
+  job_slot->next_free= shard->job_slot_free;
+  shard->job_slot_free= server_job->slot + 1;
+  shard->job_count--;
 
-static uint32_t _server_job_hash(const char *key, size_t key_size)
+  server_job->slot= UINT32_MAX;
+}
+
+static inline void _server_job_slot_begin(gearman_server_job_slot_st *job_slot)
+{
+  *((volatile uint32_t *)&(job_slot->sequence))= job_slot->sequence + 1;
+  __sync_synchronize();
+}
+
+static inline void _server_job_slot_end(gearman_server_job_slot_st *job_slot)
+{
+  __sync_synchronize();
+  *((volatile uint32_t *)&(job_slot->sequence))= job_slot->sequence + 1;
+}
+
+static inline gearman_server_job_slot_st *
+_server_job_slot(gearman_server_shard_st *shard, uint32_t slot)
+{
+  return &(shard->job_slot_page[slot >> GEARMAN_JOB_SLOT_PAGE_SHIFT]
+           [slot & (GEARMAN_JOB_SLOT_PAGE_SIZE - 1)]);
+}
+
+static void _server_job_list_add(gearman_server_job_st *server_job)
 {
-  const char *ptr= key;
-  int32_t value= 0;
+  gearman_server_function_st *function= server_job->function;
+  gearman_job_priority_t priority= server_job->priority;
+  gearman_server_worker_st *server_worker;
+
+  server_job->function_next= NULL;
+  server_job->function_prev= function->job_end[priority];
 
-  while (key_size--)
+  if (function->job_end[priority] == NULL)
   {
-    value += (int32_t)*ptr++;
-    value += (value << 10);
-    value ^= (value >> 6);
+    function->job_list[priority]= server_job;
+
+    for (server_worker= function->worker_list; server_worker != NULL;
+         server_worker= server_worker->function_next)
+    {
+      gearman_server_worker_ready_add(server_worker, priority);
+    }
   }
-  value += (value << 3);
-  value ^= (value >> 11);
-  value += (value << 15);
+  else
+    function->job_end[priority]->function_next= server_job;
+
+  function->job_end[priority]= server_job;
+  function->job_count++;
+}
+
+static void _server_job_list_del(gearman_server_job_st *server_job)
+{
+  gearman_server_function_st *function= server_job->function;
+  gearman_job_priority_t priority= server_job->priority;
+  gearman_server_worker_st *server_worker;
+
+  if (server_job->function_prev == NULL)
+    function->job_list[priority]= server_job->function_next;
+  else
+    server_job->function_prev->function_next= server_job->function_next;
+
+  if (server_job->function_next == NULL)
+    function->job_end[priority]= server_job->function_prev;
+  else
+    server_job->function_next->function_prev= server_job->function_prev;
+
+  server_job->function_next= NULL;
+  server_job->function_prev= NULL;
+  function->job_count--;
 
-  return (uint32_t)(value == 0 ? 1 : value);
+  if (function->job_list[priority] == NULL)
+  {
+    for (server_worker= function->worker_list; server_worker != NULL;
+         server_worker= server_worker->function_next)
+    {
+      gearman_server_worker_ready_del(server_worker, priority);
+    }
+  }
 }
 
 static gearman_server_job_st *
-_server_job_get_unique(gearman_server_st *server, uint32_t unique_key,
+_server_job_get_unique(gearman_server_shard_st *shard, uint32_t unique_key,
                        gearman_server_function_st *server_function,
-                       const char *unique, size_t data_size)
+                       const void *unique, size_t unique_size, bool data)
 {
+  gearman_server_hash_node_st *node;
   gearman_server_job_st *server_job;
 
-  for (server_job= server->unique_hash[unique_key % GEARMAN_JOB_HASH_SIZE];
-       server_job != NULL; server_job= server_job->unique_next)
+  for (node= gearman_server_hash_get(&(shard->unique_hash), unique_key);
+       node != NULL; node= node->next)
   {
-    if (data_size == 0)
+    if (node->key != unique_key)
+      continue;
+
+    server_job= GEARMAN_HASH_ENTRY(node, gearman_server_job_st, unique_node);
+    if (server_job->function != server_function)
+      continue;
+
+    if (data)
     {
-      if (server_job->function == server_function &&
-          server_job->unique_key == unique_key &&
-          !strcmp(server_job->unique, unique))
+      if (server_job->data_size == unique_size &&
+          !memcmp(server_job->data, unique, unique_size))
       {
         return server_job;
       }
     }
     else
     {
-      if (server_job->function == server_function &&
-          server_job->unique_key == unique_key &&
-          server_job->data_size == data_size &&
-          !memcmp(server_job->data, unique, data_size))
+      if (server_job->unique_size == unique_size &&
+          !memcmp(GEARMAN_SERVER_JOB_UNIQUE(server_job), unique, unique_size))
       {
         return server_job;
       }
@@ -476,3 +777,47 @@ _server_job_get_unique(gearman_server_st *server, uint32_t unique_key,
 
   return NULL;
 }
+
+static gearman_return_t
+_server_job_set_unique(gearman_server_job_st *server_job, const char *unique,
+                       size_t unique_size)
+{
+  char *buffer;
+
+  if (unique_size < GEARMAN_SERVER_JOB_UNIQUE_INLINE)
+    buffer= server_job->unique.buffer;
+  else
+  {
+    buffer= malloc(unique_size + 1);
+    if (buffer == NULL)
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+    server_job->unique.ptr= buffer;
+  }
+
+  memcpy(buffer, unique, unique_size);
+  buffer[unique_size]= 0;
+  server_job->unique_size= (uint8_t)unique_size;
+
+  return GEARMAN_SUCCESS;
+}
+
+static bool _server_job_handle_number(const char **ptr, const char *end,
+                                      uint64_t max, uint64_t *value)
+{
+  const char *start= *ptr;
+  uint64_t digit;
+
+  *value= 0;
+  for (; *ptr < end && **ptr >= '0' && **ptr <= '9'; (*ptr)++)
+  {
+    digit= (uint64_t)(**ptr - '0');
+    if (*value > (max - digit) / 10)
+      return false;
+
+    *value= (*value * 10) + digit;
+  }
+
+  /* One handle per job: no empty numbers and no leading zeros. */
+  return *ptr != start && (*start != '0' || *ptr == start + 1);
+}
@@ -27,11 +27,20 @@ extern "C" {
  */
 
 /**
- * Add a new job to a server instance.
+ * Get the NUL terminated unique ID of a job, which is kept in the job
+ * structure when it is short enough.
+ */
+#define GEARMAN_SERVER_JOB_UNIQUE(__job) \
+  ((__job)->unique_size < GEARMAN_SERVER_JOB_UNIQUE_INLINE ? \
+   (__job)->unique.buffer : (__job)->unique.ptr)
+
+/**
+ * Add a new job to the shard that owns the function.
  */
 GEARMAN_API
 gearman_server_job_st *
-gearman_server_job_add(gearman_server_st *server, const char *function_name,
+gearman_server_job_add(gearman_server_shard_st *shard,
+                       const char *function_name,
                        size_t function_name_size, const char *unique,
                        size_t unique_size, const void *data, size_t data_size,
                        gearman_job_priority_t priority,
@@ -43,7 +52,7 @@ gearman_server_job_add(gearman_server_st *server, const char *function_name,
  */
 GEARMAN_API
 gearman_server_job_st *
-gearman_server_job_create(gearman_server_st *server,
+gearman_server_job_create(gearman_server_shard_st *shard,
                           gearman_server_job_st *server_job);
 
 /**
@@ -53,25 +62,75 @@ GEARMAN_API
 void gearman_server_job_free(gearman_server_job_st *server_job);
 
 /**
- * Get a server job structure from the job handle.
+ * Get a server job structure from the job handle. The handle does not need to
+ * be NULL terminated, but may include the terminating NULL in job_handle_size.
+ * Jobs owned by other shards are not found.
+ */
+GEARMAN_API
+gearman_server_job_st *gearman_server_job_get(gearman_server_shard_st *shard,
+                                              const char *job_handle,
+                                              size_t job_handle_size);
+
+/**
+ * Get the status of a job from its handle, as reported to GET_STATUS. This
+ * only reads the job slot, so it may be called from any thread.
+ * @return true if the job is known, in which case the other values are set.
+ */
+GEARMAN_API
+bool gearman_server_job_status(gearman_server_st *server,
+                               const char *job_handle, size_t job_handle_size,
+                               bool *running, uint32_t *numerator,
+                               uint32_t *denominator);
+
+/**
+ * Update the status gearman_server_job_status() reports for a job after its
+ * worker or progress changed. Must be called from the thread that owns the
+ * shard of the job.
+ */
+GEARMAN_API
+void gearman_server_job_publish(gearman_server_job_st *server_job);
+
+/**
+ * Format the handle of a job that has a slot, from the slot number and its
+ * generation, so jobs don't have to carry their handle around.
+ * @param server_job Job to get the handle of.
+ * @param job_handle Buffer of at least GEARMAN_JOB_HANDLE_SIZE bytes, the
+ *        handle is NUL terminated.
+ * @return Size of the handle, without the NUL.
+ */
+GEARMAN_API
+size_t gearman_server_job_handle(gearman_server_job_st *server_job,
+                                 char *job_handle);
+
+/**
+ * Parse the number out of a job handle created by this server. The low 32
+ * bits are the slot number and the high 32 bits the generation of the slot.
+ * Slot numbers of the shards are interleaved, so the slot number modulo the
+ * shard count is the shard that owns the job. Handles with numbers the server
+ * would not have written, with leading zeros or too large, are not accepted.
  */
 GEARMAN_API
-gearman_server_job_st *gearman_server_job_get(gearman_server_st *server,
-                                              const char *job_handle);
+bool gearman_server_job_handle_decode(gearman_server_st *server,
+                                      const char *job_handle,
+                                      size_t job_handle_size, uint32_t *number,
+                                      uint32_t *generation);
 
 /**
- * See if there are any jobs to be run for the server worker connection.
+ * See if there are any jobs in a shard to be run for the server worker
+ * connection.
  */
 GEARMAN_API
 gearman_server_job_st *
-gearman_server_job_peek(gearman_server_con_st *server_con);
+gearman_server_job_peek(gearman_server_con_st *server_con,
+                        gearman_server_shard_st *shard);
 
 /**
- * Start running a job for the server worker connection.
+ * Start running a job from a shard for the server worker connection.
  */
 GEARMAN_API
 gearman_server_job_st *
-gearman_server_job_take(gearman_server_con_st *server_con);
+gearman_server_job_take(gearman_server_con_st *server_con,
+                        gearman_server_shard_st *shard);
 
 /**
  * Queue a job to be run.
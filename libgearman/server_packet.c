@@ -13,106 +13,502 @@
 
 #include "common.h"
 
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearman_server_packet_private Private Server Packet Functions
+ * @ingroup gearman_server_con
+ * @{
+ */
+
+/**
+ * Build a packet from a list of arguments and add it to the io queue. When
+ * payload is given it is used as the packet data and a reference is taken.
+ * The data is framed or decoded to suit the connection, as told by framed.
+ */
+static gearman_return_t _server_io_packet_add(gearman_server_con_st *con,
+                                              gearman_server_shard_st *shard,
+                                              bool take_data,
+                                            gearman_server_payload_st *payload,
+                                              bool framed,
+                                              gearman_magic_t magic,
+                                              gearman_command_t command,
+                                              const void *arg, va_list ap);
+
+/**
+ * Build a packet from a list of arguments, with data that may be framed,
+ * and add it to the io queue.
+ */
+static gearman_return_t
+_server_io_packet_add_framed(gearman_server_con_st *con,
+                             gearman_server_shard_st *shard, bool framed,
+                             gearman_command_t command, const void *arg, ...);
+
+/**
+ * Start a response packet to be encoded by hand, with room for the header.
+ */
+static gearman_server_packet_st *
+_server_io_packet_start(gearman_server_con_st *con,
+                        gearman_server_shard_st *shard,
+                        gearman_command_t command);
+
+/**
+ * Append an argument to a packet started with _server_io_packet_start. The
+ * caller makes sure it fits in args_buffer.
+ */
+static void _server_io_packet_arg(gearman_packet_st *packet, const void *arg,
+                                  size_t arg_size);
+
+/**
+ * Write the header of a packet started with _server_io_packet_start, once
+ * the arguments and data are set.
+ */
+static void _server_io_packet_header(gearman_packet_st *packet);
+
+/**
+ * Make the data of a packet fit the connection it goes to. Framed data is
+ * decoded for connections that did not negotiate compression, and plain
+ * data gets a raw frame byte after the arguments for those that did. The
+ * header is written again if anything changed.
+ */
+static gearman_return_t
+_server_io_packet_frame(gearman_server_con_st *con,
+                        gearman_server_packet_st *server_packet, bool framed);
+
+/**
+ * Add a finished packet to the io queue of a connection.
+ */
+static void _server_io_packet_finish(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard,
+                                     gearman_server_packet_st *server_packet);
+
+/**
+ * Responses without arguments, encoded ahead of time.
+ */
+static const uint8_t _server_noop_header[GEARMAN_PACKET_HEADER_SIZE]=
+{
+  0, 'R', 'E', 'S', 0, 0, 0, GEARMAN_COMMAND_NOOP, 0, 0, 0, 0
+};
+
+static const uint8_t _server_no_job_header[GEARMAN_PACKET_HEADER_SIZE]=
+{
+  0, 'R', 'E', 'S', 0, 0, 0, GEARMAN_COMMAND_NO_JOB, 0, 0, 0, 0
+};
+
+/** @} */
+
 /*
  * Public definitions
  */
 
 gearman_server_packet_st *
 gearman_server_packet_create(gearman_server_thread_st *thread,
-                             bool from_thread)
+                             gearman_server_shard_st *shard)
 {
-  gearman_server_packet_st *server_packet= NULL;
+  gearman_server_packet_st *server_packet;
 
-  if (from_thread && thread->server->options & GEARMAN_SERVER_PROC_THREAD)
-  {
-    if (thread->free_packet_count > 0)
-    {
-      server_packet= thread->free_packet_list;
-      thread->free_packet_list= server_packet->next;
-      thread->free_packet_count--;
-    }
-  }
+  if (shard != NULL)
+    server_packet= gearman_server_slab_alloc(&(shard->packet_cache));
+  else if (thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+    server_packet= gearman_server_slab_alloc(&(thread->packet_cache));
   else
   {
-    if (thread->server->free_packet_count > 0)
-    {
-      server_packet= thread->server->free_packet_list;
-      thread->server->free_packet_list= server_packet->next;
-      thread->server->free_packet_count--;
-    }
+    server_packet= gearman_server_slab_alloc(&(thread->server->shard[0].
+                                               packet_cache));
   }
 
   if (server_packet == NULL)
   {
-    server_packet= malloc(sizeof(gearman_server_packet_st));
-    if (server_packet == NULL)
-    {
-      GEARMAN_ERROR_SET(thread->gearman, "gearman_server_packet_create",
-                        "malloc")
-      return NULL;
-    }
+    GEARMAN_ERROR_SET(thread->gearman, "gearman_server_packet_create",
+                      "gearman_server_slab_alloc")
+    return NULL;
   }
 
   server_packet->next= NULL;
+  server_packet->payload= NULL;
 
   return server_packet;
 }
 
 void gearman_server_packet_free(gearman_server_packet_st *packet,
                                 gearman_server_thread_st *thread,
-                                bool from_thread)
+                                gearman_server_shard_st *shard)
+{
+  if (packet->payload != NULL)
+    gearman_server_payload_free(packet->payload);
+
+  if (shard != NULL)
+    gearman_server_slab_dealloc(&(shard->packet_cache), packet);
+  else if (thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+    gearman_server_slab_dealloc(&(thread->packet_cache), packet);
+  else
+  {
+    gearman_server_slab_dealloc(&(thread->server->shard[0].packet_cache),
+                                packet);
+  }
+}
+
+gearman_return_t gearman_server_io_packet_add(gearman_server_con_st *con,
+                                              gearman_server_shard_st *shard,
+                                              bool take_data,
+                                              gearman_magic_t magic,
+                                              gearman_command_t command,
+                                              const void *arg, ...)
+{
+  va_list ap;
+  gearman_return_t ret;
+
+  /* The data is already in the form the connection takes. */
+  va_start(ap, arg);
+  ret= _server_io_packet_add(con, shard, take_data, NULL,
+                             (con->options & GEARMAN_SERVER_CON_COMPRESS) != 0,
+                             magic, command, arg, ap);
+  va_end(ap);
+
+  return ret;
+}
+
+gearman_return_t
+gearman_server_io_packet_add_payload(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard,
+                                     gearman_server_payload_st *payload,
+                                     bool framed, gearman_magic_t magic,
+                                     gearman_command_t command,
+                                     const void *arg, ...)
+{
+  va_list ap;
+  gearman_return_t ret;
+
+  va_start(ap, arg);
+  ret= _server_io_packet_add(con, shard, false, payload, framed, magic,
+                             command, arg, ap);
+  va_end(ap);
+
+  return ret;
+}
+
+gearman_return_t gearman_server_io_packet_add_const(gearman_server_con_st *con,
+                                                gearman_server_shard_st *shard,
+                                                gearman_command_t command)
 {
-  if (from_thread && thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+  gearman_server_packet_st *server_packet;
+  const uint8_t *header;
+
+  if (command == GEARMAN_COMMAND_NOOP)
+    header= _server_noop_header;
+  else if (command == GEARMAN_COMMAND_NO_JOB)
+    header= _server_no_job_header;
+  else
   {
-    if (thread->free_packet_count < GEARMAN_MAX_FREE_SERVER_PACKET)
+    GEARMAN_ERROR_SET(con->thread->gearman,
+                      "gearman_server_io_packet_add_const",
+                      "no constant packet for command")
+    return GEARMAN_INVALID_COMMAND;
+  }
+
+  server_packet= _server_io_packet_start(con, shard, command);
+  if (server_packet == NULL)
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+  memcpy(server_packet->packet.args, header, GEARMAN_PACKET_HEADER_SIZE);
+  _server_io_packet_finish(con, shard, server_packet);
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t
+gearman_server_io_packet_add_job_created(gearman_server_con_st *con,
+                                         gearman_server_shard_st *shard,
+                                         gearman_server_job_st *server_job)
+{
+  gearman_server_packet_st *server_packet;
+  gearman_packet_st *packet;
+  size_t job_handle_size;
+
+  server_packet= _server_io_packet_start(con, shard,
+                                         GEARMAN_COMMAND_JOB_CREATED);
+  if (server_packet == NULL)
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+  /* The handle always fits after the header, and is the whole packet. */
+  packet= &(server_packet->packet);
+  job_handle_size= gearman_server_job_handle(server_job,
+                                             (char *)(packet->args +
+                                                      packet->args_size));
+  packet->arg[0]= packet->args + packet->args_size;
+  packet->arg_size[0]= job_handle_size;
+  packet->args_size+= job_handle_size;
+  packet->argc= 1;
+
+  _server_io_packet_header(packet);
+  _server_io_packet_finish(con, shard, server_packet);
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t
+gearman_server_io_packet_add_job_assign(gearman_server_con_st *con,
+                                        gearman_server_shard_st *shard,
+                                        gearman_server_job_st *server_job,
+                                        bool unique)
+{
+  gearman_server_function_st *function= server_job->function;
+  bool framed= (server_job->options & GEARMAN_SERVER_JOB_FRAMED) != 0;
+  gearman_server_packet_st *server_packet;
+  gearman_packet_st *packet;
+  char job_handle[GEARMAN_JOB_HANDLE_SIZE];
+  size_t job_handle_size;
+  size_t size;
+  gearman_return_t ret;
+
+  job_handle_size= gearman_server_job_handle(server_job, job_handle);
+  size= GEARMAN_PACKET_HEADER_SIZE + job_handle_size + 1 +
+        function->function_name_size + 1;
+  if (unique)
+    size+= (size_t)(server_job->unique_size) + 1;
+
+  /* Arguments that don't fit in the packet are built the usual way. */
+  if (size > GEARMAN_ARGS_BUFFER_SIZE)
+  {
+    if (unique)
     {
-      packet->next= thread->free_packet_list;
-      thread->free_packet_list= packet;
-      thread->free_packet_count++;
+      return _server_io_packet_add_framed(con, shard, framed,
+                                          GEARMAN_COMMAND_JOB_ASSIGN_UNIQ,
+                                          job_handle, job_handle_size + 1,
+                                          function->function_name,
+                                          function->function_name_size + 1,
+                                          GEARMAN_SERVER_JOB_UNIQUE(server_job),
+                                          (size_t)(server_job->unique_size + 1),
+                                          server_job->data,
+                                          server_job->data_size, NULL);
     }
-    else
-      free(packet);
+
+    return _server_io_packet_add_framed(con, shard, framed,
+                                        GEARMAN_COMMAND_JOB_ASSIGN,
+                                        job_handle, job_handle_size + 1,
+                                        function->function_name,
+                                        function->function_name_size + 1,
+                                        server_job->data,
+                                        server_job->data_size, NULL);
+  }
+
+  server_packet= _server_io_packet_start(con, shard,
+                                         unique ?
+                                         GEARMAN_COMMAND_JOB_ASSIGN_UNIQ :
+                                         GEARMAN_COMMAND_JOB_ASSIGN);
+  if (server_packet == NULL)
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+  packet= &(server_packet->packet);
+  _server_io_packet_arg(packet, job_handle, job_handle_size + 1);
+  _server_io_packet_arg(packet, function->function_name,
+                        function->function_name_size + 1);
+  if (unique)
+  {
+    _server_io_packet_arg(packet, GEARMAN_SERVER_JOB_UNIQUE(server_job),
+                          (size_t)(server_job->unique_size) + 1);
+  }
+
+  /* The job keeps its workload, the packet only points at it. */
+  packet->data= server_job->data;
+  packet->data_size= server_job->data_size;
+
+  _server_io_packet_header(packet);
+  ret= _server_io_packet_frame(con, server_packet, framed);
+  if (ret != GEARMAN_SUCCESS)
+  {
+    gearman_packet_free(packet);
+    gearman_server_packet_free(server_packet, con->thread, shard);
+    return ret;
+  }
+
+  _server_io_packet_finish(con, shard, server_packet);
+
+  return GEARMAN_SUCCESS;
+}
+
+void gearman_server_io_packet_queue(gearman_server_con_st *con,
+                                    gearman_server_packet_st *packet)
+{
+  if (con->thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+  {
+    packet->con= con;
+    gearman_server_packet_push(&(con->thread->io_queue), packet);
+    gearman_server_thread_wakeup(con->thread);
+    return;
+  }
+
+  GEARMAN_FIFO_ADD(con->io_packet, packet,)
+  gearman_server_con_io_add(con);
+}
+
+void gearman_server_io_packet_remove(gearman_server_con_st *con)
+{
+  gearman_server_packet_st *server_packet= con->io_packet_list;
+
+  gearman_packet_free(&(server_packet->packet));
+  GEARMAN_FIFO_DEL(con->io_packet, server_packet,)
+  gearman_server_packet_free(server_packet, con->thread, NULL);
+}
+
+void gearman_server_proc_packet_add(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard,
+                                    gearman_server_packet_st *packet)
+{
+  packet->con= con;
+  packet->proc_time= gearman_server_packet_time();
+  gearman_server_packet_push(&(shard->proc_queue), packet);
+
+  /* The push is a full barrier, and the processing thread sets the flag
+     before checking the queue one last time, so a wakeup cannot be lost. */
+  if (*((volatile bool *)&(shard->proc_sleeping)))
+  {
+    (void) pthread_mutex_lock(&(shard->proc_lock));
+    shard->proc_wakeup= true;
+    (void) pthread_cond_signal(&(shard->proc_cond));
+    (void) pthread_mutex_unlock(&(shard->proc_lock));
+  }
+}
+
+uint64_t gearman_server_packet_time(void)
+{
+  struct timeval tv;
+
+  if (gettimeofday(&tv, NULL) == -1)
+    return 0;
+
+  return ((uint64_t)tv.tv_sec * 1000000) + (uint64_t)tv.tv_usec;
+}
+
+void gearman_server_packet_push(gearman_server_packet_st **queue,
+                                gearman_server_packet_st *packet)
+{
+  gearman_server_packet_st *head;
+
+  /* Pushing alone is safe from ABA since the head is never dereferenced. */
+  do
+  {
+    head= *((gearman_server_packet_st * volatile *)queue);
+    packet->next= head;
+  }
+  while (!__sync_bool_compare_and_swap(queue, head, packet));
+}
+
+gearman_server_packet_st *
+gearman_server_packet_take(gearman_server_packet_st **queue)
+{
+  gearman_server_packet_st *packet;
+  gearman_server_packet_st *next;
+  gearman_server_packet_st *list= NULL;
+
+  if (*((gearman_server_packet_st * volatile *)queue) == NULL)
+    return NULL;
+
+  packet= __sync_lock_test_and_set(queue, NULL);
+
+  /* The queue is a stack, reverse it back to the order of the pushes. */
+  while (packet != NULL)
+  {
+    next= packet->next;
+    packet->next= list;
+    list= packet;
+    packet= next;
+  }
+
+  return list;
+}
+
+gearman_server_payload_st *
+gearman_server_payload_create(gearman_packet_st *packet)
+{
+  gearman_server_payload_st *payload;
+  void *data;
+
+  payload= malloc(sizeof(gearman_server_payload_st));
+  if (payload == NULL)
+  {
+    GEARMAN_ERROR_SET(packet->gearman, "gearman_server_payload_create",
+                      "malloc")
+    return NULL;
+  }
+
+  if (packet->options & GEARMAN_PACKET_FREE_DATA)
+  {
+    payload->data= packet->data;
+    packet->options&= (gearman_packet_options_t)~GEARMAN_PACKET_FREE_DATA;
   }
   else
   {
-    if (thread->server->free_packet_count < GEARMAN_MAX_FREE_SERVER_PACKET)
+    data= malloc(packet->data_size);
+    if (data == NULL)
     {
-      packet->next= thread->server->free_packet_list;
-      thread->server->free_packet_list= packet;
-      thread->server->free_packet_count++;
+      free(payload);
+      GEARMAN_ERROR_SET(packet->gearman, "gearman_server_payload_create",
+                        "malloc")
+      return NULL;
     }
-    else
-      free(packet);
+
+    memcpy(data, packet->data, packet->data_size);
+    payload->data= data;
   }
+
+  payload->ref_count= 1;
+  payload->data_size= packet->data_size;
+  payload->gearman= packet->gearman;
+
+  return payload;
 }
 
-gearman_return_t gearman_server_io_packet_add(gearman_server_con_st *con,
+void gearman_server_payload_free(gearman_server_payload_st *payload)
+{
+  /* Packets holding the payload may be sent from different I/O threads. */
+  if (__sync_sub_and_fetch(&(payload->ref_count), 1) != 0)
+    return;
+
+  if (payload->gearman->workload_free == NULL)
+    free((void *)(payload->data));
+  else
+  {
+    payload->gearman->workload_free((void *)(payload->data),
+                                 (void *)(payload->gearman->workload_free_arg));
+  }
+
+  free(payload);
+}
+
+/*
+ * Private definitions
+ */
+
+static gearman_return_t _server_io_packet_add(gearman_server_con_st *con,
+                                              gearman_server_shard_st *shard,
                                               bool take_data,
+                                            gearman_server_payload_st *payload,
+                                              bool framed,
                                               gearman_magic_t magic,
                                               gearman_command_t command,
-                                              const void *arg, ...)
+                                              const void *arg, va_list ap)
 {
   gearman_server_packet_st *server_packet;
-  va_list ap;
   size_t arg_size;
   gearman_return_t ret;
 
-  server_packet= gearman_server_packet_create(con->thread, false);
+  server_packet= gearman_server_packet_create(con->thread, shard);
   if (server_packet == NULL)
     return GEARMAN_MEMORY_ALLOCATION_FAILURE;
 
   if (gearman_packet_create(con->thread->gearman,
                             &(server_packet->packet)) == NULL)
   {
-    gearman_server_packet_free(server_packet, con->thread, false);
+    gearman_server_packet_free(server_packet, con->thread, shard);
     return GEARMAN_MEMORY_ALLOCATION_FAILURE;
   }
 
   server_packet->packet.magic= magic;
   server_packet->packet.command= command;
 
-  va_start(ap, arg);
-
   while (arg != NULL)
   {
     arg_size = va_arg(ap, size_t);
@@ -120,71 +516,215 @@ gearman_return_t gearman_server_io_packet_add(gearman_server_con_st *con,
     ret= gearman_packet_add_arg(&(server_packet->packet), arg, arg_size);
     if (ret != GEARMAN_SUCCESS)
     {
-      va_end(ap);
       gearman_packet_free(&(server_packet->packet));
-      gearman_server_packet_free(server_packet, con->thread, false);
+      gearman_server_packet_free(server_packet, con->thread, shard);
       return ret;
     }
 
     arg = va_arg(ap, void *);
   }
 
-  va_end(ap);
+  if (payload != NULL)
+  {
+    (void)__sync_add_and_fetch(&(payload->ref_count), 1);
+    server_packet->payload= payload;
+    server_packet->packet.data= payload->data;
+    server_packet->packet.data_size= payload->data_size;
+  }
 
   ret= gearman_packet_pack_header(&(server_packet->packet));
   if (ret != GEARMAN_SUCCESS)
   {
     gearman_packet_free(&(server_packet->packet));
-    gearman_server_packet_free(server_packet, con->thread, false);
+    gearman_server_packet_free(server_packet, con->thread, shard);
     return ret;
   }
 
   if (take_data)
     server_packet->packet.options|= GEARMAN_PACKET_FREE_DATA;
 
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  GEARMAN_FIFO_ADD(con->io_packet, server_packet,)
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  ret= _server_io_packet_frame(con, server_packet, framed);
+  if (ret != GEARMAN_SUCCESS)
+  {
+    gearman_packet_free(&(server_packet->packet));
+    gearman_server_packet_free(server_packet, con->thread, shard);
+    return ret;
+  }
 
-  gearman_server_con_io_add(con);
+  _server_io_packet_finish(con, shard, server_packet);
 
   return GEARMAN_SUCCESS;
 }
 
-void gearman_server_io_packet_remove(gearman_server_con_st *con)
+static gearman_return_t
+_server_io_packet_add_framed(gearman_server_con_st *con,
+                             gearman_server_shard_st *shard, bool framed,
+                             gearman_command_t command, const void *arg, ...)
 {
-  gearman_server_packet_st *server_packet= con->io_packet_list;
+  va_list ap;
+  gearman_return_t ret;
 
-  gearman_packet_free(&(server_packet->packet));
+  va_start(ap, arg);
+  ret= _server_io_packet_add(con, shard, false, NULL, framed,
+                             GEARMAN_MAGIC_RESPONSE, command, arg, ap);
+  va_end(ap);
 
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  GEARMAN_FIFO_DEL(con->io_packet, server_packet,)
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  return ret;
+}
 
-  gearman_server_packet_free(server_packet, con->thread, true);
+static gearman_server_packet_st *
+_server_io_packet_start(gearman_server_con_st *con,
+                        gearman_server_shard_st *shard,
+                        gearman_command_t command)
+{
+  gearman_server_packet_st *server_packet;
+  gearman_packet_st *packet;
+
+  server_packet= gearman_server_packet_create(con->thread, shard);
+  if (server_packet == NULL)
+    return NULL;
+
+  /* Server threads don't track packets, so this is all gearman_packet_create
+     would do, with the header space taken up front. */
+  packet= &(server_packet->packet);
+  packet->options= GEARMAN_PACKET_COMPLETE;
+  packet->magic= GEARMAN_MAGIC_RESPONSE;
+  packet->command= command;
+  packet->argc= 0;
+  packet->args_size= GEARMAN_PACKET_HEADER_SIZE;
+  packet->data_size= 0;
+  packet->gearman= con->thread->gearman;
+  packet->args= packet->args_buffer;
+  packet->data= NULL;
+
+  return server_packet;
 }
 
-void gearman_server_proc_packet_add(gearman_server_con_st *con,
-                                    gearman_server_packet_st *packet)
+static void _server_io_packet_arg(gearman_packet_st *packet, const void *arg,
+                                  size_t arg_size)
+{
+  packet->arg[packet->argc]= packet->args + packet->args_size;
+  packet->arg_size[packet->argc]= arg_size;
+  memcpy(packet->args + packet->args_size, arg, arg_size);
+  packet->args_size+= arg_size;
+  packet->argc++;
+}
+
+static void _server_io_packet_header(gearman_packet_st *packet)
 {
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  GEARMAN_FIFO_ADD(con->proc_packet, packet,)
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  uint32_t tmp;
 
-  gearman_server_con_proc_add(con);
+  memcpy(packet->args, "\0RES", 4);
+
+  tmp= htonl((uint32_t)(packet->command));
+  memcpy(packet->args + 4, &tmp, 4);
+
+  tmp= htonl((uint32_t)(packet->args_size + packet->data_size -
+                        GEARMAN_PACKET_HEADER_SIZE));
+  memcpy(packet->args + 8, &tmp, 4);
 }
 
-gearman_server_packet_st *
-gearman_server_proc_packet_remove(gearman_server_con_st *con)
+static void _server_io_packet_finish(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard,
+                                     gearman_server_packet_st *server_packet)
 {
-  gearman_server_packet_st *server_packet= con->proc_packet_list;
+  /* Packets without a shard are only made by the I/O thread of the
+     connection, which owns the io queue. */
+  if (shard == NULL)
+  {
+    GEARMAN_FIFO_ADD(con->io_packet, server_packet,)
+    gearman_server_con_io_add(con);
+  }
+  else
+    gearman_server_io_packet_queue(con, server_packet);
+}
 
-  if (server_packet == NULL)
-    return NULL;
+static gearman_return_t
+_server_io_packet_frame(gearman_server_con_st *con,
+                        gearman_server_packet_st *server_packet, bool framed)
+{
+  gearman_packet_st *packet= &(server_packet->packet);
+  gearman_frame_t type;
+  size_t data_size;
+  size_t offset;
+  uint8_t *args;
+  void *data;
+  gearman_return_t ret;
+  uint8_t x;
 
-  GEARMAN_SERVER_THREAD_LOCK(con->thread)
-  GEARMAN_FIFO_DEL(con->proc_packet, server_packet,)
-  GEARMAN_SERVER_THREAD_UNLOCK(con->thread)
+  if (packet->data_size == 0 ||
+      framed == ((con->options & GEARMAN_SERVER_CON_COMPRESS) != 0))
+  {
+    return GEARMAN_SUCCESS;
+  }
 
-  return server_packet;
+  if (!framed)
+  {
+    if (packet->args != packet->args_buffer)
+      args= realloc(packet->args, packet->args_size + 1);
+    else if (packet->args_size < GEARMAN_ARGS_BUFFER_SIZE)
+      args= packet->args;
+    else
+    {
+      args= malloc(packet->args_size + 1);
+      if (args != NULL)
+        memcpy(args, packet->args, packet->args_size);
+    }
+
+    if (args == NULL)
+    {
+      GEARMAN_ERROR_SET(packet->gearman, "_server_io_packet_frame", "malloc")
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    args[packet->args_size]= GEARMAN_FRAME_RAW;
+    packet->args= args;
+    packet->args_size++;
+
+    for (x= 0, offset= GEARMAN_PACKET_HEADER_SIZE; x < packet->argc; x++)
+    {
+      packet->arg[x]= packet->args + offset;
+      offset+= packet->arg_size[x];
+    }
+  }
+  else
+  {
+    ret= gearman_packet_frame_check(packet->gearman, packet->data,
+                                    packet->data_size, &type, &data_size);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    if (type == GEARMAN_FRAME_ZLIB)
+    {
+      data= gearman_packet_frame_decode(packet->gearman, packet->data,
+                                        packet->data_size, &data_size, &ret);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      /* The decoded copy is only for this connection. */
+      if (server_packet->payload != NULL)
+      {
+        gearman_server_payload_free(server_packet->payload);
+        server_packet->payload= NULL;
+      }
+
+      gearman_packet_give_data(packet, data, data_size);
+    }
+    else if (packet->options & GEARMAN_PACKET_FREE_DATA)
+    {
+      memmove((void *)(packet->data),
+              ((uint8_t *)(packet->data)) + GEARMAN_FRAME_RAW_SIZE, data_size);
+      packet->data_size= data_size;
+    }
+    else
+    {
+      /* Whoever owns the data still frees it from the start. */
+      packet->data= ((uint8_t *)(packet->data)) + GEARMAN_FRAME_RAW_SIZE;
+      packet->data_size= data_size;
+    }
+  }
+
+  _server_io_packet_header(packet);
+
+  return GEARMAN_SUCCESS;
 }
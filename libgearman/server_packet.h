@@ -27,50 +27,148 @@ extern "C" {
  */
 
 /**
- * Initialize a server packet structure.
+ * Initialize a server packet structure. Packets are allocated from the cache
+ * of the shard given, or from the cache of the I/O thread if shard is NULL.
  */
 GEARMAN_API
 gearman_server_packet_st *
 gearman_server_packet_create(gearman_server_thread_st *thread,
-                             bool from_thread);
+                             gearman_server_shard_st *shard);
 
 /**
- * Free a server connection structure.
+ * Free a server connection structure. The shard has the same meaning as for
+ * gearman_server_packet_create(), but may differ from the one it used.
  */
 GEARMAN_API
 void gearman_server_packet_free(gearman_server_packet_st *packet,
                                 gearman_server_thread_st *thread,
-                                bool from_thread);
+                                gearman_server_shard_st *shard);
 
 /**
- * Add a server packet structure to io queue for a connection.
+ * Add a server packet structure to io queue for a connection. This is called
+ * by the shard given. Any data is sent as it is, so it has to be framed
+ * already for connections that negotiated compression.
  */
 GEARMAN_API
 gearman_return_t gearman_server_io_packet_add(gearman_server_con_st *con,
+                                              gearman_server_shard_st *shard,
                                               bool take_data,
                                               gearman_magic_t magic,
                                               gearman_command_t command,
                                               const void *arg, ...);
 
+/**
+ * Add a server packet structure to io queue for a connection, using a shared
+ * payload as the data. The packet holds a reference to the payload until it
+ * is freed, so the same payload can be queued for many connections. With
+ * framed set, the payload came from a connection that negotiated
+ * compression, and is decoded for connections that did not. Plain payloads
+ * get a raw frame for connections that did.
+ */
+GEARMAN_API
+gearman_return_t
+gearman_server_io_packet_add_payload(gearman_server_con_st *con,
+                                     gearman_server_shard_st *shard,
+                                     gearman_server_payload_st *payload,
+                                     bool framed, gearman_magic_t magic,
+                                     gearman_command_t command,
+                                     const void *arg, ...);
+
+/**
+ * Add a response without arguments to the io queue for a connection, copied
+ * from a packet encoded ahead of time. Only NOOP and NO_JOB have one.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_io_packet_add_const(gearman_server_con_st *con,
+                                                gearman_server_shard_st *shard,
+                                                gearman_command_t command);
+
+/**
+ * Add a JOB_CREATED response for a job to the io queue for a connection. The
+ * handle is formatted straight into the packet.
+ */
+GEARMAN_API
+gearman_return_t
+gearman_server_io_packet_add_job_created(gearman_server_con_st *con,
+                                         gearman_server_shard_st *shard,
+                                         gearman_server_job_st *server_job);
+
+/**
+ * Add a JOB_ASSIGN, or with unique set a JOB_ASSIGN_UNIQ, response for a job
+ * to the io queue for a connection. Arguments are encoded straight into the
+ * packet when they fit in it, and the packet points at the job workload,
+ * unless it has to be decoded for the connection.
+ */
+GEARMAN_API
+gearman_return_t
+gearman_server_io_packet_add_job_assign(gearman_server_con_st *con,
+                                        gearman_server_shard_st *shard,
+                                        gearman_server_job_st *server_job,
+                                        bool unique);
+
+/**
+ * Add a server packet structure that is ready to send to the io queue for a
+ * connection. With processing threads, this goes through the lock-free
+ * queue of the I/O thread that owns the connection.
+ */
+GEARMAN_API
+void gearman_server_io_packet_queue(gearman_server_con_st *con,
+                                    gearman_server_packet_st *packet);
+
 /**
  * Remove the first server packet structure from io queue for a connection.
+ * This must only be called from the I/O thread that owns the connection.
  */
 GEARMAN_API
 void gearman_server_io_packet_remove(gearman_server_con_st *con);
 
 /**
- * Add a server packet structure to proc queue for a connection.
+ * Add a server packet structure for a connection to the proc queue of a
+ * shard, waking the processing thread if it is asleep. The packet is stamped
+ * with gearman_server_packet_time() so the wait can be measured.
  */
 GEARMAN_API
 void gearman_server_proc_packet_add(gearman_server_con_st *con,
+                                    gearman_server_shard_st *shard,
                                     gearman_server_packet_st *packet);
 
 /**
- * Remove the first server packet structure from proc queue for a connection.
+ * Get the current time in microseconds, as used for proc_time.
+ */
+GEARMAN_API
+uint64_t gearman_server_packet_time(void);
+
+/**
+ * Push a server packet structure onto a lock-free queue. Any number of
+ * threads may push onto the same queue.
+ */
+GEARMAN_API
+void gearman_server_packet_push(gearman_server_packet_st **queue,
+                                gearman_server_packet_st *packet);
+
+/**
+ * Take every server packet structure off a lock-free queue, linked through
+ * next in the order they were pushed. Only one thread may take from a queue.
  */
 GEARMAN_API
 gearman_server_packet_st *
-gearman_server_proc_packet_remove(gearman_server_con_st *con);
+gearman_server_packet_take(gearman_server_packet_st **queue);
+
+/**
+ * Create a shared payload from the data of a packet, with one reference held
+ * by the caller. If the packet owns its data the payload takes it over,
+ * otherwise the data is copied.
+ */
+GEARMAN_API
+gearman_server_payload_st *
+gearman_server_payload_create(gearman_packet_st *packet);
+
+/**
+ * Drop a reference to a shared payload, freeing it with the last reference.
+ * This may be called from any thread.
+ */
+GEARMAN_API
+void gearman_server_payload_free(gearman_server_payload_st *payload);
 
 /** @} */
 
@@ -0,0 +1,331 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server shard definitions
+ */
+
+#include "common.h"
+
+/*
+ * Public definitions
+ */
+
+gearman_server_shard_st *
+gearman_server_shard_create(gearman_server_st *server,
+                            gearman_server_shard_st *shard, uint32_t index)
+{
+  shard->proc_wakeup= false;
+  shard->proc_sleeping= false;
+  shard->stats_dirty= true;
+  shard->index= index;
+  shard->function_count= 0;
+  shard->job_count= 0;
+  shard->job_slot_count= 0;
+  shard->job_slot_free= 0;
+  shard->proc_count= 0;
+  shard->proc_active_count= 0;
+  shard->con_count= 0;
+  shard->stats_readers= 0;
+  shard->stats_time= 0;
+  shard->noop_count= 0;
+  shard->no_job_count= 0;
+  shard->job_assign_count= 0;
+  shard->server= server;
+  shard->function_list= NULL;
+  shard->con_list= NULL;
+  shard->proc_list= NULL;
+  shard->proc_active_list= NULL;
+  shard->proc_active_end= NULL;
+  shard->proc_queue= NULL;
+  (void)gearman_server_hash_create(&(shard->function_hash));
+  (void)gearman_server_hash_create(&(shard->unique_hash));
+  shard->job_slot_page= NULL;
+  shard->stats= NULL;
+  shard->stats_retired= NULL;
+
+  if (pthread_mutex_init(&(shard->proc_lock), NULL) != 0)
+  {
+    gearman_server_hash_free(&(shard->unique_hash));
+    gearman_server_hash_free(&(shard->function_hash));
+    return NULL;
+  }
+
+  if (pthread_cond_init(&(shard->proc_cond), NULL) != 0)
+  {
+    (void) pthread_mutex_destroy(&(shard->proc_lock));
+    gearman_server_hash_free(&(shard->unique_hash));
+    gearman_server_hash_free(&(shard->function_hash));
+    return NULL;
+  }
+
+  (void)gearman_server_slab_cache_create(&(server->packet_slab),
+                                         &(shard->packet_cache));
+  (void)gearman_server_slab_cache_create(&(server->job_slab),
+                                         &(shard->job_cache));
+  (void)gearman_server_slab_cache_create(&(server->client_slab),
+                                         &(shard->client_cache));
+  (void)gearman_server_slab_cache_create(&(server->worker_slab),
+                                         &(shard->worker_cache));
+
+  return shard;
+}
+
+void gearman_server_shard_free(gearman_server_shard_st *shard)
+{
+  uint32_t slot;
+  gearman_server_job_slot_st *job_slot;
+
+  gearman_server_stats_free(shard);
+
+  for (slot= 0; slot < shard->job_slot_count; slot++)
+  {
+    job_slot= &(shard->job_slot_page[slot >> GEARMAN_JOB_SLOT_PAGE_SHIFT]
+                [slot & (GEARMAN_JOB_SLOT_PAGE_SIZE - 1)]);
+    if (job_slot->job != NULL)
+      gearman_server_job_free(job_slot->job);
+  }
+
+  for (slot= 0; slot < shard->job_slot_count;
+       slot+= GEARMAN_JOB_SLOT_PAGE_SIZE)
+  {
+    free(shard->job_slot_page[slot >> GEARMAN_JOB_SLOT_PAGE_SHIFT]);
+  }
+
+  if (shard->job_slot_page != NULL)
+    free(shard->job_slot_page);
+
+  gearman_server_hash_free(&(shard->unique_hash));
+
+  while (shard->function_list != NULL)
+    gearman_server_function_free(shard->function_list);
+
+  gearman_server_hash_free(&(shard->function_hash));
+
+  gearman_server_slab_cache_free(&(shard->packet_cache));
+  gearman_server_slab_cache_free(&(shard->job_cache));
+  gearman_server_slab_cache_free(&(shard->client_cache));
+  gearman_server_slab_cache_free(&(shard->worker_cache));
+
+  (void) pthread_cond_destroy(&(shard->proc_cond));
+  (void) pthread_mutex_destroy(&(shard->proc_lock));
+}
+
+gearman_server_shard_st *gearman_server_shard_find(gearman_server_st *server,
+                                                   const char *function_name,
+                                                   size_t function_name_size)
+{
+  uint32_t key;
+
+  if (server->shard_count == 1)
+    return server->shard;
+
+  /* Use the high bits, the function hash buckets use the low ones. */
+  key= gearman_server_hash_key(function_name, function_name_size);
+  return &(server->shard[((uint64_t)key * server->shard_count) >> 32]);
+}
+
+gearman_server_shard_st *
+gearman_server_shard_route(gearman_server_con_st *con,
+                           gearman_packet_st *packet)
+{
+  gearman_server_st *server= con->thread->server;
+  gearman_server_shard_st *shard;
+  uint32_t number;
+  uint32_t generation;
+
+  if (server->shard_count == 1)
+  {
+    con->shard_used= 1;
+    return server->shard;
+  }
+
+  switch (packet->command)
+  {
+  case GEARMAN_COMMAND_CAN_DO:
+  case GEARMAN_COMMAND_CANT_DO:
+    shard= gearman_server_shard_find(server, (char *)(packet->arg[0]),
+                                     packet->arg_size[0]);
+    break;
+
+  case GEARMAN_COMMAND_CAN_DO_TIMEOUT:
+  case GEARMAN_COMMAND_SUBMIT_JOB:
+  case GEARMAN_COMMAND_SUBMIT_JOB_BG:
+  case GEARMAN_COMMAND_SUBMIT_JOB_HIGH:
+  case GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG:
+  case GEARMAN_COMMAND_SUBMIT_JOB_LOW:
+  case GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG:
+    shard= gearman_server_shard_find(server, (char *)(packet->arg[0]),
+                                     packet->arg_size[0] - 1);
+    break;
+
+  case GEARMAN_COMMAND_GET_STATUS:
+  case GEARMAN_COMMAND_WORK_DATA:
+  case GEARMAN_COMMAND_WORK_WARNING:
+  case GEARMAN_COMMAND_WORK_STATUS:
+  case GEARMAN_COMMAND_WORK_COMPLETE:
+  case GEARMAN_COMMAND_WORK_EXCEPTION:
+  case GEARMAN_COMMAND_WORK_FAIL:
+    /* Unknown handles go to the first shard, which will not find them. */
+    if (gearman_server_job_handle_decode(server, (char *)(packet->arg[0]),
+                                         packet->arg_size[0], &number,
+                                         &generation))
+    {
+      shard= &(server->shard[number % server->shard_count]);
+    }
+    else
+      shard= server->shard;
+    break;
+
+  case GEARMAN_COMMAND_GRAB_JOB:
+  case GEARMAN_COMMAND_GRAB_JOB_UNIQ:
+  case GEARMAN_COMMAND_PRE_SLEEP:
+  case GEARMAN_COMMAND_RESET_ABILITIES:
+    if (con->shard_mask == 0)
+      shard= server->shard;
+    else
+      shard= &(server->shard[__builtin_ctzll(con->shard_mask)]);
+    break;
+
+  case GEARMAN_COMMAND_TEXT:
+    if (packet->argc > 1 && !strcasecmp("maxqueue", (char *)(packet->arg[0])))
+    {
+      shard= gearman_server_shard_find(server, (char *)(packet->arg[1]),
+                                       strlen((char *)(packet->arg[1])));
+    }
+    else
+      shard= server->shard;
+    break;
+
+  /* Everything else only touches connection state, or nothing at all. */
+  case GEARMAN_COMMAND_UNUSED:
+  case GEARMAN_COMMAND_NOOP:
+  case GEARMAN_COMMAND_JOB_CREATED:
+  case GEARMAN_COMMAND_NO_JOB:
+  case GEARMAN_COMMAND_JOB_ASSIGN:
+  case GEARMAN_COMMAND_ECHO_REQ:
+  case GEARMAN_COMMAND_ECHO_RES:
+  case GEARMAN_COMMAND_ERROR:
+  case GEARMAN_COMMAND_STATUS_RES:
+  case GEARMAN_COMMAND_SET_CLIENT_ID:
+  case GEARMAN_COMMAND_ALL_YOURS:
+  case GEARMAN_COMMAND_OPTION_REQ:
+  case GEARMAN_COMMAND_OPTION_RES:
+  case GEARMAN_COMMAND_JOB_ASSIGN_UNIQ:
+  case GEARMAN_COMMAND_SUBMIT_JOB_SCHED:
+  case GEARMAN_COMMAND_SUBMIT_JOB_EPOCH:
+  case GEARMAN_COMMAND_MAX:
+  default:
+    shard= server->shard;
+    break;
+  }
+
+  /* The mask only ever grows, so routing a held packet again is harmless. A
+     shard reached through it before its CAN_DO runs just has no workers for
+     the connection yet. */
+  if (packet->command == GEARMAN_COMMAND_CAN_DO ||
+      packet->command == GEARMAN_COMMAND_CAN_DO_TIMEOUT)
+  {
+    (void)__sync_fetch_and_or(&(con->shard_mask),
+                              (uint64_t)1 << shard->index);
+  }
+
+  con->shard_used|= (uint64_t)1 << shard->index;
+
+  return shard;
+}
+
+gearman_server_shard_st *
+gearman_server_shard_next(gearman_server_shard_st *shard,
+                          gearman_server_con_st *con)
+{
+  uint64_t mask;
+
+  mask= *((volatile uint64_t *)&(con->shard_mask));
+  mask&= ~(((uint64_t)2 << shard->index) - 1);
+  if (mask == 0)
+    return NULL;
+
+  return &(shard->server->shard[__builtin_ctzll(mask)]);
+}
+
+gearman_return_t gearman_server_shard_forward(gearman_server_shard_st *shard,
+                                              gearman_server_shard_st *next,
+                                              gearman_server_con_st *con,
+                                              gearman_command_t command)
+{
+  gearman_server_packet_st *server_packet;
+  gearman_packet_st packet;
+  gearman_return_t ret;
+
+  if (!(shard->server->options & GEARMAN_SERVER_PROC_THREAD))
+  {
+    if (gearman_packet_create(con->thread->gearman, &packet) == NULL)
+      return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+    packet.magic= GEARMAN_MAGIC_REQUEST;
+    packet.command= command;
+
+    ret= gearman_server_run_command(con, next, &packet);
+    gearman_packet_free(&packet);
+    return ret;
+  }
+
+  server_packet= gearman_server_packet_create(con->thread, shard);
+  if (server_packet == NULL)
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+
+  if (gearman_packet_create(con->thread->gearman,
+                            &(server_packet->packet)) == NULL)
+  {
+    gearman_server_packet_free(server_packet, con->thread, shard);
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  server_packet->packet.magic= GEARMAN_MAGIC_REQUEST;
+  server_packet->packet.command= command;
+
+  /* The I/O thread holds back packets for other shards until this is done. */
+  (void)__sync_add_and_fetch(&(con->shard_busy), 1);
+  gearman_server_proc_packet_add(con, next, server_packet);
+
+  return GEARMAN_SUCCESS;
+}
+
+gearman_return_t
+gearman_server_shard_wake_clear(gearman_server_shard_st *shard,
+                                gearman_server_con_st *con)
+{
+  gearman_server_shard_st *other;
+  uint64_t mask;
+  gearman_return_t ret;
+
+  mask= *((volatile uint64_t *)&(con->shard_woken));
+  mask&= ~((uint64_t)1 << shard->index);
+
+  for (; mask != 0; mask&= mask - 1)
+  {
+    other= &(shard->server->shard[__builtin_ctzll(mask)]);
+
+    if (!(shard->server->options & GEARMAN_SERVER_PROC_THREAD))
+    {
+      ret= gearman_server_con_wake_clear(con, other);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      continue;
+    }
+
+    /* The other shard clears it the next time it runs the connection. */
+    GEARMAN_SERVER_CON_SHARD(con, other)->wake_clear= true;
+    gearman_server_con_proc_add(con, other);
+  }
+
+  return GEARMAN_SUCCESS;
+}
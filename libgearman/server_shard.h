@@ -0,0 +1,103 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server shard declarations
+ */
+
+#ifndef __GEARMAN_SERVER_SHARD_H__
+#define __GEARMAN_SERVER_SHARD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_shard Server Shards
+ * @ingroup gearman_server
+ * This is a low level interface for the processing shards of a server. Each
+ * shard owns the functions whose names hash to it, along with their jobs and
+ * unique table, and runs the commands for them in its own processing thread.
+ * I/O threads route every packet to one shard: function commands by name,
+ * work results by the shard encoded in the job handle, and everything else
+ * to the first shard. Commands that concern every function a worker can do
+ * (GRAB_JOB, PRE_SLEEP and RESET_ABILITIES) start at the lowest shard the
+ * worker registered functions in and are forwarded to the next one as
+ * needed, so a worker drains lower shards first.
+ * @{
+ */
+
+/**
+ * Initialize a shard of a server.
+ */
+GEARMAN_API
+gearman_server_shard_st *
+gearman_server_shard_create(gearman_server_st *server,
+                            gearman_server_shard_st *shard, uint32_t index);
+
+/**
+ * Free a shard along with all functions and jobs it owns. Its processing
+ * thread must not be running.
+ */
+GEARMAN_API
+void gearman_server_shard_free(gearman_server_shard_st *shard);
+
+/**
+ * Get the shard that owns a function name.
+ */
+GEARMAN_API
+gearman_server_shard_st *gearman_server_shard_find(gearman_server_st *server,
+                                                   const char *function_name,
+                                                   size_t function_name_size);
+
+/**
+ * Get the shard a packet read from a connection should run in. This must be
+ * called from the I/O thread of the connection.
+ */
+GEARMAN_API
+gearman_server_shard_st *
+gearman_server_shard_route(gearman_server_con_st *con,
+                           gearman_packet_st *packet);
+
+/**
+ * Get the next shard after the given one in which the connection registered
+ * functions, or NULL if there is none.
+ */
+GEARMAN_API
+gearman_server_shard_st *
+gearman_server_shard_next(gearman_server_shard_st *shard,
+                          gearman_server_con_st *con);
+
+/**
+ * Run a request without arguments for a connection in another shard. With a
+ * processing thread the request is queued with a packet allocated by the
+ * calling shard, otherwise it runs right away.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_shard_forward(gearman_server_shard_st *shard,
+                                              gearman_server_shard_st *next,
+                                              gearman_server_con_st *con,
+                                              gearman_command_t command);
+
+/**
+ * Clear wakeups pending for a connection in every shard but the given one,
+ * after it was assigned a job there.
+ */
+GEARMAN_API
+gearman_return_t
+gearman_server_shard_wake_clear(gearman_server_shard_st *shard,
+                                gearman_server_con_st *con);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAN_SERVER_SHARD_H__ */
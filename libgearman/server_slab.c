@@ -0,0 +1,342 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server slab allocator definitions
+ */
+
+#include "common.h"
+
+/**
+ * Size of the chunk header, rounded up so the first object starts a cache
+ * line. Objects sized in whole cache lines then never straddle more of them
+ * than they need.
+ */
+#define _SLAB_CHUNK_HEADER_SIZE \
+  ((sizeof(gearman_server_slab_chunk_st) + GEARMAN_SERVER_CACHE_LINE - 1) & \
+   ~((size_t)GEARMAN_SERVER_CACHE_LINE - 1))
+
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearman_server_slab_private Private Server Slab Functions
+ * @ingroup gearman_server_slab
+ * @{
+ */
+
+/**
+ * Fill a cache up to half its size from the depot.
+ */
+static void _slab_refill(gearman_server_slab_cache_st *cache);
+
+/**
+ * Return objects from a cache to the depot until only keep are left.
+ */
+static void _slab_drain(gearman_server_slab_cache_st *cache, uint32_t keep);
+
+/**
+ * Allocate a new chunk and add it to the depot. Depot lock must be held.
+ */
+static gearman_server_slab_chunk_st *
+_slab_chunk_create(gearman_server_slab_st *slab);
+
+/**
+ * Add a chunk to the full, partial, or empty list for its free count.
+ */
+static void _slab_chunk_link(gearman_server_slab_st *slab,
+                             gearman_server_slab_chunk_st *chunk);
+
+/**
+ * Remove a chunk from the full, partial, or empty list for its free count.
+ */
+static void _slab_chunk_unlink(gearman_server_slab_st *slab,
+                               gearman_server_slab_chunk_st *chunk);
+
+/** @} */
+
+/*
+ * Public definitions
+ */
+
+gearman_server_slab_st *gearman_server_slab_create(gearman_server_slab_st *slab,
+                                                   const char *name,
+                                                   size_t size)
+{
+  size= (size + GEARMAN_SERVER_SLAB_ALIGN - 1) &
+        ~((size_t)GEARMAN_SERVER_SLAB_ALIGN - 1);
+  if (size == 0 || size > GEARMAN_SERVER_SLAB_SIZE - _SLAB_CHUNK_HEADER_SIZE)
+    return NULL;
+
+  if (slab == NULL)
+  {
+    slab= malloc(sizeof(gearman_server_slab_st));
+    if (slab == NULL)
+      return NULL;
+
+    slab->options= GEARMAN_SERVER_SLAB_ALLOCATED;
+  }
+  else
+    slab->options= 0;
+
+  slab->full_count= 0;
+  slab->partial_count= 0;
+  slab->empty_count= 0;
+  slab->chunk_objects= (uint32_t)((GEARMAN_SERVER_SLAB_SIZE -
+                                   _SLAB_CHUNK_HEADER_SIZE) / size);
+  slab->free_count= 0;
+  slab->cached_count= 0;
+  slab->size= size;
+  slab->name= name;
+  slab->full_list= NULL;
+  slab->partial_list= NULL;
+  slab->empty_list= NULL;
+
+  if (pthread_mutex_init(&(slab->lock), NULL) != 0)
+  {
+    if (slab->options & GEARMAN_SERVER_SLAB_ALLOCATED)
+      free(slab);
+    return NULL;
+  }
+
+  return slab;
+}
+
+void gearman_server_slab_free(gearman_server_slab_st *slab)
+{
+  gearman_server_slab_chunk_st *chunk;
+
+  while (slab->full_list != NULL)
+  {
+    chunk= slab->full_list;
+    slab->full_list= chunk->next;
+    free(chunk);
+  }
+
+  while (slab->partial_list != NULL)
+  {
+    chunk= slab->partial_list;
+    slab->partial_list= chunk->next;
+    free(chunk);
+  }
+
+  while (slab->empty_list != NULL)
+  {
+    chunk= slab->empty_list;
+    slab->empty_list= chunk->next;
+    free(chunk);
+  }
+
+  pthread_mutex_destroy(&(slab->lock));
+
+  if (slab->options & GEARMAN_SERVER_SLAB_ALLOCATED)
+    free(slab);
+}
+
+gearman_server_slab_cache_st *
+gearman_server_slab_cache_create(gearman_server_slab_st *slab,
+                                 gearman_server_slab_cache_st *cache)
+{
+  if (cache == NULL)
+  {
+    cache= malloc(sizeof(gearman_server_slab_cache_st));
+    if (cache == NULL)
+      return NULL;
+
+    cache->options= GEARMAN_SERVER_SLAB_CACHE_ALLOCATED;
+  }
+  else
+    cache->options= 0;
+
+  cache->count= 0;
+  cache->reported= 0;
+  cache->slab= slab;
+
+  return cache;
+}
+
+void gearman_server_slab_cache_free(gearman_server_slab_cache_st *cache)
+{
+  _slab_drain(cache, 0);
+
+  if (cache->options & GEARMAN_SERVER_SLAB_CACHE_ALLOCATED)
+    free(cache);
+}
+
+void gearman_server_slab_cache_sync(gearman_server_slab_cache_st *cache)
+{
+  (void) pthread_mutex_lock(&(cache->slab->lock));
+  cache->slab->cached_count+= cache->count - cache->reported;
+  cache->reported= cache->count;
+  (void) pthread_mutex_unlock(&(cache->slab->lock));
+}
+
+void *gearman_server_slab_alloc(gearman_server_slab_cache_st *cache)
+{
+  if (cache->count == 0)
+  {
+    _slab_refill(cache);
+    if (cache->count == 0)
+      return NULL;
+  }
+
+  cache->count--;
+  return cache->object[cache->count];
+}
+
+void gearman_server_slab_dealloc(gearman_server_slab_cache_st *cache,
+                                 void *object)
+{
+  if (cache->count == GEARMAN_SERVER_SLAB_CACHE_SIZE)
+    _slab_drain(cache, GEARMAN_SERVER_SLAB_CACHE_SIZE / 2);
+
+  cache->object[cache->count]= object;
+  cache->count++;
+}
+
+/*
+ * Private definitions
+ */
+
+static void _slab_refill(gearman_server_slab_cache_st *cache)
+{
+  gearman_server_slab_st *slab= cache->slab;
+  gearman_server_slab_chunk_st *chunk;
+  void *object;
+
+  (void) pthread_mutex_lock(&(slab->lock));
+
+  while (cache->count < GEARMAN_SERVER_SLAB_CACHE_SIZE / 2)
+  {
+    /* Prefer partially used chunks so empty ones can be given back. */
+    if (slab->partial_list != NULL)
+      chunk= slab->partial_list;
+    else if (slab->empty_list != NULL)
+      chunk= slab->empty_list;
+    else
+    {
+      chunk= _slab_chunk_create(slab);
+      if (chunk == NULL)
+        break;
+    }
+
+    _slab_chunk_unlink(slab, chunk);
+
+    while (chunk->free_count > 0 &&
+           cache->count < GEARMAN_SERVER_SLAB_CACHE_SIZE / 2)
+    {
+      object= chunk->free_list;
+      chunk->free_list= *((void **)object);
+      chunk->free_count--;
+      slab->free_count--;
+      cache->object[cache->count]= object;
+      cache->count++;
+    }
+
+    _slab_chunk_link(slab, chunk);
+  }
+
+  slab->cached_count+= cache->count - cache->reported;
+  cache->reported= cache->count;
+
+  (void) pthread_mutex_unlock(&(slab->lock));
+}
+
+static void _slab_drain(gearman_server_slab_cache_st *cache, uint32_t keep)
+{
+  gearman_server_slab_st *slab= cache->slab;
+  gearman_server_slab_chunk_st *chunk;
+  void *object;
+
+  (void) pthread_mutex_lock(&(slab->lock));
+
+  while (cache->count > keep)
+  {
+    cache->count--;
+    object= cache->object[cache->count];
+    chunk= (gearman_server_slab_chunk_st *)((uintptr_t)object &
+           ~((uintptr_t)GEARMAN_SERVER_SLAB_SIZE - 1));
+
+    _slab_chunk_unlink(slab, chunk);
+
+    *((void **)object)= chunk->free_list;
+    chunk->free_list= object;
+    chunk->free_count++;
+    slab->free_count++;
+
+    if (chunk->free_count == slab->chunk_objects &&
+        slab->empty_count == GEARMAN_SERVER_SLAB_EMPTY_MAX)
+    {
+      slab->free_count-= chunk->free_count;
+      free(chunk);
+    }
+    else
+      _slab_chunk_link(slab, chunk);
+  }
+
+  slab->cached_count+= cache->count - cache->reported;
+  cache->reported= cache->count;
+
+  (void) pthread_mutex_unlock(&(slab->lock));
+}
+
+static gearman_server_slab_chunk_st *
+_slab_chunk_create(gearman_server_slab_st *slab)
+{
+  gearman_server_slab_chunk_st *chunk;
+  char *object;
+  uint32_t x;
+
+  if (posix_memalign((void **)&chunk, GEARMAN_SERVER_SLAB_SIZE,
+                     GEARMAN_SERVER_SLAB_SIZE) != 0)
+  {
+    return NULL;
+  }
+
+  chunk->free_list= NULL;
+  object= (char *)chunk + _SLAB_CHUNK_HEADER_SIZE +
+          (slab->chunk_objects * slab->size);
+
+  /* Push in reverse so objects are handed out in address order. */
+  for (x= 0; x < slab->chunk_objects; x++)
+  {
+    object-= slab->size;
+    *((void **)object)= chunk->free_list;
+    chunk->free_list= object;
+  }
+
+  chunk->free_count= slab->chunk_objects;
+  slab->free_count+= slab->chunk_objects;
+  _slab_chunk_link(slab, chunk);
+
+  return chunk;
+}
+
+static void _slab_chunk_link(gearman_server_slab_st *slab,
+                             gearman_server_slab_chunk_st *chunk)
+{
+  if (chunk->free_count == 0)
+    GEARMAN_LIST_ADD(slab->full, chunk,)
+  else if (chunk->free_count == slab->chunk_objects)
+    GEARMAN_LIST_ADD(slab->empty, chunk,)
+  else
+    GEARMAN_LIST_ADD(slab->partial, chunk,)
+}
+
+static void _slab_chunk_unlink(gearman_server_slab_st *slab,
+                               gearman_server_slab_chunk_st *chunk)
+{
+  if (chunk->free_count == 0)
+    GEARMAN_LIST_DEL(slab->full, chunk,)
+  else if (chunk->free_count == slab->chunk_objects)
+    GEARMAN_LIST_DEL(slab->empty, chunk,)
+  else
+    GEARMAN_LIST_DEL(slab->partial, chunk,)
+}
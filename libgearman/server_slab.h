@@ -0,0 +1,92 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server slab allocator declarations
+ */
+
+#ifndef __GEARMAN_SERVER_SLAB_H__
+#define __GEARMAN_SERVER_SLAB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_slab Server Slab Allocator
+ * @ingroup gearman_server
+ * This is a low level interface for the allocator used for server objects
+ * of a fixed size, such as packets and jobs. Objects are carved out of
+ * aligned chunks of GEARMAN_SERVER_SLAB_SIZE bytes held in a shared depot.
+ * Each thread allocates through its own gearman_server_slab_cache_st, which
+ * only takes the depot lock when it needs to refill or drain half of its
+ * objects. Chunks with no objects in use are returned to the system once
+ * more than GEARMAN_SERVER_SLAB_EMPTY_MAX of them are idle.
+ * @{
+ */
+
+/**
+ * Initialize a server slab depot for objects of the given size.
+ */
+GEARMAN_API
+gearman_server_slab_st *gearman_server_slab_create(gearman_server_slab_st *slab,
+                                                   const char *name,
+                                                   size_t size);
+
+/**
+ * Free a server slab depot and all of its chunks. All caches for this depot
+ * must be freed first.
+ */
+GEARMAN_API
+void gearman_server_slab_free(gearman_server_slab_st *slab);
+
+/**
+ * Initialize a per-thread cache for a server slab depot.
+ */
+GEARMAN_API
+gearman_server_slab_cache_st *
+gearman_server_slab_cache_create(gearman_server_slab_st *slab,
+                                 gearman_server_slab_cache_st *cache);
+
+/**
+ * Free a per-thread cache, returning all objects it holds to the depot.
+ */
+GEARMAN_API
+void gearman_server_slab_cache_free(gearman_server_slab_cache_st *cache);
+
+/**
+ * Update the depot counters with the number of objects a cache holds. This
+ * must be called from the thread that owns the cache. Counters for other
+ * caches are only updated when those caches refill or drain.
+ */
+GEARMAN_API
+void gearman_server_slab_cache_sync(gearman_server_slab_cache_st *cache);
+
+/**
+ * Allocate an object through a cache. Returns NULL if the depot is empty and
+ * no more chunks can be allocated.
+ */
+GEARMAN_API
+void *gearman_server_slab_alloc(gearman_server_slab_cache_st *cache);
+
+/**
+ * Return an object to a cache. The cache does not need to be the one the
+ * object was allocated through, but it must belong to the same depot.
+ */
+GEARMAN_API
+void gearman_server_slab_dealloc(gearman_server_slab_cache_st *cache,
+                                 void *object);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAN_SERVER_SLAB_H__ */
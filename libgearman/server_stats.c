@@ -0,0 +1,329 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server statistics definitions
+ */
+
+#include "common.h"
+
+/*
+ * Private declarations
+ */
+
+/**
+ * @addtogroup gearman_server_stats_private Private Server Statistics Functions
+ * @ingroup gearman_server_stats
+ * @{
+ */
+
+/**
+ * Format the worker listing for a shard into a snapshot from the connections
+ * the shard has seen. Shard 0 lists every connection, the other shards only
+ * the ones with workers in that shard. Connections stay in the list until the
+ * shard frees its part of them, so no other thread's lock is needed.
+ */
+static gearman_return_t _stats_workers(gearman_server_shard_st *shard,
+                                       gearman_server_stats_st *stats);
+
+/**
+ * Format the longest processing thread wait of each connection in the shard
+ * into a snapshot. Waits are recorded by the thread that owns the shard, so
+ * connections that never waited here have nothing to report.
+ */
+static gearman_return_t _stats_waits(gearman_server_shard_st *shard,
+                                     gearman_server_stats_st *stats);
+
+/**
+ * Make sure a snapshot buffer has at least GEARMAN_TEXT_RESPONSE_SIZE bytes
+ * free past size, freeing it on failure.
+ */
+static gearman_return_t _stats_reserve(gearman_server_shard_st *shard,
+                                       char **data, size_t *total,
+                                       size_t size);
+
+/**
+ * Free a snapshot.
+ */
+static void _stats_free(gearman_server_stats_st *stats);
+
+/** @} */
+
+/*
+ * Public definitions
+ */
+
+gearman_return_t gearman_server_stats_publish(gearman_server_shard_st *shard)
+{
+  gearman_server_stats_st *stats;
+  gearman_server_stats_st *next;
+  gearman_server_stats_function_st *stats_function;
+  gearman_server_function_st *function;
+  gearman_return_t ret;
+
+  /* A failed publish is retried after the next interval, not every round. */
+  shard->stats_time= gearman_server_packet_time();
+
+  stats= malloc(sizeof(gearman_server_stats_st) +
+                (sizeof(gearman_server_stats_function_st) *
+                 shard->function_count));
+  if (stats == NULL)
+  {
+    GEARMAN_ERROR_SET(shard->server->gearman, "gearman_server_stats_publish",
+                      "malloc")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  stats->function_count= 0;
+  stats->noop_count= shard->noop_count;
+  stats->no_job_count= shard->no_job_count;
+  stats->job_assign_count= shard->job_assign_count;
+  stats->workers_size= 0;
+  stats->workers= NULL;
+  stats->waits_size= 0;
+  stats->waits= NULL;
+  stats->next= NULL;
+  stats->function= (gearman_server_stats_function_st *)(stats + 1);
+
+  /* Functions are only freed with the shard, so names can be shared. */
+  for (function= shard->function_list; function != NULL;
+       function= function->next)
+  {
+    stats_function= &(stats->function[stats->function_count]);
+    stats_function->job_total= function->job_total;
+    stats_function->job_running= function->job_running;
+    stats_function->worker_count= function->worker_count;
+    stats_function->function_name_size= function->function_name_size;
+    stats_function->function_name= function->function_name;
+    stats->function_count++;
+  }
+
+  ret= _stats_workers(shard, stats);
+  if (ret == GEARMAN_SUCCESS)
+    ret= _stats_waits(shard, stats);
+  if (ret != GEARMAN_SUCCESS)
+  {
+    _stats_free(stats);
+    return ret;
+  }
+
+  if (shard->stats != NULL)
+  {
+    shard->stats->next= shard->stats_retired;
+    shard->stats_retired= shard->stats;
+  }
+
+  /* Full barrier so readers never see the pointer before the contents, and
+     so the reader count below covers everyone who could still have loaded a
+     retired snapshot. */
+  __sync_synchronize();
+  shard->stats= stats;
+  __sync_synchronize();
+
+  /* Never wait for readers, retired snapshots just pile up until a publish
+     finds none. Readers only hold a snapshot while copying it out, so the
+     list rarely outlives a single interval. */
+  if (*((volatile uint32_t *)&(shard->stats_readers)) == 0)
+  {
+    for (stats= shard->stats_retired; stats != NULL; stats= next)
+    {
+      next= stats->next;
+      _stats_free(stats);
+    }
+
+    shard->stats_retired= NULL;
+  }
+
+  shard->stats_dirty= false;
+
+  return GEARMAN_SUCCESS;
+}
+
+const gearman_server_stats_st *
+gearman_server_stats_acquire(gearman_server_shard_st *shard)
+{
+  /* The increment is a full barrier, so the load below either sees a
+     snapshot the publisher will not free while we are counted, or a newer
+     one. */
+  (void)__sync_add_and_fetch(&(shard->stats_readers), 1);
+  return *((gearman_server_stats_st * volatile *)&(shard->stats));
+}
+
+void gearman_server_stats_release(gearman_server_shard_st *shard)
+{
+  (void)__sync_sub_and_fetch(&(shard->stats_readers), 1);
+}
+
+void gearman_server_stats_free(gearman_server_shard_st *shard)
+{
+  gearman_server_stats_st *next;
+
+  for (; shard->stats_retired != NULL; shard->stats_retired= next)
+  {
+    next= shard->stats_retired->next;
+    _stats_free(shard->stats_retired);
+  }
+
+  if (shard->stats != NULL)
+  {
+    _stats_free(shard->stats);
+    shard->stats= NULL;
+  }
+}
+
+/*
+ * Private definitions
+ */
+
+static gearman_return_t _stats_workers(gearman_server_shard_st *shard,
+                                       gearman_server_stats_st *stats)
+{
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_con_st *con;
+  const gearman_server_con_addr_st *addr;
+  gearman_server_worker_st *worker;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char *data= NULL;
+  size_t size= 0;
+  size_t total= 0;
+  gearman_return_t ret;
+
+  for (con_shard= shard->con_list; con_shard != NULL;
+       con_shard= con_shard->con_next)
+  {
+    if (shard->index != 0 && con_shard->worker_list == NULL)
+      continue;
+
+    /* The I/O thread clears this before handing the connection to the
+       shards to free, and the address itself lives in the connection. */
+    con= con_shard->con;
+    addr= *((const gearman_server_con_addr_st * volatile *)&(con->addr));
+    if (addr == NULL)
+      continue;
+
+    if (size > total)
+      size= total;
+
+    ret= _stats_reserve(shard, &data, &total, size);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    /* Only the first shard sets the ID, so the others bound the read. */
+    size+= (size_t)snprintf(data + size, total - size, "%d %s %.*s :",
+                            con->con.fd,
+                            gearman_server_con_addr_host(addr, host),
+                            GEARMAN_SERVER_CON_ID_SIZE - 1, con->id);
+    if (size > total)
+      continue;
+
+    for (worker= con_shard->worker_list; worker != NULL;
+         worker= worker->con_next)
+    {
+      size+= (size_t)snprintf(data + size, total - size, " %.*s",
+                              (int)(worker->function->function_name_size),
+                              worker->function->function_name);
+      if (size > total)
+        break;
+    }
+
+    if (size > total)
+      continue;
+
+    size+= (size_t)snprintf(data + size, total - size, "\n");
+  }
+
+  if (data != NULL && size >= total)
+    size= total - 1;
+
+  stats->workers= data;
+  stats->workers_size= size;
+
+  return GEARMAN_SUCCESS;
+}
+
+static gearman_return_t _stats_waits(gearman_server_shard_st *shard,
+                                     gearman_server_stats_st *stats)
+{
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_con_st *con;
+  const gearman_server_con_addr_st *addr;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char *data= NULL;
+  size_t size= 0;
+  size_t total= 0;
+  gearman_return_t ret;
+
+  for (con_shard= shard->con_list; con_shard != NULL;
+       con_shard= con_shard->con_next)
+  {
+    if (con_shard->proc_wait_max == 0)
+      continue;
+
+    con= con_shard->con;
+    addr= *((const gearman_server_con_addr_st * volatile *)&(con->addr));
+    if (addr == NULL)
+      continue;
+
+    if (size > total)
+      size= total;
+
+    ret= _stats_reserve(shard, &data, &total, size);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+
+    size+= (size_t)snprintf(data + size, total - size,
+                            "%d %s %.*s %u %" PRIu64 "\n", con->con.fd,
+                            gearman_server_con_addr_host(addr, host),
+                            GEARMAN_SERVER_CON_ID_SIZE - 1, con->id,
+                            shard->index, con_shard->proc_wait_max);
+  }
+
+  if (data != NULL && size >= total)
+    size= total - 1;
+
+  stats->waits= data;
+  stats->waits_size= size;
+
+  return GEARMAN_SUCCESS;
+}
+
+static gearman_return_t _stats_reserve(gearman_server_shard_st *shard,
+                                       char **data, size_t *total,
+                                       size_t size)
+{
+  char *new_data;
+
+  if (size + GEARMAN_TEXT_RESPONSE_SIZE <= *total)
+    return GEARMAN_SUCCESS;
+
+  new_data= realloc(*data, *total + GEARMAN_TEXT_RESPONSE_SIZE);
+  if (new_data == NULL)
+  {
+    if (*data != NULL)
+      free(*data);
+    GEARMAN_ERROR_SET(shard->server->gearman, "_stats_reserve", "realloc")
+    return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+  }
+
+  *data= new_data;
+  *total+= GEARMAN_TEXT_RESPONSE_SIZE;
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _stats_free(gearman_server_stats_st *stats)
+{
+  if (stats->workers != NULL)
+    free(stats->workers);
+
+  if (stats->waits != NULL)
+    free(stats->waits);
+
+  free(stats);
+}
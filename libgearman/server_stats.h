@@ -0,0 +1,71 @@
+/* Gearman server and library
+ * Copyright (C) 2008 Brian Aker, Eric Day
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the BSD license.  See
+ * the COPYING file in the parent directory for full text.
+ */
+
+/**
+ * @file
+ * @brief Server statistics declarations
+ */
+
+#ifndef __GEARMAN_SERVER_STATS_H__
+#define __GEARMAN_SERVER_STATS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup gearman_server_stats Server Statistics
+ * @ingroup gearman_server
+ * This is a low level interface for the statistics reported by the text
+ * protocol. Each shard publishes an immutable gearman_server_stats_st
+ * snapshot of its own functions, counters and connections from the thread
+ * that owns the shard. A processing thread publishes at most once every
+ * GEARMAN_SERVER_STATS_INTERVAL milliseconds while busy, and once more
+ * before it goes idle, so readers never ask for or wait on a snapshot.
+ * Readers never take a lock either: they announce themselves in the shard's
+ * reader count and use whatever snapshot is current. Replaced snapshots are
+ * kept on a list that the publisher frees whenever it finds the count at
+ * zero, so it never waits on readers.
+ * @{
+ */
+
+/**
+ * Build a new snapshot and make it current. Must only be called from the
+ * thread that owns the shard.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_stats_publish(gearman_server_shard_st *shard);
+
+/**
+ * Get the current snapshot, which may be NULL if none was published yet.
+ * This may be called from any thread, and every call must be paired with
+ * gearman_server_stats_release() once the snapshot is no longer used.
+ */
+GEARMAN_API
+const gearman_server_stats_st *
+gearman_server_stats_acquire(gearman_server_shard_st *shard);
+
+/**
+ * Release a snapshot returned by gearman_server_stats_acquire().
+ */
+GEARMAN_API
+void gearman_server_stats_release(gearman_server_shard_st *shard);
+
+/**
+ * Free all snapshots. No readers may be active.
+ */
+GEARMAN_API
+void gearman_server_stats_free(gearman_server_shard_st *shard);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GEARMAN_SERVER_STATS_H__ */
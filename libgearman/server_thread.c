@@ -28,26 +28,78 @@
  */
 gearman_return_t _thread_packet_read(gearman_server_con_st *con);
 
+/**
+ * Queue held packets for a connection to the processing threads of their
+ * shards. A packet is only queued while the connection has nothing running
+ * in other shards, so responses are sent in the order requests came in.
+ */
+static void _thread_packet_proc(gearman_server_con_st *con);
+
 /**
  * Flush outgoing packets for a connection.
  */
 static gearman_return_t _thread_packet_flush(gearman_server_con_st *con);
 
 /**
- * Start processing thread for the server.
+ * Check if a packet can be sent from its own buffers with writev.
+ */
+static bool _thread_packet_gather(gearman_server_packet_st *packet);
+
+/**
+ * Send as many queued packets as fit in one writev call, straight from the
+ * packet buffers, and free the ones that were sent completely. The offset
+ * into a partly sent first packet is kept on the connection. With a writev
+ * callback set on the thread, the write is handed to it instead and
+ * GEARMAN_IO_WAIT is returned until gearman_server_thread_writev_done.
+ */
+static gearman_return_t _thread_packet_writev(gearman_server_con_st *con);
+
+/**
+ * Free the queued packets covered by a write of the given size.
+ */
+static void _thread_packet_sent(gearman_server_con_st *con, size_t size);
+
+/**
+ * Start a processing thread for each shard of the server.
  */
 static gearman_return_t _proc_thread_start(gearman_server_st *server);
 
 /**
- * Kill processing thread for the server.
+ * Kill processing threads for the server.
  */
 static void _proc_thread_kill(gearman_server_st *server);
 
 /**
- * Processing thread.
+ * Processing thread for a shard.
  */
 static void *_proc(void *data);
 
+/**
+ * Run a list of packets taken from the proc queue of a shard.
+ */
+static void _proc_packet_run(gearman_server_shard_st *shard,
+                             gearman_server_packet_st *packet);
+
+/**
+ * Sort a list of packets taken from the proc queue of a shard onto the queue
+ * of each connection, and make those connections active.
+ */
+static void _proc_packet_queue(gearman_server_shard_st *shard,
+                               gearman_server_packet_st *packet);
+
+/**
+ * Give every connection that is active one turn, in deficit round-robin
+ * order. A turn runs packets until the packet budget is used up or the next
+ * packet is larger than the byte deficit.
+ */
+static void _proc_round(gearman_server_shard_st *shard);
+
+/**
+ * Take a connection off the active list, running whatever it has queued.
+ */
+static void _proc_active_remove(gearman_server_shard_st *shard,
+                                gearman_server_con_shard_st *con_shard);
+
 /**
  * Wrapper for log handling.
  */
@@ -85,21 +137,30 @@ gearman_server_thread_create(gearman_server_st *server,
   else
     thread->options= 0;
 
+  thread->index= server->thread_count;
   thread->con_count= 0;
   thread->io_count= 0;
-  thread->proc_count= 0;
+  thread->io_wakeup= 0;
   thread->free_con_count= 0;
-  thread->free_packet_count= 0;
+  thread->packet_count= 0;
+  thread->byte_count= 0;
+  thread->packet_last= 0;
+  thread->byte_last= 0;
+  thread->packet_recent= 0;
+  thread->byte_recent= 0;
   thread->server= server;
   thread->log_fn= NULL;
   thread->log_fn_arg= NULL;
   thread->run_fn= NULL;
   thread->run_fn_arg= NULL;
+  thread->writev_fn= NULL;
+  thread->writev_fn_arg= NULL;
   thread->con_list= NULL;
   thread->io_list= NULL;
-  thread->proc_list= NULL;
   thread->free_con_list= NULL;
-  thread->free_packet_list= NULL;
+  thread->io_queue= NULL;
+  (void)gearman_server_slab_cache_create(&(server->packet_slab),
+                                         &(thread->packet_cache));
 
   if (pthread_mutex_init(&(thread->lock), NULL) != 0)
   {
@@ -126,10 +187,12 @@ gearman_server_thread_create(gearman_server_st *server,
 void gearman_server_thread_free(gearman_server_thread_st *thread)
 {
   gearman_server_con_st *con;
-  gearman_server_packet_st *packet;
 
   _proc_thread_kill(thread->server);
 
+  /* Anything still queued is freed along with its connection. */
+  gearman_server_thread_io_drain(thread);
+
   while (thread->con_list != NULL)
     gearman_server_con_free(thread->con_list);
 
@@ -140,12 +203,7 @@ void gearman_server_thread_free(gearman_server_thread_st *thread)
     free(con);
   }
 
-  while (thread->free_packet_list != NULL)
-  {
-    packet= thread->free_packet_list;
-    thread->free_packet_list= packet->next;
-    free(packet);
-  }
+  gearman_server_slab_cache_free(&(thread->packet_cache));
 
   if (thread->gearman != NULL)
     gearman_free(thread->gearman);
@@ -183,6 +241,103 @@ void gearman_server_thread_set_run(gearman_server_thread_st *thread,
   thread->run_fn_arg= run_fn_arg;
 }
 
+void gearman_server_thread_set_writev(gearman_server_thread_st *thread,
+                                      gearman_server_thread_writev_fn
+                                      *writev_fn, void *writev_fn_arg)
+{
+  thread->writev_fn= writev_fn;
+  thread->writev_fn_arg= writev_fn_arg;
+}
+
+void gearman_server_thread_writev_done(gearman_server_con_st *con,
+                                       size_t write_size)
+{
+  con->io_writev= false;
+  _thread_packet_sent(con, write_size);
+
+  if (con->io_packet_list != NULL)
+    gearman_server_con_io_add(con);
+}
+
+void gearman_server_thread_wakeup(gearman_server_thread_st *thread)
+{
+  if (__sync_bool_compare_and_swap(&(thread->io_wakeup), 0, 1) &&
+      thread->run_fn != NULL)
+  {
+    (*thread->run_fn)(thread, thread->run_fn_arg);
+  }
+}
+
+void gearman_server_thread_io_drain(gearman_server_thread_st *thread)
+{
+  gearman_server_packet_st *packet;
+  gearman_server_packet_st *next;
+  gearman_server_con_st *con;
+
+  for (packet= gearman_server_packet_take(&(thread->io_queue)); packet != NULL;
+       packet= next)
+  {
+    next= packet->next;
+    packet->next= NULL;
+    con= packet->con;
+
+    GEARMAN_FIFO_ADD(con->io_packet, packet,)
+
+    /* Dead connections are freed with whatever is left on the queue. */
+    if (con->io_packet_count == 1 && !(con->options & GEARMAN_SERVER_CON_DEAD))
+      gearman_server_con_io_add(con);
+  }
+}
+
+void gearman_server_thread_sample(gearman_server_thread_st *thread)
+{
+  uint64_t packet_count;
+  uint64_t byte_count;
+
+  /* Totals only ever grow and are written by the thread itself, so a slightly
+     stale read just moves some activity into the next interval. */
+  packet_count= *((volatile uint64_t *)&(thread->packet_count));
+  byte_count= *((volatile uint64_t *)&(thread->byte_count));
+
+  thread->packet_recent= packet_count - thread->packet_last;
+  thread->byte_recent= byte_count - thread->byte_last;
+  thread->packet_last= packet_count;
+  thread->byte_last= byte_count;
+}
+
+bool gearman_server_thread_cpu_valid(uint32_t cpu)
+{
+#ifdef CPU_SETSIZE
+  return cpu < CPU_SETSIZE;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+gearman_return_t gearman_server_thread_attr_cpu(pthread_attr_t *attr,
+                                                uint32_t cpu)
+{
+#ifdef CPU_SETSIZE
+  cpu_set_t cpus;
+
+  if (cpu >= CPU_SETSIZE)
+    return GEARMAN_PTHREAD;
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+
+  if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpus) != 0)
+    return GEARMAN_PTHREAD;
+
+  return GEARMAN_SUCCESS;
+#else
+  (void)attr;
+  (void)cpu;
+  return GEARMAN_PTHREAD;
+#endif
+}
+
 void gearman_server_thread_set_log(gearman_server_thread_st *thread,
                                    gearman_server_thread_log_fn *log_fn, 
                                    void *log_fn_arg, gearman_verbose_t verbose)
@@ -199,32 +354,9 @@ gearman_server_thread_run(gearman_server_thread_st *thread,
   gearman_con_st *con;
   gearman_server_con_st *server_con;
 
-  /* If we are multi-threaded, we may have packets to flush or connections that
-     should start reading again. */
+  /* No need for other threads to wake us up while we are running. */
   if (thread->server->options & GEARMAN_SERVER_PROC_THREAD)
-  {
-    while ((server_con= gearman_server_con_io_next(thread)) != NULL)
-    {
-      if (server_con->options & GEARMAN_SERVER_CON_DEAD)
-      {
-        if (server_con->proc_removed)
-          gearman_server_con_free(server_con);
-
-        continue;
-      }
-
-      if (server_con->ret != GEARMAN_SUCCESS)
-      {
-        *ret_ptr= server_con->ret;
-        return server_con;
-      }
-
-      /* See if any outgoing packets were queued. */
-      *ret_ptr= _thread_packet_flush(server_con);
-      if (*ret_ptr != GEARMAN_SUCCESS && *ret_ptr != GEARMAN_IO_WAIT)
-        return server_con;
-    }
-  }
+    thread->io_wakeup= 1;
 
   /* Check for new activity on connections. */
   while ((con= gearman_con_ready(thread->gearman)) != NULL)
@@ -251,8 +383,61 @@ gearman_server_thread_run(gearman_server_thread_st *thread,
     }
   }
 
-  /* Start flushing new outgoing packets if we are single threaded. */
-  if (!(thread->server->options & GEARMAN_SERVER_PROC_THREAD))
+  /* If we are multi-threaded, we may have packets to flush or connections that
+     should start reading again. Otherwise start flushing new outgoing
+     packets. */
+  if (thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+  {
+    while (1)
+    {
+      gearman_server_thread_io_drain(thread);
+
+      server_con= gearman_server_con_io_next(thread);
+      if (server_con == NULL)
+      {
+        /* Check once more after allowing wakeups again, so nothing queued
+           in between is left behind. */
+        thread->io_wakeup= 0;
+        __sync_synchronize();
+        if ((thread->io_queue == NULL && thread->io_list == NULL) ||
+            !__sync_bool_compare_and_swap(&(thread->io_wakeup), 0, 1))
+        {
+          break;
+        }
+
+        continue;
+      }
+
+      if (server_con->options & GEARMAN_SERVER_CON_DEAD)
+      {
+        /* Packets for the connection may still be queued by shards. */
+        if (server_con->proc_removed &&
+            *((volatile uint32_t *)&(server_con->shard_busy)) == 0)
+        {
+          gearman_server_thread_io_drain(thread);
+          gearman_server_con_free(server_con);
+        }
+
+        continue;
+      }
+
+      if (server_con->ret != GEARMAN_SUCCESS)
+      {
+        *ret_ptr= server_con->ret;
+        return server_con;
+      }
+
+      /* Packets may be held until other shards are done. */
+      if (server_con->hold_packet_list != NULL)
+        _thread_packet_proc(server_con);
+
+      /* See if any outgoing packets were queued. */
+      *ret_ptr= _thread_packet_flush(server_con);
+      if (*ret_ptr != GEARMAN_SUCCESS && *ret_ptr != GEARMAN_IO_WAIT)
+        return server_con;
+    }
+  }
+  else
   {
     while ((server_con= gearman_server_con_io_next(thread)) != NULL)
     {
@@ -267,7 +452,7 @@ gearman_server_thread_run(gearman_server_thread_st *thread,
     *ret_ptr= GEARMAN_SHUTDOWN;
   else if (thread->server->shutdown_graceful)
   {
-    if (thread->server->job_count == 0)
+    if (gearman_server_job_count(thread->server) == 0)
       *ret_ptr= GEARMAN_SHUTDOWN;
     else
       *ret_ptr= GEARMAN_SHUTDOWN_GRACEFUL;
@@ -284,13 +469,16 @@ gearman_server_thread_run(gearman_server_thread_st *thread,
 
 gearman_return_t _thread_packet_read(gearman_server_con_st *con)
 {
+  gearman_server_shard_st *shard;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
   gearman_return_t ret;
 
   while (1)
   {
     if (con->packet == NULL)
     {
-      con->packet= gearman_server_packet_create(con->thread, true);
+      con->packet= gearman_server_packet_create(con->thread, NULL);
       if (con->packet == NULL)
         return GEARMAN_MEMORY_ALLOCATION_FAILURE;
     }
@@ -301,29 +489,67 @@ gearman_return_t _thread_packet_read(gearman_server_con_st *con)
       if (ret == GEARMAN_IO_WAIT)
         break;
 
-      gearman_server_packet_free(con->packet, con->thread, true);
+      gearman_server_packet_free(con->packet, con->thread, NULL);
       con->packet= NULL;
       return ret;
     }
 
+    con->thread->packet_count++;
+    con->thread->byte_count+= con->packet->packet.args_size +
+                              con->packet->packet.data_size;
+
     GEARMAN_DEBUG(con->thread->gearman, "%15s:%5s Received  %s",
-                  con->host == NULL ? "-" : con->host,
-                  con->port == NULL ? "-" : con->port,
+                  gearman_server_con_addr_host(con->addr, host),
+                  gearman_server_con_addr_port(con->addr, port),
                   gearman_command_info_list[con->packet->packet.command].name)
 
-    /* We read a complete packet. */
-    if (con->thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+    if (con->thread->server->options & GEARMAN_SERVER_PROC_THREAD &&
+        (*((volatile uint32_t *)&(con->shard_busy)) != 0 ||
+         con->hold_packet_list != NULL ||
+         !gearman_server_run_inline(&(con->packet->packet))))
     {
-      /* Multi-threaded, queue for the processing thread to run. */
-      gearman_server_proc_packet_add(con, con->packet);
+      /* Multi-threaded, queue for the processing thread to run. The
+         arguments have to move out of the receive buffer first, since the
+         buffer is reused for the packets after this one long before the
+         processing thread gets to it. */
+      ret= gearman_packet_unpin_args(&(con->packet->packet));
+      if (ret != GEARMAN_SUCCESS)
+      {
+        gearman_packet_free(&(con->packet->packet));
+        gearman_server_packet_free(con->packet, con->thread, NULL);
+        con->packet= NULL;
+        return ret;
+      }
+
+      if (con->thread->server->shard_count == 1)
+      {
+        shard= gearman_server_shard_route(con, &(con->packet->packet));
+        (void)__sync_add_and_fetch(&(con->shard_busy), 1);
+        gearman_server_proc_packet_add(con, shard, con->packet);
+      }
+      else
+      {
+        GEARMAN_FIFO_ADD(con->hold_packet, con->packet,)
+        _thread_packet_proc(con);
+      }
+
       con->packet= NULL;
     }
     else
     {
-      /* Single threaded, run the command here. */
-      ret= gearman_server_run_command(con, &(con->packet->packet));
+      /* Single threaded, or a read-only command with nothing queued before
+         it so the response stays in order, run the command here. */
+      if (con->thread->server->options & GEARMAN_SERVER_PROC_THREAD)
+      {
+        /* Responses for earlier requests must be sent first. */
+        gearman_server_thread_io_drain(con->thread);
+        shard= NULL;
+      }
+      else
+        shard= gearman_server_shard_route(con, &(con->packet->packet));
+      ret= gearman_server_run_command(con, shard, &(con->packet->packet));
       gearman_packet_free(&(con->packet->packet));
-      gearman_server_packet_free(con->packet, con->thread, true);
+      gearman_server_packet_free(con->packet, con->thread, NULL);
       con->packet= NULL;
       if (ret != GEARMAN_SUCCESS)
         return ret;
@@ -333,27 +559,81 @@ gearman_return_t _thread_packet_read(gearman_server_con_st *con)
   return GEARMAN_SUCCESS;
 }
 
+static void _thread_packet_proc(gearman_server_con_st *con)
+{
+  gearman_server_packet_st *packet;
+  gearman_server_shard_st *shard;
+
+  while ((packet= con->hold_packet_list) != NULL)
+  {
+    shard= gearman_server_shard_route(con, &(packet->packet));
+    if (*((volatile uint32_t *)&(con->shard_busy)) != 0 &&
+        shard != con->shard_last)
+    {
+      break;
+    }
+
+    GEARMAN_FIFO_DEL(con->hold_packet, packet,)
+    packet->next= NULL;
+
+    /* These may be forwarded to other shards, so nothing can follow them
+       until they are done. */
+    if (packet->packet.command == GEARMAN_COMMAND_GRAB_JOB ||
+        packet->packet.command == GEARMAN_COMMAND_GRAB_JOB_UNIQ ||
+        packet->packet.command == GEARMAN_COMMAND_PRE_SLEEP ||
+        packet->packet.command == GEARMAN_COMMAND_RESET_ABILITIES)
+    {
+      con->shard_last= NULL;
+    }
+    else
+      con->shard_last= shard;
+
+    (void)__sync_add_and_fetch(&(con->shard_busy), 1);
+    gearman_server_proc_packet_add(con, shard, packet);
+  }
+}
+
 static gearman_return_t _thread_packet_flush(gearman_server_con_st *con)
 {
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
   gearman_return_t ret;
 
-  /* Check to see if we've already tried to avoid excessive system calls. */
-  if (con->con.events & POLLOUT)
+  /* Check to see if we've already tried to avoid excessive system calls, or
+     if a write handed to the writev callback is still going. */
+  if (con->con.events & POLLOUT || con->io_writev)
     return GEARMAN_IO_WAIT;
 
   while (con->io_packet_list != NULL)
   {
+    /* The send buffer is only needed for custom protocols, or for packets
+       that stream their data. It must be empty before skipping it. */
+    if (con->io_packet_offset > 0 ||
+        (con->con.send_fn == NULL &&
+         con->con.packet_pack_fn == gearman_packet_pack &&
+         con->con.send_state == GEARMAN_CON_SEND_STATE_NONE &&
+         con->con.send_buffer_size == 0 &&
+         _thread_packet_gather(con->io_packet_list)))
+    {
+      ret= _thread_packet_writev(con);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      continue;
+    }
+
     ret= gearman_con_send(&(con->con), &(con->io_packet_list->packet),
                           con->io_packet_list->next == NULL ? true : false);
     if (ret != GEARMAN_SUCCESS)
       return ret;
 
-    if (con->io_packet_list->packet.command == GEARMAN_COMMAND_NOOP)
-      con->noop_queued= false;
+    con->thread->packet_count++;
+    con->thread->byte_count+= con->io_packet_list->packet.args_size +
+                              con->io_packet_list->packet.data_size;
 
     GEARMAN_DEBUG(con->thread->gearman, "%15s:%5s Sent      %s",
-            con->host == NULL ? "-" : con->host,
-            con->port == NULL ? "-" : con->port,
+            gearman_server_con_addr_host(con->addr, host),
+            gearman_server_con_addr_port(con->addr, port),
             gearman_command_info_list[con->io_packet_list->packet.command].name)
 
     gearman_server_io_packet_remove(con);
@@ -363,15 +643,110 @@ static gearman_return_t _thread_packet_flush(gearman_server_con_st *con)
   return gearman_con_set_events(&(con->con), POLLIN);
 }
 
-static gearman_return_t _proc_thread_start(gearman_server_st *server)
+static bool _thread_packet_gather(gearman_server_packet_st *packet)
 {
-  pthread_attr_t attr;
+  return packet->packet.data != NULL || packet->packet.data_size == 0;
+}
 
-  if (pthread_mutex_init(&(server->proc_lock), NULL) != 0)
-    return GEARMAN_PTHREAD;
+static gearman_return_t _thread_packet_writev(gearman_server_con_st *con)
+{
+  struct iovec iov[GEARMAN_SERVER_IOV_MAX];
+  gearman_server_packet_st *server_packet;
+  gearman_packet_st *packet;
+  size_t offset= con->io_packet_offset;
+  size_t size= 0;
+  int iov_count= 0;
+  gearman_return_t ret;
 
-  if (pthread_cond_init(&(server->proc_cond), NULL) != 0)
-    return GEARMAN_PTHREAD;
+  for (server_packet= con->io_packet_list;
+       server_packet != NULL && iov_count + 2 <= GEARMAN_SERVER_IOV_MAX &&
+       _thread_packet_gather(server_packet);
+       server_packet= server_packet->next)
+  {
+    packet= &(server_packet->packet);
+
+    /* Only the first packet can have an offset. */
+    if (offset < packet->args_size)
+    {
+      iov[iov_count].iov_base= packet->args + offset;
+      iov[iov_count].iov_len= packet->args_size - offset;
+      iov_count++;
+      offset= 0;
+    }
+    else
+      offset-= packet->args_size;
+
+    if (offset < packet->data_size)
+    {
+      iov[iov_count].iov_base= (void *)((const uint8_t *)(packet->data) +
+                                        offset);
+      iov[iov_count].iov_len= packet->data_size - offset;
+      iov_count++;
+    }
+
+    offset= 0;
+  }
+
+  if (iov_count > 0)
+  {
+    if (con->thread->writev_fn != NULL)
+    {
+      ret= (*con->thread->writev_fn)(con, iov, iov_count,
+                                     con->thread->writev_fn_arg);
+      if (ret != GEARMAN_SUCCESS)
+        return ret;
+
+      con->io_writev= true;
+      return GEARMAN_IO_WAIT;
+    }
+
+    ret= gearman_con_writev(&(con->con), iov, iov_count, &size);
+    if (ret != GEARMAN_SUCCESS)
+      return ret;
+  }
+
+  _thread_packet_sent(con, size);
+
+  return GEARMAN_SUCCESS;
+}
+
+static void _thread_packet_sent(gearman_server_con_st *con, size_t size)
+{
+  gearman_packet_st *packet;
+  size_t packet_size;
+  char host[GEARMAN_SERVER_CON_HOST_SIZE];
+  char port[GEARMAN_SERVER_CON_PORT_SIZE];
+
+  size+= con->io_packet_offset;
+
+  while (con->io_packet_list != NULL)
+  {
+    packet= &(con->io_packet_list->packet);
+    packet_size= packet->args_size + packet->data_size;
+    if (size < packet_size)
+      break;
+
+    size-= packet_size;
+
+    con->thread->packet_count++;
+    con->thread->byte_count+= packet_size;
+
+    GEARMAN_DEBUG(con->thread->gearman, "%15s:%5s Sent      %s",
+            gearman_server_con_addr_host(con->addr, host),
+            gearman_server_con_addr_port(con->addr, port),
+            gearman_command_info_list[packet->command].name)
+
+    gearman_server_io_packet_remove(con);
+  }
+
+  con->io_packet_offset= size;
+}
+
+static gearman_return_t _proc_thread_start(gearman_server_st *server)
+{
+  pthread_attr_t attr;
+  gearman_return_t ret;
+  uint32_t x;
 
   if (pthread_attr_init(&attr) != 0)
     return GEARMAN_PTHREAD;
@@ -379,8 +754,28 @@ static gearman_return_t _proc_thread_start(gearman_server_st *server)
   if (pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM) != 0)
     return GEARMAN_PTHREAD;
 
-  if (pthread_create(&(server->proc_id), &attr, _proc, server) != 0)
-    return GEARMAN_PTHREAD;
+  for (x= 0; x < server->shard_count; x++)
+  {
+    /* Shards take the given CPUs in turn. */
+    if (server->proc_cpu_count > 0)
+    {
+      ret= gearman_server_thread_attr_cpu(&attr, server->proc_cpus[x %
+                                          server->proc_cpu_count]);
+    }
+    else
+      ret= GEARMAN_SUCCESS;
+
+    if (ret != GEARMAN_SUCCESS ||
+        pthread_create(&(server->shard[x].proc_id), &attr, _proc,
+                       &(server->shard[x])) != 0)
+    {
+      /* Stop the ones that did start. */
+      server->shard_count= x;
+      server->options|= GEARMAN_SERVER_PROC_THREAD;
+      _proc_thread_kill(server);
+      return GEARMAN_PTHREAD;
+    }
+  }
 
   (void) pthread_attr_destroy(&attr);
 
@@ -391,76 +786,293 @@ static gearman_return_t _proc_thread_start(gearman_server_st *server)
 
 static void _proc_thread_kill(gearman_server_st *server)
 {
+  gearman_server_shard_st *shard;
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_packet_st *packet;
+  gearman_server_packet_st *next;
+  uint32_t x;
+
   if (!(server->options & GEARMAN_SERVER_PROC_THREAD) || server->proc_shutdown)
     return;
 
   server->proc_shutdown= true;
 
-  /* Signal proc thread to shutdown. */
-  (void) pthread_mutex_lock(&(server->proc_lock));
-  (void) pthread_cond_signal(&(server->proc_cond));
-  (void) pthread_mutex_unlock(&(server->proc_lock));
+  /* Signal proc threads to shutdown. */
+  for (x= 0; x < server->shard_count; x++)
+  {
+    shard= &(server->shard[x]);
+    (void) pthread_mutex_lock(&(shard->proc_lock));
+    (void) pthread_cond_signal(&(shard->proc_cond));
+    (void) pthread_mutex_unlock(&(shard->proc_lock));
+  }
+
+  /* Wait for the proc threads to exit. */
+  for (x= 0; x < server->shard_count; x++)
+    (void) pthread_join(server->shard[x].proc_id, NULL);
+
+  /* Drop whatever they did not get to. */
+  for (x= 0; x < server->shard_count; x++)
+  {
+    shard= &(server->shard[x]);
+    packet= gearman_server_packet_take(&(shard->proc_queue));
+    while (packet != NULL)
+    {
+      next= packet->next;
+      gearman_packet_free(&(packet->packet));
+      gearman_server_packet_free(packet, packet->con->thread, shard);
+      packet= next;
+    }
+
+    for (con_shard= shard->proc_active_list; con_shard != NULL;
+         con_shard= con_shard->proc_active_next)
+    {
+      for (packet= con_shard->proc_packet_list; packet != NULL; packet= next)
+      {
+        next= packet->next;
+        gearman_packet_free(&(packet->packet));
+        gearman_server_packet_free(packet, packet->con->thread, shard);
+      }
 
-  /* Wait for the proc thread to exit and then cleanup. */
-  (void) pthread_join(server->proc_id, NULL);
-  (void) pthread_cond_destroy(&(server->proc_cond));
-  (void) pthread_mutex_destroy(&(server->proc_lock));
+      con_shard->proc_packet_list= NULL;
+    }
+  }
 }
 
 static void *_proc(void *data)
 {
-  gearman_server_st *server= (gearman_server_st *)data;
-  gearman_server_thread_st *thread;
+  gearman_server_shard_st *shard= (gearman_server_shard_st *)data;
+  gearman_server_st *server= shard->server;
   gearman_server_con_st *con;
   gearman_server_packet_st *packet;
 
   while (1)
   {
-    (void) pthread_mutex_lock(&(server->proc_lock));
-    while (server->proc_wakeup == false)
+    packet= gearman_server_packet_take(&(shard->proc_queue));
+    if (packet == NULL && shard->proc_list == NULL &&
+        shard->proc_active_list == NULL)
     {
-      if (server->proc_shutdown)
+      /* Leave a snapshot of where the shard settled before going idle. */
+      if (shard->stats_dirty)
+        (void)gearman_server_stats_publish(shard);
+
+      (void) pthread_mutex_lock(&(shard->proc_lock));
+
+      /* Producers only signal once they see this, and they check it after
+         pushing, so one of us always sees the other. */
+      shard->proc_sleeping= true;
+      __sync_synchronize();
+
+      while (shard->proc_wakeup == false &&
+             *((gearman_server_packet_st * volatile *)&(shard->proc_queue)) ==
+             NULL)
       {
-        (void) pthread_mutex_unlock(&(server->proc_lock));
-        return NULL;
+        if (server->proc_shutdown)
+        {
+          shard->proc_sleeping= false;
+          (void) pthread_mutex_unlock(&(shard->proc_lock));
+          return NULL;
+        }
+
+        (void) pthread_cond_wait(&(shard->proc_cond), &(shard->proc_lock));
       }
 
-      (void) pthread_cond_wait(&(server->proc_cond), &(server->proc_lock));
+      shard->proc_sleeping= false;
+      shard->proc_wakeup= false;
+      (void) pthread_mutex_unlock(&(shard->proc_lock));
+
+      packet= gearman_server_packet_take(&(shard->proc_queue));
     }
-    server->proc_wakeup= false;
-    (void) pthread_mutex_unlock(&(server->proc_lock));
 
-    for (thread= server->thread_list; thread != NULL; thread= thread->next)
+    _proc_packet_queue(shard, packet);
+    _proc_round(shard);
+
+    while ((con= gearman_server_con_proc_next(shard)) != NULL)
     {
-      while ((con= gearman_server_con_proc_next(thread)) != NULL)
+      if (con->options & GEARMAN_SERVER_CON_DEAD)
       {
-        if (con->options & GEARMAN_SERVER_CON_DEAD)
-        {
-          gearman_server_con_free_workers(con);
+        /* Packets queued before the connection died go first. */
+        _proc_packet_queue(shard,
+                           gearman_server_packet_take(&(shard->proc_queue)));
+        _proc_active_remove(shard, GEARMAN_SERVER_CON_SHARD(con, shard));
+        gearman_server_con_proc_free(con, shard);
+        continue;
+      }
 
-          while (con->client_list != NULL)
-            gearman_server_client_free(con->client_list);
+      /* New connections are announced to the first shard this way. */
+      gearman_server_con_list_add(con, shard);
 
-          con->proc_removed= true;
-          gearman_server_con_io_add(con);
-          continue;
-        }
+      /* Another shard assigned a job to a worker woken from this one. */
+      if (__sync_bool_compare_and_swap(&(GEARMAN_SERVER_CON_SHARD(con, shard)->
+                                         wake_clear), true, false))
+      {
+        (void)gearman_server_con_wake_clear(con, shard);
+      }
+    }
 
-        while (1)
-        {
-          packet= gearman_server_proc_packet_remove(con);
-          if (packet == NULL)
-            break;
+    /* While busy, rebuild the snapshot at most once an interval. */
+    shard->stats_dirty= true;
+    if (gearman_server_packet_time() - shard->stats_time >=
+        GEARMAN_SERVER_STATS_INTERVAL * 1000)
+    {
+      (void)gearman_server_stats_publish(shard);
+    }
+  }
+}
 
-          con->ret= gearman_server_run_command(con, &(packet->packet));
-          gearman_packet_free(&(packet->packet));
-          gearman_server_packet_free(packet, con->thread, false);
-        }
+static void _proc_packet_run(gearman_server_shard_st *shard,
+                             gearman_server_packet_st *packet)
+{
+  gearman_server_packet_st *next;
+  gearman_server_con_st *con;
+  gearman_return_t ret;
+
+  for (; packet != NULL; packet= next)
+  {
+    next= packet->next;
+    con= packet->con;
+
+    /* Several shards may run packets for the connection, so only ever
+       replace success with an error. */
+    if (!(con->options & GEARMAN_SERVER_CON_DEAD))
+    {
+      ret= gearman_server_run_command(con, shard, &(packet->packet));
+      if (ret != GEARMAN_SUCCESS)
+        con->ret= ret;
+    }
+
+    gearman_packet_free(&(packet->packet));
+    gearman_server_packet_free(packet, con->thread, shard);
+
+    /* Let the I/O thread queue packets it held back for other shards. */
+    if (__sync_sub_and_fetch(&(con->shard_busy), 1) == 0 &&
+        shard->server->shard_count > 1)
+    {
+      gearman_server_con_io_add(con);
+    }
+  }
+}
+
+static void _proc_packet_queue(gearman_server_shard_st *shard,
+                               gearman_server_packet_st *packet)
+{
+  gearman_server_packet_st *next;
+  gearman_server_con_shard_st *con_shard;
+
+  for (; packet != NULL; packet= next)
+  {
+    next= packet->next;
+    packet->next= NULL;
+
+    con_shard= GEARMAN_SERVER_CON_SHARD(packet->con, shard);
+    GEARMAN_FIFO_ADD(con_shard->proc_packet, packet,)
+
+    if (!(con_shard->proc_active))
+    {
+      con_shard->proc_active_next= NULL;
+      GEARMAN_FIFO_ADD(shard->proc_active, con_shard, proc_active_)
+      con_shard->proc_active= true;
+    }
+  }
+}
+
+static void _proc_round(gearman_server_shard_st *shard)
+{
+  gearman_server_st *server= shard->server;
+  gearman_server_con_shard_st *con_shard;
+  gearman_server_packet_st *packet;
+  uint32_t con_count= shard->proc_active_count;
+  uint32_t packet_count;
+  uint64_t now;
+  uint64_t size;
+
+  now= gearman_server_packet_time();
+
+  /* Connections that become active during the round wait for the next. */
+  while (con_count > 0 && (con_shard= shard->proc_active_list) != NULL)
+  {
+    con_count--;
+    GEARMAN_FIFO_DEL(shard->proc_active, con_shard, proc_active_)
+    con_shard->proc_active= false;
+
+    con_shard->proc_deficit+= server->proc_bytes;
+
+    for (packet_count= 0; packet_count < server->proc_packets;
+         packet_count++)
+    {
+      packet= con_shard->proc_packet_list;
+      if (packet == NULL)
+        break;
+
+      size= packet->packet.args_size + packet->packet.data_size;
+      if ((int64_t)size > con_shard->proc_deficit)
+        break;
+
+      if (now > packet->proc_time &&
+          now - packet->proc_time > con_shard->proc_wait_max)
+      {
+        con_shard->proc_wait_max= now - packet->proc_time;
       }
+
+      GEARMAN_FIFO_DEL(con_shard->proc_packet, packet,)
+      packet->next= NULL;
+      con_shard->proc_deficit-= (int64_t)size;
+
+      _proc_packet_run(shard, packet);
     }
+
+    if (con_shard->proc_packet_list == NULL)
+    {
+      con_shard->proc_deficit= 0;
+      continue;
+    }
+
+    /* Bytes only carry over to let large packets through, not to build up
+       while the packet budget is what ran out. */
+    if (packet_count == server->proc_packets &&
+        con_shard->proc_deficit > (int64_t)server->proc_bytes)
+    {
+      con_shard->proc_deficit= (int64_t)server->proc_bytes;
+    }
+
+    con_shard->proc_active_next= NULL;
+    GEARMAN_FIFO_ADD(shard->proc_active, con_shard, proc_active_)
+    con_shard->proc_active= true;
   }
 }
 
+static void _proc_active_remove(gearman_server_shard_st *shard,
+                                gearman_server_con_shard_st *con_shard)
+{
+  gearman_server_con_shard_st *prev;
+
+  if (con_shard->proc_active)
+  {
+    if (shard->proc_active_list == con_shard)
+      GEARMAN_FIFO_DEL(shard->proc_active, con_shard, proc_active_)
+    else
+    {
+      for (prev= shard->proc_active_list; prev->proc_active_next != con_shard;
+           prev= prev->proc_active_next)
+      {
+      }
+
+      prev->proc_active_next= con_shard->proc_active_next;
+      if (shard->proc_active_end == con_shard)
+        shard->proc_active_end= prev;
+      shard->proc_active_count--;
+    }
+
+    con_shard->proc_active= false;
+  }
+
+  /* The connection is dead, so these are only freed. */
+  _proc_packet_run(shard, con_shard->proc_packet_list);
+  con_shard->proc_packet_list= NULL;
+  con_shard->proc_packet_end= NULL;
+  con_shard->proc_packet_count= 0;
+  con_shard->proc_deficit= 0;
+}
+
 static void _log(gearman_st *gearman __attribute__ ((unused)),
                  gearman_verbose_t verbose, const char *line, void *fn_arg)
 {
@@ -89,6 +89,35 @@ void gearman_server_thread_set_log(gearman_server_thread_st *thread,
                                    gearman_server_thread_log_fn log_fn,
                                    void *log_fn_arg, gearman_verbose_t verbose);
 
+/**
+ * Move the packet and byte totals for a thread into its recent counts, so
+ * they cover the activity since the previous call. This should be called from
+ * one place at a fixed interval, the totals are only updated by the thread.
+ * @param thread Thread structure previously initialized with
+ *        gearman_server_thread_create.
+ */
+GEARMAN_API
+void gearman_server_thread_sample(gearman_server_thread_st *thread);
+
+/**
+ * Check if threads can be pinned to a CPU on this system.
+ * @param cpu CPU number.
+ * @return true if gearman_server_thread_attr_cpu() can use the CPU.
+ */
+GEARMAN_API
+bool gearman_server_thread_cpu_valid(uint32_t cpu);
+
+/**
+ * Set attributes so a thread created with them only runs on one CPU.
+ * @param attr Thread attributes previously initialized with
+ *        pthread_attr_init.
+ * @param cpu CPU number.
+ * @return Standard gearman return value.
+ */
+GEARMAN_API
+gearman_return_t gearman_server_thread_attr_cpu(pthread_attr_t *attr,
+                                                uint32_t cpu);
+
 /**
  * Set thread run callback.
  * @param thread Thread structure previously initialized with
@@ -101,6 +130,53 @@ void gearman_server_thread_set_run(gearman_server_thread_st *thread,
                                    gearman_server_thread_run_fn *run_fn,
                                    void *run_arg);
 
+/**
+ * Set a callback that takes over writes of queued packets. It gets the
+ * connection and the buffers to write, and must report the number of bytes
+ * written with gearman_server_thread_writev_done before the connection is
+ * flushed again. The buffers are only valid during the call, but the data
+ * they point to stays until then.
+ * @param thread Thread structure previously initialized with
+ *        gearman_server_thread_create.
+ * @param writev_fn Function to call with buffers to write, or NULL to write
+ *        them on the socket.
+ * @param writev_fn_arg Argument to pass along with writev_fn.
+ */
+GEARMAN_API
+void gearman_server_thread_set_writev(gearman_server_thread_st *thread,
+                                      gearman_server_thread_writev_fn
+                                      *writev_fn, void *writev_fn_arg);
+
+/**
+ * Finish a write handed to the writev callback, freeing the packets that
+ * were sent and flushing the connection again if any are left.
+ * @param con Server connection the write was for.
+ * @param write_size Number of bytes written.
+ */
+GEARMAN_API
+void gearman_server_thread_writev_done(gearman_server_con_st *con,
+                                       size_t write_size);
+
+/**
+ * Make sure the thread run callback is called soon. This may be called from
+ * any thread, and wakeups that come in before the thread gets around to
+ * running are coalesced into one callback.
+ * @param thread Thread structure previously initialized with
+ *        gearman_server_thread_create.
+ */
+GEARMAN_API
+void gearman_server_thread_wakeup(gearman_server_thread_st *thread);
+
+/**
+ * Move packets the processing threads queued for this thread onto the
+ * outgoing queues of their connections. Only the thread itself may call
+ * this.
+ * @param thread Thread structure previously initialized with
+ *        gearman_server_thread_create.
+ */
+GEARMAN_API
+void gearman_server_thread_io_drain(gearman_server_thread_st *thread);
+
 /**
  * Process server thread connections.
  * @param thread Thread structure previously initialized with
@@ -18,13 +18,15 @@
  */
 
 gearman_server_worker_st *
-gearman_server_worker_add(gearman_server_con_st *con, const char *function_name,
+gearman_server_worker_add(gearman_server_con_st *con,
+                          gearman_server_shard_st *shard,
+                          const char *function_name,
                           size_t function_name_size, uint32_t timeout)
 {
   gearman_server_worker_st *worker;
   gearman_server_function_st *function;
 
-  function= gearman_server_function_get(con->thread->server, function_name,
+  function= gearman_server_function_get(shard, function_name,
                                         function_name_size);
   if (function == NULL)
     return NULL;
@@ -43,24 +45,19 @@ gearman_server_worker_create(gearman_server_con_st *con,
                              gearman_server_function_st *function,
                              gearman_server_worker_st *worker)
 {
-  gearman_server_st *server= con->thread->server;
+  gearman_server_con_shard_st *con_shard;
+  gearman_job_priority_t priority;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(con, function->shard);
 
   if (worker == NULL)
   {
-    if (server->free_worker_count > 0)
-    {
-      worker= server->free_worker_list;
-      GEARMAN_LIST_DEL(server->free_worker, worker, con_)
-    }
-    else
+    worker= gearman_server_slab_alloc(&(function->shard->worker_cache));
+    if (worker == NULL)
     {
-      worker= malloc(sizeof(gearman_server_worker_st));
-      if (worker == NULL)
-      {
-        GEARMAN_ERROR_SET(con->thread->gearman, "gearman_server_worker_create",
-                          "malloc")
-        return NULL;
-      }
+      GEARMAN_ERROR_SET(con->thread->gearman, "gearman_server_worker_create",
+                        "gearman_server_slab_alloc")
+      return NULL;
     }
 
     worker->options= GEARMAN_SERVER_WORKER_ALLOCATED;
@@ -70,30 +67,130 @@ gearman_server_worker_create(gearman_server_con_st *con,
 
   worker->timeout= 0;
   worker->con= con;
-  GEARMAN_LIST_ADD(con->worker, worker, con_)
+  GEARMAN_LIST_ADD(con_shard->worker, worker, con_)
   worker->function= function;
   GEARMAN_LIST_ADD(function->worker, worker, function_)
+  worker->sleep_next= NULL;
+  worker->sleep_prev= NULL;
   worker->job= NULL;
 
+  for (priority= GEARMAN_JOB_PRIORITY_HIGH;
+       priority != GEARMAN_JOB_PRIORITY_MAX; priority++)
+  {
+    if (function->job_list[priority] != NULL)
+      gearman_server_worker_ready_add(worker, priority);
+  }
+
+  if (con_shard->sleeping)
+    gearman_server_worker_sleep(worker);
+
   return worker;
 }
 
 void gearman_server_worker_free(gearman_server_worker_st *worker)
 {
-  gearman_server_st *server= worker->con->thread->server;
+  gearman_server_shard_st *shard= worker->function->shard;
+  gearman_job_priority_t priority;
 
   /* If the worker was in the middle of a job, requeue it. */
   if (worker->job != NULL)
     (void)gearman_server_job_queue(worker->job);
 
-  GEARMAN_LIST_DEL(worker->con->worker, worker, con_)
+  for (priority= GEARMAN_JOB_PRIORITY_HIGH;
+       priority != GEARMAN_JOB_PRIORITY_MAX; priority++)
+  {
+    if (worker->function->job_list[priority] != NULL)
+      gearman_server_worker_ready_del(worker, priority);
+  }
+
+  gearman_server_worker_wake(worker);
+
+  GEARMAN_LIST_DEL(GEARMAN_SERVER_CON_SHARD(worker->con, shard)->worker,
+                   worker, con_)
   GEARMAN_LIST_DEL(worker->function->worker, worker, function_)
 
   if (worker->options & GEARMAN_SERVER_WORKER_ALLOCATED)
+    gearman_server_slab_dealloc(&(shard->worker_cache), worker);
+}
+
+void gearman_server_worker_ready_add(gearman_server_worker_st *worker,
+                                     gearman_job_priority_t priority)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(worker->con, worker->function->shard);
+
+  worker->ready_next[priority]= NULL;
+  worker->ready_prev[priority]= con_shard->ready_end[priority];
+  if (con_shard->ready_end[priority] == NULL)
+    con_shard->ready_list[priority]= worker;
+  else
+    con_shard->ready_end[priority]->ready_next[priority]= worker;
+  con_shard->ready_end[priority]= worker;
+}
+
+void gearman_server_worker_ready_del(gearman_server_worker_st *worker,
+                                     gearman_job_priority_t priority)
+{
+  gearman_server_con_shard_st *con_shard;
+
+  con_shard= GEARMAN_SERVER_CON_SHARD(worker->con, worker->function->shard);
+
+  if (worker->ready_prev[priority] == NULL)
+    con_shard->ready_list[priority]= worker->ready_next[priority];
+  else
+  {
+    worker->ready_prev[priority]->ready_next[priority]=
+                                                   worker->ready_next[priority];
+  }
+
+  if (worker->ready_next[priority] == NULL)
+    con_shard->ready_end[priority]= worker->ready_prev[priority];
+  else
   {
-    if (server->free_worker_count < GEARMAN_MAX_FREE_SERVER_WORKER)
-      GEARMAN_LIST_ADD(server->free_worker, worker, con_)
-    else
-      free(worker);
+    worker->ready_next[priority]->ready_prev[priority]=
+                                                   worker->ready_prev[priority];
   }
 }
+
+void gearman_server_worker_sleep(gearman_server_worker_st *worker)
+{
+  gearman_server_function_st *function= worker->function;
+
+  if (worker->options & GEARMAN_SERVER_WORKER_SLEEPING)
+    return;
+
+  worker->sleep_next= NULL;
+  worker->sleep_prev= function->sleep_end;
+  if (function->sleep_end == NULL)
+    function->sleep_list= worker;
+  else
+    function->sleep_end->sleep_next= worker;
+  function->sleep_end= worker;
+  function->sleep_count++;
+
+  worker->options|= GEARMAN_SERVER_WORKER_SLEEPING;
+}
+
+void gearman_server_worker_wake(gearman_server_worker_st *worker)
+{
+  gearman_server_function_st *function= worker->function;
+
+  if (!(worker->options & GEARMAN_SERVER_WORKER_SLEEPING))
+    return;
+
+  if (worker->sleep_prev == NULL)
+    function->sleep_list= worker->sleep_next;
+  else
+    worker->sleep_prev->sleep_next= worker->sleep_next;
+
+  if (worker->sleep_next == NULL)
+    function->sleep_end= worker->sleep_prev;
+  else
+    worker->sleep_next->sleep_prev= worker->sleep_prev;
+
+  function->sleep_count--;
+
+  worker->options&=
+                  (gearman_server_worker_options_t)~GEARMAN_SERVER_WORKER_SLEEPING;
+}
@@ -27,11 +27,13 @@ extern "C" {
  */
 
 /**
- * Add a new worker to a server instance.
+ * Add a new worker to the shard that owns the function.
  */
 GEARMAN_API
 gearman_server_worker_st *
-gearman_server_worker_add(gearman_server_con_st *con, const char *function_name,
+gearman_server_worker_add(gearman_server_con_st *con,
+                          gearman_server_shard_st *shard,
+                          const char *function_name,
                           size_t function_name_size, uint32_t timeout);
 
 /**
@@ -49,6 +51,35 @@ gearman_server_worker_create(gearman_server_con_st *con,
 GEARMAN_API
 void gearman_server_worker_free(gearman_server_worker_st *worker);
 
+/**
+ * Add a worker to the end of the ready list of its connection for a
+ * priority. This is done for all workers of a function when the function
+ * gets queued jobs of that priority.
+ */
+GEARMAN_API
+void gearman_server_worker_ready_add(gearman_server_worker_st *worker,
+                                     gearman_job_priority_t priority);
+
+/**
+ * Remove a worker from the ready list of its connection for a priority.
+ */
+GEARMAN_API
+void gearman_server_worker_ready_del(gearman_server_worker_st *worker,
+                                     gearman_job_priority_t priority);
+
+/**
+ * Add a worker to the end of the sleeping worker list for its function.
+ */
+GEARMAN_API
+void gearman_server_worker_sleep(gearman_server_worker_st *worker);
+
+/**
+ * Remove a worker from the sleeping worker list for its function, if it is
+ * on it.
+ */
+GEARMAN_API
+void gearman_server_worker_wake(gearman_server_worker_st *worker);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -31,11 +31,13 @@ struct gearman_st
   uint32_t packet_count;
   uint32_t pfds_size;
   uint32_t sending;
+  uint32_t con_buffer_count;
   int last_errno;
   gearman_con_st *con_list;
   gearman_job_st *job_list;
   gearman_task_st *task_list;
   gearman_packet_st *packet_list;
+  void *con_buffer_list;
   struct pollfd *pfds;
   gearman_log_fn *log_fn;
   void *log_fn_arg;
@@ -104,17 +106,26 @@ struct gearman_con_st
   size_t send_data_size;
   size_t send_data_offset;
   size_t recv_buffer_size;
+  size_t recv_buffer_total;
   size_t recv_data_size;
   size_t recv_data_offset;
+  size_t recv_input_size;
+  size_t send_frame_size;
+  size_t send_zlib_size;
+  size_t zlib_buffer_size;
   gearman_st *gearman;
   gearman_con_st *next;
   gearman_con_st *prev;
   void *data;
   struct addrinfo *addrinfo;
   struct addrinfo *addrinfo_next;
+  char *host;
+  uint8_t *send_buffer;
   uint8_t *send_buffer_ptr;
   gearman_packet_st *recv_packet;
   uint8_t *recv_buffer_ptr;
+  uint8_t *recv_buffer_start;
+  const uint8_t *recv_input;
   void *protocol_data;
   gearman_con_protocol_data_free_fn *protocol_data_free_fn;
   gearman_con_recv_fn *recv_fn;
@@ -123,10 +134,10 @@ struct gearman_con_st
   gearman_con_send_data_fn *send_data_fn;
   gearman_packet_pack_fn *packet_pack_fn;
   gearman_packet_unpack_fn *packet_unpack_fn;
+  void *zlib_stream;
+  uint8_t *zlib_buffer;
+  uint8_t send_frame[GEARMAN_FRAME_ZLIB_SIZE];
   gearman_packet_st packet;
-  char host[NI_MAXHOST];
-  uint8_t send_buffer[GEARMAN_SEND_BUFFER_SIZE];
-  uint8_t recv_buffer[GEARMAN_RECV_BUFFER_SIZE];
 };
 
 /**
@@ -230,6 +241,103 @@ struct gearman_worker_function_st
   gearman_packet_st packet;
 };
 
+/**
+ * @ingroup gearman_server_hash
+ */
+struct gearman_server_hash_node_st
+{
+  uint32_t key;
+  gearman_server_hash_node_st *next;
+  gearman_server_hash_node_st *prev;
+};
+
+/**
+ * @ingroup gearman_server_hash
+ */
+struct gearman_server_hash_st
+{
+  gearman_server_hash_options_t options;
+  uint32_t count;
+  uint32_t size;
+  uint32_t old_size;
+  uint32_t rehash_bucket;
+  uint32_t first_bucket;
+  gearman_server_hash_node_st **table;
+  gearman_server_hash_node_st **old_table;
+};
+
+/**
+ * @ingroup gearman_server_slab
+ */
+struct gearman_server_slab_st
+{
+  gearman_server_slab_options_t options;
+  uint32_t full_count;
+  uint32_t partial_count;
+  uint32_t empty_count;
+  uint32_t chunk_objects;
+  uint32_t free_count;
+  uint32_t cached_count;
+  size_t size;
+  const char *name;
+  gearman_server_slab_chunk_st *full_list;
+  gearman_server_slab_chunk_st *partial_list;
+  gearman_server_slab_chunk_st *empty_list;
+  pthread_mutex_t lock;
+};
+
+/**
+ * @ingroup gearman_server_slab
+ */
+struct gearman_server_slab_chunk_st
+{
+  uint32_t free_count;
+  gearman_server_slab_chunk_st *next;
+  gearman_server_slab_chunk_st *prev;
+  void *free_list;
+};
+
+/**
+ * @ingroup gearman_server_slab
+ */
+struct gearman_server_slab_cache_st
+{
+  gearman_server_slab_cache_options_t options;
+  uint32_t count;
+  uint32_t reported;
+  gearman_server_slab_st *slab;
+  void *object[GEARMAN_SERVER_SLAB_CACHE_SIZE];
+};
+
+/**
+ * @ingroup gearman_server_stats
+ */
+struct gearman_server_stats_function_st
+{
+  uint32_t job_total;
+  uint32_t job_running;
+  uint32_t worker_count;
+  size_t function_name_size;
+  const char *function_name;
+};
+
+/**
+ * @ingroup gearman_server_stats
+ */
+struct gearman_server_stats_st
+{
+  uint32_t function_count;
+  uint64_t noop_count;
+  uint64_t no_job_count;
+  uint64_t job_assign_count;
+  size_t workers_size;
+  char *workers;
+  size_t waits_size;
+  char *waits;
+  gearman_server_stats_st *next;
+  gearman_server_stats_function_st *function;
+};
+
 /**
  * @ingroup gearman_server
  */
@@ -238,33 +346,68 @@ struct gearman_server_st
   gearman_server_options_t options;
   bool shutdown;
   bool shutdown_graceful;
-  bool proc_wakeup;
   bool proc_shutdown;
-  uint32_t job_handle_count;
   uint32_t thread_count;
-  uint32_t function_count;
-  uint32_t job_count;
-  uint32_t unique_count;
-  uint32_t free_packet_count;
-  uint32_t free_job_count;
-  uint32_t free_client_count;
-  uint32_t free_worker_count;
+  uint32_t shard_count;
+  uint32_t proc_cpu_count;
+  uint32_t proc_packets;
+  uint32_t proc_bytes;
+  const uint32_t *proc_cpus;
   gearman_st *gearman;
   gearman_server_thread_st *thread_list;
-  gearman_server_function_st *function_list;
-  gearman_server_packet_st *free_packet_list;
-  gearman_server_job_st *free_job_list;
-  gearman_server_client_st *free_client_list;
-  gearman_server_worker_st *free_worker_list;
+  gearman_server_shard_st *shard;
   gearman_server_log_fn *log_fn;
   void *log_fn_arg;
   gearman_st gearman_static;
+  pthread_mutex_t queue_lock;
+  gearman_server_slab_st packet_slab;
+  gearman_server_slab_st job_slab;
+  gearman_server_slab_st client_slab;
+  gearman_server_slab_st worker_slab;
+  size_t job_handle_prefix_size;
+  char job_handle_prefix[GEARMAN_JOB_HANDLE_SIZE];
+};
+
+/**
+ * @ingroup gearman_server_shard
+ */
+struct gearman_server_shard_st
+{
+  bool proc_wakeup;
+  bool proc_sleeping;
+  bool stats_dirty;
+  uint32_t index;
+  uint32_t function_count;
+  uint32_t job_count;
+  uint32_t job_slot_count;
+  uint32_t job_slot_free;
+  uint32_t proc_count;
+  uint32_t proc_active_count;
+  uint32_t con_count;
+  uint32_t stats_readers;
+  uint64_t stats_time;
+  uint64_t noop_count;
+  uint64_t no_job_count;
+  uint64_t job_assign_count;
+  gearman_server_st *server;
+  gearman_server_function_st *function_list;
+  gearman_server_con_shard_st *con_list;
+  gearman_server_con_shard_st *proc_list;
+  gearman_server_con_shard_st *proc_active_list;
+  gearman_server_con_shard_st *proc_active_end;
+  gearman_server_packet_st *proc_queue;
   pthread_mutex_t proc_lock;
   pthread_cond_t proc_cond;
   pthread_t proc_id;
-  char job_handle_prefix[GEARMAN_JOB_HANDLE_SIZE];
-  gearman_server_job_st *job_hash[GEARMAN_JOB_HASH_SIZE];
-  gearman_server_job_st *unique_hash[GEARMAN_JOB_HASH_SIZE];
+  gearman_server_hash_st function_hash;
+  gearman_server_hash_st unique_hash;
+  gearman_server_job_slot_st **job_slot_page;
+  gearman_server_slab_cache_st packet_cache;
+  gearman_server_slab_cache_st job_cache;
+  gearman_server_slab_cache_st client_cache;
+  gearman_server_slab_cache_st worker_cache;
+  gearman_server_stats_st *stats;
+  gearman_server_stats_st *stats_retired;
 };
 
 /**
@@ -273,11 +416,17 @@ struct gearman_server_st
 struct gearman_server_thread_st
 {
   gearman_server_thread_options_t options;
+  uint32_t index;
   uint32_t con_count;
   uint32_t io_count;
-  uint32_t proc_count;
+  uint32_t io_wakeup;
   uint32_t free_con_count;
-  uint32_t free_packet_count;
+  uint64_t packet_count;
+  uint64_t byte_count;
+  uint64_t packet_last;
+  uint64_t byte_last;
+  uint64_t packet_recent;
+  uint64_t byte_recent;
   gearman_st *gearman;
   gearman_server_st *server;
   gearman_server_thread_st *next;
@@ -286,15 +435,28 @@ struct gearman_server_thread_st
   void *log_fn_arg;
   gearman_server_thread_run_fn *run_fn;
   void *run_fn_arg;
+  gearman_server_thread_writev_fn *writev_fn;
+  void *writev_fn_arg;
   gearman_server_con_st *con_list;
   gearman_server_con_st *io_list;
-  gearman_server_con_st *proc_list;
   gearman_server_con_st *free_con_list;
-  gearman_server_packet_st *free_packet_list;
+  gearman_server_packet_st *io_queue;
   gearman_st gearman_static;
+  gearman_server_slab_cache_st packet_cache;
   pthread_mutex_t lock;
 };
 
+/**
+ * @ingroup gearman_server_con
+ */
+struct gearman_server_con_addr_st
+{
+  sa_family_t family;
+  in_port_t port;
+  uint32_t scope_id;
+  uint8_t addr[16];
+};
+
 /**
  * @ingroup gearman_server_con
  */
@@ -303,31 +465,63 @@ struct gearman_server_con_st
   gearman_con_st con; /* This must be the first struct member. */
   gearman_server_con_options_t options;
   gearman_return_t ret;
-  bool noop_queued;
   bool io_list;
-  bool proc_list;
+  bool io_writev;
   bool proc_removed;
   uint32_t io_packet_count;
-  uint32_t proc_packet_count;
-  uint32_t worker_count;
-  uint32_t client_count;
+  uint32_t hold_packet_count;
+  uint32_t proc_pending;
+  uint32_t shard_busy;
+  uint64_t shard_used;
+  uint64_t shard_mask;
+  uint64_t shard_woken;
+  size_t io_packet_offset;
   gearman_server_thread_st *thread;
   gearman_server_con_st *next;
   gearman_server_con_st *prev;
   gearman_server_packet_st *packet;
   gearman_server_packet_st *io_packet_list;
   gearman_server_packet_st *io_packet_end;
-  gearman_server_packet_st *proc_packet_list;
-  gearman_server_packet_st *proc_packet_end;
+  gearman_server_packet_st *hold_packet_list;
+  gearman_server_packet_st *hold_packet_end;
   gearman_server_con_st *io_next;
   gearman_server_con_st *io_prev;
-  gearman_server_con_st *proc_next;
-  gearman_server_con_st *proc_prev;
+  gearman_server_shard_st *shard_last;
+  gearman_server_con_shard_st *shard;
+  const gearman_server_con_addr_st *addr;
+  gearman_server_con_addr_st addr_data;
+  char id[GEARMAN_SERVER_CON_ID_SIZE];
+};
+
+/**
+ * @ingroup gearman_server_con
+ */
+struct gearman_server_con_shard_st
+{
+  bool con_list;
+  bool proc_list;
+  bool proc_removed;
+  bool proc_active;
+  bool sleeping;
+  bool wake_clear;
+  uint32_t worker_count;
+  uint32_t client_count;
+  uint32_t proc_packet_count;
+  int64_t proc_deficit;
+  uint64_t proc_wait_max;
+  gearman_server_con_st *con;
+  gearman_server_con_shard_st *con_next;
+  gearman_server_con_shard_st *con_prev;
+  gearman_server_con_shard_st *proc_next;
+  gearman_server_con_shard_st *proc_prev;
+  gearman_server_con_shard_st *proc_active_next;
+  gearman_server_packet_st *proc_packet_list;
+  gearman_server_packet_st *proc_packet_end;
   gearman_server_worker_st *worker_list;
   gearman_server_client_st *client_list;
-  const char *host;
-  const char *port;
-  char id[GEARMAN_SERVER_CON_ID_SIZE];
+  gearman_server_function_st *woken_function;
+  gearman_server_worker_st *ready_list[GEARMAN_JOB_PRIORITY_MAX];
+  gearman_server_worker_st *ready_end[GEARMAN_JOB_PRIORITY_MAX];
 };
 
 /**
@@ -336,7 +530,21 @@ struct gearman_server_con_st
 struct gearman_server_packet_st
 {
   gearman_packet_st packet;
+  uint64_t proc_time;
   gearman_server_packet_st *next;
+  gearman_server_con_st *con;
+  gearman_server_payload_st *payload;
+};
+
+/**
+ * @ingroup gearman_server_con
+ */
+struct gearman_server_payload_st
+{
+  uint32_t ref_count;
+  size_t data_size;
+  gearman_st *gearman;
+  const void *data;
 };
 
 /**
@@ -350,12 +558,17 @@ struct gearman_server_function_st
   uint32_t job_total;
   uint32_t job_running;
   uint32_t max_queue_size;
+  uint32_t sleep_count;
+  uint32_t wake_count;
   size_t function_name_size;
-  gearman_server_st *server;
+  gearman_server_shard_st *shard;
   gearman_server_function_st *next;
   gearman_server_function_st *prev;
+  gearman_server_hash_node_st function_node;
   char *function_name;
   gearman_server_worker_st *worker_list;
+  gearman_server_worker_st *sleep_list;
+  gearman_server_worker_st *sleep_end;
   gearman_server_job_st *job_list[GEARMAN_JOB_PRIORITY_MAX];
   gearman_server_job_st *job_end[GEARMAN_JOB_PRIORITY_MAX];
 };
@@ -367,6 +580,7 @@ struct gearman_server_client_st
 {
   gearman_server_client_options_t options;
   gearman_server_con_st *con;
+  gearman_server_shard_st *shard;
   gearman_server_client_st *con_next;
   gearman_server_client_st *con_prev;
   gearman_server_job_st *job;
@@ -387,6 +601,10 @@ struct gearman_server_worker_st
   gearman_server_function_st *function;
   gearman_server_worker_st *function_next;
   gearman_server_worker_st *function_prev;
+  gearman_server_worker_st *sleep_next;
+  gearman_server_worker_st *sleep_prev;
+  gearman_server_worker_st *ready_next[GEARMAN_JOB_PRIORITY_MAX];
+  gearman_server_worker_st *ready_prev[GEARMAN_JOB_PRIORITY_MAX];
   gearman_server_job_st *job;
 };
 
@@ -395,26 +613,41 @@ struct gearman_server_worker_st
  */
 struct gearman_server_job_st
 {
+  /* Queueing and handing out jobs only needs this first cache line. */
   gearman_server_job_options_t options;
   gearman_job_priority_t priority;
-  uint32_t job_handle_key;
-  uint32_t unique_key;
-  uint32_t client_count;
-  uint32_t numerator;
-  uint32_t denominator;
-  size_t data_size;
-  gearman_server_st *server;
-  gearman_server_job_st *next;
-  gearman_server_job_st *prev;
-  gearman_server_job_st *unique_next;
-  gearman_server_job_st *unique_prev;
   gearman_server_function_st *function;
   gearman_server_job_st *function_next;
-  const void *data;
-  gearman_server_client_st *client_list;
+  gearman_server_job_st *function_prev;
   gearman_server_worker_st *worker;
-  char job_handle[GEARMAN_JOB_HANDLE_SIZE];
-  char unique[GEARMAN_UNIQUE_SIZE];
+  gearman_server_client_st *client_list;
+  const void *data;
+  size_t data_size;
+  uint32_t numerator;
+  uint32_t denominator;
+  uint32_t slot;
+  uint32_t client_count;
+  uint8_t unique_size;
+  gearman_server_hash_node_st unique_node;
+  union
+  {
+    char buffer[GEARMAN_SERVER_JOB_UNIQUE_INLINE];
+    char *ptr;
+  } unique;
+};
+
+/**
+ * @ingroup gearman_server_job
+ */
+struct gearman_server_job_slot_st
+{
+  gearman_server_job_st *job;
+  uint32_t generation;
+  uint32_t next_free;
+  uint32_t sequence;
+  uint32_t numerator;
+  uint32_t denominator;
+  bool running;
 };
 
 /**
@@ -431,17 +664,28 @@ struct gearmand_st
   uint32_t thread_count;
   uint32_t free_dcon_count;
   uint32_t max_thread_free_dcon_count;
+  uint32_t thread_cpu_count;
   int wakeup_fd[2];
   const char *host;
+  bool log_shutdown;
+  bool log_sleeping;
   gearmand_log_fn *log_fn;
   void *log_fn_arg;
+  gearmand_log_fn *log_write_fn;
+  gearmand_log_ring_st *log_ring_list;
   struct event_base *base;
   gearmand_port_st *port_list;
   gearmand_thread_st *thread_list;
   gearmand_thread_st *thread_add_next;
   gearmand_con_st *free_dcon_list;
+  const uint32_t *thread_cpus;
   gearman_server_st server;
   struct event wakeup_event;
+  struct event load_event;
+  pthread_key_t log_key;
+  pthread_t log_id;
+  pthread_mutex_t log_lock;
+  pthread_cond_t log_cond;
 };
 
 /**
@@ -457,6 +701,48 @@ struct gearmand_port_st
   struct event *listen_event;
 };
 
+/**
+ * @ingroup gearmand_thread
+ */
+struct gearmand_listen_st
+{
+  int fd;
+  gearmand_port_st *port;
+  gearmand_thread_st *thread;
+  struct event event;
+};
+
+/**
+ * @ingroup gearmand_uring
+ */
+struct gearmand_uring_st
+{
+  int fd;
+  bool accept_once;
+  bool recv_once;
+  uint16_t buf_tail;
+  uint32_t entries;
+  uint32_t sq_mask;
+  uint32_t cq_mask;
+  uint32_t sq_tail;
+  uint32_t pending;
+  uint32_t active;
+  uint32_t *sq_khead;
+  uint32_t *sq_ktail;
+  uint32_t *cq_khead;
+  uint32_t *cq_ktail;
+  void *sqes;
+  void *cqes;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_size;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  void *buf_ring;
+  uint8_t *buffers;
+  struct iovec *iovs;
+};
+
 /**
  * @ingroup gearmand_thread
  */
@@ -467,36 +753,71 @@ struct gearmand_thread_st
   uint32_t dcon_count;
   uint32_t dcon_add_count;
   uint32_t free_dcon_count;
+  uint32_t listen_count;
+  uint32_t move_count;
   int wakeup_fd[2];
+  int run_fd;
+  int epoll_fd;
+  uint64_t load;
   gearmand_thread_st *next;
   gearmand_thread_st *prev;
+  gearmand_thread_st *move_thread;
   gearmand_st *gearmand;
   struct event_base *base;
   gearmand_con_st *dcon_list;
   gearmand_con_st *dcon_add_list;
   gearmand_con_st *free_dcon_list;
+  gearmand_con_st *dcon_release_list;
+  gearmand_listen_st *listen_list;
   gearman_server_thread_st server_thread;
+  gearmand_uring_st uring;
   struct event wakeup_event;
+  struct event run_event;
   pthread_t id;
   pthread_mutex_t lock;
 };
 
+/**
+ * @ingroup gearmand_log
+ */
+struct gearmand_log_entry_st
+{
+  gearman_verbose_t verbose;
+  char line[GEARMAN_MAX_ERROR_SIZE];
+};
+
+/**
+ * @ingroup gearmand_log
+ */
+struct gearmand_log_ring_st
+{
+  uint32_t tail;
+  uint32_t dropped;
+  uint32_t head;
+  uint32_t dropped_reported;
+  gearmand_log_ring_st *next;
+  gearmand_log_entry_st entry[GEARMAND_LOG_RING_SIZE];
+};
+
 /**
  * @ingroup gearmand_con
  */
 struct gearmand_con_st
 {
+  gearmand_con_options_t options;
   short last_events;
   int fd;
   gearmand_thread_st *thread;
+  gearmand_thread_st *move_thread;
   gearmand_con_st *next;
   gearmand_con_st *prev;
   gearman_server_con_st *server_con;
   gearman_con_st *con;
   gearman_con_add_fn *add_fn;
+  uint8_t *input;
+  size_t input_size;
   struct event event;
-  char host[NI_MAXHOST];
-  char port[NI_MAXSERV];
+  gearman_server_con_addr_st addr;
 };
 
 /**
@@ -163,6 +163,9 @@ void gearman_worker_set_options(gearman_worker_st *worker,
   if (options & GEARMAN_WORKER_NON_BLOCKING)
     gearman_set_options(worker->gearman, GEARMAN_NON_BLOCKING, data);
 
+  if (options & GEARMAN_WORKER_COMPRESS)
+    gearman_set_options(worker->gearman, GEARMAN_COMPRESS, data);
+
   if (options & GEARMAN_WORKER_GRAB_UNIQ)
   {
     if (data)
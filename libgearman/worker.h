@@ -74,7 +74,9 @@ GEARMAN_API
 int gearman_worker_errno(gearman_worker_st *worker);
 
 /**
- * Set options for a worker structure.
+ * Set options for a worker structure. With GEARMAN_WORKER_COMPRESS, new
+ * connections ask job servers for compressed payloads, see
+ * gearman_set_options().
  * @param worker Worker structure previously initialized with
  *        gearman_worker_create or gearman_worker_clone.
  * @param options Available options for gearman_worker structs.
@@ -6,6 +6,8 @@
  * the COPYING file in the parent directory for full text.
  */
 
+#include "config.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,7 +19,14 @@
 #include "test_gearmand.h"
 #include "test_worker.h"
 
+/* Work out zlib support the way libgearman/common.h does. */
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define GEARMAN_ZLIB_SUPPORTED 1
+#endif
+
 #define CLIENT_TEST_PORT 32123
+#define CLIENT_TEST_FRAME_SIZE 2000
+#define CLIENT_TEST_COMPRESS_SIZE 65536
 
 typedef struct
 {
@@ -33,9 +42,15 @@ test_return clone_test(void *object);
 test_return echo_test(void *object);
 test_return submit_job_test(void *object);
 test_return submit_null_job_test(void *object);
+test_return submit_job_shard_test(void *object);
 test_return background_test(void *object);
 test_return background_failure_test(void *object);
 test_return add_servers_test(void *object);
+test_return compress_frame_test(void *object);
+test_return compress_option_test(void *object);
+test_return compress_plain_test(void *object);
+test_return compress_busy_test(void *object);
+test_return compress_job_test(void *object);
 
 void *create(void *object);
 void destroy(void *object);
@@ -45,6 +60,12 @@ test_return flush(void);
 
 void *client_test_worker(gearman_job_st *job, void *cb_arg, size_t *result_size,
                          gearman_return_t *ret_ptr);
+void client_test_data(uint8_t *data, size_t data_size);
+size_t client_test_zlib_frame(uint8_t *frame, const uint8_t *data,
+                              uint16_t data_size);
+test_return client_test_raw_job(gearman_con_st *con, const void *data,
+                                size_t data_size, gearman_command_t command,
+                                const void *result, size_t result_size);
 void *world_create(void);
 void world_destroy(void *object);
 
@@ -158,6 +179,41 @@ test_return submit_null_job_test(void *object)
   return TEST_SUCCESS;
 }
 
+test_return submit_job_shard_test(void *object)
+{
+  gearman_return_t rc;
+  gearman_client_st *client= (gearman_client_st *)object;
+  const char *function_name[2]= { "client_test_shard", "client_test" };
+  uint8_t *job_result;
+  size_t job_length;
+  uint8_t *value= (uint8_t *)"submit_job_shard_test";
+  size_t value_length= strlen("submit_job_shard_test");
+  uint32_t x;
+
+  /* With two shards, these two functions of the same worker hash to
+     different ones, so the worker's grabs have to go to both. */
+  for (x= 0; x < 4; x++)
+  {
+    job_result= gearman_client_do(client, function_name[x % 2], NULL, value,
+                                  value_length, &job_length, &rc);
+    if (rc != GEARMAN_SUCCESS)
+    {
+      printf("submit_job_shard_test:%s\n", gearman_client_error(client));
+      return TEST_FAILURE;
+    }
+
+    if (job_result == NULL)
+      return TEST_FAILURE;
+
+    if (value_length != job_length || memcmp(value, job_result, value_length))
+      return TEST_FAILURE;
+
+    free(job_result);
+  }
+
+  return TEST_SUCCESS;
+}
+
 test_return background_test(void *object)
 {
   gearman_return_t rc;
@@ -248,6 +304,435 @@ test_return add_servers_test(void *object __attribute__((unused)))
   return TEST_SUCCESS;
 }
 
+test_return compress_frame_test(void *object __attribute__((unused)))
+{
+  gearman_st gearman;
+  uint8_t data[CLIENT_TEST_FRAME_SIZE];
+  uint8_t frame[CLIENT_TEST_FRAME_SIZE + 16];
+  size_t frame_size;
+  size_t data_size;
+  gearman_frame_t type;
+  uint8_t *decoded;
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  uint32_t tmp;
+#endif
+  gearman_return_t ret;
+
+  if (gearman_create(&gearman) == NULL)
+    return TEST_FAILURE;
+
+  client_test_data(data, CLIENT_TEST_FRAME_SIZE);
+
+  /* A raw frame is the type byte and the data as is. */
+  frame[0]= GEARMAN_FRAME_RAW;
+  memcpy(frame + GEARMAN_FRAME_RAW_SIZE, data, 100);
+  if (gearman_packet_frame_check(&gearman, frame, 101, &type,
+                                 &data_size) != GEARMAN_SUCCESS ||
+      type != GEARMAN_FRAME_RAW || data_size != 100)
+  {
+    return TEST_FAILURE;
+  }
+
+  decoded= gearman_packet_frame_decode(&gearman, frame, 101, &data_size,
+                                       &ret);
+  if (ret != GEARMAN_SUCCESS || decoded == NULL || data_size != 100 ||
+      memcmp(decoded, data, 100))
+  {
+    return TEST_FAILURE;
+  }
+  free(decoded);
+
+  /* A zlib frame has the decoded size after the type byte. */
+  frame_size= client_test_zlib_frame(frame, data, CLIENT_TEST_FRAME_SIZE);
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  if (gearman_packet_frame_check(&gearman, frame, frame_size, &type,
+                                 &data_size) != GEARMAN_SUCCESS ||
+      type != GEARMAN_FRAME_ZLIB || data_size != CLIENT_TEST_FRAME_SIZE)
+  {
+    return TEST_FAILURE;
+  }
+
+  decoded= gearman_packet_frame_decode(&gearman, frame, frame_size,
+                                       &data_size, &ret);
+  if (ret != GEARMAN_SUCCESS || decoded == NULL ||
+      data_size != CLIENT_TEST_FRAME_SIZE ||
+      memcmp(decoded, data, CLIENT_TEST_FRAME_SIZE))
+  {
+    return TEST_FAILURE;
+  }
+  free(decoded);
+
+  /* Truncated and corrupt zlib streams don't decode. */
+  decoded= gearman_packet_frame_decode(&gearman, frame, frame_size / 2,
+                                       &data_size, &ret);
+  if (ret != GEARMAN_INVALID_PACKET || decoded != NULL)
+    return TEST_FAILURE;
+
+  frame[frame_size / 2]^= 0xff;
+  decoded= gearman_packet_frame_decode(&gearman, frame, frame_size,
+                                       &data_size, &ret);
+  if (ret != GEARMAN_INVALID_PACKET || decoded != NULL)
+    return TEST_FAILURE;
+  frame[frame_size / 2]^= 0xff;
+
+  /* Sizes zlib could never inflate to are refused before decoding. */
+  tmp= htonl((uint32_t)((frame_size - GEARMAN_FRAME_ZLIB_SIZE) *
+                        GEARMAN_FRAME_ZLIB_RATIO));
+  memcpy(frame + 1, &tmp, 4);
+  if (gearman_packet_frame_check(&gearman, frame, frame_size, &type,
+                                 &data_size) != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  tmp= htonl((uint32_t)((frame_size - GEARMAN_FRAME_ZLIB_SIZE + 1) *
+                        GEARMAN_FRAME_ZLIB_RATIO));
+  memcpy(frame + 1, &tmp, 4);
+  if (gearman_packet_frame_check(&gearman, frame, frame_size, &type,
+                                 &data_size) != GEARMAN_INVALID_PACKET)
+  {
+    return TEST_FAILURE;
+  }
+#else
+  /* Without zlib, zlib frames are refused. */
+  if (gearman_packet_frame_check(&gearman, frame, frame_size, &type,
+                                 &data_size) != GEARMAN_INVALID_PACKET)
+  {
+    return TEST_FAILURE;
+  }
+
+  decoded= gearman_packet_frame_decode(&gearman, frame, frame_size,
+                                       &data_size, &ret);
+  if (ret != GEARMAN_INVALID_PACKET || decoded != NULL)
+    return TEST_FAILURE;
+#endif
+
+  frame[0]= GEARMAN_FRAME_ZLIB + 1;
+  if (gearman_packet_frame_check(&gearman, frame, frame_size, &type,
+                                 &data_size) != GEARMAN_INVALID_PACKET)
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_free(&gearman);
+
+  return TEST_SUCCESS;
+}
+
+test_return compress_option_test(void *object __attribute__((unused)))
+{
+  gearman_st gearman;
+  gearman_con_st con;
+  gearman_packet_st packet;
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  uint8_t data[CLIENT_TEST_FRAME_SIZE];
+  uint8_t frame[CLIENT_TEST_FRAME_SIZE + 16];
+  uint8_t result[CLIENT_TEST_FRAME_SIZE + GEARMAN_FRAME_RAW_SIZE];
+  size_t frame_size;
+  uint32_t tmp;
+#endif
+  gearman_return_t ret;
+
+  if (gearman_create(&gearman) == NULL)
+    return TEST_FAILURE;
+
+  if (gearman_con_create(&gearman, &con) == NULL)
+    return TEST_FAILURE;
+
+  gearman_con_set_host(&con, NULL);
+  gearman_con_set_port(&con, CLIENT_TEST_PORT);
+
+  if (gearman_packet_add(&gearman, &packet, GEARMAN_MAGIC_REQUEST,
+                         GEARMAN_COMMAND_OPTION_REQ, (uint8_t *)"compress", 8,
+                         NULL) != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  if (gearman_con_send(&con, &packet, true) != GEARMAN_SUCCESS)
+    return TEST_FAILURE;
+
+  gearman_packet_free(&packet);
+
+  if (gearman_con_recv(&con, &packet, &ret, true) == NULL ||
+      ret != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+#ifndef GEARMAN_ZLIB_SUPPORTED
+  /* Servers built without zlib don't know the option, and pass framed data
+     through untouched as compress_plain_test checks. */
+  if (packet.command != GEARMAN_COMMAND_ERROR ||
+      packet.arg_size[0] != 15 || memcmp(packet.arg[0], "unknown_option", 15))
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_packet_free(&packet);
+#else
+  if (packet.command != GEARMAN_COMMAND_OPTION_RES ||
+      packet.arg_size[0] != 8 || memcmp(packet.arg[0], "compress", 8))
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_packet_free(&packet);
+
+  /* The worker did not ask for compression, so it gets plain data, and its
+     plain results come back to us in raw frames. */
+  client_test_data(data, CLIENT_TEST_FRAME_SIZE);
+  result[0]= GEARMAN_FRAME_RAW;
+  memcpy(result + GEARMAN_FRAME_RAW_SIZE, data, CLIENT_TEST_FRAME_SIZE);
+
+  frame[0]= GEARMAN_FRAME_RAW;
+  memcpy(frame + GEARMAN_FRAME_RAW_SIZE, data, 100);
+  if (client_test_raw_job(&con, frame, 101, GEARMAN_COMMAND_WORK_COMPLETE,
+                          result, 101) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  frame_size= client_test_zlib_frame(frame, data, CLIENT_TEST_FRAME_SIZE);
+  if (client_test_raw_job(&con, frame, frame_size,
+                          GEARMAN_COMMAND_WORK_COMPLETE, result,
+                          sizeof(result)) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  /* zlib data is only inflated for the worker, so truncated and corrupt
+     streams fail the job there. */
+  if (client_test_raw_job(&con, frame, frame_size / 2,
+                          GEARMAN_COMMAND_WORK_FAIL, NULL, 0) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  frame[frame_size / 2]^= 0xff;
+  if (client_test_raw_job(&con, frame, frame_size, GEARMAN_COMMAND_WORK_FAIL,
+                          NULL, 0) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+  frame[frame_size / 2]^= 0xff;
+
+  /* Frame headers are checked when the job is submitted. */
+  tmp= htonl((uint32_t)((frame_size - GEARMAN_FRAME_ZLIB_SIZE + 1) *
+                        GEARMAN_FRAME_ZLIB_RATIO));
+  memcpy(frame + 1, &tmp, 4);
+  if (client_test_raw_job(&con, frame, frame_size, GEARMAN_COMMAND_ERROR,
+                          "invalid_frame", 14) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+#endif
+
+  gearman_con_free(&con);
+  gearman_free(&gearman);
+
+  return TEST_SUCCESS;
+}
+
+test_return compress_plain_test(void *object __attribute__((unused)))
+{
+  gearman_st gearman;
+  gearman_con_st con;
+  uint8_t data[CLIENT_TEST_FRAME_SIZE];
+  uint8_t frame[CLIENT_TEST_FRAME_SIZE + 16];
+  size_t frame_size;
+
+  if (gearman_create(&gearman) == NULL)
+    return TEST_FAILURE;
+
+  if (gearman_con_create(&gearman, &con) == NULL)
+    return TEST_FAILURE;
+
+  gearman_con_set_host(&con, NULL);
+  gearman_con_set_port(&con, CLIENT_TEST_PORT);
+
+  /* Without the option, data that looks like a frame is left alone. */
+  client_test_data(data, CLIENT_TEST_FRAME_SIZE);
+  frame_size= client_test_zlib_frame(frame, data, CLIENT_TEST_FRAME_SIZE);
+  if (client_test_raw_job(&con, frame, frame_size,
+                          GEARMAN_COMMAND_WORK_COMPLETE, frame,
+                          frame_size) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  if (client_test_raw_job(&con, frame, frame_size / 2,
+                          GEARMAN_COMMAND_WORK_COMPLETE, frame,
+                          frame_size / 2) != TEST_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_con_free(&con);
+  gearman_free(&gearman);
+
+  return TEST_SUCCESS;
+}
+
+test_return compress_busy_test(void *object __attribute__((unused)))
+{
+  gearman_st gearman;
+  gearman_con_st con;
+  gearman_packet_st packet;
+  const char *error;
+  size_t error_size;
+  gearman_return_t ret;
+
+  if (gearman_create(&gearman) == NULL)
+    return TEST_FAILURE;
+
+  if (gearman_con_create(&gearman, &con) == NULL)
+    return TEST_FAILURE;
+
+  gearman_con_set_host(&con, NULL);
+  gearman_con_set_port(&con, CLIENT_TEST_PORT);
+
+  /* Leave a job waiting for its result, there is no worker for it. */
+  if (gearman_packet_add(&gearman, &packet, GEARMAN_MAGIC_REQUEST,
+                         GEARMAN_COMMAND_SUBMIT_JOB,
+                         (uint8_t *)"client_test_busy", 17, (uint8_t *)"", 1,
+                         NULL) != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  if (gearman_con_send(&con, &packet, true) != GEARMAN_SUCCESS)
+    return TEST_FAILURE;
+
+  gearman_packet_free(&packet);
+
+  if (gearman_con_recv(&con, &packet, &ret, true) == NULL ||
+      ret != GEARMAN_SUCCESS ||
+      packet.command != GEARMAN_COMMAND_JOB_CREATED)
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_packet_free(&packet);
+
+  if (gearman_packet_add(&gearman, &packet, GEARMAN_MAGIC_REQUEST,
+                         GEARMAN_COMMAND_OPTION_REQ, (uint8_t *)"compress", 8,
+                         NULL) != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  if (gearman_con_send(&con, &packet, true) != GEARMAN_SUCCESS)
+    return TEST_FAILURE;
+
+  gearman_packet_free(&packet);
+
+  if (gearman_con_recv(&con, &packet, &ret, true) == NULL ||
+      ret != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  /* Processing threads could be framing its result while the option is
+     turned on, so threaded servers turn it down. */
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  if (getenv("GEARMAND_TEST_THREADS") == NULL)
+    error= NULL;
+  else
+    error= "option_busy";
+#else
+  error= "unknown_option";
+#endif
+
+  if (error == NULL)
+  {
+    if (packet.command != GEARMAN_COMMAND_OPTION_RES)
+      return TEST_FAILURE;
+  }
+  else
+  {
+    error_size= strlen(error) + 1;
+    if (packet.command != GEARMAN_COMMAND_ERROR ||
+        packet.arg_size[0] != error_size ||
+        memcmp(packet.arg[0], error, error_size))
+    {
+      return TEST_FAILURE;
+    }
+  }
+
+  gearman_packet_free(&packet);
+  gearman_con_free(&con);
+  gearman_free(&gearman);
+
+  return TEST_SUCCESS;
+}
+
+test_return compress_job_test(void *object __attribute__((unused)))
+{
+  gearman_client_st client;
+  gearman_return_t rc;
+  uint8_t *value;
+  uint8_t *job_result;
+  size_t job_length;
+  size_t value_length[2]= { GEARMAN_FRAME_ZLIB_MIN / 2,
+                            CLIENT_TEST_COMPRESS_SIZE };
+  uint32_t x;
+
+  if (gearman_client_create(&client) == NULL)
+    return TEST_FAILURE;
+
+  if (gearman_client_add_server(&client, NULL, CLIENT_TEST_PORT) !=
+      GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  gearman_client_set_options(&client, GEARMAN_CLIENT_COMPRESS, 1);
+
+  value= malloc(CLIENT_TEST_COMPRESS_SIZE);
+  if (value == NULL)
+    return TEST_MEMORY_ALLOCATION_FAILURE;
+
+  client_test_data(value, CLIENT_TEST_COMPRESS_SIZE);
+
+  /* One job below the size that gets compressed, and one above it. */
+  for (x= 0; x < 2; x++)
+  {
+    job_result= gearman_client_do(&client, "client_test", NULL, value,
+                                  value_length[x], &job_length, &rc);
+    if (rc != GEARMAN_SUCCESS)
+    {
+      printf("compress_job_test:%s\n", gearman_client_error(&client));
+      return TEST_FAILURE;
+    }
+
+    if (job_result == NULL || job_length != value_length[x] ||
+        memcmp(value, job_result, job_length))
+    {
+      return TEST_FAILURE;
+    }
+
+    free(job_result);
+  }
+
+  /* Jobs still run when the server turned the option down. */
+  if (client.gearman->con_list == NULL)
+    return TEST_FAILURE;
+
+#ifdef GEARMAN_ZLIB_SUPPORTED
+  if (!(client.gearman->con_list->options & GEARMAN_CON_COMPRESS))
+    return TEST_FAILURE;
+#else
+  if (client.gearman->con_list->options & GEARMAN_CON_COMPRESS)
+    return TEST_FAILURE;
+#endif
+
+  free(value);
+  gearman_client_free(&client);
+
+  return TEST_SUCCESS;
+}
+
 test_return flush(void)
 {
   return TEST_SUCCESS;
@@ -299,6 +784,117 @@ void *client_test_worker(gearman_job_st *job, void *cb_arg, size_t *result_size,
   return result;
 }
 
+void client_test_data(uint8_t *data, size_t data_size)
+{
+  size_t x;
+
+  /* Repeats often enough to compress well. */
+  for (x= 0; x < data_size; x++)
+    data[x]= (uint8_t)('a' + ((x / 7) % 26));
+}
+
+size_t client_test_zlib_frame(uint8_t *frame, const uint8_t *data,
+                              uint16_t data_size)
+{
+  uint32_t a= 1;
+  uint32_t b= 0;
+  uint32_t tmp;
+  uint8_t *ptr;
+  uint16_t x;
+
+  frame[0]= GEARMAN_FRAME_ZLIB;
+  tmp= htonl(data_size);
+  memcpy(frame + 1, &tmp, 4);
+
+  /* A zlib header, then a single stored block, so no zlib is needed here. */
+  ptr= frame + GEARMAN_FRAME_ZLIB_SIZE;
+  ptr[0]= 0x78;
+  ptr[1]= 0x01;
+  ptr[2]= 0x01;
+  ptr[3]= (uint8_t)(data_size & 0xff);
+  ptr[4]= (uint8_t)(data_size >> 8);
+  ptr[5]= (uint8_t)(~ptr[3]);
+  ptr[6]= (uint8_t)(~ptr[4]);
+  memcpy(ptr + 7, data, data_size);
+
+  for (x= 0; x < data_size; x++)
+  {
+    a= (a + data[x]) % 65521;
+    b= (b + a) % 65521;
+  }
+
+  tmp= htonl((b << 16) | a);
+  memcpy(ptr + 7 + data_size, &tmp, 4);
+
+  return GEARMAN_FRAME_ZLIB_SIZE + 7 + data_size + 4;
+}
+
+test_return client_test_raw_job(gearman_con_st *con, const void *data,
+                                size_t data_size, gearman_command_t command,
+                                const void *result, size_t result_size)
+{
+  gearman_packet_st packet;
+  const void *packet_result;
+  size_t packet_result_size;
+  gearman_return_t ret;
+
+  if (gearman_packet_add(con->gearman, &packet, GEARMAN_MAGIC_REQUEST,
+                         GEARMAN_COMMAND_SUBMIT_JOB, (uint8_t *)"client_test",
+                         12, (uint8_t *)"", 1, data, data_size,
+                         NULL) != GEARMAN_SUCCESS)
+  {
+    return TEST_FAILURE;
+  }
+
+  if (gearman_con_send(con, &packet, true) != GEARMAN_SUCCESS)
+    return TEST_FAILURE;
+
+  gearman_packet_free(&packet);
+
+  /* Errors are compared by their code, anything else by its data. */
+  while (1)
+  {
+    if (gearman_con_recv(con, &packet, &ret, true) == NULL ||
+        ret != GEARMAN_SUCCESS)
+    {
+      return TEST_FAILURE;
+    }
+
+    if (packet.command == command)
+      break;
+
+    if (packet.command != GEARMAN_COMMAND_JOB_CREATED)
+    {
+      gearman_packet_free(&packet);
+      return TEST_FAILURE;
+    }
+
+    gearman_packet_free(&packet);
+  }
+
+  if (command == GEARMAN_COMMAND_ERROR)
+  {
+    packet_result= packet.arg[0];
+    packet_result_size= packet.arg_size[0];
+  }
+  else
+  {
+    packet_result= packet.data;
+    packet_result_size= packet.data_size;
+  }
+
+  if (packet_result_size != result_size ||
+      (result_size > 0 && memcmp(packet_result, result, result_size)))
+  {
+    gearman_packet_free(&packet);
+    return TEST_FAILURE;
+  }
+
+  gearman_packet_free(&packet);
+
+  return TEST_SUCCESS;
+}
+
 void *world_create(void)
 {
   client_test_st *test;
@@ -307,6 +903,7 @@ void *world_create(void)
    *  right thing
    */  
   const char *argv[1]= { "client_gearmand" };
+  const char *function_name[2]= { "client_test", "client_test_shard" };
 
   assert((test= malloc(sizeof(client_test_st))) != NULL);
   memset(test, 0, sizeof(client_test_st));
@@ -317,8 +914,9 @@ void *world_create(void)
 
   test->gearmand_pid= test_gearmand_start(CLIENT_TEST_PORT, NULL,
                                           (char **)argv, 1);
-  test->worker_pid= test_worker_start(CLIENT_TEST_PORT, "client_test",
-                                      client_test_worker, NULL);
+  test->worker_pid= test_worker_start_functions(CLIENT_TEST_PORT,
+                                                function_name, 2,
+                                                client_test_worker, NULL);
 
   return (void *)test;
 }
@@ -339,9 +937,15 @@ test_st tests[] ={
   {"echo", 0, echo_test },
   {"submit_job", 0, submit_job_test },
   {"submit_null_job", 0, submit_null_job_test },
+  {"submit_job_shard", 0, submit_job_shard_test },
   {"background", 0, background_test },
   {"background_failure", 0, background_failure_test },
   {"add_servers", 0, add_servers_test },
+  {"compress_frame", 0, compress_frame_test },
+  {"compress_option", 0, compress_option_test },
+  {"compress_plain", 0, compress_plain_test },
+  {"compress_busy", 0, compress_busy_test },
+  {"compress_job", 0, compress_job_test },
   {0, 0, 0}
 };
 
@@ -0,0 +1,27 @@
+
+==========================================================================
+
+client
+
+Testing init                                              [ ok     ]
+Testing allocation                                        [ ok     ]
+Testing clone_test                                        [ ok     ]
+Testing echo                                              [ ok     ]
+Testing submit_job                                        [ ok     ]
+Testing submit_null_job                                   [ ok     ]
+Testing submit_job_shard                                  [ ok     ]
+Testing background                                        [ ok     ]
+Testing background_failure                                [ ok     ]
+Testing add_servers                                       [ ok     ]
+Testing compress_frame                                    [ ok     ]
+Testing compress_option                                   [ ok     ]
+Testing compress_plain                                    [ ok     ]
+Testing compress_busy                                     [ ok     ]
+Testing compress_job                                      [ ok     ]
+
+==========================================================================
+
+Test run complete
+
+==========================================================================
+
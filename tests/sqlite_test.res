@@ -0,0 +1,14 @@
+
+==========================================================================
+
+sqlite queue
+
+Testing add                                               [ ok     ]
+Testing worker                                            [ ok     ]
+
+==========================================================================
+
+Test run complete
+
+==========================================================================
+
@@ -34,6 +34,7 @@ pid_t test_gearmand_start(in_port_t port, const char *queue_type,
   pid_t gearmand_pid;
   gearmand_st *gearmand;
   gearman_conf_st conf;
+  const char *value;
 
   assert((gearmand_pid= fork()) != -1);
 
@@ -55,6 +56,21 @@ pid_t test_gearmand_start(in_port_t port, const char *queue_type,
     gearmand= gearmand_create(NULL, port);
     assert(gearmand != NULL);
 
+    /* Lets make check run the same tests against other server setups. */
+    if ((value= getenv("GEARMAND_TEST_THREADS")) != NULL)
+      gearmand_set_threads(gearmand, (uint32_t)atoi(value));
+    if ((value= getenv("GEARMAND_TEST_SHARDS")) != NULL)
+    {
+      assert(gearmand_set_shards(gearmand, (uint32_t)atoi(value)) ==
+             GEARMAN_SUCCESS);
+    }
+    if (getenv("GEARMAND_TEST_REUSEPORT") != NULL)
+      gearmand_set_reuseport(gearmand, true);
+    if (getenv("GEARMAND_TEST_IO_URING") != NULL)
+      gearmand_set_io_uring(gearmand, true);
+    if (getenv("GEARMAND_TEST_EPOLL") != NULL)
+      gearmand_set_epoll(gearmand, true);
+
     if (queue_type != NULL)
     {
       assert(argc);
@@ -16,9 +16,20 @@
 
 pid_t test_worker_start(in_port_t port, const char *function_name,
                         gearman_worker_fn *function, const void *function_arg)
+{
+  return test_worker_start_functions(port, &function_name, 1, function,
+                                     function_arg);
+}
+
+pid_t test_worker_start_functions(in_port_t port,
+                                  const char *function_name[],
+                                  uint32_t function_count,
+                                  gearman_worker_fn *function,
+                                  const void *function_arg)
 {
   pid_t worker_pid;
   gearman_worker_st worker;
+  uint32_t x;
 
   worker_pid= fork();
   assert(worker_pid != -1);
@@ -27,8 +38,11 @@ pid_t test_worker_start(in_port_t port, const char *function_name,
   {
     assert(gearman_worker_create(&worker) != NULL);
     assert(gearman_worker_add_server(&worker, NULL, port) == GEARMAN_SUCCESS);
-    assert(gearman_worker_add_function(&worker, function_name, 0, function,
-           function_arg) == GEARMAN_SUCCESS);
+    for (x= 0; x < function_count; x++)
+    {
+      assert(gearman_worker_add_function(&worker, function_name[x], 0,
+             function, function_arg) == GEARMAN_SUCCESS);
+    }
     while (1)
     {
       gearman_return_t ret= gearman_worker_work(&worker);
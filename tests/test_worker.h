@@ -11,4 +11,9 @@
 
 pid_t test_worker_start(in_port_t port, const char *function_name,
                         gearman_worker_fn *function, const void *function_arg);
+pid_t test_worker_start_functions(in_port_t port,
+                                  const char *function_name[],
+                                  uint32_t function_count,
+                                  gearman_worker_fn *function,
+                                  const void *function_arg);
 void test_worker_stop(pid_t gearmand_pid);
@@ -0,0 +1,17 @@
+
+==========================================================================
+
+worker
+
+Testing init                                              [ ok     ]
+Testing allocation                                        [ ok     ]
+Testing clone                                             [ ok     ]
+Testing echo                                              [ ok     ]
+Testing bug372074                                         [ ok     ]
+
+==========================================================================
+
+Test run complete
+
+==========================================================================
+